@@ -31,7 +31,7 @@ struct Proxy::Private
 		stop( false ),
 		new_connection( false ),
 		listener( true ),
-		pool( size ),
+		pool( size, "session" ),
 		worker_on_hold( false ),
 		logger( logger )
 	{}
@@ -115,6 +115,17 @@ struct Proxy::Private
 	{
 		pool.join();
 		worker_thread.join();
+
+		ThreadPool::Stats st = pool.stats();
+		log_debug( "Pool: get() wait p50 %lu ns, p99 %lu ns, run p50 %lu ns, p99 %lu ns",
+				st.wait.percentile( 0.5 ), st.wait.percentile( 0.99 ),
+				st.run.percentile( 0.5 ), st.run.percentile( 0.99 ) );
+		for( size_t i = 0; i < st.workers.size(); i++ )
+		{
+			log_debug( "Pool worker %lu: %lu runs, busy %ld ms, idle %ld ms", i, st.workers[i].runs,
+					std::chrono::duration_cast<std::chrono::milliseconds>( st.workers[i].busy ).count(),
+					std::chrono::duration_cast<std::chrono::milliseconds>( st.workers[i].idle ).count() );
+		}
 	}
 };
 
@@ -1,8 +1,56 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <algorithm>
 #include "thread_pool.hpp"
 
+static inline uint64_t nanoseconds( ThreadPool::Clock::duration d )
+{
+	int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>( d ).count();
+	return ns > 0 ? ns : 0;
+}
+
+void ThreadPool::Histogram::add( uint64_t v )
+{
+	int b = v ? 64 - __builtin_clzll( v ) : 0;
+	counts[b < Buckets ? b : Buckets - 1]++;
+}
+
+uint64_t ThreadPool::Histogram::count() const
+{
+	uint64_t n = 0;
+	for( auto c : counts )
+	{
+		n += c;
+	}
+	return n;
+}
+
+uint64_t ThreadPool::Histogram::percentile( double p ) const
+{
+	uint64_t n = count();
+	if ( n == 0 )
+	{
+		return 0;
+	}
+	uint64_t rank = static_cast<uint64_t>( p * n );
+	uint64_t seen = 0;
+	for( int i = 0; i < Buckets; i++ )
+	{
+		seen += counts[i];
+		if ( seen > rank )
+		{
+			return i ? ( uint64_t( 1 ) << i ) - 1 : 0;
+		}
+	}
+	return ( uint64_t( 1 ) << ( Buckets - 1 ) ) - 1;
+}
+
 ThreadPool::Worker::Worker() :
 	started_( false ),
-	done_( false )
+	done_( false ),
+	reserved_( false ),
+	pool_( nullptr ),
+	index_( 0 )
 {}
 
 ThreadPool::Worker::~Worker()
@@ -13,7 +61,7 @@ ThreadPool::Worker::~Worker()
 ThreadPool::Worker::operator bool()
 {
 	mtx_.lock();
-	bool ret = !started_ || ( started_ && done_ );
+	bool ret = ( !started_ && !reserved_ ) || ( started_ && done_ );
 	mtx_.unlock();
 	return ret;
 }
@@ -23,6 +71,7 @@ void ThreadPool::Worker::swap( Worker &rhs )
 	thread_.swap( rhs.thread_ );
 	std::swap( started_, rhs.started_ );
 	std::swap( done_, rhs.done_ );
+	std::swap( reserved_, rhs.reserved_ );
 }
 
 void ThreadPool::Worker::join()
@@ -48,42 +97,170 @@ void ThreadPool::Worker::join()
 	}
 }
 
-ThreadPool::ThreadPool( int size ) :
+ThreadPool::ThreadPool( int size, const std::string &name ) :
 	workers_( size ),
-	joining_( false )
+	aging_( std::chrono::milliseconds( 100 ) ),
+	joining_( false ),
+	name_( name ),
+	created_( Clock::now() ),
+	cancelled_( 0 )
 {
+	for( size_t i = 0; i < workers_.size(); i++ )
+	{
+		workers_[i].pool_ = this;
+		workers_[i].index_ = i;
+	}
 }
 
 ThreadPool::Worker& ThreadPool::get()
 {
+	return *get( Priority::Normal );
+}
+
+ThreadPool::Worker* ThreadPool::get( Priority priority, Clock::time_point deadline, Late late )
+{
+	Waiter self{ priority, Clock::now(), deadline, late };
+	std::unique_lock<std::mutex> lck( mtx_ );
+	depth_.add( waiters_.size() );
+	waiters_.push_back( &self );
 	while( true )
 	{
+		if ( next_waiter() == &self )
 		{
-			std::lock_guard<std::mutex> lck( mtx_ );
-			for( auto &w : workers_ )
+			Worker *w = take();
+			if ( w )
 			{
-				if ( w )
-				{
-					Worker tmp;
-					w.swap( tmp );
-					return w;
-				}
+				waiters_.erase( std::find( waiters_.begin(), waiters_.end(), &self ) );
+				wait_.add( nanoseconds( Clock::now() - self.queued ) );
+				// There may be more free workers for the others
+				released_.notify_all();
+				return w;
 			}
 		}
-		std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+		if ( late == Late::Cancel && Clock::now() >= deadline )
+		{
+			waiters_.erase( std::find( waiters_.begin(), waiters_.end(), &self ) );
+			wait_.add( nanoseconds( Clock::now() - self.queued ) );
+			cancelled_++;
+			released_.notify_all();
+			return nullptr;
+		}
+		if ( late == Late::Cancel && deadline != Clock::time_point::max() )
+		{
+			released_.wait_until( lck, deadline );
+		}
+		else
+		{
+			released_.wait( lck );
+		}
 	}
 }
 
+void ThreadPool::set_aging( Clock::duration step )
+{
+	std::lock_guard<std::mutex> lck( mtx_ );
+	aging_ = step > Clock::duration::zero() ? step : Clock::duration( 1 );
+}
+
+ThreadPool::Waiter* ThreadPool::next_waiter() const
+{
+	// Caller holds mtx_. Waiters of the same rank are served in arrival order.
+	Clock::time_point now = Clock::now();
+	Waiter *best = nullptr;
+	int64_t best_rank = 0;
+	for( auto w : waiters_ )
+	{
+		int64_t rank;
+		if ( w->late == Late::Escalate && now >= w->deadline )
+		{
+			rank = -Levels - 1;
+		}
+		else
+		{
+			rank = static_cast<int64_t>( w->priority ) - ( now - w->queued ) / aging_;
+			rank = rank < -Levels ? -Levels : rank;
+		}
+		if ( !best || rank < best_rank )
+		{
+			best = w;
+			best_rank = rank;
+		}
+	}
+	return best;
+}
+
+ThreadPool::Worker* ThreadPool::take()
+{
+	for( auto &w : workers_ )
+	{
+		if ( w )
+		{
+			Worker tmp;
+			w.swap( tmp );
+			w.reserved_ = true;
+			return &w;
+		}
+	}
+	return nullptr;
+}
+
+void ThreadPool::released( Worker &w )
+{
+	// Done flag is raised under the pool lock, so waiters can not miss it
+	std::lock_guard<std::mutex> lck( mtx_ );
+	w.mtx_.lock();
+	w.done_ = true;
+	Clock::duration spent = Clock::now() - w.started_at_;
+	w.mtx_.unlock();
+	w.stats_.runs++;
+	w.stats_.busy += spent;
+	run_.add( nanoseconds( spent ) );
+	released_.notify_all();
+}
+
+void ThreadPool::name_thread( Worker &w )
+{
+	char name[16];
+	snprintf( name, sizeof( name ), "%s-%d", name_.c_str(), w.index_ );
+	pthread_setname_np( pthread_self(), name );
+}
+
+ThreadPool::Stats ThreadPool::stats()
+{
+	std::lock_guard<std::mutex> lck( mtx_ );
+	Stats st;
+	Clock::time_point now = Clock::now();
+	for( auto &w : workers_ )
+	{
+		WorkerStats ws = w.stats_;
+		w.mtx_.lock();
+		if ( w.started_ && !w.done_ )
+		{
+			// Running right now
+			ws.busy += now - w.started_at_;
+		}
+		w.mtx_.unlock();
+		ws.idle = now - created_ - ws.busy;
+		st.workers.push_back( ws );
+	}
+	st.waiting = waiters_.size();
+	st.cancelled = cancelled_;
+	st.wait = wait_;
+	st.depth = depth_;
+	st.run = run_;
+	return st;
+}
+
 void ThreadPool::join()
 {
-	mtx_.lock();
+	std::unique_lock<std::mutex> lck( mtx_ );
 	if ( !joining_ )
 	{
 		joining_ = true;
 		for( auto &w : workers_ )
 		{
+			released_.wait( lck, [&w]() { return static_cast<bool>( w ); } );
 			w.join();
 		}
 	}
-	mtx_.unlock();
-}
\ No newline at end of file
+}
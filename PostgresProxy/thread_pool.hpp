@@ -1,11 +1,63 @@
 #pragma once
+#include <chrono>
+#include <condition_variable>
 #include <thread>
 #include <mutex>
+#include <string>
 #include <vector>
 
 class ThreadPool
 {
 public:
+	typedef std::chrono::steady_clock Clock;
+
+	enum class Priority
+	{
+		High,
+		Normal,
+		Low
+	};
+
+	// What happens to a caller still waiting for a worker when its deadline passes
+	enum class Late
+	{
+		Escalate,   // serve it ahead of everybody else
+		Cancel      // give up, get() returns nullptr
+	};
+
+	/**
+	 * Power of two histogram: bucket i counts values in [2^(i-1), 2^i), bucket 0 counts zeros
+	 */
+	struct Histogram
+	{
+		static const int Buckets = 40;
+		uint64_t counts[Buckets] = {};
+
+		void add( uint64_t v );
+		uint64_t count() const;
+		/**
+		 * @return upper bound of the bucket holding p-th fraction of values (p in 0..1)
+		 */
+		uint64_t percentile( double p ) const;
+	};
+
+	struct WorkerStats
+	{
+		uint64_t runs = 0;
+		Clock::duration busy{};
+		Clock::duration idle{};   // since the pool was created
+	};
+
+	struct Stats
+	{
+		std::vector<WorkerStats> workers;
+		size_t waiting = 0;       // callers waiting in get() right now
+		uint64_t cancelled = 0;   // callers gave up at deadline
+		Histogram wait;           // ns spent in get()
+		Histogram depth;          // callers already waiting when get() was called
+		Histogram run;            // ns of running
+	};
+
 	struct Worker
 	{
 		Worker();
@@ -21,6 +73,8 @@ public:
 		{
 			mtx_.lock();
 			started_ = true;
+			reserved_ = false;
+			started_at_ = Clock::now();
 			thread_ = std::thread( &Worker::wrapper<Fn, Args...>, this,
 					std::forward<Fn>( fn ), std::forward<Args>( args )... );
 			mtx_.unlock();
@@ -32,14 +86,19 @@ public:
 		std::mutex mtx_;
 		bool started_;
 		bool done_;
+		bool reserved_; // handed out by get(), not run yet
+		Clock::time_point started_at_;
+
+		ThreadPool *pool_;
+		int index_;
+		WorkerStats stats_; // guarded by pool mutex
 
 		template <class Fn, class... Args>
 		void wrapper( Fn &&fn, Args &&... args )
 		{
+			pool_->name_thread( *this );
 			fn( std::forward<Args>( args )... );
-			mtx_.lock();
-			done_ = true;
-			mtx_.unlock();
+			pool_->released( *this );
 		}
 
 		operator bool();
@@ -47,13 +106,59 @@ public:
 		void join();
 	};
 
-	ThreadPool( int size );
+	/**
+	 * @param size - number of worker threads
+	 * @param name - worker thread name prefix, as seen by profilers and debuggers
+	 */
+	ThreadPool( int size, const std::string &name = "pool" );
 
+	/**
+	 * Wait for a free worker with normal priority and no deadline
+	 */
 	Worker& get();
+
+	/**
+	 * Wait for a free worker. Waiting callers are served by priority,
+	 * a caller gains one level per aging step it has been waiting.
+	 * Worker handed out must be run, it is not given to anybody else until then.
+	 * @return nullptr if deadline passed and late is Cancel
+	 */
+	Worker* get( Priority priority, Clock::time_point deadline = Clock::time_point::max(), Late late = Late::Cancel );
+
+	void set_aging( Clock::duration step );
 	void join();
 
+	/**
+	 * Snapshot of worker utilization and get() waiting
+	 */
+	Stats stats();
+
 private:
+	static const int Levels = 3;
+
+	struct Waiter
+	{
+		Priority priority;
+		Clock::time_point queued;
+		Clock::time_point deadline;
+		Late late;
+	};
+
 	std::vector<Worker> workers_;
+	std::vector<Waiter*> waiters_;
 	std::mutex mtx_;
+	std::condition_variable released_;
+	Clock::duration aging_;
 	bool joining_;
+	std::string name_;
+	Clock::time_point created_;
+	uint64_t cancelled_;
+	Histogram wait_;
+	Histogram depth_;
+	Histogram run_;
+
+	Waiter* next_waiter() const;
+	Worker* take();
+	void released( Worker &w );
+	void name_thread( Worker &w );
 };
\ No newline at end of file
@@ -0,0 +1,364 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+#include "cjson.hpp"
+#include "cjson_simd.hpp"
+
+
+/*
+ * Wrapper overhead benchmark.
+ *
+ * Every operation runs on every corpus through raw cJSON, through the Json
+ * wrapper and, where there is one, through JsonView or another fast path:
+ *
+ *     parse     text to document
+ *     build     document to unformatted text
+ *     access    follow 64 paths from the root to leaves
+ *     iterate   walk the whole tree, summing numbers
+ *     mutate    replace up to 256 members of the root object, or append
+ *               and remove 256 items of the root array
+ *     copy      deep copy
+ *
+ * Corpora are generated: a small API payload, a large array of records,
+ * deep nesting and a wide object. Each run lasts a fixed time. Results are
+ * printed as CSV, one row per run; MB/s is the corpus text size times
+ * operations per second, allocations count cJSON and C++ heap calls.
+ *
+ * Usage: bench [milliseconds per run]
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t allocations = 0;
+
+static void* counting_malloc( size_t size )
+{
+	allocations++;
+	return malloc( size );
+}
+
+void* operator new( size_t size )
+{
+	allocations++;
+	void *p = malloc( size ? size : 1 );
+	if ( !p )
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete( void *p ) noexcept
+{
+	free( p );
+}
+
+void operator delete( void *p, size_t ) noexcept
+{
+	free( p );
+}
+
+struct Corpus
+{
+	const char *name;
+	std::string text;
+	std::vector<std::vector<std::string>> paths;   // object keys, array indexes as "#n"
+};
+
+static std::string record( int i )
+{
+	return "{\"id\":" + std::to_string( i ) + ",\"name\":\"user " + std::to_string( i ) +
+		   "\",\"email\":\"user" + std::to_string( i ) + "@example.com\",\"active\":" + ( i % 3 ? "true" : "false" ) +
+		   ",\"score\":" + std::to_string( i * 0.25 ) + ",\"tags\":[\"a\",\"b\",\"c\"],"
+		   "\"address\":{\"city\":\"Springfield\",\"zip\":" + std::to_string( 10000 + i ) + "}}";
+}
+
+static std::vector<Corpus> corpora()
+{
+	std::vector<Corpus> all;
+
+	Corpus small{ "small", record( 7 ), {} };
+	small.paths = { { "id" }, { "name" }, { "email" }, { "active" }, { "score" }, { "tags", "#1" }, { "address", "city" }, { "address", "zip" } };
+	all.push_back( small );
+
+	Corpus array{ "large_array", "[", {} };
+	for( int i = 0; i < 10000; i++ )
+	{
+		array.text += ( i ? "," : "" ) + record( i );
+	}
+	array.text += "]";
+	for( int i = 0; i < 10000; i += 10000 / 16 )
+	{
+		array.paths.push_back( { "#" + std::to_string( i ), "id" } );
+		array.paths.push_back( { "#" + std::to_string( i ), "address", "zip" } );
+	}
+	all.push_back( array );
+
+	Corpus deep{ "deep", "", {} };
+	const int depth = 500;
+	std::vector<std::string> path;
+	for( int i = 0; i < depth; i++ )
+	{
+		deep.text += i % 2 ? "[" + std::to_string( i ) + "," : "{\"v\":" + std::to_string( i ) + ",\"next\":";
+		path.push_back( i % 2 ? "#1" : "next" );
+		if ( i % 8 == 7 )
+		{
+			deep.paths.push_back( path );
+		}
+	}
+	deep.text += "null";
+	for( int i = depth - 1; i >= 0; i-- )
+	{
+		deep.text += i % 2 ? "]" : "}";
+	}
+	all.push_back( deep );
+
+	Corpus wide{ "wide_object", "{", {} };
+	for( int i = 0; i < 10000; i++ )
+	{
+		wide.text += ( i ? ",\"key" : "\"key" ) + std::to_string( i ) + "\":" + std::to_string( i );
+	}
+	wide.text += "}";
+	for( int i = 0; i < 10000; i += 10000 / 64 )
+	{
+		wide.paths.push_back( { "key" + std::to_string( i ) } );
+	}
+	all.push_back( wide );
+
+	for( Corpus &c : all )
+	{
+		if ( c.paths.size() > 64 )
+		{
+			c.paths.resize( 64 );
+		}
+	}
+	return all;
+}
+
+/**
+ * Run fn for the given time, print a CSV row
+ */
+static void run( const Corpus &corpus, const char *operation, const char *api, int ms, const std::function<void()> &fn )
+{
+	// Warm up
+	fn();
+	uint64_t ops = 0;
+	uint64_t allocated = allocations;
+	Clock::time_point start = Clock::now();
+	Clock::time_point end = start + std::chrono::milliseconds( ms );
+	Clock::time_point now;
+	do
+	{
+		for( int i = 0; i < 8; i++ )
+		{
+			fn();
+		}
+		ops += 8;
+		now = Clock::now();
+	}
+	while( now < end );
+	double seconds = std::chrono::duration<double>( now - start ).count();
+	printf( "%s,%s,%s,%zu,%.1f,%.1f,%.2f\n", corpus.name, operation, api, corpus.text.size(),
+			corpus.text.size() * ops / seconds / 1e6, seconds * 1e9 / ops, double( allocations - allocated ) / ops );
+	fflush( stdout );
+}
+
+static const cJSON* raw_follow( const cJSON *node, const std::vector<std::string> &path )
+{
+	for( const std::string &step : path )
+	{
+		node = step[0] == '#' ? cJSON_GetArrayItem( node, atoi( step.c_str() + 1 ) )
+							  : cJSON_GetObjectItemCaseSensitive( node, step.c_str() );
+	}
+	return node;
+}
+
+static Json json_follow( Json node, const std::vector<std::string> &path )
+{
+	for( const std::string &step : path )
+	{
+		node = step[0] == '#' ? node.at( atoi( step.c_str() + 1 ) ) : node.at( step );
+	}
+	return node;
+}
+
+static JsonView view_follow( JsonView node, const std::vector<std::string> &path )
+{
+	for( const std::string &step : path )
+	{
+		node = step[0] == '#' ? node.at( atoi( step.c_str() + 1 ) ) : node.at( step );
+	}
+	return node;
+}
+
+static double raw_sum( const cJSON *node )
+{
+	double sum = cJSON_IsNumber( node ) ? node->valuedouble : 0;
+	for( const cJSON *c = node->child; c; c = c->next )
+	{
+		sum += raw_sum( c );
+	}
+	return sum;
+}
+
+static double json_sum( const Json &node )
+{
+	double sum = node.as_float();
+	if ( node.is_array() || node.is_object() )
+	{
+		for( const Json &c : node )
+		{
+			sum += json_sum( c );
+		}
+	}
+	return sum;
+}
+
+static double view_sum( JsonView node )
+{
+	double sum = node.as_float();
+	for( JsonView c : node )
+	{
+		sum += view_sum( c );
+	}
+	return sum;
+}
+
+static volatile double sink;
+
+int main( int argc, char **argv )
+{
+	int ms = argc > 1 ? atoi( argv[1] ) : 200;
+	cJSON_Hooks hooks = { counting_malloc, free };
+	cJSON_InitHooks( &hooks );
+
+	printf( "corpus,operation,api,bytes,mb_per_s,ns_per_op,allocs_per_op\n" );
+	for( const Corpus &corpus : corpora() )
+	{
+		const char *text = corpus.text.c_str();
+		size_t size = corpus.text.size();
+
+		run( corpus, "parse", "cjson", ms, [&]() {
+			cJSON_Delete( cJSON_Parse( text ) );
+		} );
+		run( corpus, "parse", "json", ms, [&]() {
+			Json jo;
+			Json::parse( text, jo );
+		} );
+		run( corpus, "parse", "simd", ms, [&]() {
+			Json jo;
+			JsonSimd::parse( text, size, jo );
+		} );
+
+		cJSON *raw = cJSON_Parse( text );
+		Json jo;
+		Json::parse( text, jo );
+
+		run( corpus, "build", "cjson", ms, [&]() {
+			cJSON_free( cJSON_PrintUnformatted( raw ) );
+		} );
+		run( corpus, "build", "json", ms, [&]() {
+			sink = jo.build().size();
+		} );
+		std::string out;
+		run( corpus, "build", "json_build_into", ms, [&]() {
+			jo.build_into( out );
+		} );
+
+		run( corpus, "access", "cjson", ms, [&]() {
+			for( const std::vector<std::string> &path : corpus.paths )
+			{
+				sink = raw_follow( raw, path ) != nullptr;
+			}
+		} );
+		run( corpus, "access", "json", ms, [&]() {
+			for( const std::vector<std::string> &path : corpus.paths )
+			{
+				sink = json_follow( jo, path ).is_null();
+			}
+		} );
+		run( corpus, "access", "view", ms, [&]() {
+			for( const std::vector<std::string> &path : corpus.paths )
+			{
+				sink = view_follow( jo.view(), path ).valid();
+			}
+		} );
+
+		run( corpus, "iterate", "cjson", ms, [&]() {
+			sink = raw_sum( raw );
+		} );
+		run( corpus, "iterate", "json", ms, [&]() {
+			sink = json_sum( jo );
+		} );
+		run( corpus, "iterate", "view", ms, [&]() {
+			sink = view_sum( jo.view() );
+		} );
+
+		// Members to replace are collected once
+		std::vector<std::string> keys;
+		if ( cJSON_IsObject( raw ) )
+		{
+			for( const cJSON *c = raw->child; c && keys.size() < 256; c = c->next )
+			{
+				keys.push_back( c->string );
+			}
+		}
+		run( corpus, "mutate", "cjson", ms, [&]() {
+			if ( cJSON_IsObject( raw ) )
+			{
+				for( const std::string &key : keys )
+				{
+					cJSON_ReplaceItemInObjectCaseSensitive( raw, key.c_str(), cJSON_CreateNumber( 1 ) );
+				}
+			}
+			else if ( cJSON_IsArray( raw ) )
+			{
+				int n = cJSON_GetArraySize( raw );
+				for( int i = 0; i < 256; i++ )
+				{
+					cJSON_AddItemToArray( raw, cJSON_CreateNumber( i ) );
+				}
+				for( int i = 0; i < 256; i++ )
+				{
+					cJSON_DeleteItemFromArray( raw, n );
+				}
+			}
+		} );
+		run( corpus, "mutate", "json", ms, [&]() {
+			if ( jo.is_object() )
+			{
+				for( const std::string &key : keys )
+				{
+					jo.set( key, 1 );
+				}
+			}
+			else if ( jo.is_array() )
+			{
+				int n = jo.size();
+				for( int i = 0; i < 256; i++ )
+				{
+					jo.insert( i );
+				}
+				for( int i = 0; i < 256; i++ )
+				{
+					jo.remove( n );
+				}
+			}
+		} );
+
+		run( corpus, "copy", "cjson", ms, [&]() {
+			cJSON_Delete( cJSON_Duplicate( raw, 1 ) );
+		} );
+		run( corpus, "copy", "json", ms, [&]() {
+			Json copy = jo.view().copy();
+		} );
+
+		cJSON_Delete( raw );
+	}
+	return 0;
+}
@@ -2,25 +2,280 @@
 
 #include "cjson/cJSON.h"
 #include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
 #include <limits>
-#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <memory>
+#include <new>
 #include <utility>
 #include <functional>
 
 
+/**
+ * Bump allocator for Json documents.
+ *
+ * While a Scope is active on a thread, cJSON nodes and strings, Json handles
+ * and their bookkeeping are carved out of the arena. Nothing is freed one by
+ * one, the whole document goes away with the arena or on reset(). Documents
+ * built in an arena do not own their nodes, and no Json handle into them may
+ * outlive the arena.
+ *
+ * The first arena installs process-wide cJSON hooks which fall back to
+ * malloc/free outside of a Scope.
+ */
+class JsonArena
+{
+public:
+	explicit JsonArena( size_t chunk = 64 * 1024 ) :
+		chunk_( chunk ),
+		cur_( nullptr ),
+		end_( nullptr )
+	{
+		static bool installed = install();
+		(void)installed;
+	}
+
+	~JsonArena()
+	{
+		for( auto &c : chunks_ )
+		{
+			free( c.begin );
+		}
+	}
+
+	JsonArena( const JsonArena& ) = delete;
+	JsonArena& operator=( const JsonArena& ) = delete;
+
+	/**
+	 * Makes an arena current for the calling thread, nullptr selects the heap
+	 */
+	class Scope
+	{
+	public:
+		explicit Scope( JsonArena &arena ) :
+			prev_( current() )
+		{
+			current() = &arena;
+		}
+		explicit Scope( JsonArena *arena ) :
+			prev_( current() )
+		{
+			current() = arena;
+		}
+		~Scope()
+		{
+			current() = prev_;
+		}
+
+		Scope( const Scope& ) = delete;
+		Scope& operator=( const Scope& ) = delete;
+
+	private:
+		JsonArena *prev_;
+	};
+
+	/**
+	 * STL allocator, takes memory from the arena or from the heap if there is none
+	 */
+	template<typename T>
+	struct Allocator
+	{
+		typedef T value_type;
+		JsonArena *arena;
+
+		explicit Allocator( JsonArena *a = nullptr ) :
+			arena( a )
+		{}
+		template<typename U>
+		Allocator( const Allocator<U> &rhs ) :
+			arena( rhs.arena )
+		{}
+
+		T* allocate( size_t n )
+		{
+			if ( arena )
+			{
+				return static_cast<T*>( arena->allocate( n * sizeof( T ) ) );
+			}
+			return static_cast<T*>( ::operator new( n * sizeof( T ) ) );
+		}
+		void deallocate( T *p, size_t )
+		{
+			if ( !arena )
+			{
+				::operator delete( p );
+			}
+		}
+
+		template<typename U>
+		bool operator==( const Allocator<U> &rhs ) const
+		{
+			return arena == rhs.arena;
+		}
+		template<typename U>
+		bool operator!=( const Allocator<U> &rhs ) const
+		{
+			return arena != rhs.arena;
+		}
+	};
+
+	/**
+	 * Arena of the calling thread, nullptr if none
+	 */
+	static JsonArena*& current()
+	{
+		static thread_local JsonArena *arena = nullptr;
+		return arena;
+	}
+
+	void* allocate( size_t size )
+	{
+		const size_t align = alignof( std::max_align_t );
+		size = ( size + align - 1 ) & ~( align - 1 );
+		if ( static_cast<size_t>( end_ - cur_ ) < size )
+		{
+			grow( size );
+		}
+		void *ptr = cur_;
+		cur_ += size;
+		return ptr;
+	}
+
+	bool owns( const void *ptr ) const
+	{
+		const char *p = static_cast<const char*>( ptr );
+		// Newest chunk first, that is where most of the recent nodes are
+		for( auto it = chunks_.rbegin(); it != chunks_.rend(); it++ )
+		{
+			if ( p >= it->begin && p < it->end )
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * Drop every document, keeps the biggest chunk for reuse
+	 */
+	void reset()
+	{
+		if ( chunks_.empty() )
+		{
+			return;
+		}
+		Chunk keep = chunks_.back();
+		for( size_t i = 0; i + 1 < chunks_.size(); i++ )
+		{
+			free( chunks_[i].begin );
+		}
+		chunks_.assign( 1, keep );
+		cur_ = keep.begin;
+		end_ = keep.end;
+	}
+
+	/**
+	 * Bytes handed out since construction or the last reset
+	 */
+	size_t used() const
+	{
+		size_t total = 0;
+		for( size_t i = 0; i + 1 < chunks_.size(); i++ )
+		{
+			total += chunks_[i].used;
+		}
+		if ( !chunks_.empty() )
+		{
+			total += cur_ - chunks_.back().begin;
+		}
+		return total;
+	}
+
+	size_t reserved() const
+	{
+		size_t total = 0;
+		for( auto &c : chunks_ )
+		{
+			total += c.end - c.begin;
+		}
+		return total;
+	}
+
+private:
+	struct Chunk
+	{
+		char *begin;
+		char *end;
+		size_t used;    // filled when the chunk is retired
+	};
+
+	size_t chunk_;              // size of the next chunk, doubles every time
+	char *cur_;
+	char *end_;
+	std::vector<Chunk> chunks_;
+
+	void grow( size_t size )
+	{
+		if ( !chunks_.empty() )
+		{
+			chunks_.back().used = cur_ - chunks_.back().begin;
+		}
+		size_t bytes = chunk_ > size ? chunk_ : size;
+		char *mem = static_cast<char*>( malloc( bytes ) );
+		if ( !mem )
+		{
+			throw std::bad_alloc();
+		}
+		chunks_.push_back( Chunk{ mem, mem + bytes, 0 } );
+		cur_ = mem;
+		end_ = mem + bytes;
+		chunk_ *= 2;
+	}
+
+	static void* hook_malloc( size_t size )
+	{
+		JsonArena *arena = current();
+		return arena ? arena->allocate( size ) : malloc( size );
+	}
+
+	static void hook_free( void *ptr )
+	{
+		JsonArena *arena = current();
+		if ( !arena || !arena->owns( ptr ) )
+		{
+			free( ptr );
+		}
+	}
+
+	static bool install()
+	{
+		cJSON_Hooks hooks = { hook_malloc, hook_free };
+		cJSON_InitHooks( &hooks );
+		return true;
+	}
+};
+
+class JsonView;
+class JsonPatch;
+
 class Json
 {
 	struct Data
 	{
 		cJSON *data;
 		bool own;
-		Data( cJSON *obj, bool own ) :
+		JsonArena *arena;   // nodes are freed with the arena
+		Data( cJSON *obj, bool own, JsonArena *arena ) :
 			data( obj ),
-			own( own )
+			own( own && !arena ),
+			arena( arena )
 		{}
 		~Data()
 		{
@@ -42,11 +297,187 @@ class Json
 	};
 
 	typedef std::shared_ptr<Data> DataPtr;
-	typedef std::set<std::pair<Json, cJSON*> > ObjectSet;
+	// Reference node in the parent -> owner of the referenced item
+	typedef std::unordered_map<cJSON*, Json, std::hash<cJSON*>, std::equal_to<cJSON*>,
+							   JsonArena::Allocator<std::pair<cJSON* const, Json> > > RefMap;
+
+	/**
+	 * Keys compare like cJSON_GetObjectItem, ignoring case
+	 */
+	struct KeyHash
+	{
+		size_t operator()( const char *key ) const
+		{
+			size_t h = 2166136261u;
+			for( const unsigned char *c = reinterpret_cast<const unsigned char*>( key ); *c; c++ )
+			{
+				h = ( h ^ static_cast<size_t>( tolower( *c ) ) ) * 16777619u;
+			}
+			return h;
+		}
+	};
+
+	struct KeyEqual
+	{
+		bool operator()( const char *a, const char *b ) const
+		{
+			const unsigned char *x = reinterpret_cast<const unsigned char*>( a );
+			const unsigned char *y = reinterpret_cast<const unsigned char*>( b );
+			for( ; tolower( *x ) == tolower( *y ); x++, y++ )
+			{
+				if ( !*x )
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+	};
+
+	struct KeyEntry
+	{
+		cJSON *item;    // first member with this key
+		bool shared;    // more members match, lookups fall back to cJSON
+	};
+
+	typedef std::unordered_map<const char*, KeyEntry, KeyHash, KeyEqual,
+							   JsonArena::Allocator<std::pair<const char* const, KeyEntry> > > KeyMap;
+
+	/**
+	 * Sub-item references and, for large objects, a key index.
+	 *
+	 * The index is built on the first lookup once an object has IndexMin
+	 * members and is kept up to date by set() and remove(). Sets of array and
+	 * object members are kept in subs, so every wrapper of a node reached
+	 * from the same root shares one set and one index. A change of the first
+	 * or last member made elsewhere is noticed and the index rebuilt.
+	 */
+	struct ObjectSet : public RefMap
+	{
+		enum { IndexMin = 32 };
+
+		typedef std::unordered_map<const cJSON*, std::shared_ptr<ObjectSet>, std::hash<const cJSON*>, std::equal_to<const cJSON*>,
+								   JsonArena::Allocator<std::pair<const cJSON* const, std::shared_ptr<ObjectSet> > > > SubMap;
+
+		ObjectSet( cJSON *object, JsonArena *arena ) :
+			RefMap( 0, std::hash<cJSON*>(), std::equal_to<cJSON*>(), RefMap::allocator_type( arena ) ),
+			subs( 0, std::hash<const cJSON*>(), std::equal_to<const cJSON*>(), SubMap::allocator_type( arena ) ),
+			keys( 0, KeyHash(), KeyEqual(), KeyMap::allocator_type( arena ) ),
+			indexed( false ),
+			members( 0 ),
+			head( nullptr ),
+			tail( nullptr ),
+			owner( object )
+		{}
+
+		/**
+		 * Member count and index match the object
+		 */
+		bool tracking( const cJSON *object ) const
+		{
+			return object->child == head && ( head ? head->prev : nullptr ) == tail;
+		}
+
+		KeyMap* index( const cJSON *object )
+		{
+			if ( !tracking( object ) )
+			{
+				keys.clear();
+				indexed = false;
+				members = 0;
+				for( cJSON *c = object->child; c; c = c->next )
+				{
+					members++;
+				}
+				sync( object );
+			}
+			if ( !indexed && members >= IndexMin )
+			{
+				keys.reserve( members );
+				for( cJSON *c = object->child; c; c = c->next )
+				{
+					std::pair<KeyMap::iterator, bool> r = keys.emplace( c->string, KeyEntry{ c, false } );
+					r.first->second.shared |= !r.second;
+				}
+				indexed = true;
+			}
+			return indexed ? &keys : nullptr;
+		}
+
+		void added( const cJSON *object, cJSON *item, bool tracked )
+		{
+			if ( tracked )
+			{
+				members++;
+				if ( indexed )
+				{
+					std::pair<KeyMap::iterator, bool> r = keys.emplace( item->string, KeyEntry{ item, false } );
+					r.first->second.shared |= !r.second;
+				}
+				sync( object );
+			}
+		}
+
+		/**
+		 * Call after the item is detached and before it is deleted
+		 */
+		void removed( const cJSON *object, cJSON *item, bool tracked )
+		{
+			if ( tracked )
+			{
+				members--;
+				KeyMap::iterator it = indexed ? keys.find( item->string ) : keys.end();
+				if ( it != keys.end() )
+				{
+					if ( it->second.shared )
+					{
+						// Which member comes first now is unknown
+						keys.clear();
+						indexed = false;
+					}
+					else if ( it->second.item == item )
+					{
+						keys.erase( it );
+					}
+				}
+				sync( object );
+			}
+		}
+
+		/**
+		 * Forget counts and index after changes anywhere in the object
+		 */
+		void reset()
+		{
+			keys.clear();
+			indexed = false;
+			members = 0;
+			head = nullptr;
+			tail = nullptr;
+		}
+
+		void sync( const cJSON *object )
+		{
+			head = object->child;
+			tail = head ? head->prev : nullptr;
+		}
+
+		SubMap subs;        // member arrays and objects not added by reference
+		KeyMap keys;
+		bool indexed;
+		size_t members;
+		const cJSON *head;  // first and last member when members was counted
+		const cJSON *tail;
+		cJSON *owner;       // node the set was made for, handles of references to it share the set
+	};
+
 	typedef std::shared_ptr<ObjectSet> ObjectSetPtr;
 	DataPtr data_;
 	ObjectSetPtr refs_; // Array/object sub-item references
 
+	// Patches the cJSON tree directly
+	friend class JsonPatch;
+
 public:
 
 	enum Type {
@@ -86,19 +517,23 @@ public:
 		}
 		const Json operator*() const
 		{
-			return Json( i_, false );
+			return child( i_, arena_, refs_ );
 		}
 		const Json operator->() const
 		{
-			return Json( i_, false );
+			return child( i_, arena_, refs_ );
 		}
 
 	private:
 		friend class Json;
 		cJSON *i_;
+		JsonArena *arena_;
+		ObjectSetPtr refs_;
 
-		Iterator( cJSON *c ) :
-			i_( c )
+		Iterator( cJSON *c, JsonArena *arena, const ObjectSetPtr &refs ) :
+			i_( c ),
+			arena_( arena ),
+			refs_( refs )
 		{}
 	};
 
@@ -138,67 +573,48 @@ public:
 	}
 
 	Json() :
-		data_( new Data( cJSON_CreateNull(), true ) ),
-		refs_( new ObjectSet )
+		Json( cJSON_CreateNull(), true, JsonArena::current() )
 	{}
 
+	/**
+	 * Wrap existing node, a node from the current arena is never owned
+	 */
 	Json( cJSON *obj, bool own ) :
-		data_( new Data( obj, own ) ),
-		refs_( new ObjectSet )
+		Json( obj, own, JsonArena::current() && JsonArena::current()->owns( obj ) ? JsonArena::current() : nullptr )
 	{}
 
-	explicit Json( const Type t ) : Json()
-	{
-		switch( t )
-		{
-			case Bool:
-				data_.reset( new Data( cJSON_CreateFalse(), true ) );
-				break;
-			case Number:
-				data_.reset( new Data( cJSON_CreateNumber( 0.0 ), true ) );
-				break;
-			case String:
-				data_.reset( new Data( cJSON_CreateString( "" ), true ) );
-				break;
-			case Array:
-				data_.reset( new Data( cJSON_CreateArray(), true ) );
-				break;
-			case Object:
-				data_.reset( new Data( cJSON_CreateObject(), true ) );
-				break;
-			default:
-				break;
-		}
-	}
+	explicit Json( const Type t ) :
+		Json( create( t ), true, JsonArena::current() )
+	{}
 
 	explicit Json( bool value ) :
-		data_( new Data( value ? cJSON_CreateTrue() : cJSON_CreateFalse(), true ) )
+		data_( make_data( value ? cJSON_CreateTrue() : cJSON_CreateFalse() ) )
 	{}
 
 	explicit Json( double value ) :
-		data_( new Data( cJSON_CreateNumber( value ), true ) )
+		data_( make_data( cJSON_CreateNumber( value ) ) )
 	{}
 
 	explicit Json( int value ) :
-		data_( new Data( cJSON_CreateNumber( static_cast<double>( value ) ), true ) )
+		data_( make_data( cJSON_CreateNumber( static_cast<double>( value ) ) ) )
 	{}
 
 	explicit Json( unsigned value ) :
-		data_( new Data( cJSON_CreateNumber( static_cast<double>( value ) ), true ) )
+		data_( make_data( cJSON_CreateNumber( static_cast<double>( value ) ) ) )
 	{}
 
 	explicit Json( const char *value ) :
-		data_( new Data( cJSON_CreateString( value ), true ) )
+		data_( make_data( cJSON_CreateString( value ) ) )
 	{}
 
 	explicit Json( const std::string &value ) :
-		data_( new Data( cJSON_CreateString( value.c_str() ), true ) )
+		data_( make_data( cJSON_CreateString( value.c_str() ) ) )
 	{}
 
 	template <typename T, template<typename X, typename A> class ContT=std::vector>
 	explicit Json( const ContT<T, std::allocator<T> >& elems ) :
-		data_( new Data( cJSON_CreateArray(), true ) ),
-		refs_( new ObjectSet )
+		data_( make_data( cJSON_CreateArray() ) ),
+		refs_( make_refs( data_->data, data_->arena ) )
 	{
 		for( typename ContT<T, std::allocator<T> >::const_iterator it = elems.begin();
 			 it != elems.end(); it++ )
@@ -209,8 +625,8 @@ public:
 
 	template <typename T>
 	Json( const std::initializer_list<T> &elems ) :
-		data_( new Data( cJSON_CreateArray(), true ) ),
-		refs_( new ObjectSet )
+		data_( make_data( cJSON_CreateArray() ) ),
+		refs_( make_refs( data_->data, data_->arena ) )
 	{
 		for( auto &it : elems )
 		{
@@ -220,8 +636,8 @@ public:
 
 	template <typename T, template<typename X> class ContT>
 	explicit Json( const ContT<T> &elems ) :
-		data_( new Data( cJSON_CreateArray(), true ) ),
-		refs_( new ObjectSet )
+		data_( make_data( cJSON_CreateArray() ) ),
+		refs_( make_refs( data_->data, data_->arena ) )
 	{
 		for( typename ContT<T>::const_iterator it = elems.begin(); it != elems.end(); it++ )
 		{
@@ -278,6 +694,7 @@ public:
 
 	Json& operator=( const char *value )
 	{
+		JsonArena::Scope scope( data_->arena );
 		if ( !is_string() )
 		{
 			swap( Json( String ) );
@@ -294,6 +711,7 @@ public:
 
 	Json& operator=( bool value )
 	{
+		JsonArena::Scope scope( data_->arena );
 		if ( !is_bool() )
 		{
 			swap( Json( Bool ) );
@@ -314,6 +732,7 @@ public:
 									 std::is_same<T, double>::value>::type* = nullptr>
 	Json& operator=( const T &value )
 	{
+		JsonArena::Scope scope( data_->arena );
 		if ( !is_number() )
 		{
 			swap( Json( Number ) );
@@ -424,18 +843,23 @@ public:
 		return at( key );
 	}
 
+	/**
+	 * Read-only view of this value, valid as long as the value is
+	 */
+	JsonView view() const;
+
 	Iterator begin() const
 	{
 		if ( !data_ || !data_->data )
 		{
-			return Iterator( nullptr );
+			return Iterator( nullptr, nullptr, ObjectSetPtr() );
 		}
-		return Iterator( data_->data->child );
+		return Iterator( data_->data->child, data_->arena, refs_ );
 	}
 
 	const Iterator end() const
 	{
-		return Iterator( nullptr );
+		return Iterator( nullptr, nullptr, ObjectSetPtr() );
 	}
 
 	/**
@@ -502,7 +926,7 @@ public:
 		{
 			return false;
 		}
-		return cJSON_HasObjectItem( data_->data, key );
+		return find( key, false ) != nullptr;
 	}
 
 	inline bool has( const std::string &key ) const
@@ -522,16 +946,7 @@ public:
 			cJSON* item = cJSON_GetArrayItem( data_->data, index );
 			if ( item )
 			{
-				auto o = Json( item, false );
-				for( ObjectSet::iterator it = refs_->begin(); it != refs_->end(); it++ )
-				{
-					if ( it->second == item )
-					{
-						o.refs_ = it->first.refs_;
-						break;
-					}
-				}
-				return o;
+				return child( item );
 			}
 		}
 		return Json();
@@ -558,19 +973,10 @@ public:
 		{
 			return Json();
 		}
-		cJSON* item = cJSON_GetObjectItemCaseSensitive( data_->data, key );
+		cJSON* item = find( key, true );
 		if ( item )
 		{
-			auto o = Json( item, false );
-			for( ObjectSet::iterator it = refs_->begin(); it != refs_->end(); it++ )
-			{
-				if ( it->second == item )
-				{
-					o.refs_ = it->first.refs_;
-					break;
-				}
-			}
-			return o;
+			return child( item );
 		}
 		return Json();
 	}
@@ -581,19 +987,10 @@ public:
 		{
 			return Json();
 		}
-		cJSON* item = cJSON_GetObjectItemCaseSensitive( data_->data, key );
+		cJSON* item = find( key, true );
 		if ( item )
 		{
-			auto o = Json( item, false );
-			for( ObjectSet::iterator it = refs_->begin(); it != refs_->end(); it++ )
-			{
-				if ( it->second == item )
-				{
-					o.refs_ = it->first.refs_;
-					break;
-				}
-			}
-			return o;
+			return child( item );
 		}
 		return Json();
 	}
@@ -627,7 +1024,7 @@ public:
 			cJSON* item = cJSON_GetArrayItem( data_->data, index );
 			if ( item )
 			{
-				return Json( item, false );
+				return child( item );
 			}
 		}
 		return Json();
@@ -643,11 +1040,10 @@ public:
 	{
 		if ( is_array() )
 		{
+			JsonArena::Scope scope( data_->arena );
 			Json o( value );
-			int i = cJSON_GetArraySize( data_->data );
 			cJSON_AddItemReferenceToArray( data_->data, o.data_->data );
-			cJSON *ref = cJSON_GetArrayItem( data_->data, i );
-			refs_->insert( std::pair<Json, cJSON*>( std::move( o ), ref ) );
+			refs_->emplace( last(), std::move( o ) );
 		}
 		return *this;
 	}
@@ -663,14 +1059,17 @@ public:
 	{
 		if ( is_object() )
 		{
-			if ( has( key ) )
+			JsonArena::Scope scope( data_->arena );
+			cJSON *old = find( key, false );
+			if ( old )
 			{
-				remove( key );
+				erase( old );
 			}
 			Json o( value );
+			bool tracked = refs_->tracking( data_->data );
 			cJSON_AddItemReferenceToObject( data_->data, key, o.data_->data );
-			cJSON *ref = cJSON_GetObjectItemCaseSensitive( data_->data, key );
-			refs_->insert( std::pair<Json, cJSON*>( std::move( o ), ref ) );
+			refs_->emplace( last(), std::move( o ) );
+			refs_->added( data_->data, last(), tracked );
 		}
 		return *this;
 	}
@@ -690,17 +1089,12 @@ public:
 	{
 		if ( is_array() )
 		{
+			JsonArena::Scope scope( data_->arena );
 			cJSON* detached = cJSON_DetachItemFromArray( data_->data, index );
 			if (detached)
 			{
-				for( ObjectSet::iterator it = refs_->begin(); it != refs_->end(); it++ )
-				{
-					if ( it->first.data_->data == detached )
-					{
-						refs_->erase( it );
-						break;
-					}
-				}
+				refs_->erase( detached );
+				refs_->subs.erase( detached );
 				cJSON_Delete( detached );
 			}
 		}
@@ -716,18 +1110,10 @@ public:
 	{
 		if ( is_object() )
 		{
-			cJSON* detached = cJSON_DetachItemFromObject( data_->data, name );
-			if ( detached )
+			cJSON* item = find( name, false );
+			if ( item )
 			{
-				for( ObjectSet::iterator it = refs_->begin(); it != refs_->end(); it++ )
-				{
-					if ( it->second == detached )
-					{
-						refs_->erase( it );
-						break;
-					}
-				}
-				cJSON_Delete( detached );
+				erase( item );
 			}
 		}
 		return *this;
@@ -845,7 +1231,7 @@ public:
 		{
 			for( int i = 0; i < cJSON_GetArraySize( data_->data ); i++ )
 			{
-				retval.push_back( Json( cJSON_GetArrayItem( data_->data, i ), false ) );
+				retval.push_back( child( cJSON_GetArrayItem( data_->data, i ) ) );
 			}
 		}
 		return retval;
@@ -858,10 +1244,612 @@ public:
 	 */
 	std::string build( bool formatted = false ) const
 	{
+		// Print buffer is temporary, keep it out of the arena
+		JsonArena::Scope scope( nullptr );
 		char *json = formatted ? cJSON_Print( data_->data ) : cJSON_PrintUnformatted( data_->data );
 		std::string retval( json );
-		free( json );
+		cJSON_free( json );
 		return retval;
 	}
-};
 
+	/**
+	 * Dump object into a caller string, its capacity is reused
+	 * @param out result, empty on failure
+	 * @param formatted pretty print
+	 * @return false if the object can not be printed
+	 */
+	bool build_into( std::string &out, bool formatted = false ) const
+	{
+		const size_t limit = static_cast<size_t>( std::numeric_limits<int>::max() );
+		// Capacity left by a previous call usually fits, only the slack past the old text is filled
+		out.resize( std::min( out.capacity(), limit ) );
+		if ( !cJSON_PrintPreallocated( data_->data, &out[0], static_cast<int>( out.size() ), formatted ) )
+		{
+			// cJSON wants a few bytes of slack past the text, some headroom keeps the next call on the fast path
+			size_t size = estimate( formatted ) + 5;
+			size += size / 8;
+			if ( size > limit )
+			{
+				out.clear();
+				return false;
+			}
+			out.resize( size );
+			if ( !cJSON_PrintPreallocated( data_->data, &out[0], static_cast<int>( size ), formatted ) )
+			{
+				out.clear();
+				return false;
+			}
+		}
+		out.resize( strlen( out.c_str() ) );
+		return true;
+	}
+
+	/**
+	 * Dump object into a caller buffer, nothing is allocated
+	 * @param buffer output, NUL-terminated on success
+	 * @param size buffer size, estimate() + 5 is always enough
+	 * @param formatted pretty print
+	 * @return text length, 0 if the buffer is too small
+	 */
+	size_t build_into( char *buffer, size_t size, bool formatted = false ) const
+	{
+		int length = size > static_cast<size_t>( std::numeric_limits<int>::max() ) ? std::numeric_limits<int>::max() : static_cast<int>( size );
+		if ( !buffer || !cJSON_PrintPreallocated( data_->data, buffer, length, formatted ) )
+		{
+			return 0;
+		}
+		return strlen( buffer );
+	}
+
+	/**
+	 * Upper bound of build() length, exact but for non-integer numbers
+	 */
+	inline size_t estimate( bool formatted = false ) const
+	{
+		return estimate( data_->data, formatted, 0 );
+	}
+
+private:
+	Json( cJSON *obj, bool own, JsonArena *arena ) :
+		data_( make_data( obj, own, arena ) ),
+		refs_( make_refs( obj, arena ) )
+	{}
+
+	Json( cJSON *obj, JsonArena *arena, const ObjectSetPtr &refs ) :
+		data_( make_data( obj, false, arena ) ),
+		refs_( refs )
+	{}
+
+	static size_t estimate( const cJSON *item, bool formatted, size_t depth )
+	{
+		switch( item->type & 0xFF )
+		{
+			case cJSON_NULL:
+			case cJSON_True:
+				return 4;
+			case cJSON_False:
+				return 5;
+			case cJSON_Number:
+			{
+				double d = item->valuedouble;
+				if ( std::isnan( d ) || std::isinf( d ) )
+				{
+					return 4;
+				}
+				if ( d == static_cast<double>( item->valueint ) )
+				{
+					size_t digits = item->valueint < 0 ? 2 : 1;
+					for( int v = item->valueint; v <= -10 || v >= 10; v /= 10 )
+					{
+						digits++;
+					}
+					return digits;
+				}
+				// %1.17g
+				return 25;
+			}
+			case cJSON_Raw:
+				return item->valuestring ? strlen( item->valuestring ) : 0;
+			case cJSON_String:
+				return estimate( item->valuestring );
+			case cJSON_Array:
+			{
+				size_t size = 2;
+				for( const cJSON *c = item->child; c; c = c->next )
+				{
+					size += estimate( c, formatted, depth + 1 ) + ( formatted ? 2 : 1 );
+				}
+				return size;
+			}
+			case cJSON_Object:
+			{
+				// "{\n" ... tabs "}", each member is tabs "key":\tvalue,\n
+				size_t size = formatted ? 3 + depth : 2;
+				for( const cJSON *c = item->child; c; c = c->next )
+				{
+					size += estimate( c->string ) + estimate( c, formatted, depth + 1 ) + ( formatted ? depth + 5 : 2 );
+				}
+				return size;
+			}
+			default:
+				return 0;
+		}
+	}
+
+	/**
+	 * Quoted and escaped string length
+	 */
+	static size_t estimate( const char *str )
+	{
+		size_t size = 2;
+		for( const unsigned char *c = reinterpret_cast<const unsigned char*>( str ); c && *c; c++ )
+		{
+			switch( *c )
+			{
+				case '"':
+				case '\\':
+				case '\b':
+				case '\f':
+				case '\n':
+				case '\r':
+				case '\t':
+					size += 2;
+					break;
+				default:
+					size += *c < 32 ? 6 : 1;
+					break;
+			}
+		}
+		return size;
+	}
+
+	static DataPtr make_data( cJSON *obj, bool own = true, JsonArena *arena = JsonArena::current() )
+	{
+		return std::allocate_shared<Data>( JsonArena::Allocator<Data>( arena ), obj, own, arena );
+	}
+
+	/**
+	 * Only arrays and objects keep sub-item references
+	 */
+	static ObjectSetPtr make_refs( cJSON *obj, JsonArena *arena )
+	{
+		if ( !cJSON_IsArray( obj ) && !cJSON_IsObject( obj ) )
+		{
+			return ObjectSetPtr();
+		}
+		return std::allocate_shared<ObjectSet>( JsonArena::Allocator<ObjectSet>( arena ), obj, arena );
+	}
+
+	static cJSON* create( Type t )
+	{
+		switch( t )
+		{
+			case Bool:
+				return cJSON_CreateFalse();
+			case Number:
+				return cJSON_CreateNumber( 0.0 );
+			case String:
+				return cJSON_CreateString( "" );
+			case Array:
+				return cJSON_CreateArray();
+			case Object:
+				return cJSON_CreateObject();
+			default:
+				return cJSON_CreateNull();
+		}
+	}
+
+	/**
+	 * Object member by key, through the key index for large objects
+	 * @param exact compare case-sensitive like cJSON_GetObjectItemCaseSensitive, or like cJSON_GetObjectItem
+	 */
+	cJSON* find( const char *key, bool exact ) const
+	{
+		if ( !key )
+		{
+			return nullptr;
+		}
+		KeyMap *keys = refs_ ? refs_->index( data_->data ) : nullptr;
+		if ( keys )
+		{
+			KeyMap::const_iterator it = keys->find( key );
+			if ( it == keys->end() )
+			{
+				return nullptr;
+			}
+			if ( !it->second.shared )
+			{
+				return !exact || !strcmp( it->second.item->string, key ) ? it->second.item : nullptr;
+			}
+		}
+		return exact ? cJSON_GetObjectItemCaseSensitive( data_->data, key ) : cJSON_GetObjectItem( data_->data, key );
+	}
+
+	/**
+	 * Detach and delete an object member
+	 */
+	void erase( cJSON *item )
+	{
+		JsonArena::Scope scope( data_->arena );
+		bool tracked = refs_->tracking( data_->data );
+		cJSON_DetachItemViaPointer( data_->data, item );
+		refs_->removed( data_->data, item, tracked );
+		refs_->erase( item );
+		refs_->subs.erase( item );
+		cJSON_Delete( item );
+	}
+
+	/**
+	 * Wraps a child node, sharing sub-item references of its owner if the child was added by reference
+	 */
+	inline Json child( cJSON *item ) const
+	{
+		return child( item, data_->arena, refs_ );
+	}
+
+	/**
+	 * Other array and object children get their set from subs of the parent, created on first use
+	 */
+	static Json child( cJSON *item, JsonArena *arena, const ObjectSetPtr &refs )
+	{
+		if ( !refs )
+		{
+			return Json( item, false, arena );
+		}
+		ObjectSet::const_iterator it = refs->find( item );
+		if ( it != refs->end() )
+		{
+			return Json( item, arena, it->second.refs_ );
+		}
+		if ( !cJSON_IsArray( item ) && !cJSON_IsObject( item ) )
+		{
+			return Json( item, arena, ObjectSetPtr() );
+		}
+		ObjectSetPtr &sub = refs->subs[item];
+		if ( !sub )
+		{
+			sub = make_refs( item, arena );
+		}
+		return Json( item, arena, sub );
+	}
+
+	/**
+	 * Last child, cJSON keeps it in prev of the first one
+	 */
+	cJSON* last() const
+	{
+		return data_->data->child ? data_->data->child->prev : nullptr;
+	}
+};
+
+/**
+ * Non-owning read-only view of a cJSON node.
+ *
+ * A view is a single pointer, it is copied by value and never allocates.
+ * Missing elements are returned as a null view, which reads as Null.
+ * A view must not outlive the document it points into.
+ */
+class JsonView
+{
+public:
+	typedef Json::Type Type;
+
+	struct Iterator;
+
+	JsonView() :
+		node_( nullptr )
+	{}
+
+	explicit JsonView( const cJSON *node ) :
+		node_( node )
+	{}
+
+	/**
+	 * Underlying node, nullptr for a missing element
+	 */
+	inline const cJSON* node() const
+	{
+		return node_;
+	}
+
+	/**
+	 * False for a missing element
+	 */
+	inline bool valid() const
+	{
+		return node_ != nullptr;
+	}
+
+	inline Type type() const
+	{
+		if ( !node_ )
+		{
+			return Json::Null;
+		}
+		switch( node_->type & 0xff )
+		{
+			case cJSON_False:
+			case cJSON_True:
+				return Json::Bool;
+			case cJSON_Number:
+				return Json::Number;
+			case cJSON_String:
+				return Json::String;
+			case cJSON_Array:
+				return Json::Array;
+			case cJSON_Object:
+				return Json::Object;
+			default:
+				return Json::Null;
+		}
+	}
+
+	inline bool is( Type t ) const
+	{
+		return type() == t;
+	}
+
+	inline bool is_null() const
+	{
+		return type() == Json::Null;
+	}
+
+	inline bool is_bool() const
+	{
+		return type() == Json::Bool;
+	}
+
+	inline bool is_number() const
+	{
+		return type() == Json::Number;
+	}
+
+	inline bool is_string() const
+	{
+		return type() == Json::String;
+	}
+
+	inline bool is_array() const
+	{
+		return type() == Json::Array;
+	}
+
+	inline bool is_object() const
+	{
+		return type() == Json::Object;
+	}
+
+	/**
+	 * Key of an object member, empty string otherwise
+	 */
+	const char* name() const
+	{
+		return node_ && node_->string ? node_->string : "";
+	}
+
+	inline bool empty() const
+	{
+		switch( type() )
+		{
+			case Json::Null:
+				return true;
+			case Json::Array:
+			case Json::Object:
+				return node_->child == nullptr;
+			default:
+				return false;
+		}
+	}
+
+	/**
+	 * Array or object elements count
+	 */
+	int size() const
+	{
+		if ( is_array() || is_object() )
+		{
+			return cJSON_GetArraySize( node_ );
+		}
+		return 0;
+	}
+
+	bool has( const char *key ) const
+	{
+		return is_object() && cJSON_GetObjectItemCaseSensitive( node_, key ) != nullptr;
+	}
+
+	inline bool has( const std::string &key ) const
+	{
+		return has( key.c_str() );
+	}
+
+	JsonView at( int index ) const
+	{
+		if ( is_array() )
+		{
+			return JsonView( cJSON_GetArrayItem( node_, index ) );
+		}
+		return JsonView();
+	}
+
+	JsonView at( const char *key ) const
+	{
+		if ( is_object() )
+		{
+			return JsonView( cJSON_GetObjectItemCaseSensitive( node_, key ) );
+		}
+		return JsonView();
+	}
+
+	inline JsonView at( const std::string &key ) const
+	{
+		return at( key.c_str() );
+	}
+
+	inline JsonView operator[]( int index ) const
+	{
+		return at( index );
+	}
+
+	inline JsonView operator[]( const char *key ) const
+	{
+		return at( key );
+	}
+
+	inline JsonView operator[]( const std::string &key ) const
+	{
+		return at( key.c_str() );
+	}
+
+	/**
+	 * Last array element
+	 */
+	JsonView back() const
+	{
+		if ( is_array() && node_->child )
+		{
+			// cJSON keeps the last child in prev of the first one
+			return JsonView( node_->child->prev );
+		}
+		return JsonView();
+	}
+
+	Iterator begin() const;
+	Iterator end() const;
+
+	int as_int() const
+	{
+		return is_number() ? node_->valueint : 0;
+	}
+
+	unsigned as_uint() const
+	{
+		return is_number() ? (unsigned)node_->valueint : 0u;
+	}
+
+	int64_t as_int64() const
+	{
+		return is_number() ? static_cast<int64_t>( node_->valuedouble ) : 0;
+	}
+
+	double as_float() const
+	{
+		return is_number() ? node_->valuedouble : 0.0;
+	}
+
+	bool as_bool() const
+	{
+		return node_ && ( node_->type & 0xff ) == cJSON_True;
+	}
+
+	/**
+	 * String value in place, nullptr if not a string
+	 */
+	const char* c_str() const
+	{
+		return is_string() ? node_->valuestring : nullptr;
+	}
+
+	/**
+	 * Same conversion as Json::as_string()
+	 */
+	std::string as_string() const
+	{
+		switch( type() )
+		{
+			case Json::Bool:
+				return as_bool() ? "true" : "false";
+			case Json::Number:
+				return std::to_string( as_int() );
+			case Json::String:
+				return node_->valuestring;
+			case Json::Array:
+			case Json::Object:
+				return "";
+			default:
+				return "null";
+		}
+	}
+
+	bool operator==( const JsonView &rhs ) const
+	{
+		return node_ && rhs.node_ && cJSON_Compare( node_, rhs.node_, 1 );
+	}
+
+	bool operator!=( const JsonView &rhs ) const
+	{
+		return !( *this == rhs );
+	}
+
+	/**
+	 * Deep copy into a standalone Json
+	 */
+	Json copy() const
+	{
+		if ( !node_ )
+		{
+			return Json();
+		}
+		return Json( cJSON_Duplicate( node_, 1 ), true );
+	}
+
+private:
+	const cJSON *node_;
+};
+
+struct JsonView::Iterator
+{
+	Iterator& operator++()
+	{
+		if ( v_.node_ )
+		{
+			v_.node_ = v_.node_->next;
+		}
+		return *this;
+	}
+	Iterator operator++( int )
+	{
+		Iterator prev( *this );
+		++*this;
+		return prev;
+	}
+	bool operator==( const Iterator &rhs ) const
+	{
+		return v_.node_ == rhs.v_.node_;
+	}
+	bool operator!=( const Iterator &rhs ) const
+	{
+		return v_.node_ != rhs.v_.node_;
+	}
+	JsonView operator*() const
+	{
+		return v_;
+	}
+	const JsonView* operator->() const
+	{
+		return &v_;
+	}
+
+private:
+	friend class JsonView;
+	JsonView v_;
+
+	explicit Iterator( const cJSON *c ) :
+		v_( c )
+	{}
+};
+
+inline JsonView::Iterator JsonView::begin() const
+{
+	return Iterator( is_array() || is_object() ? node_->child : nullptr );
+}
+
+inline JsonView::Iterator JsonView::end() const
+{
+	return Iterator( nullptr );
+}
+
+inline JsonView Json::view() const
+{
+	return JsonView( data_->data );
+}
@@ -0,0 +1,663 @@
+#pragma once
+
+#include "cjson.hpp"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+
+/**
+ * CBOR (RFC 8949) encoding of Json documents.
+ *
+ * Integral numbers are written as CBOR integers, other numbers as single
+ * floats when that is exact and as doubles otherwise; containers have
+ * definite lengths. Decoding also takes indefinite lengths, half floats and
+ * tags (the tag is dropped). Byte strings become base64url strings as
+ * RFC 8949 section 6.1 suggests, map keys must be text strings.
+ */
+class JsonCbor
+{
+public:
+	/**
+	 * Encodes a document into caller buffers of any size, part by part
+	 */
+	class Encoder
+	{
+	public:
+		explicit Encoder( JsonView root )
+		{
+			reset( root );
+		}
+
+		void reset( JsonView root )
+		{
+			stack_.clear();
+			node_ = root.node();
+			step_ = node_ ? Value : Done;
+			pending_ = nullptr;
+			pending_size_ = 0;
+		}
+
+		inline bool done() const
+		{
+			return step_ == Done && !pending_size_;
+		}
+
+		/**
+		 * Write the next part
+		 * @param size at least 9 bytes, the longest head
+		 * @return bytes written, 0 when the document is complete
+		 */
+		size_t next( void *out, size_t size )
+		{
+			out_ = static_cast<uint8_t*>( out );
+			size_ = size;
+			used_ = 0;
+			fill();
+			return used_;
+		}
+
+	private:
+		enum Step {
+			Key,
+			Value,
+			Done
+		};
+
+		void fill()
+		{
+			while( true )
+			{
+				if ( pending_size_ )
+				{
+					size_t n = std::min( pending_size_, size_ - used_ );
+					memcpy( out_ + used_, pending_, n );
+					used_ += n;
+					pending_ += n;
+					pending_size_ -= n;
+					if ( pending_size_ )
+					{
+						return;
+					}
+				}
+				if ( step_ == Done || ( size_ - used_ < 9 && size_ - used_ < head_size() ) )
+				{
+					return;
+				}
+				if ( step_ == Key )
+				{
+					string( node_->string );
+					step_ = Value;
+				}
+				else
+				{
+					value();
+				}
+			}
+		}
+
+		/**
+		 * Bytes written by the next step before any string contents
+		 */
+		size_t head_size() const
+		{
+			if ( step_ == Key )
+			{
+				return JsonCbor::head_size( node_->string ? strlen( node_->string ) : 0 );
+			}
+			uint8_t tmp[9];
+			switch( node_->type & 0xFF )
+			{
+				case cJSON_Object:
+				case cJSON_Array:
+					return JsonCbor::head_size( count( node_ ) );
+				case cJSON_String:
+				case cJSON_Raw:
+					return JsonCbor::head_size( node_->valuestring ? strlen( node_->valuestring ) : 0 );
+				case cJSON_Number:
+					return number( tmp, node_->valuedouble );
+				default:
+					return 1;
+			}
+		}
+
+		void value()
+		{
+			switch( node_->type & 0xFF )
+			{
+				case cJSON_Object:
+				case cJSON_Array:
+				{
+					used_ += head( out_ + used_, cJSON_IsObject( node_ ) ? Map : Array, count( node_ ) );
+					if ( node_->child )
+					{
+						stack_.push_back( node_ );
+						node_ = node_->child;
+						step_ = cJSON_IsObject( stack_.back() ) ? Key : Value;
+						return;
+					}
+					break;
+				}
+				case cJSON_String:
+				case cJSON_Raw:
+					string( node_->valuestring );
+					break;
+				case cJSON_Number:
+					used_ += number( out_ + used_, node_->valuedouble );
+					break;
+				case cJSON_True:
+					out_[used_++] = 0xf5;
+					break;
+				case cJSON_False:
+					out_[used_++] = 0xf4;
+					break;
+				default:
+					out_[used_++] = 0xf6;
+					break;
+			}
+			after_value();
+		}
+
+		void after_value()
+		{
+			while( !stack_.empty() )
+			{
+				if ( node_->next )
+				{
+					node_ = node_->next;
+					step_ = cJSON_IsObject( stack_.back() ) ? Key : Value;
+					return;
+				}
+				node_ = stack_.back();
+				stack_.pop_back();
+			}
+			step_ = Done;
+		}
+
+		void string( const char *s )
+		{
+			s = s ? s : "";
+			size_t n = strlen( s );
+			used_ += head( out_ + used_, Text, n );
+			pending_ = reinterpret_cast<const uint8_t*>( s );
+			pending_size_ = n;
+		}
+
+		std::vector<const cJSON*> stack_;   // open containers
+		const cJSON *node_;
+		Step step_;
+		const uint8_t *pending_;            // rest of the string being written
+		size_t pending_size_;
+
+		uint8_t *out_;
+		size_t size_;
+		size_t used_;
+	};
+
+	/**
+	 * Encoded size of a document
+	 */
+	static size_t size( JsonView json )
+	{
+		return json.valid() ? size( json.node() ) : 0;
+	}
+
+	/**
+	 * Encode into a caller buffer
+	 * @return bytes written, 0 if the buffer is too small
+	 */
+	static size_t encode( JsonView json, void *buffer, size_t size )
+	{
+		if ( !json.valid() || JsonCbor::size( json ) > size )
+		{
+			return 0;
+		}
+		Encoder encoder( json );
+		size_t used = 0;
+		while( !encoder.done() )
+		{
+			size_t n = encoder.next( static_cast<uint8_t*>( buffer ) + used, size - used );
+			if ( !n )
+			{
+				return 0;
+			}
+			used += n;
+		}
+		return used;
+	}
+
+	/**
+	 * Encode into a string, its capacity is reused
+	 */
+	static void encode( JsonView json, std::string &out )
+	{
+		out.resize( size( json ) );
+		if ( !out.empty() )
+		{
+			encode( json, &out[0], out.size() );
+		}
+	}
+
+	static std::string encode( JsonView json )
+	{
+		std::string out;
+		encode( json, out );
+		return out;
+	}
+
+	/**
+	 * Decode one data item
+	 * @param jo result, Null on error
+	 * @return false on malformed or truncated input, trailing bytes or a non-text map key
+	 */
+	static bool decode( const void *data, size_t size, Json &jo )
+	{
+		Decoder d( static_cast<const uint8_t*>( data ), size );
+		cJSON *root = d.item( 0 );
+		if ( !root || d.p != d.end )
+		{
+			cJSON_Delete( root );
+			jo.clean();
+			return false;
+		}
+		jo = Json( root, true );
+		return true;
+	}
+
+	static inline bool decode( const std::string &data, Json &jo )
+	{
+		return decode( data.data(), data.size(), jo );
+	}
+
+private:
+	enum Major {
+		Unsigned,
+		Negative,
+		Bytes,
+		Text,
+		Array,
+		Map,
+		Tag,
+		Simple
+	};
+
+	static size_t head( uint8_t *out, Major major, uint64_t value )
+	{
+		uint8_t type = static_cast<uint8_t>( major << 5 );
+		if ( value < 24 )
+		{
+			out[0] = type | static_cast<uint8_t>( value );
+			return 1;
+		}
+		int bytes = value <= 0xff ? 1 : value <= 0xffff ? 2 : value <= 0xffffffffULL ? 4 : 8;
+		out[0] = type | ( bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27 );
+		for( int i = 0; i < bytes; i++ )
+		{
+			out[bytes - i] = static_cast<uint8_t>( value >> ( 8 * i ) );
+		}
+		return bytes + 1;
+	}
+
+	static size_t number( uint8_t *out, double d )
+	{
+		if ( d == std::floor( d ) && d >= -9223372036854775808.0 && d < 18446744073709551616.0 )
+		{
+			return d >= 0 ? head( out, Unsigned, static_cast<uint64_t>( d ) )
+						  : head( out, Negative, static_cast<uint64_t>( -( d + 1 ) ) );
+		}
+		float f = static_cast<float>( d );
+		if ( static_cast<double>( f ) == d )
+		{
+			uint32_t bits;
+			memcpy( &bits, &f, sizeof( bits ) );
+			out[0] = 0xfa;
+			for( int i = 0; i < 4; i++ )
+			{
+				out[4 - i] = static_cast<uint8_t>( bits >> ( 8 * i ) );
+			}
+			return 5;
+		}
+		uint64_t bits;
+		memcpy( &bits, &d, sizeof( bits ) );
+		out[0] = 0xfb;
+		for( int i = 0; i < 8; i++ )
+		{
+			out[8 - i] = static_cast<uint8_t>( bits >> ( 8 * i ) );
+		}
+		return 9;
+	}
+
+	static uint64_t count( const cJSON *item )
+	{
+		uint64_t n = 0;
+		for( const cJSON *c = item->child; c; c = c->next )
+		{
+			n++;
+		}
+		return n;
+	}
+
+	static size_t head_size( uint64_t value )
+	{
+		return value < 24 ? 1 : value <= 0xff ? 2 : value <= 0xffff ? 3 : value <= 0xffffffffULL ? 5 : 9;
+	}
+
+	static size_t size( const cJSON *item )
+	{
+		switch( item->type & 0xFF )
+		{
+			case cJSON_Object:
+			case cJSON_Array:
+			{
+				size_t count = 0;
+				size_t bytes = 0;
+				for( const cJSON *c = item->child; c; c = c->next )
+				{
+					count++;
+					bytes += size( c );
+					if ( cJSON_IsObject( item ) )
+					{
+						size_t n = c->string ? strlen( c->string ) : 0;
+						bytes += head_size( n ) + n;
+					}
+				}
+				return head_size( count ) + bytes;
+			}
+			case cJSON_String:
+			case cJSON_Raw:
+			{
+				size_t n = item->valuestring ? strlen( item->valuestring ) : 0;
+				return head_size( n ) + n;
+			}
+			case cJSON_Number:
+			{
+				uint8_t tmp[9];
+				return number( tmp, item->valuedouble );
+			}
+			default:
+				return 1;
+		}
+	}
+
+	struct Decoder
+	{
+		const uint8_t *p;
+		const uint8_t *end;
+
+		Decoder( const uint8_t *data, size_t size ) :
+			p( data ),
+			end( data + size )
+		{}
+
+		/**
+		 * Read the head of an item
+		 * @param info low 5 bits of the first byte, 31 for indefinite length
+		 * @param value argument
+		 */
+		bool head( Major &major, uint8_t &info, uint64_t &value )
+		{
+			if ( p == end )
+			{
+				return false;
+			}
+			major = static_cast<Major>( *p >> 5 );
+			info = *p++ & 0x1f;
+			if ( info < 24 || info == 31 )
+			{
+				value = info;
+				return info != 31 || ( major >= Bytes && major <= Map ) || major == Simple;
+			}
+			if ( info > 27 )
+			{
+				return false;
+			}
+			size_t bytes = static_cast<size_t>( 1 ) << ( info - 24 );
+			if ( static_cast<size_t>( end - p ) < bytes )
+			{
+				return false;
+			}
+			value = 0;
+			for( size_t i = 0; i < bytes; i++ )
+			{
+				value = ( value << 8 ) | *p++;
+			}
+			return true;
+		}
+
+		inline bool at_break()
+		{
+			if ( p != end && *p == 0xff )
+			{
+				p++;
+				return true;
+			}
+			return false;
+		}
+
+		/**
+		 * Read the rest of a byte or text string, chunks are joined
+		 */
+		bool string( Major major, uint8_t info, uint64_t length, std::string &out )
+		{
+			if ( info != 31 )
+			{
+				if ( static_cast<uint64_t>( end - p ) < length )
+				{
+					return false;
+				}
+				out.append( reinterpret_cast<const char*>( p ), static_cast<size_t>( length ) );
+				p += length;
+				return true;
+			}
+			while( !at_break() )
+			{
+				Major m;
+				uint8_t i;
+				uint64_t n;
+				if ( !head( m, i, n ) || m != major || i == 31 || !string( major, i, n, out ) )
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		cJSON* item( size_t depth )
+		{
+			Major major;
+			uint8_t info;
+			uint64_t value;
+			if ( depth >= CJSON_NESTING_LIMIT || !head( major, info, value ) )
+			{
+				return nullptr;
+			}
+			switch( major )
+			{
+				case Unsigned:
+					return cJSON_CreateNumber( static_cast<double>( value ) );
+				case Negative:
+					return cJSON_CreateNumber( -1.0 - static_cast<double>( value ) );
+				case Bytes:
+				case Text:
+				{
+					std::string text;
+					if ( !string( major, info, value, text ) )
+					{
+						return nullptr;
+					}
+					return create_string( major == Text ? text : base64url( text ) );
+				}
+				case Array:
+				case Map:
+					return container( major, info, value, depth );
+				case Tag:
+					return item( depth + 1 );
+				case Simple:
+					return simple( info, value );
+			}
+			return nullptr;
+		}
+
+		cJSON* container( Major major, uint8_t info, uint64_t count, size_t depth )
+		{
+			cJSON *node = major == Map ? cJSON_CreateObject() : cJSON_CreateArray();
+			for( uint64_t i = 0; node; i++ )
+			{
+				if ( info == 31 ? at_break() : i == count )
+				{
+					return node;
+				}
+				if ( !member( node, major == Map, depth ) )
+				{
+					break;
+				}
+			}
+			cJSON_Delete( node );
+			return nullptr;
+		}
+
+		/**
+		 * Read a value, with its key in a map, and append it
+		 */
+		bool member( cJSON *node, bool keyed, size_t depth )
+		{
+			std::string key;
+			if ( keyed )
+			{
+				Major m;
+				uint8_t i;
+				uint64_t n;
+				if ( !head( m, i, n ) || m != Text || !string( Text, i, n, key ) )
+				{
+					return false;
+				}
+			}
+			cJSON *child = item( depth + 1 );
+			if ( !child )
+			{
+				return false;
+			}
+			if ( keyed && !( child->string = copy( key ) ) )
+			{
+				cJSON_Delete( child );
+				return false;
+			}
+			if ( node->child )
+			{
+				cJSON *last = node->child->prev;
+				last->next = child;
+				child->prev = last;
+			}
+			else
+			{
+				node->child = child;
+			}
+			node->child->prev = child;
+			return true;
+		}
+
+		cJSON* simple( uint8_t info, uint64_t value )
+		{
+			switch( info )
+			{
+				case 20:
+					return cJSON_CreateFalse();
+				case 21:
+					return cJSON_CreateTrue();
+				case 22:
+				case 23:
+					return cJSON_CreateNull();
+				case 25:
+					return cJSON_CreateNumber( half( static_cast<uint16_t>( value ) ) );
+				case 26:
+				{
+					uint32_t bits = static_cast<uint32_t>( value );
+					float f;
+					memcpy( &f, &bits, sizeof( f ) );
+					return cJSON_CreateNumber( f );
+				}
+				case 27:
+				{
+					double d;
+					memcpy( &d, &value, sizeof( d ) );
+					return cJSON_CreateNumber( d );
+				}
+				default:
+					// Unassigned simple values and a break outside of an indefinite item
+					return nullptr;
+			}
+		}
+
+		static double half( uint16_t bits )
+		{
+			int exponent = ( bits >> 10 ) & 0x1f;
+			int mantissa = bits & 0x3ff;
+			double value;
+			if ( exponent == 0 )
+			{
+				value = std::ldexp( mantissa, -24 );
+			}
+			else if ( exponent == 31 )
+			{
+				value = mantissa ? NAN : INFINITY;
+			}
+			else
+			{
+				value = std::ldexp( mantissa + 1024, exponent - 25 );
+			}
+			return bits & 0x8000 ? -value : value;
+		}
+
+		static char* copy( const std::string &text )
+		{
+			char *s = static_cast<char*>( cJSON_malloc( text.size() + 1 ) );
+			if ( s )
+			{
+				memcpy( s, text.data(), text.size() );
+				s[text.size()] = '\0';
+			}
+			return s;
+		}
+
+		static cJSON* create_string( const std::string &text )
+		{
+			cJSON *item = cJSON_CreateNull();
+			char *s = item ? copy( text ) : nullptr;
+			if ( !s )
+			{
+				cJSON_Delete( item );
+				return nullptr;
+			}
+			item->type = cJSON_String;
+			item->valuestring = s;
+			return item;
+		}
+
+		static std::string base64url( const std::string &bytes )
+		{
+			static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+			std::string out;
+			out.reserve( ( bytes.size() + 2 ) / 3 * 4 );
+			uint32_t bits = 0;
+			int count = 0;
+			for( unsigned char c : bytes )
+			{
+				bits = ( bits << 8 ) | c;
+				count += 8;
+				while( count >= 6 )
+				{
+					count -= 6;
+					out += digits[( bits >> count ) & 0x3f];
+				}
+			}
+			if ( count )
+			{
+				out += digits[( bits << ( 6 - count ) ) & 0x3f];
+			}
+			return out;
+		}
+	};
+};
@@ -0,0 +1,750 @@
+#pragma once
+
+#include "cjson.hpp"
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+/**
+ * JSON Patch (RFC 6902), JSON Merge Patch (RFC 7386) and patch generation.
+ *
+ * Patches are applied to the cJSON tree of a Json in place: only the
+ * members which are added, removed or replaced are touched, the rest of the
+ * document is neither copied nor re-parsed. JSON Patch is atomic, a failing
+ * operation reverts the ones before it. Handles to members which a patch
+ * removes or replaces are invalid afterwards, other handles stay usable.
+ * Values added with set() or insert() are patched in place, their handles
+ * see the change.
+ */
+class JsonPatch
+{
+public:
+	/**
+	 * Apply an RFC 6902 patch
+	 * @param doc document, unchanged if the patch fails
+	 * @param patch array of operations
+	 * @return false if the patch is malformed, a path does not exist or a test fails
+	 */
+	static bool apply( Json &doc, JsonView patch )
+	{
+		if ( !patch.is_array() )
+		{
+			return false;
+		}
+		JsonArena::Scope scope( doc.data_->arena );
+		Log log( doc );
+		for( JsonView op : patch )
+		{
+			if ( !operation( log, op ) )
+			{
+				log.revert();
+				return false;
+			}
+		}
+		log.commit();
+		return true;
+	}
+
+	/**
+	 * Apply an RFC 7386 merge patch: objects are merged member by member, null removes a member
+	 */
+	static void merge( Json &doc, JsonView patch )
+	{
+		if ( !patch.valid() )
+		{
+			return;
+		}
+		JsonArena::Scope scope( doc.data_->arena );
+		cJSON *target = root( doc );
+		cJSON *merged = merge( target, doc.refs_.get(), patch.node() );
+		if ( merged != target )
+		{
+			doc = Json( merged, true );
+		}
+		else if ( doc.refs_ )
+		{
+			// Members may be gone, references to them are stale
+			prune( doc );
+		}
+	}
+
+	/**
+	 * RFC 6902 patch which turns one document into another
+	 */
+	static Json diff( JsonView from, JsonView to )
+	{
+		cJSON *ops = cJSON_CreateArray();
+		std::string path;
+		diff( ops, path, from.node(), to.node() );
+		return Json( ops, true );
+	}
+
+private:
+	/**
+	 * Changes made by a patch, to undo them if a later operation fails
+	 */
+	class Log
+	{
+	public:
+		explicit Log( Json &doc ) :
+			doc_( doc )
+		{}
+
+		inline const Json& doc() const
+		{
+			return doc_;
+		}
+
+		/**
+		 * Link a new node before next, at the end if next is nullptr
+		 */
+		void insert( cJSON *parent, cJSON *node, cJSON *next )
+		{
+			link( parent, node, next );
+			entries_.push_back( Entry{ Entry::Inserted, parent, node, nullptr } );
+		}
+
+		/**
+		 * Unlink a node, it is deleted once the patch succeeds
+		 */
+		void detach( cJSON *parent, cJSON *node )
+		{
+			cJSON *next = node->next;
+			cJSON_DetachItemViaPointer( parent, node );
+			entries_.push_back( Entry{ Entry::Detached, parent, node, next } );
+		}
+
+		void replace_root( cJSON *node )
+		{
+			roots_.push_back( doc_ );
+			doc_ = Json( node, true );
+			entries_.push_back( Entry{ Entry::Root, nullptr, nullptr, nullptr } );
+		}
+
+		void revert()
+		{
+			for( size_t i = entries_.size(); i-- > 0; )
+			{
+				Entry &e = entries_[i];
+				switch( e.kind )
+				{
+					case Entry::Inserted:
+						cJSON_DetachItemViaPointer( e.parent, e.node );
+						cJSON_Delete( e.node );
+						break;
+					case Entry::Detached:
+						link( e.parent, e.node, e.next );
+						break;
+					case Entry::Root:
+						doc_ = roots_.back();
+						roots_.pop_back();
+						break;
+				}
+			}
+			entries_.clear();
+		}
+
+		void commit()
+		{
+			for( Entry &e : entries_ )
+			{
+				if ( e.kind == Entry::Detached )
+				{
+					cJSON_Delete( e.node );
+				}
+			}
+			entries_.clear();
+			prune( doc_ );
+		}
+
+	private:
+		struct Entry
+		{
+			enum Kind {
+				Inserted,
+				Detached,
+				Root
+			} kind;
+			cJSON *parent;
+			cJSON *node;
+			cJSON *next;    // successor of a detached node
+		};
+
+		static void link( cJSON *parent, cJSON *node, cJSON *next )
+		{
+			if ( !next )
+			{
+				if ( parent->child )
+				{
+					cJSON *last = parent->child->prev;
+					last->next = node;
+					node->prev = last;
+				}
+				else
+				{
+					parent->child = node;
+				}
+				node->next = nullptr;
+				parent->child->prev = node;
+				return;
+			}
+			node->next = next;
+			node->prev = next->prev;
+			if ( next == parent->child )
+			{
+				parent->child = node;
+			}
+			else
+			{
+				next->prev->next = node;
+			}
+			next->prev = node;
+		}
+
+		Json &doc_;
+		std::vector<Entry> entries_;
+		std::vector<Json> roots_;   // documents replaced by a whole-document operation
+	};
+
+	/**
+	 * Split an RFC 6901 pointer into unescaped tokens
+	 */
+	static bool tokens( const char *pointer, std::vector<std::string> &out )
+	{
+		out.clear();
+		if ( !pointer || ( *pointer && *pointer != '/' ) )
+		{
+			return false;
+		}
+		while( *pointer )
+		{
+			out.push_back( std::string() );
+			for( pointer++; *pointer && *pointer != '/'; pointer++ )
+			{
+				if ( *pointer == '~' )
+				{
+					pointer++;
+					if ( *pointer != '0' && *pointer != '1' )
+					{
+						return false;
+					}
+					out.back() += *pointer == '0' ? '~' : '/';
+				}
+				else
+				{
+					out.back() += *pointer;
+				}
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Array index token, -1 if it is not one
+	 */
+	static int index( const std::string &token )
+	{
+		if ( token.empty() || token.size() > 9 || ( token[0] == '0' && token.size() > 1 ) )
+		{
+			return -1;
+		}
+		int value = 0;
+		for( char c : token )
+		{
+			if ( c < '0' || c > '9' )
+			{
+				return -1;
+			}
+			value = value * 10 + ( c - '0' );
+		}
+		return value;
+	}
+
+	static cJSON* child( cJSON *node, const std::string &token )
+	{
+		if ( cJSON_IsObject( node ) )
+		{
+			for( cJSON *c = node->child; c; c = c->next )
+			{
+				if ( c->string && token == c->string )
+				{
+					return c;
+				}
+			}
+		}
+		else if ( cJSON_IsArray( node ) )
+		{
+			int i = index( token );
+			cJSON *c = node->child;
+			for( ; c && i > 0; i-- )
+			{
+				c = c->next;
+			}
+			return i == 0 ? c : nullptr;
+		}
+		return nullptr;
+	}
+
+	/**
+	 * Node at the first n tokens
+	 */
+	static cJSON* resolve( const Json &doc, const std::vector<std::string> &path, size_t n )
+	{
+		Json::ObjectSet *refs = doc.refs_.get();
+		cJSON *node = root( doc );
+		for( size_t i = 0; node && i < n; i++ )
+		{
+			node = child( node, path[i] );
+			if ( node )
+			{
+				node = owned( node, refs );
+			}
+		}
+		return node;
+	}
+
+	/**
+	 * Node holding the member list of the document
+	 */
+	static cJSON* root( const Json &doc )
+	{
+		cJSON *node = doc.data_->data;
+		return ( node->type & cJSON_IsReference ) && doc.refs_ ? doc.refs_->owner : node;
+	}
+
+	/**
+	 * Node to patch for a member, its owner if it was added by reference:
+	 * the reference node only has a copy of the head of the member list
+	 * @param refs set of the parent, replaced with the set of the member
+	 */
+	static cJSON* owned( cJSON *node, Json::ObjectSet *&refs )
+	{
+		Json::ObjectSet *parent = refs;
+		refs = nullptr;
+		if ( !parent )
+		{
+			return node;
+		}
+		if ( node->type & cJSON_IsReference )
+		{
+			Json::RefMap::iterator it = parent->find( node );
+			if ( it != parent->end() )
+			{
+				refs = it->second.refs_.get();
+				return it->second.data_->data;
+			}
+			return node;
+		}
+		Json::ObjectSet::SubMap::iterator it = parent->subs.find( node );
+		if ( it != parent->subs.end() )
+		{
+			refs = it->second.get();
+		}
+		return node;
+	}
+
+	/**
+	 * Give a node its member name, nullptr for array items
+	 */
+	static bool rename( cJSON *node, const char *key )
+	{
+		if ( !( node->type & cJSON_StringIsConst ) )
+		{
+			cJSON_free( node->string );
+		}
+		node->type &= ~cJSON_StringIsConst;
+		node->string = nullptr;
+		if ( key )
+		{
+			size_t n = strlen( key ) + 1;
+			node->string = static_cast<char*>( cJSON_malloc( n ) );
+			if ( !node->string )
+			{
+				return false;
+			}
+			memcpy( node->string, key, n );
+		}
+		return true;
+	}
+
+	/**
+	 * Add a node at a path or replace the array item there, the node is deleted on failure
+	 */
+	static bool add( Log &log, const std::vector<std::string> &path, cJSON *node, bool replace )
+	{
+		if ( path.empty() )
+		{
+			rename( node, nullptr );
+			log.replace_root( node );
+			return true;
+		}
+		cJSON *parent = resolve( log.doc(), path, path.size() - 1 );
+		const std::string &key = path.back();
+		if ( cJSON_IsObject( parent ) )
+		{
+			if ( !rename( node, key.c_str() ) )
+			{
+				cJSON_Delete( node );
+				return false;
+			}
+			cJSON *old = child( parent, key );
+			cJSON *next = nullptr;
+			if ( old )
+			{
+				// Replaced in place, member order is kept
+				next = old->next;
+				log.detach( parent, old );
+			}
+			log.insert( parent, node, next );
+			return true;
+		}
+		if ( cJSON_IsArray( parent ) && rename( node, nullptr ) )
+		{
+			if ( key == "-" && !replace )
+			{
+				log.insert( parent, node, nullptr );
+				return true;
+			}
+			int i = index( key );
+			cJSON *next = parent->child;
+			for( ; next && i > 0; i-- )
+			{
+				next = next->next;
+			}
+			if ( i == 0 && ( next || !replace ) )
+			{
+				if ( replace )
+				{
+					cJSON *old = next;
+					next = old->next;
+					log.detach( parent, old );
+				}
+				log.insert( parent, node, next );
+				return true;
+			}
+		}
+		cJSON_Delete( node );
+		return false;
+	}
+
+	static bool remove( Log &log, const std::vector<std::string> &path )
+	{
+		if ( path.empty() )
+		{
+			return false;
+		}
+		cJSON *parent = resolve( log.doc(), path, path.size() - 1 );
+		cJSON *node = parent ? child( parent, path.back() ) : nullptr;
+		if ( !node )
+		{
+			return false;
+		}
+		log.detach( parent, node );
+		return true;
+	}
+
+	static bool operation( Log &log, JsonView op )
+	{
+		const char *name = op["op"].c_str();
+		std::vector<std::string> path;
+		if ( !name || !tokens( op["path"].c_str(), path ) )
+		{
+			return false;
+		}
+		JsonView value = op["value"];
+		if ( !strcmp( name, "add" ) || !strcmp( name, "replace" ) )
+		{
+			if ( !value.valid() )
+			{
+				return false;
+			}
+			bool replace = name[0] == 'r';
+			if ( replace && !resolve( log.doc(), path, path.size() ) )
+			{
+				return false;
+			}
+			cJSON *node = cJSON_Duplicate( value.node(), true );
+			return node && add( log, path, node, replace );
+		}
+		if ( !strcmp( name, "remove" ) )
+		{
+			return remove( log, path );
+		}
+		if ( !strcmp( name, "test" ) )
+		{
+			cJSON *node = resolve( log.doc(), path, path.size() );
+			return node && value.valid() && cJSON_Compare( node, value.node(), true );
+		}
+		if ( !strcmp( name, "move" ) || !strcmp( name, "copy" ) )
+		{
+			std::vector<std::string> from;
+			if ( !tokens( op["from"].c_str(), from ) )
+			{
+				return false;
+			}
+			cJSON *source = resolve( log.doc(), from, from.size() );
+			if ( !source )
+			{
+				return false;
+			}
+			if ( name[0] == 'm' )
+			{
+				// A value can not move into itself
+				if ( path.size() > from.size() && std::equal( from.begin(), from.end(), path.begin() ) )
+				{
+					return false;
+				}
+				if ( path == from )
+				{
+					return true;
+				}
+			}
+			cJSON *node = cJSON_Duplicate( source, true );
+			if ( !node )
+			{
+				return false;
+			}
+			if ( name[0] == 'm' && !remove( log, from ) )
+			{
+				cJSON_Delete( node );
+				return false;
+			}
+			return add( log, path, node, false );
+		}
+		return false;
+	}
+
+	/**
+	 * Drop indexes, and references and sets of members which are no longer in the document
+	 */
+	static void prune( Json &doc )
+	{
+		if ( doc.refs_ )
+		{
+			cJSON *node = root( doc );
+			doc.data_->data->child = node->child;
+			prune( node, *doc.refs_ );
+		}
+	}
+
+	/**
+	 * Sets of members below the object are pruned too, handles to them share the sets
+	 */
+	static void prune( const cJSON *object, Json::ObjectSet &refs )
+	{
+		refs.reset();
+		if ( refs.empty() && refs.subs.empty() )
+		{
+			return;
+		}
+		std::unordered_set<const cJSON*> members;
+		for( const cJSON *c = object->child; c; c = c->next )
+		{
+			members.insert( c );
+		}
+		for( Json::RefMap::iterator it = refs.begin(); it != refs.end(); )
+		{
+			// A new member may have been given the address of a removed one
+			if ( members.count( it->first ) && ( it->first->type & cJSON_IsReference ) )
+			{
+				if ( it->second.refs_ )
+				{
+					// The owner was patched, the reference follows its head
+					cJSON *owner = it->second.data_->data;
+					it->first->child = owner->child;
+					prune( owner, *it->second.refs_ );
+				}
+				++it;
+			}
+			else
+			{
+				it = refs.erase( it );
+			}
+		}
+		for( Json::ObjectSet::SubMap::iterator it = refs.subs.begin(); it != refs.subs.end(); )
+		{
+			if ( members.count( it->first ) && ( cJSON_IsArray( it->first ) || cJSON_IsObject( it->first ) ) )
+			{
+				prune( it->first, *it->second );
+				++it;
+			}
+			else
+			{
+				it = refs.subs.erase( it );
+			}
+		}
+	}
+
+	/**
+	 * Merge patch into target
+	 * @param refs set of target, if it has one
+	 * @return target, or the node which replaces it
+	 */
+	static cJSON* merge( cJSON *target, Json::ObjectSet *refs, const cJSON *patch )
+	{
+		if ( !cJSON_IsObject( patch ) )
+		{
+			cJSON *node = cJSON_Duplicate( patch, true );
+			return node ? node : target;
+		}
+		if ( !cJSON_IsObject( target ) )
+		{
+			target = cJSON_CreateObject();
+			refs = nullptr;
+		}
+		for( const cJSON *p = patch->child; p && target; p = p->next )
+		{
+			cJSON *old = cJSON_GetObjectItemCaseSensitive( target, p->string );
+			if ( cJSON_IsNull( p ) )
+			{
+				if ( old )
+				{
+					cJSON_Delete( cJSON_DetachItemViaPointer( target, old ) );
+				}
+				continue;
+			}
+			Json::ObjectSet *sub = refs;
+			cJSON *member = old ? owned( old, sub ) : nullptr;
+			cJSON *node = merge( member, sub, p );
+			if ( node && node != member )
+			{
+				if ( old )
+				{
+					rename( node, old->string );
+					cJSON_ReplaceItemViaPointer( target, old, node );
+				}
+				else
+				{
+					cJSON_AddItemToObject( target, p->string, node );
+				}
+			}
+		}
+		return target;
+	}
+
+	static std::string escape( const char *key )
+	{
+		std::string out;
+		for( ; *key; key++ )
+		{
+			if ( *key == '~' )
+			{
+				out += "~0";
+			}
+			else if ( *key == '/' )
+			{
+				out += "~1";
+			}
+			else
+			{
+				out += *key;
+			}
+		}
+		return out;
+	}
+
+	static void emit( cJSON *ops, const char *op, const std::string &path, const cJSON *value )
+	{
+		cJSON *o = cJSON_CreateObject();
+		cJSON_AddItemToObject( o, "op", cJSON_CreateString( op ) );
+		cJSON_AddItemToObject( o, "path", cJSON_CreateString( path.c_str() ) );
+		if ( value )
+		{
+			cJSON_AddItemToObject( o, "value", cJSON_Duplicate( value, true ) );
+		}
+		cJSON_AddItemToArray( ops, o );
+	}
+
+	static void diff( cJSON *ops, std::string &path, const cJSON *from, const cJSON *to )
+	{
+		if ( !from || !to || cJSON_Compare( from, to, true ) )
+		{
+			return;
+		}
+		size_t length = path.size();
+		if ( cJSON_IsObject( from ) && cJSON_IsObject( to ) )
+		{
+			std::unordered_map<std::string, const cJSON*> members;
+			for( const cJSON *c = to->child; c; c = c->next )
+			{
+				members.emplace( c->string, c );
+			}
+			for( const cJSON *c = from->child; c; c = c->next )
+			{
+				path.resize( length );
+				path += "/" + escape( c->string );
+				std::unordered_map<std::string, const cJSON*>::iterator it = members.find( c->string );
+				if ( it == members.end() )
+				{
+					emit( ops, "remove", path, nullptr );
+				}
+				else
+				{
+					diff( ops, path, c, it->second );
+					members.erase( it );
+				}
+			}
+			for( const cJSON *c = to->child; c; c = c->next )
+			{
+				if ( members.count( c->string ) )
+				{
+					path.resize( length );
+					path += "/" + escape( c->string );
+					emit( ops, "add", path, c );
+				}
+			}
+		}
+		else if ( cJSON_IsArray( from ) && cJSON_IsArray( to ) )
+		{
+			std::vector<const cJSON*> a, b;
+			for( const cJSON *c = from->child; c; c = c->next )
+			{
+				a.push_back( c );
+			}
+			for( const cJSON *c = to->child; c; c = c->next )
+			{
+				b.push_back( c );
+			}
+			// Equal head and tail are skipped, so one insert or removal is one operation
+			size_t head = 0;
+			while( head < a.size() && head < b.size() && cJSON_Compare( a[head], b[head], true ) )
+			{
+				head++;
+			}
+			size_t tail = 0;
+			while( tail < a.size() - head && tail < b.size() - head &&
+				   cJSON_Compare( a[a.size() - 1 - tail], b[b.size() - 1 - tail], true ) )
+			{
+				tail++;
+			}
+			size_t common = std::min( a.size(), b.size() ) - head - tail;
+			for( size_t i = 0; i < common; i++ )
+			{
+				path.resize( length );
+				path += "/" + std::to_string( head + i );
+				diff( ops, path, a[head + i], b[head + i] );
+			}
+			path.resize( length );
+			path += "/" + std::to_string( head + common );
+			for( size_t i = head + common; i < a.size() - tail; i++ )
+			{
+				emit( ops, "remove", path, nullptr );
+			}
+			for( size_t i = head + common; i < b.size() - tail; i++ )
+			{
+				path.resize( length );
+				path += "/" + std::to_string( i );
+				emit( ops, "add", path, b[i] );
+			}
+		}
+		else
+		{
+			emit( ops, "replace", path, to );
+		}
+		path.resize( length );
+	}
+};
@@ -0,0 +1,475 @@
+#pragma once
+
+#include "cjson.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+
+/**
+ * Compiled path into a document.
+ *
+ * A path is compiled once from an RFC 6901 JSON Pointer or from a small
+ * query language and then evaluated against any number of documents.
+ * Evaluation walks cJSON nodes directly and returns JsonView results, it
+ * never allocates. Query syntax:
+ *
+ *     $.store.book[0].title     member and index steps, $ is optional
+ *     $['key with spaces']      quoted member
+ *     $.items[*].id, $.map.*    every array element or object member
+ *     $.items[-1]               index from the end
+ *     $.items[1:5], [::2], [::-1]  slices with Python semantics
+ */
+class JsonPath
+{
+public:
+	JsonPath()
+	{}
+
+	/**
+	 * Compile an RFC 6901 JSON Pointer, "" is the whole document
+	 * @return false on a malformed pointer, path is cleared
+	 */
+	static bool pointer( const char *text, JsonPath &path )
+	{
+		path.steps_.clear();
+		if ( !text || ( *text && *text != '/' ) )
+		{
+			return false;
+		}
+		while( *text )
+		{
+			Step step( Step::Member );
+			for( text++; *text && *text != '/'; text++ )
+			{
+				if ( *text == '~' )
+				{
+					text++;
+					if ( *text != '0' && *text != '1' )
+					{
+						path.steps_.clear();
+						return false;
+					}
+					step.key += *text == '0' ? '~' : '/';
+				}
+				else
+				{
+					step.key += *text;
+				}
+			}
+			step.index = array_index( step.key );
+			path.steps_.push_back( step );
+		}
+		return true;
+	}
+
+	static inline bool pointer( const std::string &text, JsonPath &path )
+	{
+		return pointer( text.c_str(), path );
+	}
+
+	/**
+	 * Compile a query
+	 * @return false on a syntax error, path is cleared
+	 */
+	static bool compile( const char *text, JsonPath &path )
+	{
+		path.steps_.clear();
+		if ( !text )
+		{
+			return false;
+		}
+		const char *p = text;
+		if ( *p == '$' )
+		{
+			p++;
+		}
+		else if ( *p && *p != '.' && *p != '[' )
+		{
+			// Leading bare member
+			if ( !name( p, path ) )
+			{
+				return false;
+			}
+		}
+		while( *p )
+		{
+			bool ok;
+			if ( *p == '.' )
+			{
+				p++;
+				if ( *p == '*' )
+				{
+					p++;
+					path.steps_.push_back( Step( Step::Wildcard ) );
+					ok = true;
+				}
+				else
+				{
+					ok = name( p, path );
+				}
+			}
+			else if ( *p == '[' )
+			{
+				p++;
+				ok = bracket( p, path );
+			}
+			else
+			{
+				ok = false;
+			}
+			if ( !ok )
+			{
+				path.steps_.clear();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static inline bool compile( const std::string &text, JsonPath &path )
+	{
+		return compile( text.c_str(), path );
+	}
+
+	/**
+	 * Number of steps, 0 selects the whole document
+	 */
+	inline size_t size() const
+	{
+		return steps_.size();
+	}
+
+	/**
+	 * The path selects at most one value, it has no wildcards or slices
+	 */
+	bool definite() const
+	{
+		for( const Step &s : steps_ )
+		{
+			if ( s.kind == Step::Wildcard || s.kind == Step::Slice )
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * First match, a null view if there is none
+	 */
+	JsonView find( JsonView root ) const
+	{
+		JsonView found;
+		auto first = [&found]( JsonView v ) {
+			found = v;
+			return false;
+		};
+		walk( root.node(), 0, first );
+		return found;
+	}
+
+	/**
+	 * Store matches in document order
+	 * @return number of matches, may be more than max
+	 */
+	size_t select( JsonView root, JsonView *out, size_t max ) const
+	{
+		size_t count = 0;
+		auto store = [&]( JsonView v ) {
+			if ( count < max )
+			{
+				out[count] = v;
+			}
+			count++;
+			return true;
+		};
+		walk( root.node(), 0, store );
+		return count;
+	}
+
+	/**
+	 * Call visit( JsonView ) for each match, it returns false to stop
+	 * @return false if stopped
+	 */
+	template<typename F>
+	inline bool each( JsonView root, F visit ) const
+	{
+		return walk( root.node(), 0, visit );
+	}
+
+private:
+	struct Step
+	{
+		enum Kind {
+			Member,     // object key, or array index when index >= 0 (pointers)
+			Index,      // array index, negative counts from the end
+			Wildcard,
+			Slice
+		};
+
+		explicit Step( Kind k ) :
+			kind( k ),
+			index( -1 ),
+			start( 0 ),
+			end( 0 ),
+			step( 1 ),
+			has_start( false ),
+			has_end( false )
+		{}
+
+		Kind kind;
+		std::string key;
+		long index;
+		long start;
+		long end;
+		long step;
+		bool has_start;
+		bool has_end;
+	};
+
+	/**
+	 * RFC 6901 array index: 0 or digits without a leading zero
+	 */
+	static long array_index( const std::string &token )
+	{
+		if ( token.empty() || token.size() > 9 || ( token[0] == '0' && token.size() > 1 ) )
+		{
+			return -1;
+		}
+		long value = 0;
+		for( char c : token )
+		{
+			if ( c < '0' || c > '9' )
+			{
+				return -1;
+			}
+			value = value * 10 + ( c - '0' );
+		}
+		return value;
+	}
+
+	static bool name( const char *&p, JsonPath &path )
+	{
+		const char *begin = p;
+		while( *p && *p != '.' && *p != '[' && *p != ']' && *p != '*' )
+		{
+			p++;
+		}
+		if ( p == begin )
+		{
+			return false;
+		}
+		Step step( Step::Member );
+		step.key.assign( begin, p );
+		path.steps_.push_back( step );
+		return true;
+	}
+
+	static bool number( const char *&p, long &value )
+	{
+		char *end;
+		value = strtol( p, &end, 10 );
+		if ( end == p || ( *p != '-' && ( *p < '0' || *p > '9' ) ) )
+		{
+			return false;
+		}
+		p = end;
+		return true;
+	}
+
+	/**
+	 * Selector after '[' up to and including ']'
+	 */
+	static bool bracket( const char *&p, JsonPath &path )
+	{
+		if ( *p == '*' )
+		{
+			p++;
+			path.steps_.push_back( Step( Step::Wildcard ) );
+		}
+		else if ( *p == '\'' || *p == '"' )
+		{
+			char quote = *p++;
+			Step step( Step::Member );
+			for( ; *p && *p != quote; p++ )
+			{
+				if ( *p == '\\' && p[1] )
+				{
+					p++;
+				}
+				step.key += *p;
+			}
+			if ( *p != quote )
+			{
+				return false;
+			}
+			p++;
+			path.steps_.push_back( step );
+		}
+		else
+		{
+			Step step( Step::Index );
+			long value;
+			step.has_start = number( p, value );
+			step.start = value;
+			if ( *p == ':' )
+			{
+				step.kind = Step::Slice;
+				p++;
+				step.has_end = number( p, step.end );
+				if ( *p == ':' )
+				{
+					p++;
+					if ( number( p, value ) )
+					{
+						if ( value == 0 )
+						{
+							return false;
+						}
+						step.step = value;
+					}
+				}
+			}
+			else if ( !step.has_start )
+			{
+				return false;
+			}
+			step.index = step.start;
+			path.steps_.push_back( step );
+		}
+		if ( *p != ']' )
+		{
+			return false;
+		}
+		p++;
+		return true;
+	}
+
+	static const cJSON* member( const cJSON *object, const std::string &key )
+	{
+		for( const cJSON *c = object->child; c; c = c->next )
+		{
+			if ( c->string && !strcmp( c->string, key.c_str() ) )
+			{
+				return c;
+			}
+		}
+		return nullptr;
+	}
+
+	static long count( const cJSON *array )
+	{
+		long n = 0;
+		for( const cJSON *c = array->child; c; c = c->next )
+		{
+			n++;
+		}
+		return n;
+	}
+
+	static const cJSON* element( const cJSON *array, long index )
+	{
+		if ( index == -1 )
+		{
+			return array->child ? array->child->prev : nullptr;
+		}
+		if ( index < 0 )
+		{
+			index += count( array );
+			if ( index < 0 )
+			{
+				return nullptr;
+			}
+		}
+		const cJSON *c = array->child;
+		for( ; c && index > 0; index-- )
+		{
+			c = c->next;
+		}
+		return c;
+	}
+
+	template<typename F>
+	bool walk( const cJSON *node, size_t i, F &visit ) const
+	{
+		if ( !node )
+		{
+			return true;
+		}
+		if ( i == steps_.size() )
+		{
+			return visit( JsonView( node ) );
+		}
+		const Step &s = steps_[i];
+		switch( s.kind )
+		{
+			case Step::Member:
+				if ( cJSON_IsObject( node ) )
+				{
+					return walk( member( node, s.key ), i + 1, visit );
+				}
+				if ( cJSON_IsArray( node ) && s.index >= 0 )
+				{
+					return walk( element( node, s.index ), i + 1, visit );
+				}
+				return true;
+			case Step::Index:
+				return cJSON_IsArray( node ) ? walk( element( node, s.index ), i + 1, visit ) : true;
+			case Step::Wildcard:
+				if ( cJSON_IsObject( node ) || cJSON_IsArray( node ) )
+				{
+					for( const cJSON *c = node->child; c; c = c->next )
+					{
+						if ( !walk( c, i + 1, visit ) )
+						{
+							return false;
+						}
+					}
+				}
+				return true;
+			case Step::Slice:
+				return cJSON_IsArray( node ) ? slice( node, s, i, visit ) : true;
+		}
+		return true;
+	}
+
+	template<typename F>
+	bool slice( const cJSON *array, const Step &s, size_t i, F &visit ) const
+	{
+		long n = count( array );
+		auto bound = [n]( long v, long low, long high ) {
+			v = v < 0 ? v + n : v;
+			return v < low ? low : v > high ? high : v;
+		};
+		if ( s.step > 0 )
+		{
+			long start = s.has_start ? bound( s.start, 0, n ) : 0;
+			long end = s.has_end ? bound( s.end, 0, n ) : n;
+			long index = 0;
+			for( const cJSON *c = array->child; c && index < end; c = c->next, index++ )
+			{
+				if ( index >= start && ( index - start ) % s.step == 0 && !walk( c, i + 1, visit ) )
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+		long start = s.has_start ? bound( s.start, -1, n - 1 ) : n - 1;
+		long end = s.has_end ? bound( s.end, -1, n - 1 ) : -1;
+		// Backwards through prev, the first element's prev is the last one
+		long index = n - 1;
+		for( const cJSON *c = n ? array->child->prev : nullptr; index > end; c = c->prev, index-- )
+		{
+			if ( index <= start && ( start - index ) % -s.step == 0 && !walk( c, i + 1, visit ) )
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::vector<Step> steps_;
+};
@@ -0,0 +1,915 @@
+#pragma once
+
+#include "cjson.hpp"
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#define CJSON_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+
+/**
+ * Two-stage parser in the style of simdjson.
+ *
+ * Stage 1 classifies the input 64 bytes at a time with SIMD compares into
+ * bit masks: quotes, backslashes, whitespace, structural characters,
+ * control and non-ASCII bytes. Escaped quotes and string interiors are
+ * resolved with bit arithmetic, which gives the positions of every
+ * structural character, quote and scalar start outside of strings. Control
+ * characters inside strings and malformed UTF-8 are rejected here too.
+ *
+ * Stage 2 walks those positions and builds the cJSON tree, so the result is
+ * an ordinary Json. The grammar is strict RFC 8259. Positions and the
+ * nesting stack live in per-thread buffers reused by the next parse, and
+ * numbers whose digits and power of ten are exact doubles skip strtod.
+ *
+ * AVX2 or SSE2 is selected at run time, other targets use a scalar
+ * classifier with the same output.
+ */
+class JsonSimd
+{
+public:
+	enum Level {
+		Scalar,
+		SSE2,
+		AVX2
+	};
+
+	/**
+	 * Best level supported by the CPU
+	 */
+	static Level detect()
+	{
+#if CJSON_SIMD_X86
+		static const Level level = __builtin_cpu_supports( "avx2" ) ? AVX2 : SSE2;
+		return level;
+#else
+		return Scalar;
+#endif
+	}
+
+	/**
+	 * Parse text into object
+	 * @param json Json text, need not be NUL-terminated
+	 * @param size text length
+	 * @param jo result, Null on error
+	 * @param level code path, a level the CPU lacks falls back to a lower one
+	 * @return true if the text is a valid document
+	 */
+	static bool parse( const char *json, size_t size, Json &jo, Level level = detect() )
+	{
+		Buffers &b = buffers();
+		cJSON *root = nullptr;
+		bool ok = structurals( json, size, b.index, level ) && build( json, size, b, root );
+		b.release();
+		if ( ok )
+		{
+			jo = Json( root, true );
+			return true;
+		}
+		jo.clean();
+		return false;
+	}
+
+	static inline bool parse( const std::string &json, Json &jo, Level level = detect() )
+	{
+		return parse( json.data(), json.size(), jo, level );
+	}
+
+	/**
+	 * Stage 1 only
+	 * @param index positions of structural characters, all quotes and scalar starts
+	 * @return false on an unterminated string, a control character in a string or malformed UTF-8
+	 */
+	static bool structurals( const char *json, size_t size, std::vector<uint32_t> &index, Level level = detect() )
+	{
+		index.clear();
+		if ( size >= UINT32_MAX )
+		{
+			return false;
+		}
+		index.reserve( size / 4 + 8 );
+		Classify classify = classifier( level );
+		Scanner s;
+		size_t utf8_end = 0;   // bytes before this one are known to be valid UTF-8
+		size_t offset = 0;
+		for( ; offset + 64 <= size; offset += 64 )
+		{
+			Masks m;
+			classify( json + offset, m );
+			if ( !s.block( m, static_cast<uint32_t>( offset ), index ) ||
+				 ( m.high && !utf8_from( json, size, std::max( offset, utf8_end ), offset + 64, utf8_end ) ) )
+			{
+				return false;
+			}
+		}
+		if ( offset < size )
+		{
+			// Spaces are neutral for every mask
+			char tail[64];
+			memset( tail, ' ', sizeof( tail ) );
+			memcpy( tail, json + offset, size - offset );
+			Masks m;
+			classify( tail, m );
+			if ( !s.block( m, static_cast<uint32_t>( offset ), index ) ||
+				 ( m.high && !utf8_from( json, size, std::max( offset, utf8_end ), size, utf8_end ) ) )
+			{
+				return false;
+			}
+		}
+		return !s.in_string;
+	}
+
+	/**
+	 * UTF-8 check, ASCII runs are skipped 64 bytes at a time
+	 */
+	static bool validate_utf8( const char *text, size_t size, Level level = detect() )
+	{
+		Classify classify = classifier( level );
+		size_t utf8_end = 0;
+		size_t offset = 0;
+		for( ; offset + 64 <= size; offset += 64 )
+		{
+			Masks m;
+			classify( text + offset, m );
+			if ( m.high && !utf8_from( text, size, std::max( offset, utf8_end ), offset + 64, utf8_end ) )
+			{
+				return false;
+			}
+		}
+		return utf8_from( text, size, std::max( offset, utf8_end ), size, utf8_end );
+	}
+
+private:
+	/**
+	 * One bit per byte of a 64-byte block
+	 */
+	struct Masks
+	{
+		uint64_t quote;
+		uint64_t backslash;
+		uint64_t space;    // ' ', \t, \n, \r
+		uint64_t op;       // { } [ ] : ,
+		uint64_t control;  // below 0x20
+		uint64_t high;     // 0x80 and above
+	};
+
+	typedef void ( *Classify )( const char*, Masks& );
+
+	struct Frame
+	{
+		cJSON *node;
+		cJSON *tail;
+	};
+
+	/**
+	 * Stage 1 output and the stage 2 stack, reused by parses on the same thread
+	 */
+	struct Buffers
+	{
+		enum { Keep = 1 << 20 };    // entries kept between parses
+
+		std::vector<uint32_t> index;
+		std::vector<Frame> stack;
+
+		void release()
+		{
+			if ( index.capacity() > Keep )
+			{
+				std::vector<uint32_t>().swap( index );
+			}
+			stack.clear();
+		}
+	};
+
+	static Buffers& buffers()
+	{
+		static thread_local Buffers b;
+		return b;
+	}
+
+	/**
+	 * Carries string and escape state from block to block
+	 */
+	struct Scanner
+	{
+		uint64_t escaped_next = 0;  // 1 if the first byte of the next block is escaped
+		uint64_t in_string = 0;     // all ones if the next block starts inside a string
+		uint64_t scalar_prev = 0;   // 1 if the last byte of the previous block was part of a scalar
+
+		bool block( const Masks &m, uint32_t offset, std::vector<uint32_t> &index )
+		{
+			uint64_t escaped = find_escaped( m.backslash );
+			uint64_t quote = m.quote & ~escaped;
+			// Bits from an opening quote up to, not including, its closing quote
+			uint64_t string = prefix_xor( quote ) ^ in_string;
+			in_string = static_cast<uint64_t>( static_cast<int64_t>( string ) >> 63 );
+			if ( m.control & string )
+			{
+				return false;
+			}
+			uint64_t outside = ~string & ~quote;
+			uint64_t scalar = ~m.op & ~m.space & outside;
+			uint64_t scalar_start = scalar & ~( ( scalar << 1 ) | scalar_prev );
+			scalar_prev = scalar >> 63;
+			uint64_t bits = ( m.op & outside ) | quote | scalar_start;
+			while( bits )
+			{
+				index.push_back( offset + __builtin_ctzll( bits ) );
+				bits &= bits - 1;
+			}
+			return true;
+		}
+
+		// Bytes preceded by an odd number of backslashes
+		uint64_t find_escaped( uint64_t backslash )
+		{
+			if ( !backslash && !escaped_next )
+			{
+				return 0;
+			}
+			backslash &= ~escaped_next;
+			uint64_t follows_escape = ( backslash << 1 ) | escaped_next;
+			const uint64_t even = 0x5555555555555555ULL;
+			uint64_t odd_starts = backslash & ~even & ~follows_escape;
+			uint64_t even_starts;
+			escaped_next = __builtin_add_overflow( odd_starts, backslash, &even_starts ) ? 1 : 0;
+			uint64_t invert = even_starts << 1;
+			return ( even ^ invert ) & follows_escape;
+		}
+
+		static uint64_t prefix_xor( uint64_t x )
+		{
+			x ^= x << 1;
+			x ^= x << 2;
+			x ^= x << 4;
+			x ^= x << 8;
+			x ^= x << 16;
+			x ^= x << 32;
+			return x;
+		}
+	};
+
+	static Classify classifier( Level level )
+	{
+#if CJSON_SIMD_X86
+		if ( level >= AVX2 && detect() >= AVX2 )
+		{
+			return classify_avx2;
+		}
+		if ( level >= SSE2 )
+		{
+			return classify_sse2;
+		}
+#else
+		(void)level;
+#endif
+		return classify_scalar;
+	}
+
+	static void classify_scalar( const char *block, Masks &m )
+	{
+		m = Masks{ 0, 0, 0, 0, 0, 0 };
+		for( int i = 0; i < 64; i++ )
+		{
+			uint64_t bit = 1ULL << i;
+			unsigned char c = static_cast<unsigned char>( block[i] );
+			switch( c )
+			{
+				case '"':
+					m.quote |= bit;
+					break;
+				case '\\':
+					m.backslash |= bit;
+					break;
+				case ' ':
+					m.space |= bit;
+					break;
+				case '\t':
+				case '\n':
+				case '\r':
+					m.space |= bit;
+					m.control |= bit;
+					break;
+				case '{':
+				case '}':
+				case '[':
+				case ']':
+				case ':':
+				case ',':
+					m.op |= bit;
+					break;
+				default:
+					if ( c < 0x20 )
+					{
+						m.control |= bit;
+					}
+					else if ( c >= 0x80 )
+					{
+						m.high |= bit;
+					}
+					break;
+			}
+		}
+	}
+
+#if CJSON_SIMD_X86
+	static void classify_sse2( const char *block, Masks &m )
+	{
+		m = Masks{ 0, 0, 0, 0, 0, 0 };
+		for( int i = 0; i < 4; i++ )
+		{
+			__m128i x = _mm_loadu_si128( reinterpret_cast<const __m128i*>( block + 16 * i ) );
+			auto eq = [x]( char c ) {
+				return _mm_cmpeq_epi8( x, _mm_set1_epi8( c ) );
+			};
+			auto bits = [i]( __m128i v ) {
+				return static_cast<uint64_t>( static_cast<uint16_t>( _mm_movemask_epi8( v ) ) ) << ( 16 * i );
+			};
+			m.quote |= bits( eq( '"' ) );
+			m.backslash |= bits( eq( '\\' ) );
+			m.space |= bits( _mm_or_si128( _mm_or_si128( eq( ' ' ), eq( '\t' ) ), _mm_or_si128( eq( '\n' ), eq( '\r' ) ) ) );
+			m.op |= bits( _mm_or_si128( _mm_or_si128( _mm_or_si128( eq( '{' ), eq( '}' ) ), _mm_or_si128( eq( '[' ), eq( ']' ) ) ),
+										_mm_or_si128( eq( ':' ), eq( ',' ) ) ) );
+			// x <= 0x1f unsigned
+			m.control |= bits( _mm_cmpeq_epi8( _mm_max_epu8( x, _mm_set1_epi8( 0x1f ) ), _mm_set1_epi8( 0x1f ) ) );
+			m.high |= bits( x );
+		}
+	}
+
+	__attribute__(( target( "avx2" ) ))
+	static uint64_t mask_avx2( __m256i x, char c )
+	{
+		return static_cast<uint32_t>( _mm256_movemask_epi8( _mm256_cmpeq_epi8( x, _mm256_set1_epi8( c ) ) ) );
+	}
+
+	__attribute__(( target( "avx2" ) ))
+	static void classify_avx2( const char *block, Masks &m )
+	{
+		m = Masks{ 0, 0, 0, 0, 0, 0 };
+		for( int i = 0; i < 2; i++ )
+		{
+			__m256i x = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( block + 32 * i ) );
+			int shift = 32 * i;
+			m.quote |= mask_avx2( x, '"' ) << shift;
+			m.backslash |= mask_avx2( x, '\\' ) << shift;
+			m.space |= ( mask_avx2( x, ' ' ) | mask_avx2( x, '\t' ) | mask_avx2( x, '\n' ) | mask_avx2( x, '\r' ) ) << shift;
+			m.op |= ( mask_avx2( x, '{' ) | mask_avx2( x, '}' ) | mask_avx2( x, '[' ) | mask_avx2( x, ']' ) |
+					  mask_avx2( x, ':' ) | mask_avx2( x, ',' ) ) << shift;
+			// x <= 0x1f unsigned
+			__m256i low = _mm256_cmpeq_epi8( _mm256_max_epu8( x, _mm256_set1_epi8( 0x1f ) ), _mm256_set1_epi8( 0x1f ) );
+			m.control |= static_cast<uint64_t>( static_cast<uint32_t>( _mm256_movemask_epi8( low ) ) ) << shift;
+			m.high |= static_cast<uint64_t>( static_cast<uint32_t>( _mm256_movemask_epi8( x ) ) ) << shift;
+		}
+	}
+#endif
+
+	/**
+	 * Validate UTF-8 sequences starting in [from, to), a sequence may run past to
+	 * @param end set past the last validated byte
+	 */
+	static bool utf8_from( const char *text, size_t size, size_t from, size_t to, size_t &end )
+	{
+		const unsigned char *s = reinterpret_cast<const unsigned char*>( text );
+		size_t i = from;
+		while( i < to )
+		{
+			unsigned char c = s[i];
+			if ( c < 0x80 )
+			{
+				i++;
+				continue;
+			}
+			size_t n;
+			unsigned char lo = 0x80, hi = 0xBF;   // range of the second byte
+			if ( c >= 0xC2 && c <= 0xDF )
+			{
+				n = 2;
+			}
+			else if ( c >= 0xE0 && c <= 0xEF )
+			{
+				n = 3;
+				if ( c == 0xE0 )
+				{
+					lo = 0xA0;      // overlong
+				}
+				else if ( c == 0xED )
+				{
+					hi = 0x9F;      // surrogates
+				}
+			}
+			else if ( c >= 0xF0 && c <= 0xF4 )
+			{
+				n = 4;
+				if ( c == 0xF0 )
+				{
+					lo = 0x90;      // overlong
+				}
+				else if ( c == 0xF4 )
+				{
+					hi = 0x8F;      // above U+10FFFF
+				}
+			}
+			else
+			{
+				return false;
+			}
+			if ( i + n > size || s[i + 1] < lo || s[i + 1] > hi )
+			{
+				return false;
+			}
+			for( size_t k = 2; k < n; k++ )
+			{
+				if ( ( s[i + k] & 0xC0 ) != 0x80 )
+				{
+					return false;
+				}
+			}
+			i += n;
+		}
+		end = i;
+		return true;
+	}
+
+	/**
+	 * Stage 2, builds the tree out of the structural positions
+	 */
+	static bool build( const char *json, size_t size, Buffers &b, cJSON *&root )
+	{
+		const std::vector<uint32_t> &index = b.index;
+		std::vector<Frame> &stack = b.stack;
+		stack.clear();
+		size_t t = 0;
+		size_t n = index.size();
+		char *key = nullptr;
+		root = nullptr;
+
+		auto fail = [&]() {
+			cJSON_free( key );
+			cJSON_Delete( root );
+			root = nullptr;
+			return false;
+		};
+		// Link a new value into the current container
+		auto add = [&]( cJSON *item ) {
+			if ( stack.empty() )
+			{
+				root = item;
+				return;
+			}
+			Frame &f = stack.back();
+			if ( key )
+			{
+				item->string = key;
+				key = nullptr;
+			}
+			if ( f.tail )
+			{
+				f.tail->next = item;
+				item->prev = f.tail;
+			}
+			else
+			{
+				f.node->child = item;
+			}
+			f.tail = item;
+			f.node->child->prev = item;
+		};
+
+		enum { Value, ValueOrEnd, KeyOrEnd, KeyOnly, Colon, CommaOrEnd } state = Value;
+		while( t < n )
+		{
+			size_t pos = index[t];
+			char c = json[pos];
+			switch( state )
+			{
+				case Colon:
+					if ( c != ':' )
+					{
+						return fail();
+					}
+					state = Value;
+					t++;
+					continue;
+				case CommaOrEnd:
+					if ( c == ',' )
+					{
+						state = cJSON_IsObject( stack.back().node ) ? KeyOnly : Value;
+						t++;
+						continue;
+					}
+					if ( c == ( cJSON_IsObject( stack.back().node ) ? '}' : ']' ) )
+					{
+						stack.pop_back();
+						state = CommaOrEnd;
+						t++;
+						if ( stack.empty() )
+						{
+							return t == n ? true : fail();
+						}
+						continue;
+					}
+					return fail();
+				case KeyOrEnd:
+				case KeyOnly:
+					if ( c == '}' && state == KeyOrEnd )
+					{
+						stack.pop_back();
+						state = CommaOrEnd;
+						t++;
+						if ( stack.empty() )
+						{
+							return t == n ? true : fail();
+						}
+						continue;
+					}
+					if ( c != '"' || t + 1 >= n )
+					{
+						return fail();
+					}
+					key = unescape( json + pos + 1, json + index[t + 1] );
+					if ( !key )
+					{
+						return fail();
+					}
+					t += 2;
+					state = Colon;
+					continue;
+				case ValueOrEnd:
+					if ( c == ']' )
+					{
+						stack.pop_back();
+						state = CommaOrEnd;
+						t++;
+						if ( stack.empty() )
+						{
+							return t == n ? true : fail();
+						}
+						continue;
+					}
+					// fall through
+				case Value:
+					break;
+			}
+
+			// A value starts here
+			cJSON *item = nullptr;
+			switch( c )
+			{
+				case '{':
+				case '[':
+					if ( stack.size() >= CJSON_NESTING_LIMIT )
+					{
+						return fail();
+					}
+					item = node( c == '{' ? cJSON_Object : cJSON_Array );
+					if ( !item )
+					{
+						return fail();
+					}
+					add( item );
+					stack.push_back( Frame{ item, nullptr } );
+					state = c == '{' ? KeyOrEnd : ValueOrEnd;
+					t++;
+					continue;
+				case '"':
+				{
+					if ( t + 1 >= n )
+					{
+						return fail();
+					}
+					char *value = unescape( json + pos + 1, json + index[t + 1] );
+					item = value ? node( cJSON_String ) : nullptr;
+					if ( !item )
+					{
+						cJSON_free( value );
+						return fail();
+					}
+					item->valuestring = value;
+					t += 2;
+					break;
+				}
+				default:
+					item = scalar( json, size, pos );
+					if ( !item )
+					{
+						return fail();
+					}
+					t++;
+					break;
+			}
+			add( item );
+			if ( stack.empty() )
+			{
+				return t == n ? true : fail();
+			}
+			state = CommaOrEnd;
+		}
+		return fail();
+	}
+
+	static bool delimiter( const char *json, size_t size, size_t pos )
+	{
+		if ( pos == size )
+		{
+			return true;
+		}
+		switch( json[pos] )
+		{
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+			case ',':
+			case ':':
+			case ']':
+			case '}':
+			case '[':
+			case '{':
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	/**
+	 * Zeroed node, allocated like cJSON's own
+	 */
+	static cJSON* node( int type )
+	{
+		cJSON *item = static_cast<cJSON*>( cJSON_malloc( sizeof( cJSON ) ) );
+		if ( item )
+		{
+			memset( item, 0, sizeof( cJSON ) );
+			item->type = type;
+		}
+		return item;
+	}
+
+	static cJSON* number( double value )
+	{
+		cJSON *item = node( cJSON_Number );
+		if ( item )
+		{
+			item->valuedouble = value;
+			item->valueint = value >= INT_MAX ? INT_MAX : value <= static_cast<double>( INT_MIN ) ? INT_MIN : static_cast<int>( value );
+		}
+		return item;
+	}
+
+	/**
+	 * Literal or number at pos
+	 */
+	static cJSON* scalar( const char *json, size_t size, size_t pos )
+	{
+		const char *s = json + pos;
+		size_t left = size - pos;
+		switch( *s )
+		{
+			case 't':
+				return left >= 4 && !memcmp( s, "true", 4 ) && delimiter( json, size, pos + 4 ) ? node( cJSON_True ) : nullptr;
+			case 'f':
+				return left >= 5 && !memcmp( s, "false", 5 ) && delimiter( json, size, pos + 5 ) ? node( cJSON_False ) : nullptr;
+			case 'n':
+				return left >= 4 && !memcmp( s, "null", 4 ) && delimiter( json, size, pos + 4 ) ? node( cJSON_NULL ) : nullptr;
+		}
+		// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+		// Up to 19 significant digits are collected on the way for the fast path below
+		size_t i = 0;
+		uint64_t mantissa = 0;
+		int digits = 0;
+		int scale = 0;      // decimal exponent of the collected digits
+		auto run = [&]( bool fraction ) {
+			size_t start = i;
+			for( ; i < left && s[i] >= '0' && s[i] <= '9'; i++ )
+			{
+				if ( digits < 19 )
+				{
+					mantissa = mantissa * 10 + ( s[i] - '0' );
+					digits += mantissa ? 1 : 0;
+					scale -= fraction ? 1 : 0;
+				}
+				else
+				{
+					digits++;
+					scale += fraction ? 0 : 1;
+				}
+			}
+			return i > start;
+		};
+		bool negative = i < left && s[i] == '-';
+		i += negative ? 1 : 0;
+		if ( i < left && s[i] == '0' )
+		{
+			i++;
+		}
+		else if ( !run( false ) )
+		{
+			return nullptr;
+		}
+		if ( i < left && s[i] == '.' )
+		{
+			i++;
+			if ( !run( true ) )
+			{
+				return nullptr;
+			}
+		}
+		int exponent = 0;
+		if ( i < left && ( s[i] == 'e' || s[i] == 'E' ) )
+		{
+			i++;
+			bool minus = i < left && s[i] == '-';
+			i += i < left && ( s[i] == '+' || s[i] == '-' ) ? 1 : 0;
+			size_t start = i;
+			for( ; i < left && s[i] >= '0' && s[i] <= '9'; i++ )
+			{
+				exponent = exponent < 10000 ? exponent * 10 + ( s[i] - '0' ) : exponent;
+			}
+			if ( i == start )
+			{
+				return nullptr;
+			}
+			exponent = minus ? -exponent : exponent;
+		}
+		if ( !delimiter( json, size, pos + i ) )
+		{
+			return nullptr;
+		}
+		// Exact when the digits and the power of ten are both exact doubles:
+		// one IEEE multiplication or division rounds correctly, like strtod
+		static const double powers[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		int e = exponent + scale;
+		if ( digits <= 19 && mantissa <= ( 1ULL << 53 ) && e >= -22 && e <= 22 )
+		{
+			double value = static_cast<double>( mantissa );
+			value = e < 0 ? value / powers[-e] : value * powers[e];
+			return number( negative ? -value : value );
+		}
+		// Input need not be NUL-terminated
+		char local[64];
+		std::string big;
+		const char *text = local;
+		if ( i < sizeof( local ) )
+		{
+			memcpy( local, s, i );
+			local[i] = '\0';
+		}
+		else
+		{
+			big.assign( s, i );
+			text = big.c_str();
+		}
+		return number( strtod( text, nullptr ) );
+	}
+
+	static int hex4( const char *s )
+	{
+		int value = 0;
+		for( int i = 0; i < 4; i++ )
+		{
+			char c = s[i];
+			value <<= 4;
+			if ( c >= '0' && c <= '9' )
+			{
+				value |= c - '0';
+			}
+			else if ( c >= 'a' && c <= 'f' )
+			{
+				value |= c - 'a' + 10;
+			}
+			else if ( c >= 'A' && c <= 'F' )
+			{
+				value |= c - 'A' + 10;
+			}
+			else
+			{
+				return -1;
+			}
+		}
+		return value;
+	}
+
+	/**
+	 * Decode string body [begin, end) into cJSON memory, nullptr if an escape is malformed
+	 */
+	static char* unescape( const char *begin, const char *end )
+	{
+		char *out = static_cast<char*>( cJSON_malloc( end - begin + 1 ) );
+		if ( !out )
+		{
+			return nullptr;
+		}
+		char *o = out;
+		const char *s = begin;
+		if ( end - begin <= 16 )
+		{
+			// Keys and short values: a plain loop beats the memchr and memcpy calls
+			for( ; s < end && *s != '\\'; s++ )
+			{
+				*o++ = *s;
+			}
+		}
+		while( s < end )
+		{
+			const char *bs = static_cast<const char*>( memchr( s, '\\', end - s ) );
+			if ( !bs )
+			{
+				bs = end;
+			}
+			memcpy( o, s, bs - s );
+			o += bs - s;
+			s = bs;
+			if ( s == end )
+			{
+				break;
+			}
+			// Stage 1 guarantees a character after the backslash
+			char e = s[1];
+			s += 2;
+			switch( e )
+			{
+				case '"':
+				case '\\':
+				case '/':
+					*o++ = e;
+					break;
+				case 'b':
+					*o++ = '\b';
+					break;
+				case 'f':
+					*o++ = '\f';
+					break;
+				case 'n':
+					*o++ = '\n';
+					break;
+				case 'r':
+					*o++ = '\r';
+					break;
+				case 't':
+					*o++ = '\t';
+					break;
+				case 'u':
+				{
+					int cp = end - s >= 4 ? hex4( s ) : -1;
+					if ( cp < 0 || ( cp >= 0xDC00 && cp <= 0xDFFF ) )
+					{
+						cJSON_free( out );
+						return nullptr;
+					}
+					s += 4;
+					if ( cp >= 0xD800 && cp <= 0xDBFF )
+					{
+						int low = end - s >= 6 && s[0] == '\\' && s[1] == 'u' ? hex4( s + 2 ) : -1;
+						if ( low < 0xDC00 || low > 0xDFFF )
+						{
+							cJSON_free( out );
+							return nullptr;
+						}
+						s += 6;
+						cp = 0x10000 + ( ( ( cp & 0x3FF ) << 10 ) | ( low & 0x3FF ) );
+					}
+					// 6 or 12 input bytes give at most 4, there is room
+					if ( cp < 0x80 )
+					{
+						*o++ = static_cast<char>( cp );
+					}
+					else if ( cp < 0x800 )
+					{
+						*o++ = static_cast<char>( 0xC0 | ( cp >> 6 ) );
+						*o++ = static_cast<char>( 0x80 | ( cp & 0x3F ) );
+					}
+					else if ( cp < 0x10000 )
+					{
+						*o++ = static_cast<char>( 0xE0 | ( cp >> 12 ) );
+						*o++ = static_cast<char>( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+						*o++ = static_cast<char>( 0x80 | ( cp & 0x3F ) );
+					}
+					else
+					{
+						*o++ = static_cast<char>( 0xF0 | ( cp >> 18 ) );
+						*o++ = static_cast<char>( 0x80 | ( ( cp >> 12 ) & 0x3F ) );
+						*o++ = static_cast<char>( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+						*o++ = static_cast<char>( 0x80 | ( cp & 0x3F ) );
+					}
+					break;
+				}
+				default:
+					cJSON_free( out );
+					return nullptr;
+			}
+		}
+		*o = '\0';
+		return out;
+	}
+};
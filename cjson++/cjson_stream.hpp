@@ -0,0 +1,1365 @@
+#pragma once
+
+#include "cjson.hpp"
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <functional>
+
+
+/**
+ * Incremental JSON tokenizer.
+ *
+ * Input is given in chunks of any size, a token may span several chunks.
+ * next() returns one event at a time, NeedInput once the chunk is used up.
+ * Memory is the container stack plus the longest string or number, it does
+ * not depend on the size of the document. The grammar is RFC 8259: one value
+ * per document, nothing but whitespace after it.
+ */
+class JsonTokenizer
+{
+public:
+	enum Event {
+		NullValue,
+		BoolValue,
+		NumberValue,
+		StringValue,
+		Key,
+		StartObject,
+		EndObject,
+		StartArray,
+		EndArray,
+		NeedInput,  // give the next chunk or finish()
+		End,        // document is complete and input is finished
+		Error
+	};
+
+	explicit JsonTokenizer( size_t max_depth = CJSON_NESTING_LIMIT ) :
+		max_depth_( max_depth )
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		begin_ = p_ = end_ = nullptr;
+		eof_ = false;
+		state_ = ExpectValue;
+		stack_.clear();
+		text_.clear();
+		number_ = 0.0;
+		bool_ = false;
+		key_ = false;
+		code_ = digits_ = high_ = 0;
+		literal_ = "";
+		matched_ = 0;
+		literal_event_ = NullValue;
+		consumed_ = 0;
+	}
+
+	/**
+	 * Next chunk of input, the previous one must have been used up. The
+	 * memory has to stay valid until next() returns NeedInput.
+	 */
+	void input( const char *data, size_t size )
+	{
+		consumed_ += end_ - begin_;
+		begin_ = p_ = data;
+		end_ = data + size;
+	}
+
+	/**
+	 * There is no more input
+	 */
+	void finish()
+	{
+		eof_ = true;
+	}
+
+	Event next()
+	{
+		while( true )
+		{
+			if ( state_ == Failed )
+			{
+				return Error;
+			}
+			if ( p_ == end_ )
+			{
+				if ( !eof_ )
+				{
+					return NeedInput;
+				}
+				switch( state_ )
+				{
+					case InNumber:
+						return number_done();
+					case AfterRoot:
+						return End;
+					default:
+						// Truncated document
+						return fail();
+				}
+			}
+			const char c = *p_;
+			switch( state_ )
+			{
+				case InString:
+				{
+					const char *s = p_;
+					while( s < end_ && *s != '"' && *s != '\\' && static_cast<unsigned char>( *s ) >= 0x20 )
+					{
+						s++;
+					}
+					text_.append( p_, s );
+					p_ = s;
+					if ( s == end_ )
+					{
+						continue;
+					}
+					p_++;
+					if ( *s == '"' )
+					{
+						if ( key_ )
+						{
+							state_ = ExpectColon;
+							return Key;
+						}
+						return value_done( StringValue );
+					}
+					if ( *s == '\\' )
+					{
+						state_ = InEscape;
+						continue;
+					}
+					// Raw control character
+					return fail();
+				}
+				case InEscape:
+					p_++;
+					state_ = InString;
+					switch( c )
+					{
+						case '"':
+						case '\\':
+						case '/':
+							text_ += c;
+							break;
+						case 'b':
+							text_ += '\b';
+							break;
+						case 'f':
+							text_ += '\f';
+							break;
+						case 'n':
+							text_ += '\n';
+							break;
+						case 'r':
+							text_ += '\r';
+							break;
+						case 't':
+							text_ += '\t';
+							break;
+						case 'u':
+							state_ = InUnicode;
+							code_ = 0;
+							digits_ = 0;
+							break;
+						default:
+							return fail();
+					}
+					continue;
+				case InUnicode:
+				{
+					int digit = hex( c );
+					if ( digit < 0 )
+					{
+						return fail();
+					}
+					p_++;
+					code_ = ( code_ << 4 ) | digit;
+					if ( ++digits_ < 4 )
+					{
+						continue;
+					}
+					state_ = InString;
+					if ( high_ )
+					{
+						if ( code_ < 0xDC00 || code_ > 0xDFFF )
+						{
+							return fail();
+						}
+						utf8( 0x10000 + ( ( ( high_ & 0x3FF ) << 10 ) | ( code_ & 0x3FF ) ) );
+						high_ = 0;
+					}
+					else if ( code_ >= 0xD800 && code_ <= 0xDBFF )
+					{
+						// Low half must follow as another \u escape
+						high_ = code_;
+						state_ = InSurrogate;
+						digits_ = 0;
+					}
+					else if ( code_ >= 0xDC00 && code_ <= 0xDFFF )
+					{
+						return fail();
+					}
+					else
+					{
+						utf8( code_ );
+					}
+					continue;
+				}
+				case InSurrogate:
+					if ( c != ( digits_ == 0 ? '\\' : 'u' ) )
+					{
+						return fail();
+					}
+					p_++;
+					if ( ++digits_ == 2 )
+					{
+						state_ = InUnicode;
+						code_ = 0;
+						digits_ = 0;
+					}
+					continue;
+				case InNumber:
+					if ( ( c >= '0' && c <= '9' ) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E' )
+					{
+						text_ += c;
+						p_++;
+						continue;
+					}
+					return number_done();
+				case InLiteral:
+					if ( c != literal_[matched_] )
+					{
+						return fail();
+					}
+					p_++;
+					if ( literal_[++matched_] == '\0' )
+					{
+						return value_done( literal_event_ );
+					}
+					continue;
+				default:
+					break;
+			}
+
+			if ( c == ' ' || c == '\t' || c == '\n' || c == '\r' )
+			{
+				p_++;
+				continue;
+			}
+			switch( state_ )
+			{
+				case ExpectValueOrEnd:
+					if ( c == ']' )
+					{
+						p_++;
+						stack_.pop_back();
+						return value_done( EndArray );
+					}
+					return start_value( c );
+				case ExpectValue:
+					return start_value( c );
+				case ExpectKeyOrEnd:
+					if ( c == '}' )
+					{
+						p_++;
+						stack_.pop_back();
+						return value_done( EndObject );
+					}
+					// fall through
+				case ExpectKey:
+					if ( c != '"' )
+					{
+						return fail();
+					}
+					p_++;
+					start_string( true );
+					continue;
+				case ExpectColon:
+					if ( c != ':' )
+					{
+						return fail();
+					}
+					p_++;
+					state_ = ExpectValue;
+					continue;
+				case ExpectCommaOrEnd:
+					if ( c == ',' )
+					{
+						p_++;
+						state_ = stack_.back() == '{' ? ExpectKey : ExpectValue;
+						continue;
+					}
+					if ( c == stack_.back() + 2 )    // '[' + 2 == ']', '{' + 2 == '}'
+					{
+						p_++;
+						stack_.pop_back();
+						return value_done( c == '}' ? EndObject : EndArray );
+					}
+					return fail();
+				default:
+					// Anything but whitespace after the root value
+					return fail();
+			}
+		}
+	}
+
+	/**
+	 * Decoded string of StringValue and Key, NUL-terminated
+	 */
+	inline const std::string& text() const
+	{
+		return text_;
+	}
+
+	inline double number() const
+	{
+		return number_;
+	}
+
+	inline bool boolean() const
+	{
+		return bool_;
+	}
+
+	/**
+	 * Containers open after the last event
+	 */
+	inline size_t depth() const
+	{
+		return stack_.size();
+	}
+
+	/**
+	 * Input bytes used so far, points at the offending byte after an Error
+	 */
+	inline size_t offset() const
+	{
+		return consumed_ + ( p_ - begin_ );
+	}
+
+	/**
+	 * Root value is complete, only whitespace may follow
+	 */
+	inline bool complete() const
+	{
+		return state_ == AfterRoot;
+	}
+
+private:
+	enum State {
+		ExpectValue,
+		ExpectValueOrEnd,   // after [
+		ExpectKeyOrEnd,     // after {
+		ExpectKey,
+		ExpectColon,
+		ExpectCommaOrEnd,
+		AfterRoot,
+		InString,
+		InEscape,
+		InUnicode,
+		InSurrogate,        // \ and u of a low surrogate
+		InNumber,
+		InLiteral,
+		Failed
+	};
+
+	const char *begin_;         // current chunk
+	const char *p_;
+	const char *end_;
+	bool eof_;
+	State state_;
+	size_t max_depth_;
+	std::vector<char> stack_;   // '{' or '[' per open container
+	std::string text_;
+	double number_;
+	bool bool_;
+	bool key_;
+	unsigned code_;             // \u escape being read
+	unsigned digits_;
+	unsigned high_;             // pending high surrogate
+	const char *literal_;
+	size_t matched_;
+	Event literal_event_;
+	size_t consumed_;           // bytes in earlier chunks
+
+	Event fail()
+	{
+		state_ = Failed;
+		return Error;
+	}
+
+	Event value_done( Event e )
+	{
+		state_ = stack_.empty() ? AfterRoot : ExpectCommaOrEnd;
+		return e;
+	}
+
+	void start_string( bool key )
+	{
+		key_ = key;
+		high_ = 0;
+		text_.clear();
+		state_ = InString;
+	}
+
+	Event start_value( char c )
+	{
+		switch( c )
+		{
+			case '{':
+			case '[':
+				if ( stack_.size() >= max_depth_ )
+				{
+					return fail();
+				}
+				p_++;
+				stack_.push_back( c );
+				state_ = c == '{' ? ExpectKeyOrEnd : ExpectValueOrEnd;
+				return c == '{' ? StartObject : StartArray;
+			case '"':
+				p_++;
+				start_string( false );
+				return next();
+			case 't':
+				bool_ = true;
+				return start_literal( "true", BoolValue );
+			case 'f':
+				bool_ = false;
+				return start_literal( "false", BoolValue );
+			case 'n':
+				return start_literal( "null", NullValue );
+			default:
+				if ( c == '-' || ( c >= '0' && c <= '9' ) )
+				{
+					text_.clear();
+					state_ = InNumber;
+					return next();
+				}
+				return fail();
+		}
+	}
+
+	Event start_literal( const char *literal, Event e )
+	{
+		literal_ = literal;
+		matched_ = 0;
+		literal_event_ = e;
+		state_ = InLiteral;
+		return next();
+	}
+
+	Event number_done()
+	{
+		if ( !valid_number( text_ ) )
+		{
+			return fail();
+		}
+		number_ = strtod( text_.c_str(), nullptr );
+		return value_done( NumberValue );
+	}
+
+	// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+	static bool valid_number( const std::string &s )
+	{
+		size_t i = 0, n = s.size();
+		auto digits = [&]() {
+			size_t start = i;
+			while( i < n && s[i] >= '0' && s[i] <= '9' )
+			{
+				i++;
+			}
+			return i > start;
+		};
+		if ( i < n && s[i] == '-' )
+		{
+			i++;
+		}
+		if ( i < n && s[i] == '0' )
+		{
+			i++;
+		}
+		else if ( !digits() )
+		{
+			return false;
+		}
+		if ( i < n && s[i] == '.' )
+		{
+			i++;
+			if ( !digits() )
+			{
+				return false;
+			}
+		}
+		if ( i < n && ( s[i] == 'e' || s[i] == 'E' ) )
+		{
+			i++;
+			if ( i < n && ( s[i] == '+' || s[i] == '-' ) )
+			{
+				i++;
+			}
+			if ( !digits() )
+			{
+				return false;
+			}
+		}
+		return i == n;
+	}
+
+	static int hex( char c )
+	{
+		if ( c >= '0' && c <= '9' )
+		{
+			return c - '0';
+		}
+		if ( c >= 'a' && c <= 'f' )
+		{
+			return c - 'a' + 10;
+		}
+		if ( c >= 'A' && c <= 'F' )
+		{
+			return c - 'A' + 10;
+		}
+		return -1;
+	}
+
+	void utf8( unsigned cp )
+	{
+		if ( cp < 0x80 )
+		{
+			text_ += static_cast<char>( cp );
+		}
+		else if ( cp < 0x800 )
+		{
+			text_ += static_cast<char>( 0xC0 | ( cp >> 6 ) );
+			text_ += static_cast<char>( 0x80 | ( cp & 0x3F ) );
+		}
+		else if ( cp < 0x10000 )
+		{
+			text_ += static_cast<char>( 0xE0 | ( cp >> 12 ) );
+			text_ += static_cast<char>( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+			text_ += static_cast<char>( 0x80 | ( cp & 0x3F ) );
+		}
+		else
+		{
+			text_ += static_cast<char>( 0xF0 | ( cp >> 18 ) );
+			text_ += static_cast<char>( 0x80 | ( ( cp >> 12 ) & 0x3F ) );
+			text_ += static_cast<char>( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+			text_ += static_cast<char>( 0x80 | ( cp & 0x3F ) );
+		}
+	}
+};
+
+/**
+ * Receives JsonReader events, every callback returns false to stop parsing.
+ * Strings and keys are decoded and NUL-terminated, they are valid during the
+ * call only.
+ */
+class JsonHandler
+{
+public:
+	virtual ~JsonHandler()
+	{}
+
+	virtual bool null_value()
+	{
+		return true;
+	}
+	virtual bool bool_value( bool )
+	{
+		return true;
+	}
+	virtual bool number( double )
+	{
+		return true;
+	}
+	virtual bool string( const char*, size_t )
+	{
+		return true;
+	}
+	virtual bool key( const char*, size_t )
+	{
+		return true;
+	}
+	virtual bool start_object()
+	{
+		return true;
+	}
+	virtual bool end_object()
+	{
+		return true;
+	}
+	virtual bool start_array()
+	{
+		return true;
+	}
+	virtual bool end_array()
+	{
+		return true;
+	}
+
+	/**
+	 * Deliver event of a tokenizer
+	 */
+	bool dispatch( const JsonTokenizer &t, JsonTokenizer::Event e )
+	{
+		switch( e )
+		{
+			case JsonTokenizer::NullValue:
+				return null_value();
+			case JsonTokenizer::BoolValue:
+				return bool_value( t.boolean() );
+			case JsonTokenizer::NumberValue:
+				return number( t.number() );
+			case JsonTokenizer::StringValue:
+				return string( t.text().c_str(), t.text().size() );
+			case JsonTokenizer::Key:
+				return key( t.text().c_str(), t.text().size() );
+			case JsonTokenizer::StartObject:
+				return start_object();
+			case JsonTokenizer::EndObject:
+				return end_object();
+			case JsonTokenizer::StartArray:
+				return start_array();
+			case JsonTokenizer::EndArray:
+				return end_array();
+			default:
+				return false;
+		}
+	}
+};
+
+/**
+ * Handler which builds a Json tree out of the events
+ */
+class JsonBuilder : public JsonHandler
+{
+public:
+	JsonBuilder() :
+		root_( nullptr )
+	{}
+
+	~JsonBuilder()
+	{
+		cJSON_Delete( root_ );
+	}
+
+	JsonBuilder( const JsonBuilder& ) = delete;
+	JsonBuilder& operator=( const JsonBuilder& ) = delete;
+
+	bool null_value()
+	{
+		return add( cJSON_CreateNull() );
+	}
+	bool bool_value( bool value )
+	{
+		return add( cJSON_CreateBool( value ) );
+	}
+	bool number( double value )
+	{
+		return add( cJSON_CreateNumber( value ) );
+	}
+	bool string( const char *value, size_t )
+	{
+		return add( cJSON_CreateString( value ) );
+	}
+	bool key( const char *key, size_t size )
+	{
+		key_.assign( key, size );
+		return true;
+	}
+	bool start_object()
+	{
+		cJSON *item = cJSON_CreateObject();
+		if ( !add( item ) )
+		{
+			return false;
+		}
+		stack_.push_back( item );
+		return true;
+	}
+	bool end_object()
+	{
+		if ( stack_.empty() )
+		{
+			return false;
+		}
+		stack_.pop_back();
+		return true;
+	}
+	bool start_array()
+	{
+		cJSON *item = cJSON_CreateArray();
+		if ( !add( item ) )
+		{
+			return false;
+		}
+		stack_.push_back( item );
+		return true;
+	}
+	bool end_array()
+	{
+		if ( stack_.empty() )
+		{
+			return false;
+		}
+		stack_.pop_back();
+		return true;
+	}
+
+	/**
+	 * A whole value has been built
+	 */
+	inline bool complete() const
+	{
+		return root_ && stack_.empty();
+	}
+
+	/**
+	 * Hand the value over, the builder is empty afterwards
+	 */
+	Json take()
+	{
+		cJSON *root = root_;
+		root_ = nullptr;
+		stack_.clear();
+		return root ? Json( root, true ) : Json();
+	}
+
+private:
+	cJSON *root_;
+	std::vector<cJSON*> stack_;
+	std::string key_;
+
+	bool add( cJSON *item )
+	{
+		if ( !item )
+		{
+			return false;
+		}
+		if ( stack_.empty() )
+		{
+			if ( root_ )
+			{
+				cJSON_Delete( item );
+				return false;
+			}
+			root_ = item;
+			return true;
+		}
+		cJSON *parent = stack_.back();
+		if ( cJSON_IsObject( parent ) )
+		{
+			return cJSON_AddItemToObject( parent, key_.c_str(), item );
+		}
+		return cJSON_AddItemToArray( parent, item );
+	}
+};
+
+/**
+ * Push parser, input is fed as it arrives, e.g. from a socket
+ */
+class JsonReader
+{
+public:
+	explicit JsonReader( JsonHandler &handler, size_t max_depth = CJSON_NESTING_LIMIT ) :
+		handler_( handler ),
+		tokenizer_( max_depth ),
+		failed_( false )
+	{}
+
+	/**
+	 * Parse next chunk, events are delivered before return
+	 * @return false on syntax error or if the handler stopped
+	 */
+	bool feed( const char *data, size_t size )
+	{
+		if ( failed_ )
+		{
+			return false;
+		}
+		tokenizer_.input( data, size );
+		return drain();
+	}
+
+	inline bool feed( const std::string &data )
+	{
+		return feed( data.data(), data.size() );
+	}
+
+	/**
+	 * End of input
+	 * @return true if a complete document has been read
+	 */
+	bool finish()
+	{
+		if ( failed_ )
+		{
+			return false;
+		}
+		tokenizer_.finish();
+		return drain();
+	}
+
+	inline bool failed() const
+	{
+		return failed_;
+	}
+
+	/**
+	 * Input bytes used so far
+	 */
+	inline size_t offset() const
+	{
+		return tokenizer_.offset();
+	}
+
+private:
+	JsonHandler &handler_;
+	JsonTokenizer tokenizer_;
+	bool failed_;
+
+	bool drain()
+	{
+		while( true )
+		{
+			JsonTokenizer::Event e = tokenizer_.next();
+			if ( e == JsonTokenizer::NeedInput || e == JsonTokenizer::End )
+			{
+				return true;
+			}
+			if ( e == JsonTokenizer::Error || !handler_.dispatch( tokenizer_, e ) )
+			{
+				failed_ = true;
+				return false;
+			}
+		}
+	}
+};
+
+/**
+ * Pull parser over a chunked source.
+ *
+ * next() walks the document event by event, read() turns the value which
+ * has just started into a Json, skip() steps over it. Only the values which
+ * are read are ever held in memory.
+ */
+class JsonPullParser
+{
+public:
+	/**
+	 * Fills the buffer, returns bytes written, 0 at the end of input
+	 */
+	typedef std::function<size_t( char *buffer, size_t size )> Source;
+
+	explicit JsonPullParser( Source source, size_t buffer = 64 * 1024, size_t max_depth = CJSON_NESTING_LIMIT ) :
+		source_( source ),
+		buffer_( buffer ? buffer : 1 ),
+		tokenizer_( max_depth ),
+		last_( JsonTokenizer::NeedInput )
+	{}
+
+	static Source file( FILE *f )
+	{
+		return [f]( char *buffer, size_t size ) {
+			return fread( buffer, 1, size, f );
+		};
+	}
+
+	JsonTokenizer::Event next()
+	{
+		while( true )
+		{
+			JsonTokenizer::Event e = tokenizer_.next();
+			if ( e != JsonTokenizer::NeedInput )
+			{
+				last_ = e;
+				return e;
+			}
+			size_t n = source_( &buffer_[0], buffer_.size() );
+			if ( n )
+			{
+				tokenizer_.input( &buffer_[0], n );
+			}
+			else
+			{
+				tokenizer_.finish();
+			}
+		}
+	}
+
+	/**
+	 * Event returned by the last next()
+	 */
+	inline JsonTokenizer::Event event() const
+	{
+		return last_;
+	}
+
+	inline const std::string& text() const
+	{
+		return tokenizer_.text();
+	}
+
+	inline double number() const
+	{
+		return tokenizer_.number();
+	}
+
+	inline bool boolean() const
+	{
+		return tokenizer_.boolean();
+	}
+
+	inline size_t depth() const
+	{
+		return tokenizer_.depth();
+	}
+
+	/**
+	 * Materialize the value whose first event was just returned, after a
+	 * Key the value of that key
+	 * @return false on error or if there is no value here
+	 */
+	bool read( Json &out )
+	{
+		if ( last_ == JsonTokenizer::Key )
+		{
+			next();
+		}
+		JsonBuilder builder;
+		if ( !builder.dispatch( tokenizer_, last_ ) )
+		{
+			return false;
+		}
+		while( !builder.complete() )
+		{
+			if ( !builder.dispatch( tokenizer_, next() ) )
+			{
+				return false;
+			}
+		}
+		out = builder.take();
+		return true;
+	}
+
+	/**
+	 * Step over the value whose first event was just returned, after a Key
+	 * the value of that key
+	 */
+	bool skip()
+	{
+		if ( last_ == JsonTokenizer::Key )
+		{
+			next();
+		}
+		size_t level = 0;
+		JsonTokenizer::Event e = last_;
+		while( true )
+		{
+			switch( e )
+			{
+				case JsonTokenizer::StartObject:
+				case JsonTokenizer::StartArray:
+					level++;
+					break;
+				case JsonTokenizer::EndObject:
+				case JsonTokenizer::EndArray:
+					if ( level == 0 )
+					{
+						return false;
+					}
+					level--;
+					break;
+				case JsonTokenizer::Key:
+					break;
+				case JsonTokenizer::NullValue:
+				case JsonTokenizer::BoolValue:
+				case JsonTokenizer::NumberValue:
+				case JsonTokenizer::StringValue:
+					break;
+				default:
+					return false;
+			}
+			if ( level == 0 )
+			{
+				return true;
+			}
+			e = next();
+		}
+	}
+
+private:
+	Source source_;
+	std::vector<char> buffer_;
+	JsonTokenizer tokenizer_;
+	JsonTokenizer::Event last_;
+};
+
+/**
+ * Chunked serializer for writev().
+ *
+ * next() fills the next part of the unformatted document, byte for byte what
+ * build() gives. The iovec form writes punctuation and short values into an
+ * internal buffer and points long strings which need no escaping straight
+ * at the document, so nothing is copied for them. Output stays valid until
+ * the following next(); the document must not change while it is written.
+ */
+class JsonWriter
+{
+public:
+	explicit JsonWriter( JsonView root, size_t buffer = 16 * 1024 ) :
+		buffer_( std::max<size_t>( buffer, Reserve ) )
+	{
+		reset( root );
+	}
+
+	void reset( JsonView root )
+	{
+		stack_.clear();
+		node_ = root.node();
+		step_ = node_ ? Value : Done;
+		string_ = nullptr;
+		raw_ = false;
+	}
+
+	inline bool done() const
+	{
+		return step_ == Done && !string_;
+	}
+
+	/**
+	 * Copy the next part into a caller buffer of at least 32 bytes
+	 * @return bytes written, 0 when the document is complete
+	 */
+	size_t next( char *out, size_t size )
+	{
+		if ( size < Reserve )
+		{
+			return 0;
+		}
+		out_ = out;
+		size_ = size;
+		used_ = 0;
+		iov_ = nullptr;
+		fill();
+		return used_;
+	}
+
+	/**
+	 * Describe the next part as iovecs for writev()
+	 * @return vectors used, 0 when the document is complete
+	 */
+	int next( struct iovec *iov, int count )
+	{
+		if ( count < 1 )
+		{
+			return 0;
+		}
+		out_ = &buffer_[0];
+		size_ = buffer_.size();
+		used_ = 0;
+		iov_ = iov;
+		iov_count_ = count;
+		iov_used_ = 0;
+		segment_ = 0;
+		fill();
+		flush();
+		return iov_used_;
+	}
+
+private:
+	enum Step {
+		Comma,
+		Key,
+		Colon,
+		Value,
+		Close,
+		Done
+	};
+
+	enum {
+		Reserve = 32,    // largest fixed token (a number) and the smallest useful buffer
+		ZeroCopy = 256   // shorter strings are copied, a vector costs about as much as the copy
+	};
+
+	inline size_t room() const
+	{
+		return size_ - used_;
+	}
+
+	inline void put( char c )
+	{
+		out_[used_++] = c;
+	}
+
+	inline void put( const char *s, size_t n )
+	{
+		memcpy( out_ + used_, s, n );
+		used_ += n;
+	}
+
+	/**
+	 * Close the buffered segment as a vector
+	 */
+	void flush()
+	{
+		if ( iov_ && used_ > segment_ )
+		{
+			iov_[iov_used_].iov_base = out_ + segment_;
+			iov_[iov_used_].iov_len = used_ - segment_;
+			iov_used_++;
+			segment_ = used_;
+		}
+	}
+
+	void fill()
+	{
+		while( true )
+		{
+			if ( string_ && !string() )
+			{
+				return;
+			}
+			if ( step_ == Done || room() < Reserve )
+			{
+				return;
+			}
+			const cJSON *parent = stack_.empty() ? nullptr : stack_.back();
+			switch( step_ )
+			{
+				case Comma:
+					if ( node_ != parent->child )
+					{
+						put( ',' );
+					}
+					step_ = cJSON_IsObject( parent ) ? Key : Value;
+					break;
+				case Key:
+					begin_string( node_->string );
+					step_ = Colon;
+					break;
+				case Colon:
+					put( ':' );
+					step_ = Value;
+					break;
+				case Value:
+					value();
+					break;
+				case Close:
+					put( cJSON_IsObject( parent ) ? '}' : ']' );
+					node_ = parent;
+					stack_.pop_back();
+					after_value();
+					break;
+				case Done:
+					return;
+			}
+		}
+	}
+
+	void value()
+	{
+		switch( node_->type & 0xFF )
+		{
+			case cJSON_Object:
+			case cJSON_Array:
+				put( cJSON_IsObject( node_ ) ? '{' : '[' );
+				if ( node_->child )
+				{
+					stack_.push_back( node_ );
+					node_ = node_->child;
+					step_ = Comma;
+					return;
+				}
+				put( cJSON_IsObject( node_ ) ? '}' : ']' );
+				break;
+			case cJSON_String:
+				begin_string( node_->valuestring );
+				break;
+			case cJSON_Raw:
+				string_ = node_->valuestring ? node_->valuestring : "";
+				raw_ = true;
+				break;
+			case cJSON_Number:
+				number( node_ );
+				break;
+			case cJSON_True:
+				put( "true", 4 );
+				break;
+			case cJSON_False:
+				put( "false", 5 );
+				break;
+			default:
+				put( "null", 4 );
+				break;
+		}
+		after_value();
+	}
+
+	void after_value()
+	{
+		if ( stack_.empty() )
+		{
+			step_ = Done;
+		}
+		else if ( node_->next )
+		{
+			node_ = node_->next;
+			step_ = Comma;
+		}
+		else
+		{
+			step_ = Close;
+		}
+	}
+
+	void begin_string( const char *s )
+	{
+		put( '"' );
+		string_ = s ? s : "";
+		raw_ = false;
+		if ( iov_ && iov_count_ - iov_used_ >= 3 )
+		{
+			size_t n = plain( string_ );
+			if ( n >= ZeroCopy && !string_[n] )
+			{
+				flush();
+				iov_[iov_used_].iov_base = const_cast<char*>( string_ );
+				iov_[iov_used_].iov_len = n;
+				iov_used_++;
+				string_ += n;
+			}
+		}
+	}
+
+	/**
+	 * Length of the prefix which is written as is
+	 */
+	static size_t plain( const char *s )
+	{
+		const unsigned char *c = reinterpret_cast<const unsigned char*>( s );
+		while( *c >= 32 && *c != '"' && *c != '\\' )
+		{
+			c++;
+		}
+		return c - reinterpret_cast<const unsigned char*>( s );
+	}
+
+	/**
+	 * Continue the pending string
+	 * @return false if the buffer is full
+	 */
+	bool string()
+	{
+		while( true )
+		{
+			if ( raw_ )
+			{
+				size_t n = std::min( strlen( string_ ), room() );
+				put( string_, n );
+				string_ += n;
+				if ( *string_ )
+				{
+					return false;
+				}
+				string_ = nullptr;
+				return true;
+			}
+			size_t n = std::min( plain( string_ ), room() );
+			put( string_, n );
+			string_ += n;
+			// An escape and the closing quote
+			if ( room() < 7 )
+			{
+				return false;
+			}
+			unsigned char c = *string_;
+			if ( !c )
+			{
+				put( '"' );
+				string_ = nullptr;
+				return true;
+			}
+			string_++;
+			put( '\\' );
+			switch( c )
+			{
+				case '"':
+				case '\\':
+					put( c );
+					break;
+				case '\b':
+					put( 'b' );
+					break;
+				case '\f':
+					put( 'f' );
+					break;
+				case '\n':
+					put( 'n' );
+					break;
+				case '\r':
+					put( 'r' );
+					break;
+				case '\t':
+					put( 't' );
+					break;
+				default:
+					used_ += snprintf( out_ + used_, room(), "u%04x", c );
+					break;
+			}
+		}
+	}
+
+	/**
+	 * Same text as cJSON print_number
+	 */
+	void number( const cJSON *item )
+	{
+		double d = item->valuedouble;
+		char text[Reserve];
+		int length;
+		if ( std::isnan( d ) || std::isinf( d ) )
+		{
+			length = snprintf( text, sizeof( text ), "null" );
+		}
+		else if ( d == static_cast<double>( item->valueint ) )
+		{
+			length = snprintf( text, sizeof( text ), "%d", item->valueint );
+		}
+		else
+		{
+			length = snprintf( text, sizeof( text ), "%1.15g", d );
+			double test = strtod( text, nullptr );
+			double max = std::max( std::fabs( test ), std::fabs( d ) );
+			if ( !( std::fabs( test - d ) <= max * DBL_EPSILON ) )
+			{
+				length = snprintf( text, sizeof( text ), "%1.17g", d );
+			}
+		}
+		put( text, static_cast<size_t>( length ) );
+	}
+
+	std::vector<char> buffer_;
+	std::vector<const cJSON*> stack_;   // open containers
+	const cJSON *node_;
+	Step step_;
+	const char *string_;                // rest of the string being written
+	bool raw_;                          // string_ is written without quotes and escapes
+
+	char *out_;
+	size_t size_;
+	size_t used_;
+	struct iovec *iov_;
+	int iov_count_;
+	int iov_used_;
+	size_t segment_;                    // start of the buffered bytes not in a vector yet
+};
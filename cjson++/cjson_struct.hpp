@@ -0,0 +1,459 @@
+#pragma once
+
+#include "cjson.hpp"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+
+/**
+ * Key of a mapped field, the hash is a constant expression
+ */
+struct JsonKey
+{
+	// FNV-1a
+	static constexpr uint32_t hash( const char *s, uint32_t h = 2166136261u )
+	{
+		return *s ? hash( s + 1, ( h ^ static_cast<uint8_t>( *s ) ) * 16777619u ) : h;
+	}
+
+	constexpr JsonKey( const char *name ) :
+		name( name ),
+		digest( hash( name ) )
+	{}
+
+	const char *name;
+	uint32_t digest;
+};
+
+/**
+ * One struct member and its key
+ */
+template<class T, class M>
+struct JsonField
+{
+	constexpr JsonField( const char *key, M T::*member ) :
+		key( key ),
+		member( member )
+	{}
+
+	JsonKey key;
+	M T::*member;
+};
+
+template<class T, class M>
+constexpr JsonField<T, M> json_field( const char *key, M T::*member )
+{
+	return JsonField<T, M>( key, member );
+}
+
+/**
+ * Field list of a struct, specialized with CJSON_MAPPING
+ */
+template<class T>
+struct JsonMapping;
+
+/**
+ * Declare the mapped fields of a struct, at namespace scope:
+ *
+ *     CJSON_MAPPING( Point, CJSON_FIELD( x ), CJSON_FIELD( y ), CJSON_FIELD_AS( "label", name ) )
+ */
+#define CJSON_MAPPING( type, ... ) \
+	template<> \
+	struct JsonMapping<type> \
+	{ \
+		typedef type Self; \
+		static auto fields() -> const decltype( std::make_tuple( __VA_ARGS__ ) )& \
+		{ \
+			static const auto f = std::make_tuple( __VA_ARGS__ ); \
+			return f; \
+		} \
+	}
+
+#define CJSON_FIELD( member ) json_field( #member, &Self::member )
+#define CJSON_FIELD_AS( key, member ) json_field( key, &Self::member )
+
+/**
+ * Value conversion of a field type, specialize for own types
+ */
+template<class M, class Enable = void>
+struct JsonCodec;
+
+/**
+ * Serialize and deserialize structs declared with CJSON_MAPPING.
+ *
+ * Fields may be bool, arithmetic types, std::string, Json, std::vector of
+ * those and other mapped structs. Conversion works on cJSON nodes directly;
+ * deserialization walks the object once in field order and matches keys by
+ * their precomputed hash, falling back to an open-addressed table of the children
+ * when the document is in another order.
+ */
+class JsonStruct
+{
+public:
+	template<class T>
+	static Json serialize( const T &value )
+	{
+		cJSON *node = JsonCodec<T>::encode( value );
+		return node ? Json( node, true ) : Json();
+	}
+
+	/**
+	 * Fill a struct, missing keys leave fields untouched, unknown keys are ignored
+	 * @return false if the document or a field has the wrong type, or a number does not fit its field
+	 */
+	template<class T>
+	static bool deserialize( JsonView json, T &value )
+	{
+		return json.valid() && JsonCodec<T>::decode( json.node(), value );
+	}
+
+	template<class T>
+	static cJSON* encode( const T &value )
+	{
+		cJSON *object = cJSON_CreateObject();
+		if ( object && !encode_fields<0>( value, object, nullptr, JsonMapping<T>::fields() ) )
+		{
+			cJSON_Delete( object );
+			return nullptr;
+		}
+		return object;
+	}
+
+	template<class T>
+	static bool decode( const cJSON *object, T &value )
+	{
+		if ( !cJSON_IsObject( object ) )
+		{
+			return false;
+		}
+		Lookup lookup( object->child );
+		return decode_fields<0>( lookup, value, JsonMapping<T>::fields() );
+	}
+
+	/**
+	 * Append to array or object in O(1), the first child keeps the last one in prev
+	 */
+	static void append( cJSON *parent, cJSON *item )
+	{
+		if ( parent->child )
+		{
+			cJSON *last = parent->child->prev;
+			last->next = item;
+			item->prev = last;
+		}
+		else
+		{
+			parent->child = item;
+		}
+		parent->child->prev = item;
+	}
+
+private:
+	/**
+	 * Finds children by key during one decode
+	 */
+	class Lookup
+	{
+	public:
+		explicit Lookup( const cJSON *first ) :
+			first_( first ),
+			cursor_( first ),
+			mask_( 0 ),
+			built_( false )
+		{}
+
+		const cJSON* find( const JsonKey &key )
+		{
+			// Documents are usually written in field order, past a miss the table
+			// is used so that the first of duplicate keys wins
+			if ( !built_ && cursor_ && cursor_->string && !strcmp( cursor_->string, key.name ) )
+			{
+				const cJSON *found = cursor_;
+				cursor_ = cursor_->next;
+				return found;
+			}
+			if ( !built_ )
+			{
+				build();
+			}
+			const Entry *slots = table_.empty() ? local_ : &table_[0];
+			for( size_t i = key.digest & mask_; slots[i].node; i = ( i + 1 ) & mask_ )
+			{
+				if ( matches( slots[i].node, key, slots[i].hash ) )
+				{
+					return slots[i].node;
+				}
+			}
+			return nullptr;
+		}
+
+	private:
+		struct Entry
+		{
+			uint32_t hash;
+			const cJSON *node;
+		};
+
+		static bool matches( const cJSON *node, const JsonKey &key, uint32_t hash )
+		{
+			return hash == key.digest && !strcmp( node->string, key.name );
+		}
+
+		/**
+		 * Open-addressed table of the children by key hash, at most half full.
+		 * Children are inserted in order, so the first of duplicate keys is found first.
+		 */
+		void build()
+		{
+			built_ = true;
+			size_t n = 0;
+			for( const cJSON *c = first_; c; c = c->next )
+			{
+				n += c->string ? 1 : 0;
+			}
+			size_t size = Local;
+			while( size < 2 * n )
+			{
+				size *= 2;
+			}
+			Entry *slots = local_;
+			if ( size > Local )
+			{
+				table_.resize( size, Entry{ 0, nullptr } );
+				slots = &table_[0];
+			}
+			else
+			{
+				std::fill( local_, local_ + Local, Entry{ 0, nullptr } );
+			}
+			mask_ = size - 1;
+			for( const cJSON *c = first_; c; c = c->next )
+			{
+				if ( c->string )
+				{
+					uint32_t hash = JsonKey::hash( c->string );
+					size_t i = hash & mask_;
+					while( slots[i].node )
+					{
+						i = ( i + 1 ) & mask_;
+					}
+					slots[i] = Entry{ hash, c };
+				}
+			}
+		}
+
+		enum { Local = 32 };
+
+		const cJSON *first_;
+		const cJSON *cursor_;
+		Entry local_[Local];
+		std::vector<Entry> table_;
+		size_t mask_;
+		bool built_;
+	};
+
+	template<size_t I, class T, class Fields>
+	static typename std::enable_if<I == std::tuple_size<Fields>::value, bool>::type
+	encode_fields( const T&, cJSON*, cJSON*, const Fields& )
+	{
+		return true;
+	}
+
+	template<size_t I, class T, class Fields>
+	static typename std::enable_if<I < std::tuple_size<Fields>::value, bool>::type
+	encode_fields( const T &value, cJSON *object, cJSON *last, const Fields &fields )
+	{
+		const auto &field = std::get<I>( fields );
+		typedef typename std::decay<decltype( value.*field.member )>::type Member;
+		cJSON *item = JsonCodec<Member>::encode( value.*field.member );
+		if ( !item )
+		{
+			return false;
+		}
+		item->string = const_cast<char*>( field.key.name );
+		item->type |= cJSON_StringIsConst;
+		if ( last )
+		{
+			last->next = item;
+			item->prev = last;
+		}
+		else
+		{
+			object->child = item;
+		}
+		object->child->prev = item;
+		return encode_fields<I + 1>( value, object, item, fields );
+	}
+
+	template<size_t I, class T, class Fields>
+	static typename std::enable_if<I == std::tuple_size<Fields>::value, bool>::type
+	decode_fields( Lookup&, T&, const Fields& )
+	{
+		return true;
+	}
+
+	template<size_t I, class T, class Fields>
+	static typename std::enable_if<I < std::tuple_size<Fields>::value, bool>::type
+	decode_fields( Lookup &lookup, T &value, const Fields &fields )
+	{
+		const auto &field = std::get<I>( fields );
+		typedef typename std::decay<decltype( value.*field.member )>::type Member;
+		const cJSON *item = lookup.find( field.key );
+		if ( item && !JsonCodec<Member>::decode( item, value.*field.member ) )
+		{
+			return false;
+		}
+		return decode_fields<I + 1>( lookup, value, fields );
+	}
+};
+
+/**
+ * Mapped structs
+ */
+template<class T, class Enable>
+struct JsonCodec
+{
+	static cJSON* encode( const T &value )
+	{
+		return JsonStruct::encode( value );
+	}
+
+	static bool decode( const cJSON *node, T &value )
+	{
+		return JsonStruct::decode( node, value );
+	}
+};
+
+template<>
+struct JsonCodec<bool>
+{
+	static cJSON* encode( bool value )
+	{
+		return cJSON_CreateBool( value );
+	}
+
+	static bool decode( const cJSON *node, bool &value )
+	{
+		if ( !cJSON_IsBool( node ) )
+		{
+			return false;
+		}
+		value = cJSON_IsTrue( node );
+		return true;
+	}
+};
+
+template<class M>
+struct JsonCodec<M, typename std::enable_if<std::is_arithmetic<M>::value>::type>
+{
+	static cJSON* encode( M value )
+	{
+		return cJSON_CreateNumber( static_cast<double>( value ) );
+	}
+
+	/**
+	 * @return false unless the number is representable in M, integers must be whole
+	 */
+	static bool decode( const cJSON *node, M &value )
+	{
+		if ( !cJSON_IsNumber( node ) || !fits( node->valuedouble, std::is_integral<M>() ) )
+		{
+			return false;
+		}
+		value = static_cast<M>( node->valuedouble );
+		return true;
+	}
+
+private:
+	static bool fits( double d, std::true_type )
+	{
+		// Limits are powers of two, exact as doubles; NaN fails every comparison
+		const double high = std::ldexp( 1.0, std::numeric_limits<M>::digits );
+		const double low = std::numeric_limits<M>::is_signed ? -high : 0;
+		return d >= low && d < high && d == std::floor( d );
+	}
+
+	static bool fits( double d, std::false_type )
+	{
+		return !std::isfinite( d ) || std::fabs( d ) <= std::numeric_limits<M>::max();
+	}
+};
+
+template<>
+struct JsonCodec<std::string>
+{
+	static cJSON* encode( const std::string &value )
+	{
+		return cJSON_CreateString( value.c_str() );
+	}
+
+	static bool decode( const cJSON *node, std::string &value )
+	{
+		if ( !cJSON_IsString( node ) )
+		{
+			return false;
+		}
+		value = node->valuestring;
+		return true;
+	}
+};
+
+template<>
+struct JsonCodec<Json>
+{
+	static cJSON* encode( const Json &value )
+	{
+		return cJSON_Duplicate( value.view().node(), true );
+	}
+
+	static bool decode( const cJSON *node, Json &value )
+	{
+		value = JsonView( node ).copy();
+		return true;
+	}
+};
+
+template<class M>
+struct JsonCodec<std::vector<M>>
+{
+	static cJSON* encode( const std::vector<M> &value )
+	{
+		cJSON *array = cJSON_CreateArray();
+		for( size_t i = 0; array && i < value.size(); i++ )
+		{
+			cJSON *item = JsonCodec<M>::encode( value[i] );
+			if ( !item )
+			{
+				cJSON_Delete( array );
+				return nullptr;
+			}
+			JsonStruct::append( array, item );
+		}
+		return array;
+	}
+
+	static bool decode( const cJSON *node, std::vector<M> &value )
+	{
+		if ( !cJSON_IsArray( node ) )
+		{
+			return false;
+		}
+		value.clear();
+		for( const cJSON *c = node->child; c; c = c->next )
+		{
+			value.emplace_back();
+			if ( !JsonCodec<M>::decode( c, value.back() ) )
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
@@ -1,10 +1,49 @@
 
 #include "cjson.hpp"
+#include "cjson_cbor.hpp"
+#include "cjson_patch.hpp"
+#include "cjson_path.hpp"
+#include "cjson_simd.hpp"
+#include "cjson_stream.hpp"
+#include "cjson_struct.hpp"
 #include <CppUTest/CommandLineTestRunner.h>
 #include <CppUTest/TestHarness.h>
 #include <limits>
 
 
+struct Address
+{
+	std::string city;
+	int zip;
+};
+
+CJSON_MAPPING( Address, CJSON_FIELD( city ), CJSON_FIELD( zip ) );
+
+struct Person
+{
+	std::string name;
+	int age = 0;
+	double score = 0;
+	bool active = false;
+	int64_t id = 0;
+	std::vector<std::string> tags;
+	std::vector<Address> addresses;
+	Address home;
+	Json extra;
+};
+
+CJSON_MAPPING( Person,
+	CJSON_FIELD( name ),
+	CJSON_FIELD( age ),
+	CJSON_FIELD( score ),
+	CJSON_FIELD( active ),
+	CJSON_FIELD( id ),
+	CJSON_FIELD( tags ),
+	CJSON_FIELD( addresses ),
+	CJSON_FIELD( home ),
+	CJSON_FIELD_AS( "x-extra", extra ) );
+
+
 int main( int argc, char** argv)
 {
 	return CommandLineTestRunner::RunAllTests( argc, argv );
@@ -695,3 +734,1163 @@ TEST(JsonGroup, SpecialCharactersTest)
 	STRCMP_EQUAL( " \" \\ \b \f \n \r \t ", res["string"].as_string().c_str() );
 }
 
+TEST(JsonGroup, ManyChildrenTest)
+{
+	const int count = 1000;
+	Json ja( Json::Array );
+	Json jo( Json::Object );
+	for( int i = 0; i < count; i++ )
+	{
+		Json item( Json::Object );
+		item.set( "id", i );
+		ja.insert( item );
+		jo.set( std::to_string( i ), item );
+	}
+	CHECK_EQUAL( count, ja.size() );
+	CHECK_EQUAL( count, jo.size() );
+
+	// Children added by reference keep their own children reachable
+	for( int i = 0; i < count; i++ )
+	{
+		CHECK_EQUAL( i, ja[i]["id"].as_int() );
+		CHECK_EQUAL( i, jo[std::to_string( i )]["id"].as_int() );
+	}
+	ja[0].set( "name", "first" );
+	STRCMP_EQUAL( "first", ja[0]["name"].as_string().c_str() );
+
+	ja.remove( 0 );
+	jo.remove( "0" );
+	CHECK_EQUAL( count - 1, ja.size() );
+	CHECK_EQUAL( count - 1, jo.size() );
+	CHECK_EQUAL( 1, ja[0]["id"].as_int() );
+	CHECK( jo["0"].is_null() );
+	CHECK_EQUAL( count - 1, ja.back()["id"].as_int() );
+}
+
+TEST(JsonGroup, ArenaTest)
+{
+	Json outside( Json::Object );
+	outside.set( "heap", true );
+
+	JsonArena arena( 256 );
+	Json doc;
+	{
+		JsonArena::Scope scope( arena );
+		CHECK( Json::parse( "{\"a\":[1,2,3],\"b\":\"text\",\"c\":{\"d\":null}}", doc ) );
+		doc.set( "e", 5 )
+		   .set( "outside", outside );
+		doc["a"].insert( 4 );
+		Json list( Json::Array );
+		for( int i = 0; i < 100; i++ )
+		{
+			list.insert( i );
+		}
+		doc.set( "list", list );
+	}
+	CHECK( arena.used() > 0 );
+	CHECK( arena.reserved() >= arena.used() );
+
+	// Handles into the document keep using the arena outside of the scope
+	doc.remove( "b" );
+	doc["c"].set( "d", "value" );
+	doc["e"] = 6;
+	CHECK_EQUAL( 100, doc["list"].size() );
+	CHECK_EQUAL( 99, doc["list"].back().as_int() );
+	CHECK( doc["outside"]["heap"].as_bool() );
+	STRCMP_CONTAINS( "{\"a\":[1,2,3,4],\"c\":{\"d\":\"value\"},\"e\":6,\"outside\":{\"heap\":true},\"list\":[0,1,", doc.build().c_str() );
+
+	// Heap values stay on the heap
+	Json heap( Json::Array );
+	heap.insert( 1 );
+	CHECK_EQUAL( 1, heap.size() );
+
+	doc.clean();
+	arena.reset();
+	CHECK_EQUAL( 0u, arena.used() );
+	{
+		JsonArena::Scope scope( arena );
+		CHECK( Json::parse( "[true]", doc ) );
+		CHECK( doc[0].as_bool() );
+	}
+	doc.clean();
+}
+
+TEST(JsonGroup, ViewTest)
+{
+	static_assert( std::is_trivially_copyable<JsonView>::value, "JsonView is a plain pointer" );
+
+	Json o;
+	CHECK( Json::parse( "{\"s\":\"text\",\"n\":12,\"f\":1.5,\"b\":true,\"z\":null,\"a\":[1,2,3],\"o\":{\"k\":\"v\"}}", o ) );
+
+	JsonView v = o.view();
+	CHECK( v.is_object() );
+	CHECK_EQUAL( 7, v.size() );
+	CHECK( v.has( "s" ) );
+	CHECK_FALSE( v.has( "S" ) );
+	STRCMP_EQUAL( "text", v["s"].c_str() );
+	STRCMP_EQUAL( "s", v["s"].name() );
+	CHECK( v["n"].c_str() == nullptr );
+	CHECK_EQUAL( 12, v["n"].as_int() );
+	CHECK_EQUAL( 12, v.at( std::string( "n" ) ).as_int64() );
+	DOUBLES_EQUAL( 1.5, v["f"].as_float(), std::numeric_limits<double>::epsilon() );
+	CHECK( v["b"].as_bool() );
+	CHECK( v["z"].is_null() );
+	CHECK( v["z"].valid() );
+	CHECK( v["missing"].is_null() );
+	CHECK_FALSE( v["missing"].valid() );
+	CHECK( v["missing"]["deeper"][3].is_null() );
+	STRCMP_EQUAL( "v", v["o"]["k"].c_str() );
+	STRCMP_EQUAL( "12", v["n"].as_string().c_str() );
+
+	// Iteration
+	JsonView a = v["a"];
+	CHECK_EQUAL( 3, a.size() );
+	CHECK_EQUAL( 3, a.back().as_int() );
+	int sum = 0;
+	for( JsonView e : a )
+	{
+		sum += e.as_int();
+	}
+	CHECK_EQUAL( 6, sum );
+	auto it = v.begin();
+	STRCMP_EQUAL( "s", it->name() );
+	it++;
+	STRCMP_EQUAL( "n", ( *it ).name() );
+
+	// Views see changes made through Json
+	o["n"] = 13;
+	CHECK_EQUAL( 13, v["n"].as_int() );
+
+	// Copies are independent
+	Json c = v["a"].copy();
+	c.remove( 0 );
+	CHECK_EQUAL( 2, c.size() );
+	CHECK_EQUAL( 3, a.size() );
+	CHECK( v["o"] == o["o"].view() );
+	CHECK( v["o"] != v["a"] );
+}
+
+class EventLog : public JsonHandler
+{
+public:
+	std::string log;
+
+	bool null_value()
+	{
+		log += "null ";
+		return true;
+	}
+	bool bool_value( bool value )
+	{
+		log += value ? "true " : "false ";
+		return true;
+	}
+	bool number( double value )
+	{
+		log += std::to_string( static_cast<int>( value ) ) + " ";
+		return true;
+	}
+	bool string( const char *value, size_t size )
+	{
+		log += "\"" + std::string( value, size ) + "\" ";
+		return true;
+	}
+	bool key( const char *value, size_t size )
+	{
+		log += std::string( value, size ) + ": ";
+		return true;
+	}
+	bool start_object()
+	{
+		log += "{ ";
+		return true;
+	}
+	bool end_object()
+	{
+		log += "} ";
+		return true;
+	}
+	bool start_array()
+	{
+		log += "[ ";
+		return true;
+	}
+	bool end_array()
+	{
+		log += "] ";
+		return true;
+	}
+};
+
+TEST(JsonGroup, StreamEventsTest)
+{
+	std::string doc = " {\"a\": [1, -2, true, false, null], \"b\" : {\"c\":\"x\\ty\"}, \"d\": []} ";
+
+	// Byte by byte
+	EventLog events;
+	JsonReader reader( events );
+	for( char c : doc )
+	{
+		CHECK( reader.feed( &c, 1 ) );
+	}
+	CHECK( reader.finish() );
+	STRCMP_EQUAL( "{ a: [ 1 -2 true false null ] b: { c: \"x\ty\" } d: [ ] } ", events.log.c_str() );
+	CHECK_EQUAL( doc.size(), reader.offset() );
+
+	// Tree built from chunks matches parse()
+	Json expected;
+	CHECK( Json::parse( doc, expected ) );
+	for( size_t chunk = 1; chunk < 8; chunk++ )
+	{
+		JsonBuilder builder;
+		JsonReader r( builder );
+		for( size_t i = 0; i < doc.size(); i += chunk )
+		{
+			CHECK( r.feed( doc.data() + i, std::min( chunk, doc.size() - i ) ) );
+		}
+		CHECK( r.finish() );
+		CHECK( builder.complete() );
+		CHECK( builder.take() == expected );
+	}
+}
+
+TEST(JsonGroup, StreamStringTest)
+{
+	// Escapes split at every position
+	std::string doc = "[\"a\\u00e9\\ud83d\\ude00\\\"\\/\\b\\n\", 12.5e1]";
+	for( size_t split = 0; split <= doc.size(); split++ )
+	{
+		JsonBuilder builder;
+		JsonReader reader( builder );
+		CHECK( reader.feed( doc.data(), split ) );
+		CHECK( reader.feed( doc.data() + split, doc.size() - split ) );
+		CHECK( reader.finish() );
+		Json o = builder.take();
+		STRCMP_EQUAL( u8"a\u00e9\U0001F600\"/\b\n", o[0].as_string().c_str() );
+		DOUBLES_EQUAL( 125.0, o[1].as_float(), 0.0 );
+	}
+}
+
+TEST(JsonGroup, StreamInvalidTest)
+{
+	std::string scenarios[] = { "", "[1,]", "{\"a\" 1}", "{\"a\":1,}", "01", "-", "1.", "1e", "[1 2]", "tru", "nul",
+								"[", "{\"a\":", "\"abc", "\"\\x\"", "\"\\ud800\"", "\"\\udc00\"", "\"\\u12g4\"",
+								"\"a\tb\"", "1 2", "{} x", "[}", "{]", "{1:2}" };
+	for( const auto &doc : scenarios )
+	{
+		EventLog events;
+		JsonReader reader( events );
+		reader.feed( doc );
+		CHECK_FALSE( reader.finish() );
+		CHECK( reader.failed() );
+	}
+
+	// Nesting limit
+	EventLog events;
+	JsonReader reader( events, 2 );
+	CHECK( reader.feed( "[[" ) );
+	CHECK_FALSE( reader.feed( "[" ) );
+	CHECK_EQUAL( 2u, reader.offset() );
+
+	// Handler stops the parse
+	struct Stop : public JsonHandler
+	{
+		bool number( double )
+		{
+			return false;
+		}
+	} stop;
+	JsonReader stopped( stop );
+	CHECK_FALSE( stopped.feed( "[true, 1, 2]" ) );
+}
+
+TEST(JsonGroup, PullParserTest)
+{
+	std::string doc = "{\"meta\": {\"skip\": [1, [2, {\"x\": 3}]]}, \"items\": [";
+	const int count = 1000;
+	for( int i = 0; i < count; i++ )
+	{
+		doc += ( i ? ",{\"id\":" : "{\"id\":" ) + std::to_string( i ) + ",\"name\":\"item " + std::to_string( i ) + "\"}";
+	}
+	doc += "], \"total\": 1000}";
+
+	// Small chunks, so values are split between them
+	size_t pos = 0;
+	JsonPullParser parser( [&]( char *buffer, size_t size ) {
+		size_t n = std::min( std::min( size, doc.size() - pos ), static_cast<size_t>( 7 ) );
+		memcpy( buffer, doc.data() + pos, n );
+		pos += n;
+		return n;
+	}, 16 );
+
+	CHECK_EQUAL( JsonTokenizer::StartObject, parser.next() );
+	CHECK_EQUAL( JsonTokenizer::Key, parser.next() );
+	STRCMP_EQUAL( "meta", parser.text().c_str() );
+	CHECK( parser.skip() );
+	CHECK_EQUAL( JsonTokenizer::Key, parser.next() );
+	STRCMP_EQUAL( "items", parser.text().c_str() );
+	CHECK_EQUAL( JsonTokenizer::StartArray, parser.next() );
+	int seen = 0;
+	while( parser.next() == JsonTokenizer::StartObject )
+	{
+		CHECK_EQUAL( 3u, parser.depth() );
+		Json item;
+		CHECK( parser.read( item ) );
+		CHECK_EQUAL( seen, item["id"].as_int() );
+		STRCMP_EQUAL( ( "item " + std::to_string( seen ) ).c_str(), item["name"].as_string().c_str() );
+		seen++;
+	}
+	CHECK_EQUAL( count, seen );
+	CHECK_EQUAL( JsonTokenizer::EndArray, parser.event() );
+	CHECK_EQUAL( JsonTokenizer::Key, parser.next() );
+	Json total;
+	CHECK( parser.read( total ) );
+	CHECK_EQUAL( count, total.as_int() );
+	CHECK_EQUAL( JsonTokenizer::EndObject, parser.next() );
+	CHECK_EQUAL( JsonTokenizer::End, parser.next() );
+}
+
+
+static const JsonSimd::Level simd_levels[] = { JsonSimd::Scalar, JsonSimd::SSE2, JsonSimd::AVX2 };
+
+TEST(JsonGroup, SimdParseTest)
+{
+	std::string doc = "{\"name\":\"simd \\\"quoted\\\" \\\\ \\u00e9\\ud83d\\ude00\",\"n\":[0,-1.5,2e3,true,false,null,{},[]],";
+	for( int i = 0; i < 40; i++ )
+	{
+		doc += "\"k" + std::to_string( i ) + "\": { \"s\": \"" + std::string( i, static_cast<char>( 'a' + i % 26 ) ) + "\" , \"v\" : " + std::to_string( i * 7 ) + " },\n";
+	}
+	doc += "\"utf8\":\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\",\"end\":\"\\\\\"}";
+
+	Json expected;
+	CHECK( Json::parse( doc.c_str(), expected ) );
+	for( JsonSimd::Level level : simd_levels )
+	{
+		Json jo;
+		CHECK( JsonSimd::parse( doc, jo, level ) );
+		CHECK( jo == expected );
+		STRCMP_EQUAL( "simd \"quoted\" \\ \xc3\xa9\xf0\x9f\x98\x80", jo["name"].as_string().c_str() );
+		CHECK_EQUAL( 8, jo["n"].size() );
+		DOUBLES_EQUAL( 2000, jo["n"][2].as_float(), 0 );
+		CHECK_EQUAL( 273, jo["k39"]["v"].as_int() );
+		STRCMP_EQUAL( "\\", jo["end"].as_string().c_str() );
+		// Result is an ordinary document
+		jo.set( "added", 1 );
+		CHECK_EQUAL( 1, jo["added"].as_int() );
+	}
+
+	// Escapes and strings which straddle 64-byte blocks
+	for( size_t pad = 0; pad < 70; pad++ )
+	{
+		std::string text = "[\"" + std::string( pad, 'p' ) + "\\\\\\\"\\\\\",\"x\\\"]\"]";
+		for( JsonSimd::Level level : simd_levels )
+		{
+			Json jo;
+			CHECK( JsonSimd::parse( text, jo, level ) );
+			CHECK_EQUAL( 2, jo.size() );
+			STRCMP_EQUAL( ( std::string( pad, 'p' ) + "\\\"\\" ).c_str(), jo[0].as_string().c_str() );
+			STRCMP_EQUAL( "x\"]", jo[1].as_string().c_str() );
+		}
+	}
+
+	// Numbers convert exactly like strtod, with and without the fast path
+	const char *numbers[] = {
+		"0", "-0", "0.1", "-12.5e-3", "1e22", "1e23", "9007199254740993", "123456789012345678901234",
+		"0.30000000000000004", "4.9e-324", "1.7976931348623157e308", "1e-400", "-2147483649", "1e400"
+	};
+	for( const char *text : numbers )
+	{
+		Json jo;
+		CHECK( JsonSimd::parse( text, strlen( text ), jo ) );
+		double expected_value = strtod( text, nullptr );
+		CHECK( !memcmp( &expected_value, &jo.view().node()->valuedouble, sizeof( double ) ) );
+		Json ref;
+		CHECK( Json::parse( text, ref ) );
+		CHECK_EQUAL( ref.view().node()->valueint, jo.view().node()->valueint );
+	}
+
+	Json scalar;
+	CHECK( JsonSimd::parse( " 42 ", scalar ) );
+	CHECK_EQUAL( 42, scalar.as_int() );
+}
+
+TEST(JsonGroup, SimdInvalidTest)
+{
+	const char *invalid[] = {
+		"", "  ", "[1,]", "{\"a\" 1}", "{\"a\":1,}", "[1 2]", "[01]", "[1.]", "[-]", "[1e]", "tru", "nul", "[true1]",
+		"\"open", "[\"a\"", "{\"a\":1}}", "[\"\\x\"]", "[\"\\u12\"]", "[\"\\ud800\"]", "[\"\\udc00x\"]", "\"tab\there\"",
+		"[\"\xc3\"]", "[\"\xc0\xaf\"]", "[\"\xed\xa0\x80\"]", "[\"\xf5\x80\x80\x80\"]", "[\xc3\xa9]", "{1:2}", "[1]x", "{\"a\":}",
+	};
+	for( const char *text : invalid )
+	{
+		for( JsonSimd::Level level : simd_levels )
+		{
+			Json jo( 1 );
+			CHECK_FALSE( JsonSimd::parse( text, jo, level ) );
+			CHECK( jo.is_null() );
+		}
+	}
+
+	std::string deep( CJSON_NESTING_LIMIT + 1, '[' );
+	deep += std::string( CJSON_NESTING_LIMIT + 1, ']' );
+	Json jo;
+	CHECK_FALSE( JsonSimd::parse( deep, jo ) );
+
+	// Multibyte sequence split by a block boundary
+	for( size_t pad = 55; pad < 66; pad++ )
+	{
+		std::string text = std::string( pad, 'a' ) + "\xf0\x9f\x98\x80";
+		for( JsonSimd::Level level : simd_levels )
+		{
+			CHECK( JsonSimd::validate_utf8( text.data(), text.size(), level ) );
+			CHECK_FALSE( JsonSimd::validate_utf8( text.data(), text.size() - 1, level ) );
+		}
+	}
+}
+
+TEST(JsonGroup, BuildIntoTest)
+{
+	Json jo;
+	CHECK( Json::parse( "{\"a\":[1,-20,3.25,1e300,true,false,null,{},[]],\"s\":\"q\\\"\\\\\\n\\u0001\xc3\xa9\",\"o\":{\"x\":{\"y\":[]}}}", jo ) );
+	for( bool formatted : { false, true } )
+	{
+		std::string expected = jo.build( formatted );
+		CHECK( jo.estimate( formatted ) >= expected.size() );
+
+		std::string out;
+		CHECK( jo.build_into( out, formatted ) );
+		STRCMP_EQUAL( expected.c_str(), out.c_str() );
+		CHECK_EQUAL( expected.size(), out.size() );
+
+		// Capacity is reused
+		const char *data = out.data();
+		CHECK( jo.build_into( out, formatted ) );
+		POINTERS_EQUAL( data, out.data() );
+		STRCMP_EQUAL( expected.c_str(), out.c_str() );
+
+		char buffer[512];
+		CHECK_EQUAL( expected.size(), jo.build_into( buffer, sizeof( buffer ), formatted ) );
+		STRCMP_EQUAL( expected.c_str(), buffer );
+		CHECK_EQUAL( 0u, jo.build_into( buffer, expected.size() / 2, formatted ) );
+	}
+
+	Json number( 42 );
+	std::string out;
+	CHECK( number.build_into( out ) );
+	STRCMP_EQUAL( "42", out.c_str() );
+	CHECK_EQUAL( 2u, number.estimate() );
+}
+
+TEST(JsonGroup, WriterTest)
+{
+	Json jo;
+	std::string big( 1000, 'b' );
+	std::string doc = "{\"items\":[";
+	for( int i = 0; i < 200; i++ )
+	{
+		doc += ( i ? "," : "" ) + std::string( "{\"id\":" ) + std::to_string( i ) + ",\"v\":" + std::to_string( i / 3.0 ) +
+			   ",\"s\":\"tab\\there \\\"" + std::string( i, 'x' ) + "\"}";
+	}
+	doc += "],\"big\":\"" + big + "\",\"esc\":\"" + big + "\\n\",\"e\":{},\"a\":[],\"t\":true,\"f\":false,\"n\":null}";
+	CHECK( Json::parse( doc.c_str(), jo ) );
+	std::string expected = jo.build();
+
+	for( size_t size : { 32, 33, 100, 4096 } )
+	{
+		JsonWriter writer( jo.view(), size );
+		std::vector<char> buffer( size );
+		std::string out;
+		size_t n;
+		while( ( n = writer.next( &buffer[0], size ) ) > 0 )
+		{
+			CHECK( n <= size );
+			out.append( &buffer[0], n );
+		}
+		CHECK( writer.done() );
+		CHECK( expected == out );
+
+		for( int count : { 1, 3, 16 } )
+		{
+			writer.reset( jo.view() );
+			struct iovec iov[16];
+			bool zero_copy = false;
+			int used;
+			out.clear();
+			while( ( used = writer.next( iov, count ) ) > 0 )
+			{
+				CHECK( used <= count );
+				for( int i = 0; i < used; i++ )
+				{
+					zero_copy |= iov[i].iov_base == jo["big"].view().c_str();
+					out.append( static_cast<const char*>( iov[i].iov_base ), iov[i].iov_len );
+				}
+			}
+			CHECK( expected == out );
+			CHECK_EQUAL( count >= 3, zero_copy );
+		}
+	}
+
+	Json text( "text" );
+	JsonWriter scalar( text.view() );
+	char buffer[64];
+	size_t n = scalar.next( buffer, sizeof( buffer ) );
+	STRCMP_EQUAL( "\"text\"", std::string( buffer, n ).c_str() );
+	CHECK_EQUAL( 0u, scalar.next( buffer, sizeof( buffer ) ) );
+}
+
+TEST(JsonGroup, StructTest)
+{
+	static_assert( JsonKey::hash( "name" ) != JsonKey::hash( "age" ), "keys are hashed at compile time" );
+
+	Person p;
+	p.name = "Ann";
+	p.age = 41;
+	p.score = 9.5;
+	p.active = true;
+	p.id = 1234567890123LL;
+	p.tags = { "a", "b" };
+	p.addresses = { Address{ "Oslo", 150 }, Address{ "Bergen", 5003 } };
+	p.home = Address{ "Moss", 1530 };
+	p.extra = Json( Json::Object );
+	p.extra.set( "k", "v" );
+
+	Json jo = JsonStruct::serialize( p );
+	STRCMP_EQUAL( "{\"name\":\"Ann\",\"age\":41,\"score\":9.5,\"active\":true,\"id\":1234567890123,\"tags\":[\"a\",\"b\"],"
+				  "\"addresses\":[{\"city\":\"Oslo\",\"zip\":150},{\"city\":\"Bergen\",\"zip\":5003}],"
+				  "\"home\":{\"city\":\"Moss\",\"zip\":1530},\"x-extra\":{\"k\":\"v\"}}", jo.build().c_str() );
+	CHECK_EQUAL( 5003, jo["addresses"][1]["zip"].as_int() );
+
+	Person q;
+	CHECK( JsonStruct::deserialize( jo.view(), q ) );
+	STRCMP_EQUAL( "Ann", q.name.c_str() );
+	CHECK_EQUAL( 41, q.age );
+	DOUBLES_EQUAL( 9.5, q.score, 0 );
+	CHECK( q.active );
+	CHECK( q.id == p.id );
+	CHECK( q.tags == p.tags );
+	CHECK_EQUAL( 2u, q.addresses.size() );
+	STRCMP_EQUAL( "Bergen", q.addresses[1].city.c_str() );
+	CHECK_EQUAL( 1530, q.home.zip );
+	CHECK( q.extra == p.extra );
+
+	// Any key order, unknown keys ignored, missing keys keep defaults
+	Json shuffled;
+	CHECK( Json::parse( "{\"unknown\":1,\"home\":{\"zip\":7,\"city\":\"X\"},\"age\":3,\"name\":\"B\"}", shuffled ) );
+	Person r;
+	r.score = 1.5;
+	CHECK( JsonStruct::deserialize( shuffled.view(), r ) );
+	STRCMP_EQUAL( "B", r.name.c_str() );
+	CHECK_EQUAL( 3, r.age );
+	CHECK_EQUAL( 7, r.home.zip );
+	STRCMP_EQUAL( "X", r.home.city.c_str() );
+	DOUBLES_EQUAL( 1.5, r.score, 0 );
+	CHECK( r.tags.empty() );
+
+	Json wrong;
+	CHECK( Json::parse( "{\"age\":\"old\"}", wrong ) );
+	CHECK_FALSE( JsonStruct::deserialize( wrong.view(), r ) );
+	CHECK( Json::parse( "[]", wrong ) );
+	CHECK_FALSE( JsonStruct::deserialize( wrong.view(), r ) );
+
+	// Numbers must fit the field type
+	const char *unfit[] = { "{\"age\":1e20}", "{\"age\":-2147483649}", "{\"age\":41.5}", "{\"id\":9223372036854775808}" };
+	for( const char *text : unfit )
+	{
+		CHECK( Json::parse( text, wrong ) );
+		CHECK_FALSE( JsonStruct::deserialize( wrong.view(), r ) );
+	}
+	CHECK( Json::parse( "{\"age\":-2147483648,\"id\":-9223372036854775808}", wrong ) );
+	CHECK( JsonStruct::deserialize( wrong.view(), r ) );
+	CHECK_EQUAL( std::numeric_limits<int>::min(), r.age );
+	CHECK( r.id == std::numeric_limits<int64_t>::min() );
+	unsigned char byte = 7;
+	float single = 0;
+	CHECK_FALSE( JsonCodec<unsigned char>::decode( Json( -5 ).view().node(), byte ) );
+	CHECK_FALSE( JsonCodec<unsigned char>::decode( Json( 256 ).view().node(), byte ) );
+	CHECK( JsonCodec<unsigned char>::decode( Json( 255 ).view().node(), byte ) );
+	CHECK_EQUAL( 255, byte );
+	CHECK_FALSE( JsonCodec<float>::decode( Json( 1e300 ).view().node(), single ) );
+	CHECK( JsonCodec<float>::decode( Json( 0.5 ).view().node(), single ) );
+	DOUBLES_EQUAL( 0.5, single, 0 );
+
+	// More children than fit the local table
+	std::string text = "{";
+	for( int i = 0; i < 100; i++ )
+	{
+		text += "\"f" + std::to_string( i ) + "\":" + std::to_string( i ) + ",";
+	}
+	// Duplicate keys resolve to the first one, like cJSON
+	text += "\"zip\":99,\"city\":\"Far\",\"zip\":100}";
+	Json large;
+	CHECK( Json::parse( text.c_str(), large ) );
+	Address a;
+	CHECK( JsonStruct::deserialize( large.view(), a ) );
+	CHECK_EQUAL( 99, a.zip );
+	STRCMP_EQUAL( "Far", a.city.c_str() );
+
+	// Serialized keys are constants, the document is a regular one
+	jo.set( "name", "Bob" );
+	jo.remove( "age" );
+	Json copy = jo;
+	STRCMP_EQUAL( "Bob", copy["name"].as_string().c_str() );
+}
+
+TEST(JsonGroup, KeyIndexTest)
+{
+	const int count = 10000;
+	Json jo( Json::Object );
+	for( int i = 0; i < count; i++ )
+	{
+		jo.set( "key" + std::to_string( i ), i );
+	}
+	CHECK_EQUAL( count, jo.size() );
+	for( int i = 0; i < count; i += 7 )
+	{
+		CHECK_EQUAL( i, jo.at( "key" + std::to_string( i ) ).as_int() );
+	}
+	CHECK( jo.has( "KEY42" ) );
+	CHECK( jo.at( "KEY42" ).is_null() );
+	CHECK_FALSE( jo.has( "key" + std::to_string( count ) ) );
+
+	// Replace and remove keep the index current
+	jo.set( "key5", "five" );
+	STRCMP_EQUAL( "five", jo["key5"].as_string().c_str() );
+	jo.set( "KEY6", 6.5 );
+	CHECK( jo.has( "key6" ) );
+	DOUBLES_EQUAL( 6.5, jo["KEY6"].as_float(), 0 );
+	CHECK( jo["key6"].is_null() );
+	jo.remove( "key7" );
+	CHECK_FALSE( jo.has( "key7" ) );
+	CHECK_EQUAL( count - 1, jo.size() );
+	jo.remove( "key0" );
+	jo.remove( "key" + std::to_string( count - 1 ) );
+	CHECK_FALSE( jo.has( "key0" ) );
+	CHECK_EQUAL( 1, jo["key1"].as_int() );
+
+	// Changes made behind the wrapper are noticed
+	cJSON_AddNumberToObject( const_cast<cJSON*>( jo.view().node() ), "outside", 1 );
+	CHECK( jo.has( "outside" ) );
+	CHECK_EQUAL( 1, jo["outside"].as_int() );
+
+	// Parsed documents, duplicate keys resolve like cJSON
+	std::string text = "{";
+	for( int i = 0; i < 100; i++ )
+	{
+		text += "\"k" + std::to_string( i % 50 ) + "\":" + std::to_string( i ) + ",";
+	}
+	text += "\"Dup\":1,\"dup\":2}";
+	Json parsed;
+	CHECK( Json::parse( text.c_str(), parsed ) );
+	CHECK_EQUAL( 10, parsed["k10"].as_int() );
+	CHECK_EQUAL( 1, parsed["Dup"].as_int() );
+	CHECK_EQUAL( 2, parsed["dup"].as_int() );
+	CHECK( parsed["DUP"].is_null() );
+	CHECK( parsed.has( "DUP" ) );
+	parsed.remove( "k10" );
+	CHECK_EQUAL( 60, parsed["k10"].as_int() );
+	parsed.remove( "dUp" );
+	CHECK( parsed["Dup"].is_null() );
+	CHECK_EQUAL( 2, parsed["dup"].as_int() );
+	CHECK_EQUAL( 49, parsed["k49"].as_int() );
+
+	// Wrappers of one sub-object share its index
+	text = "{\"big\":{";
+	for( int i = 0; i < 40; i++ )
+	{
+		text += "\"k" + std::to_string( i ) + "\":" + std::to_string( i ) + ",";
+	}
+	text += "\"last\":{\"k\":1}}}";
+	Json doc;
+	CHECK( Json::parse( text.c_str(), doc ) );
+	Json a = doc["big"], b = doc["big"];
+	CHECK_EQUAL( 10, a.at( "k10" ).as_int() );
+	b.remove( "k10" );
+	CHECK_FALSE( a.has( "k10" ) );
+	CHECK( a.at( "k10" ).is_null() );
+	CHECK_EQUAL( 11, a["k11"].as_int() );
+	for( Json::Iterator it = doc.begin(); it != doc.end(); ++it )
+	{
+		Json member = *it;
+		member.remove( "k20" );
+	}
+	CHECK_FALSE( a.has( "k20" ) );
+	CHECK_FALSE( b.has( "k20" ) );
+	doc["big"]["last"].set( "j", 2 );
+	CHECK_EQUAL( 2, a["last"]["j"].as_int() );
+	b.remove( "last" );
+	CHECK_FALSE( doc["big"].has( "last" ) );
+	CHECK_EQUAL( 39, a["k39"].as_int() );
+}
+
+static std::string cbor_hex( const std::string &bytes )
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string out;
+	for( unsigned char c : bytes )
+	{
+		out += digits[c >> 4];
+		out += digits[c & 15];
+	}
+	return out;
+}
+
+static std::string cbor_bytes( const char *hex )
+{
+	std::string out;
+	for( ; hex[0] && hex[1]; hex += 2 )
+	{
+		out += static_cast<char>( std::stoi( std::string( hex, 2 ), nullptr, 16 ) );
+	}
+	return out;
+}
+
+TEST(JsonGroup, CborEncodeTest)
+{
+	// RFC 8949 appendix A
+	const char *vectors[][2] = {
+		{ "0", "00" }, { "23", "17" }, { "24", "1818" }, { "100", "1864" }, { "1000", "1903e8" },
+		{ "1000000000000", "1b000000e8d4a51000" }, { "-1", "20" }, { "-1000", "3903e7" },
+		{ "1.1", "fb3ff199999999999a" }, { "100000.5", "fa47c35040" }, { "-4.1", "fbc010666666666666" },
+		{ "false", "f4" }, { "true", "f5" }, { "null", "f6" }, { "\"\"", "60" }, { "\"IETF\"", "6449455446" },
+		{ "\"\\u00fc\"", "62c3bc" }, { "[]", "80" }, { "[1,[2,3],[4,5]]", "8301820203820405" }, { "{}", "a0" },
+		{ "{\"a\":1,\"b\":[2,3]}", "a26161016162820203" },
+	};
+	for( auto &v : vectors )
+	{
+		Json jo;
+		CHECK( Json::parse( v[0], jo ) );
+		std::string bytes = JsonCbor::encode( jo.view() );
+		STRCMP_EQUAL( v[1], cbor_hex( bytes ).c_str() );
+		CHECK_EQUAL( bytes.size(), JsonCbor::size( jo.view() ) );
+	}
+
+	Json jo;
+	CHECK( Json::parse( "{\"list\":[1,2.5,-3,\"x\",true,null,{}],\"text\":\"" + std::string( 300, 't' ) + "\",\"n\":{\"a\":{\"b\":[]}}}", jo ) );
+	std::string whole = JsonCbor::encode( jo.view() );
+	CHECK( whole.size() < jo.build().size() );
+
+	// Caller buffers: exact, too small, chunked
+	std::vector<char> buffer( whole.size() );
+	CHECK_EQUAL( whole.size(), JsonCbor::encode( jo.view(), &buffer[0], buffer.size() ) );
+	CHECK( std::string( buffer.begin(), buffer.end() ) == whole );
+	CHECK_EQUAL( 0u, JsonCbor::encode( jo.view(), &buffer[0], buffer.size() - 1 ) );
+	for( size_t size : { 9, 10, 64 } )
+	{
+		JsonCbor::Encoder encoder( jo.view() );
+		std::vector<char> chunk( size );
+		std::string out;
+		size_t n;
+		while( ( n = encoder.next( &chunk[0], size ) ) > 0 )
+		{
+			CHECK( n <= size );
+			out.append( &chunk[0], n );
+		}
+		CHECK( encoder.done() );
+		CHECK( out == whole );
+	}
+
+	std::string reused;
+	reused.reserve( 1024 );
+	const char *data = reused.data();
+	JsonCbor::encode( jo.view(), reused );
+	POINTERS_EQUAL( data, reused.data() );
+	CHECK( reused == whole );
+}
+
+TEST(JsonGroup, CborDecodeTest)
+{
+	const char *vectors[][2] = {
+		{ "00", "0" }, { "1903e8", "1000" }, { "3903e7", "-1000" }, { "f93e00", "1.5" }, { "f9c400", "-4" },
+		{ "fa47c35000", "100000" }, { "f7", "null" }, { "c074323031332d30332d32315432303a30343a30305a", "\"2013-03-21T20:04:00Z\"" },
+		{ "4401020304", "\"AQIDBA\"" }, { "5f42010243030405ff", "\"AQIDBAU\"" }, { "7f657374726561646d696e67ff", "\"streaming\"" },
+		{ "9f018202039f0405ffff", "[1,[2,3],[4,5]]" }, { "9fff", "[]" }, { "bf6346756ef563416d7421ff", "{\"Fun\":true,\"Amt\":-2}" },
+		{ "826161bf61626163ff", "[\"a\",{\"b\":\"c\"}]" },
+	};
+	for( auto &v : vectors )
+	{
+		Json jo;
+		CHECK( JsonCbor::decode( cbor_bytes( v[0] ), jo ) );
+		STRCMP_EQUAL( v[1], jo.build().c_str() );
+	}
+
+	const char *invalid[] = {
+		"", "18", "1900", "62c3", "8301", "a16161", "a10101", "ff", "9f01", "7f6161", "7f01ff", "1c", "f8ff", "0000", "5f6161ff",
+	};
+	for( const char *hex : invalid )
+	{
+		Json jo( 1 );
+		CHECK_FALSE( JsonCbor::decode( cbor_bytes( hex ), jo ) );
+		CHECK( jo.is_null() );
+	}
+	std::string deep( CJSON_NESTING_LIMIT + 1, '\x81' );
+	deep += '\x01';
+	Json jo;
+	CHECK_FALSE( JsonCbor::decode( deep, jo ) );
+}
+
+TEST(JsonGroup, CborRoundTripTest)
+{
+	const char *docs[] = {
+		"0", "-0.5", "3.141592653589793", "1e300", "-1e-300", "4294967296", "-4294967297", "9007199254740992",
+		"\"\"", "\"esc \\\" \\\\ \\n \\u0001 \\u00e9 \\ud83d\\ude00\"",
+		"[[],{},[[[]]],{\"\":{\"\":null}}]",
+		"{\"user\":{\"id\":42,\"name\":\"Ann\",\"tags\":[\"a\",\"b\"],\"score\":0.1,\"active\":false},\"items\":[1,2,3]}",
+	};
+	for( const char *text : docs )
+	{
+		Json jo, back;
+		CHECK( Json::parse( text, jo ) );
+		CHECK( JsonCbor::decode( JsonCbor::encode( jo.view() ), back ) );
+		CHECK( jo == back );
+		STRCMP_EQUAL( jo.build().c_str(), back.build().c_str() );
+	}
+
+	Json big( Json::Object );
+	for( int i = 0; i < 1000; i++ )
+	{
+		big.set( "k" + std::to_string( i ), Json( { i, i * 2 } ) );
+	}
+	Json back;
+	CHECK( JsonCbor::decode( JsonCbor::encode( big.view() ), back ) );
+	CHECK( big == back );
+	CHECK_EQUAL( 1998, back["k999"][1].as_int() );
+}
+
+TEST(JsonGroup, PointerTest)
+{
+	// RFC 6901 section 5
+	Json jo;
+	CHECK( Json::parse( "{\"foo\":[\"bar\",\"baz\"],\"\":0,\"a/b\":1,\"c%d\":2,\"e^f\":3,\"g|h\":4,\"i\\\\j\":5,"
+						"\"k\\\"l\":6,\" \":7,\"m~n\":8}", jo ) );
+	const char *pointers[][2] = {
+		{ "", nullptr }, { "/foo", "[\"bar\",\"baz\"]" }, { "/foo/0", "\"bar\"" }, { "/", "0" }, { "/a~1b", "1" },
+		{ "/c%d", "2" }, { "/e^f", "3" }, { "/g|h", "4" }, { "/i\\j", "5" }, { "/k\"l", "6" }, { "/ ", "7" }, { "/m~0n", "8" },
+	};
+	for( auto &p : pointers )
+	{
+		JsonPath path;
+		CHECK( JsonPath::pointer( p[0], path ) );
+		JsonView v = path.find( jo.view() );
+		CHECK( v.valid() );
+		if ( p[1] )
+		{
+			Json expected;
+			CHECK( Json::parse( p[1], expected ) );
+			CHECK( v == expected.view() );
+		}
+		else
+		{
+			CHECK( v.node() == jo.view().node() );
+		}
+	}
+
+	const char *missing[] = { "/foo/2", "/foo/-", "/foo/01", "/foo/-1", "/nope", "/foo/0/x", "/a~1b/c" };
+	for( const char *p : missing )
+	{
+		JsonPath path;
+		CHECK( JsonPath::pointer( p, path ) );
+		CHECK_FALSE( path.find( jo.view() ).valid() );
+	}
+
+	JsonPath path;
+	CHECK_FALSE( JsonPath::pointer( "foo", path ) );
+	CHECK_FALSE( JsonPath::pointer( "/a~2", path ) );
+	CHECK_FALSE( JsonPath::pointer( "/a~", path ) );
+	CHECK_EQUAL( 0u, path.size() );
+}
+
+TEST(JsonGroup, PathQueryTest)
+{
+	Json jo;
+	CHECK( Json::parse( "{\"store\":{\"book\":[{\"title\":\"A\",\"price\":8},{\"title\":\"B\",\"price\":12},"
+						"{\"title\":\"C\",\"price\":9},{\"title\":\"D\",\"price\":22}],\"bicycle\":{\"color\":\"red\"}},"
+						"\"odd key\":{\"x.y\":1},\"n\":[0,1,2,3,4,5,6,7,8,9]}", jo ) );
+
+	auto titles = [&jo]( const char *query ) {
+		JsonPath path;
+		std::string out;
+		if ( !JsonPath::compile( query, path ) )
+		{
+			return std::string( "error" );
+		}
+		path.each( jo.view(), [&out]( JsonView v ) {
+			out += v.is_string() ? v.as_string() : v.is_number() ? std::to_string( v.as_int() ) : "?";
+			return true;
+		} );
+		return out;
+	};
+	STRCMP_EQUAL( "A", titles( "$.store.book[0].title" ).c_str() );
+	STRCMP_EQUAL( "A", titles( "store.book[0].title" ).c_str() );
+	STRCMP_EQUAL( "D", titles( "$.store.book[-1].title" ).c_str() );
+	STRCMP_EQUAL( "C", titles( "$['store'][\"book\"][-2]['title']" ).c_str() );
+	STRCMP_EQUAL( "ABCD", titles( "$.store.book[*].title" ).c_str() );
+	STRCMP_EQUAL( "812922", titles( "$.store.book.*.price" ).c_str() );
+	STRCMP_EQUAL( "red", titles( "$.store.bicycle.*" ).c_str() );
+	STRCMP_EQUAL( "1", titles( "$['odd key']['x.y']" ).c_str() );
+	STRCMP_EQUAL( "1234", titles( "$.n[1:5]" ).c_str() );
+	STRCMP_EQUAL( "02468", titles( "$.n[::2]" ).c_str() );
+	STRCMP_EQUAL( "9876543210", titles( "$.n[::-1]" ).c_str() );
+	STRCMP_EQUAL( "963", titles( "$.n[-1:1:-3]" ).c_str() );
+	STRCMP_EQUAL( "789", titles( "$.n[-3:]" ).c_str() );
+	STRCMP_EQUAL( "0123456789", titles( "$.n[-100:100]" ).c_str() );
+	STRCMP_EQUAL( "", titles( "$.n[5:2]" ).c_str() );
+	STRCMP_EQUAL( "", titles( "$.n[10]" ).c_str() );
+	STRCMP_EQUAL( "", titles( "$.store.book.title" ).c_str() );
+	STRCMP_EQUAL( "BD", titles( "$.store.book[1::2].title" ).c_str() );
+
+	const char *invalid[] = { "$.", "$[", "$[1", "$['a]", "$[::0]", "$[x]", "$.a]", "$..a", "$[]" };
+	for( const char *query : invalid )
+	{
+		STRCMP_EQUAL( "error", titles( query ).c_str() );
+	}
+
+	// Compiled once, evaluated against many documents
+	JsonPath path;
+	CHECK( JsonPath::compile( "$.store.book[*].price", path ) );
+	CHECK_FALSE( path.definite() );
+	JsonView found[8];
+	CHECK_EQUAL( 4u, path.select( jo.view(), found, 2 ) );
+	CHECK_EQUAL( 12, found[1].as_int() );
+	Json other;
+	CHECK( Json::parse( "{\"store\":{\"book\":[{\"price\":1}]}}", other ) );
+	CHECK_EQUAL( 1u, path.select( other.view(), found, 8 ) );
+	CHECK_EQUAL( 1, path.find( other.view() ).as_int() );
+	CHECK_EQUAL( 8, path.find( jo.view() ).as_int() );
+
+	CHECK( JsonPath::compile( "$", path ) );
+	CHECK( path.definite() );
+	CHECK( path.find( jo.view() ).node() == jo.view().node() );
+}
+
+TEST(JsonGroup, PatchTest)
+{
+	auto patched = []( const char *doc, const char *patch ) {
+		Json jo, ops;
+		if ( !Json::parse( doc, jo ) || !Json::parse( patch, ops ) )
+		{
+			return std::string( "parse" );
+		}
+		return JsonPatch::apply( jo, ops.view() ) ? jo.build() : "failed " + jo.build();
+	};
+
+	// RFC 6902 appendix A
+	STRCMP_EQUAL( "{\"foo\":\"bar\",\"baz\":\"qux\"}",
+				  patched( "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]" ).c_str() );
+	STRCMP_EQUAL( "{\"foo\":[\"bar\",\"qux\",\"baz\"]}",
+				  patched( "{\"foo\":[\"bar\",\"baz\"]}", "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]" ).c_str() );
+	STRCMP_EQUAL( "{\"foo\":\"bar\"}",
+				  patched( "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"remove\",\"path\":\"/baz\"}]" ).c_str() );
+	STRCMP_EQUAL( "{\"foo\":[\"bar\",\"baz\"]}",
+				  patched( "{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]" ).c_str() );
+	STRCMP_EQUAL( "{\"baz\":\"boo\",\"foo\":\"bar\"}",
+				  patched( "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]" ).c_str() );
+	STRCMP_EQUAL( "{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}",
+				  patched( "{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+						   "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]" ).c_str() );
+	STRCMP_EQUAL( "{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}",
+				  patched( "{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}", "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]" ).c_str() );
+	STRCMP_EQUAL( "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}",
+				  patched( "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}",
+						   "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"qux\"},{\"op\":\"test\",\"path\":\"/foo/1\",\"value\":2}]" ).c_str() );
+	STRCMP_EQUAL( "failed {\"baz\":\"qux\"}",
+				  patched( "{\"baz\":\"qux\"}", "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"bar\"}]" ).c_str() );
+	STRCMP_EQUAL( "{\"foo\":\"bar\",\"child\":{\"grandchild\":{}}}",
+				  patched( "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/child\",\"value\":{\"grandchild\":{}}}]" ).c_str() );
+	STRCMP_EQUAL( "failed {\"foo\":\"bar\"}",
+				  patched( "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]" ).c_str() );
+	STRCMP_EQUAL( "{\"/\":9,\"~1\":10}",
+				  patched( "{\"/\":9,\"~1\":10}", "[{\"op\":\"test\",\"path\":\"/~01\",\"value\":10}]" ).c_str() );
+	STRCMP_EQUAL( "{\"foo\":[\"bar\",[\"abc\",\"def\"]]}",
+				  patched( "{\"foo\":[\"bar\"]}", "[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]" ).c_str() );
+
+	// Replaced members keep their position, whole document and copies
+	STRCMP_EQUAL( "{\"a\":1,\"b\":[2,4],\"c\":3}",
+				  patched( "{\"a\":1,\"b\":2,\"c\":3}", "[{\"op\":\"add\",\"path\":\"/b\",\"value\":[2,4]}]" ).c_str() );
+	STRCMP_EQUAL( "[1,\"x\",3]", patched( "[1,2,3]", "[{\"op\":\"replace\",\"path\":\"/1\",\"value\":\"x\"}]" ).c_str() );
+	STRCMP_EQUAL( "[1,2,[1,2]]", patched( "{}", "[{\"op\":\"add\",\"path\":\"\",\"value\":[1,2]},"
+											  "{\"op\":\"copy\",\"from\":\"\",\"path\":\"/-\"}]" ).c_str() );
+
+	// Errors revert every operation before them
+	const char *invalid[] = {
+		"[{\"op\":\"remove\",\"path\":\"/a\"},{\"op\":\"remove\",\"path\":\"/x\"}]",
+		"[{\"op\":\"add\",\"path\":\"/b/0\",\"value\":0},{\"op\":\"add\",\"path\":\"/b/5\",\"value\":0}]",
+		"[{\"op\":\"add\",\"path\":\"\",\"value\":0},{\"op\":\"test\",\"path\":\"\",\"value\":1}]",
+		"[{\"op\":\"replace\",\"path\":\"/b/-\",\"value\":0}]",
+		"[{\"op\":\"add\",\"path\":\"/b/01\",\"value\":0}]",
+		"[{\"op\":\"move\",\"from\":\"/b\",\"path\":\"/b/0\"}]",
+		"[{\"op\":\"remove\",\"path\":\"\"}]",
+		"[{\"op\":\"add\",\"path\":\"a\",\"value\":0}]",
+		"[{\"op\":\"add\",\"path\":\"/a\"}]",
+		"[{\"op\":\"jump\",\"path\":\"/a\"}]",
+		"{\"op\":\"remove\",\"path\":\"/a\"}"
+	};
+	for( const char *patch : invalid )
+	{
+		STRCMP_EQUAL( "failed {\"a\":1,\"b\":[2,3]}", patched( "{\"a\":1,\"b\":[2,3]}", patch ).c_str() );
+	}
+
+	// Nodes which are not patched stay where they are
+	Json jo, ops;
+	CHECK( Json::parse( "{\"keep\":{\"x\":[1,2]},\"drop\":1,\"list\":[1,2]}", jo ) );
+	CHECK( Json::parse( "[{\"op\":\"remove\",\"path\":\"/drop\"},{\"op\":\"add\",\"path\":\"/list/0\",\"value\":0}]", ops ) );
+	const cJSON *keep = jo.view()["keep"].node();
+	const cJSON *second = jo.view()["list"][1].node();
+	CHECK( JsonPatch::apply( jo, ops.view() ) );
+	CHECK( jo.view()["keep"].node() == keep );
+	CHECK( jo.view()["list"][2].node() == second );
+	CHECK_FALSE( jo.has( "drop" ) );
+	CHECK_EQUAL( 2, jo.view().size() );
+
+	// Index of a large object follows the patch
+	Json wide( Json::Object );
+	for( int i = 0; i < 64; i++ )
+	{
+		wide.set( "k" + std::to_string( i ), i );
+	}
+	CHECK( wide.has( "k10" ) );
+	CHECK( Json::parse( "[{\"op\":\"move\",\"from\":\"/k10\",\"path\":\"/moved\"}]", ops ) );
+	CHECK( JsonPatch::apply( wide, ops.view() ) );
+	CHECK_FALSE( wide.has( "k10" ) );
+	CHECK_EQUAL( 10, wide.at( "moved" ).as_int() );
+	CHECK_EQUAL( 64, wide.view().size() );
+
+	// So does the index of a sub-object held across patches
+	Json doc;
+	CHECK( Json::parse( "{\"parsed\":" + wide.build() + "}", doc ) );
+	Json big = doc["parsed"];
+	CHECK_EQUAL( 11, big.at( "k11" ).as_int() );
+	CHECK( Json::parse( "[{\"op\":\"remove\",\"path\":\"/parsed/k11\"},{\"op\":\"replace\",\"path\":\"/parsed/k12\",\"value\":\"x\"}]", ops ) );
+	CHECK( JsonPatch::apply( doc, ops.view() ) );
+	CHECK_FALSE( big.has( "k11" ) );
+	STRCMP_EQUAL( "x", big["k12"].as_string().c_str() );
+	CHECK( Json::parse( "{\"parsed\":{\"k13\":null,\"k14\":{\"y\":1}}}", ops ) );
+	JsonPatch::merge( doc, ops.view() );
+	CHECK_FALSE( big.has( "k13" ) );
+	CHECK_EQUAL( 1, doc["parsed"]["k14"]["y"].as_int() );
+	CHECK_EQUAL( 1, big["k14"]["y"].as_int() );
+	CHECK_EQUAL( 15, big["k15"].as_int() );
+
+	// Values added with set() and insert() are patched in place
+	Json built( Json::Object ), sub( Json::Object ), inner( Json::Object ), list( Json::Array );
+	inner.set( "a", 1 );
+	inner.set( "b", 2 );
+	list.insert( 1 );
+	list.insert( inner );
+	sub.set( "a", 1 );
+	sub.set( "b", 2 );
+	sub.set( "inner", inner );
+	built.set( "s", sub );
+	built.set( "list", list );
+	CHECK( Json::parse( "[{\"op\":\"remove\",\"path\":\"/s/a\"},{\"op\":\"add\",\"path\":\"/s/c\",\"value\":3},"
+						"{\"op\":\"remove\",\"path\":\"/s/inner/a\"},{\"op\":\"add\",\"path\":\"/list/0\",\"value\":0},"
+						"{\"op\":\"test\",\"path\":\"/list/2/b\",\"value\":2}]", ops ) );
+	CHECK( JsonPatch::apply( built, ops.view() ) );
+	STRCMP_EQUAL( "{\"b\":2,\"inner\":{\"b\":2},\"c\":3}", sub.build().c_str() );
+	STRCMP_EQUAL( "{\"b\":2}", inner.build().c_str() );
+	STRCMP_EQUAL( "[0,1,{\"b\":2}]", list.build().c_str() );
+	STRCMP_EQUAL( "{\"s\":{\"b\":2,\"inner\":{\"b\":2},\"c\":3},\"list\":[0,1,{\"b\":2}]}", built.build().c_str() );
+	CHECK_EQUAL( 3, built["s"]["c"].as_int() );
+	Json held = built["s"];
+	CHECK( Json::parse( "[{\"op\":\"remove\",\"path\":\"/b\"}]", ops ) );
+	CHECK( JsonPatch::apply( held, ops.view() ) );
+	STRCMP_EQUAL( "{\"inner\":{\"b\":2},\"c\":3}", sub.build().c_str() );
+	STRCMP_EQUAL( "{\"inner\":{\"b\":2},\"c\":3}", held.build().c_str() );
+	CHECK( Json::parse( "[{\"op\":\"remove\",\"path\":\"/s/inner\"},{\"op\":\"remove\",\"path\":\"/x\"}]", ops ) );
+	CHECK_FALSE( JsonPatch::apply( built, ops.view() ) );
+	STRCMP_EQUAL( "{\"inner\":{\"b\":2},\"c\":3}", sub.build().c_str() );
+}
+
+TEST(JsonGroup, MergePatchTest)
+{
+	auto merged = []( const char *doc, const char *patch ) {
+		Json jo, mp;
+		if ( !Json::parse( doc, jo ) || !Json::parse( patch, mp ) )
+		{
+			return std::string( "parse" );
+		}
+		JsonPatch::merge( jo, mp.view() );
+		return jo.build();
+	};
+
+	// RFC 7386 appendix A
+	const char *cases[][3] = {
+		{ "{\"a\":\"b\"}", "{\"a\":\"c\"}", "{\"a\":\"c\"}" },
+		{ "{\"a\":\"b\"}", "{\"b\":\"c\"}", "{\"a\":\"b\",\"b\":\"c\"}" },
+		{ "{\"a\":\"b\"}", "{\"a\":null}", "{}" },
+		{ "{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}", "{\"b\":\"c\"}" },
+		{ "{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{\"a\":\"c\"}" },
+		{ "{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{\"a\":[\"b\"]}" },
+		{ "{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}", "{\"a\":{\"b\":\"d\"}}" },
+		{ "{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}", "{\"a\":[1]}" },
+		{ "[\"a\",\"b\"]", "[\"c\",\"d\"]", "[\"c\",\"d\"]" },
+		{ "{\"a\":\"b\"}", "[\"c\"]", "[\"c\"]" },
+		{ "{\"a\":\"foo\"}", "null", "null" },
+		{ "{\"a\":\"foo\"}", "\"bar\"", "\"bar\"" },
+		{ "{\"e\":null}", "{\"a\":1}", "{\"e\":null,\"a\":1}" },
+		{ "[1,2]", "{\"a\":\"b\",\"c\":null}", "{\"a\":\"b\"}" },
+		{ "{}", "{\"a\":{\"bb\":{\"ccc\":null}}}", "{\"a\":{\"bb\":{}}}" }
+	};
+	for( auto &c : cases )
+	{
+		STRCMP_EQUAL( c[2], merged( c[0], c[1] ).c_str() );
+	}
+
+	// Untouched members are not copied
+	Json jo, mp;
+	CHECK( Json::parse( "{\"keep\":[1,2,3],\"nested\":{\"x\":1,\"y\":2}}", jo ) );
+	CHECK( Json::parse( "{\"nested\":{\"y\":null,\"z\":3}}", mp ) );
+	const cJSON *keep = jo.view()["keep"].node();
+	const cJSON *nested = jo.view()["nested"].node();
+	JsonPatch::merge( jo, mp.view() );
+	CHECK( jo.view()["keep"].node() == keep );
+	CHECK( jo.view()["nested"].node() == nested );
+	STRCMP_EQUAL( "{\"keep\":[1,2,3],\"nested\":{\"x\":1,\"z\":3}}", jo.build().c_str() );
+
+	// Values added with set() are merged in place
+	Json doc( Json::Object ), sub( Json::Object ), inner( Json::Object ), empty( Json::Object );
+	inner.set( "a", 1 );
+	inner.set( "b", 2 );
+	sub.set( "inner", inner );
+	sub.set( "list", std::vector<int>{ 1, 2 } );
+	doc.set( "s", sub );
+	doc.set( "e", empty );
+	CHECK( Json::parse( "{\"s\":{\"inner\":{\"a\":null,\"c\":3},\"list\":[3]},\"e\":{\"x\":1}}", mp ) );
+	JsonPatch::merge( doc, mp.view() );
+	STRCMP_EQUAL( "{\"s\":{\"inner\":{\"b\":2,\"c\":3},\"list\":[3]},\"e\":{\"x\":1}}", doc.build().c_str() );
+	STRCMP_EQUAL( "{\"inner\":{\"b\":2,\"c\":3},\"list\":[3]}", sub.build().c_str() );
+	STRCMP_EQUAL( "{\"b\":2,\"c\":3}", inner.build().c_str() );
+	STRCMP_EQUAL( "{\"x\":1}", empty.build().c_str() );
+}
+
+TEST(JsonGroup, DiffTest)
+{
+	const char *pairs[][2] = {
+		{ "{\"a\":1,\"b\":{\"c\":[1,2,3]},\"d\":\"x\"}", "{\"a\":2,\"b\":{\"c\":[1,3]},\"e\":null}" },
+		{ "[1,2,3,4,5]", "[1,9,4,5,6]" },
+		{ "[1,2,3]", "[]" },
+		{ "[]", "[{\"a\":1},2]" },
+		{ "{\"a/b\":1,\"c~d\":[0]}", "{\"a/b\":2,\"c~d\":[0,1]}" },
+		{ "{\"a\":1}", "[1]" },
+		{ "true", "false" },
+		{ "{\"same\":[1,{\"x\":2}]}", "{\"same\":[1,{\"x\":2}]}" }
+	};
+	for( auto &p : pairs )
+	{
+		Json from, to;
+		CHECK( Json::parse( p[0], from ) );
+		CHECK( Json::parse( p[1], to ) );
+		Json ops = JsonPatch::diff( from.view(), to.view() );
+		CHECK( ops.is_array() );
+		CHECK( JsonPatch::apply( from, ops.view() ) );
+		STRCMP_EQUAL( to.build().c_str(), from.build().c_str() );
+	}
+
+	// Only changed members are in the delta
+	Json from, to;
+	CHECK( Json::parse( "{\"big\":[1,2,3,4,5,6,7,8],\"n\":1,\"gone\":true}", from ) );
+	CHECK( Json::parse( "{\"big\":[1,2,3,4,0,6,7,8],\"n\":1,\"new\":{}}", to ) );
+	STRCMP_EQUAL( "[{\"op\":\"replace\",\"path\":\"/big/4\",\"value\":0},{\"op\":\"remove\",\"path\":\"/gone\"},"
+				  "{\"op\":\"add\",\"path\":\"/new\",\"value\":{}}]",
+				  JsonPatch::diff( from.view(), to.view() ).build().c_str() );
+	CHECK_EQUAL( 0, JsonPatch::diff( from.view(), from.view() ).size() );
+}
@@ -0,0 +1,242 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "containers.hpp"
+#include "seqlock.hpp"
+#include "rcu.hpp"
+
+
+/*
+ * Contention benchmark for the single value containers.
+ *
+ * Every container runs for each combination of thread count (1, 2, 4 .. N),
+ * share of writes, payload size and critical section length. A critical
+ * section spins for a number of pause instructions while the value is held,
+ * read( fn ) for readers and update( fn ) for writers. Each run lasts a fixed
+ * time, every 16th operation is timed. Results are printed as CSV, one row
+ * per run: throughput is the sum over all threads, latencies are in ns.
+ *
+ * Usage: bench [max threads] [milliseconds per run]
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static const int WritePercents[] = { 0, 1, 10, 50 };
+static const int CriticalSections[] = { 0, 100, 1000 };
+static const unsigned SampleMask = 15;
+
+/**
+ * First and last words are written as a pair, so a torn read is easy to
+ * spot, writers fill the whole payload
+ */
+template<size_t Size>
+struct Payload
+{
+	static_assert( Size >= 2 * sizeof( uint64_t ) && Size % sizeof( uint64_t ) == 0, "Payload is made of 64-bit words" );
+	static const size_t Words = Size / sizeof( uint64_t );
+	uint64_t words[Words];
+
+	explicit Payload( uint64_t value = 0 )
+	{
+		fill( value );
+	}
+
+	void fill( uint64_t value )
+	{
+		for( size_t i = 0; i + 1 < Words; i++ )
+		{
+			words[i] = value;
+		}
+		words[Words - 1] = ~value;
+	}
+
+	bool valid() const
+	{
+		return words[0] == ~words[Words - 1];
+	}
+};
+
+struct Sample
+{
+	std::vector<uint32_t> reads;    // ns per sampled read
+	std::vector<uint32_t> writes;   // ns per sampled write
+	uint64_t ops = 0;
+	uint64_t torn = 0;
+};
+
+static inline uint32_t since( Clock::time_point t )
+{
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - t ).count();
+	return ns > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>( ns );
+}
+
+static inline void spin( int iterations )
+{
+	for( int i = 0; i < iterations; i++ )
+	{
+		detail::cpu_relax();
+	}
+}
+
+static uint32_t percentile( const std::vector<uint32_t> &sorted, double p )
+{
+	if ( sorted.empty() )
+	{
+		return 0;
+	}
+	return sorted[std::min( sorted.size() - 1, static_cast<size_t>( p * sorted.size() ) )];
+}
+
+template<typename Container, size_t Size>
+void run( const char *name, int threads, int write_pct, int cs_iters, int milliseconds )
+{
+	typedef Payload<Size> Value;
+	Container c( Value( 0 ) );
+	std::vector<Sample> samples( threads );
+	std::atomic<int> ready( 0 );
+	std::atomic<bool> go( false );
+	std::atomic<bool> stop( false );
+
+	auto worker = [&]( int index ) {
+		Sample &sample = samples[index];
+		// xorshift, cheap enough not to show up in the results
+		uint64_t rng = 0x9e3779b97f4a7c15ULL * ( index + 1 );
+		ready.fetch_add( 1 );
+		while( !go.load( std::memory_order_acquire ) )
+		{
+			detail::cpu_relax();
+		}
+		uint64_t ops = 0;
+		while( !stop.load( std::memory_order_relaxed ) )
+		{
+			rng ^= rng << 13;
+			rng ^= rng >> 7;
+			rng ^= rng << 17;
+			bool write = static_cast<int>( rng % 100 ) < write_pct;
+			bool sampled = ( ops & SampleMask ) == 0;
+			Clock::time_point start;
+			if ( sampled )
+			{
+				start = Clock::now();
+			}
+			if ( write )
+			{
+				c.update( [cs_iters]( Value &v ) {
+					v.fill( v.words[0] + 1 );
+					spin( cs_iters );
+				} );
+			} else {
+				bool valid = c.read( [cs_iters]( const Value &v ) {
+					spin( cs_iters );
+					return v.valid();
+				} );
+				if ( !valid )
+				{
+					sample.torn++;
+				}
+			}
+			if ( sampled )
+			{
+				( write ? sample.writes : sample.reads ).push_back( since( start ) );
+			}
+			ops++;
+		}
+		sample.ops = ops;
+	};
+
+	std::vector<std::thread> workers;
+	for( int i = 0; i < threads; i++ )
+	{
+		workers.push_back( std::thread( worker, i ) );
+	}
+	while( ready.load() < threads )
+	{
+		std::this_thread::yield();
+	}
+	auto start = Clock::now();
+	go.store( true, std::memory_order_release );
+	std::this_thread::sleep_for( std::chrono::milliseconds( milliseconds ) );
+	stop.store( true, std::memory_order_relaxed );
+	for( auto &w : workers )
+	{
+		w.join();
+	}
+	double seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+
+	std::vector<uint32_t> reads, writes;
+	uint64_t ops = 0, torn = 0;
+	for( auto &s : samples )
+	{
+		reads.insert( reads.end(), s.reads.begin(), s.reads.end() );
+		writes.insert( writes.end(), s.writes.begin(), s.writes.end() );
+		ops += s.ops;
+		torn += s.torn;
+	}
+	if ( torn )
+	{
+		fprintf( stderr, "%s: %llu torn reads\n", name, static_cast<unsigned long long>( torn ) );
+		exit( 1 );
+	}
+	std::sort( reads.begin(), reads.end() );
+	std::sort( writes.begin(), writes.end() );
+	uint32_t max = std::max( reads.empty() ? 0 : reads.back(), writes.empty() ? 0 : writes.back() );
+	printf( "%s,%d,%d,%zu,%d,%llu,%.6f,%.0f,%u,%u,%u,%u,%u,%u,%u\n", name, threads, write_pct, Size, cs_iters,
+		static_cast<unsigned long long>( ops ), seconds, ops / seconds,
+		percentile( reads, 0.5 ), percentile( reads, 0.99 ), percentile( reads, 0.999 ),
+		percentile( writes, 0.5 ), percentile( writes, 0.99 ), percentile( writes, 0.999 ), max );
+	fflush( stdout );
+}
+
+template<size_t Size>
+void run_all( const std::vector<int> &thread_counts, int milliseconds )
+{
+	typedef Payload<Size> Value;
+	for( int threads : thread_counts )
+	{
+		for( int write_pct : WritePercents )
+		{
+			for( int cs_iters : CriticalSections )
+			{
+				run<MutexContainer<Value>, Size>( "mutex", threads, write_pct, cs_iters, milliseconds );
+				run<ConcurrentContainer<Value, SpinRWLock>, Size>( "spin", threads, write_pct, cs_iters, milliseconds );
+				run<ConcurrentContainer<Value, FutexRWLock>, Size>( "futex", threads, write_pct, cs_iters, milliseconds );
+				run<ConcurrentContainer<Value, StripedRWLock<> >, Size>( "striped", threads, write_pct, cs_iters, milliseconds );
+				run<SeqlockContainer<Value>, Size>( "seqlock", threads, write_pct, cs_iters, milliseconds );
+				run<RcuContainer<Value>, Size>( "rcu", threads, write_pct, cs_iters, milliseconds );
+			}
+		}
+	}
+}
+
+int main( int argc, char **argv )
+{
+	int max_threads = argc > 1 ? atoi( argv[1] ) : static_cast<int>( std::thread::hardware_concurrency() );
+	int milliseconds = argc > 2 ? atoi( argv[2] ) : 100;
+	if ( max_threads < 1 )
+	{
+		max_threads = 1;
+	}
+	if ( milliseconds < 1 )
+	{
+		milliseconds = 1;
+	}
+
+	std::vector<int> thread_counts;
+	for( int threads = 1; threads < max_threads; threads *= 2 )
+	{
+		thread_counts.push_back( threads );
+	}
+	thread_counts.push_back( max_threads );
+
+	printf( "container,threads,write_pct,payload,cs_iters,ops,seconds,ops_per_sec,"
+		"read_p50_ns,read_p99_ns,read_p999_ns,write_p50_ns,write_p99_ns,write_p999_ns,max_ns\n" );
+	run_all<16>( thread_counts, milliseconds );
+	run_all<64>( thread_counts, milliseconds );
+	run_all<512>( thread_counts, milliseconds );
+	return 0;
+}
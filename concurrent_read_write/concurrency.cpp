@@ -1,4 +1,5 @@
 
+#include <cassert>
 #include <cstdio>
 #include <thread>
 #include <atomic>
@@ -8,146 +9,25 @@
 #include <functional>
 #include <vector>
 #include <utility>
+#include "containers.hpp"
+#include "seqlock.hpp"
+#include "rcu.hpp"
+#include "hash_map.hpp"
 
 
-#define READ_TIME 1
-#define WRITE_TIME 2
-
-
-template<typename T>
-class ConcurrentContainer
+// Written as a pair, so a torn read is easy to spot
+struct Pair
 {
-public:
-	ConcurrentContainer( const T &value ) :
-		data_( value ),
-		readers_( 0 ),
-		write_flag_( false )
-	{}
-
-	T get()
-	{
-		ScopedReadLock guard( *this );
-		std::this_thread::sleep_for( std::chrono::milliseconds( READ_TIME ) );
-		return data_;
-	}
-
-	void set( const T &value )
-	{
-		ScopedWriteLock guard( *this );
-		std::this_thread::sleep_for( std::chrono::milliseconds( WRITE_TIME ) );
-		data_ = value;
-	}
-
-private:
-	T data_;
-	std::atomic<int> readers_;
-	std::atomic<bool> write_flag_;
-
-	struct ScopedReadLock
-	{
-		ConcurrentContainer &container;
-
-		ScopedReadLock( ConcurrentContainer &c ) :
-			container( c )
-		{
-			container.acquire_read();
-		}
-		~ScopedReadLock()
-		{
-			container.release_read();
-		}
-	};
-
-	struct ScopedWriteLock
-	{
-		ConcurrentContainer &container;
-
-		ScopedWriteLock( ConcurrentContainer &c ) :
-			container( c )
-		{
-			container.acquire_write();
-		}
-		~ScopedWriteLock()
-		{
-			container.release_write();
-		}
-	};
-
-	inline void acquire_read()
-	{
-		// Wait until write operation is complete
-		while( write_flag_.load() == true )
-		{
-			std::this_thread::yield();
-		}
-		// Increment readers
-		readers_++;
-	}
-
-	inline void release_read()
-	{
-		// Decrease readers
-		readers_--;
-	}
-
-	inline void acquire_write()
-	{
-		// Wait until write operation is complete
-		bool expected = false;
-		while( !write_flag_.compare_exchange_strong( expected, true ) )
-		{
-			std::this_thread::yield();
-			expected = false;
-		}
-		// Wait until all read operations are complete
-		while( readers_.load() > 0 )
-		{
-			std::this_thread::yield();
-		}
-	}
-
-	inline void release_write()
-	{
-		write_flag_.store( false );
-	}
+	int value;
+	int check;
 };
 
-template<typename T>
-class MutexContainer
-{
-public:
-	MutexContainer( const T &value ) :
-		data_( value )
-	{}
-
-	T get()
-	{
-		std::lock_guard<std::mutex> lck( mtx_ );
-		std::this_thread::sleep_for( std::chrono::milliseconds( READ_TIME ) );
-		return data_;
-	}
-
-	void set( const T &value )
-	{
-		std::lock_guard<std::mutex> lck( mtx_ );
-		std::this_thread::sleep_for( std::chrono::milliseconds( WRITE_TIME ) );
-		data_ = value;
-	}
-
-private:
-	T data_;
-	std::mutex mtx_;
-};
-
-
-int main()
+template<typename Container>
+void compare( const char *name, int threads_count, int iterations )
 {
 	std::vector<std::thread> threads;
-
-	// Compare mutex lock vs concurrent container
-	int iterations = 1000;
-
-	MutexContainer<int> mc( 5 );
+	Container c( Pair{ 5, -5 } );
+	std::atomic<bool> torn( false );
 	auto start = std::chrono::steady_clock::now();
 	auto foo = [&](){
 		std::default_random_engine generator;
@@ -158,50 +38,98 @@ int main()
 			int number = distribution( generator );
 			if ( number <= 2 ) // 10% - write
 			{
-				mc.set( last );
+				c.set( Pair{ last, -last } );
 				last++;
 			} else {
-				last = mc.get();
+				Pair p = c.get();
+				if ( p.check != -p.value )
+				{
+					torn = true;
+				}
+				last = p.value;
 			}
 		}
 	};
-	threads.push_back( std::thread( foo ) );
-	threads.push_back( std::thread( foo ) );
+	for( int i = 0; i < threads_count; i++ )
+	{
+		threads.push_back( std::thread( foo ) );
+	}
 	for( auto &th : threads )
 	{
 		th.join();
 	}
 	auto end = std::chrono::steady_clock::now();
 	std::chrono::duration<double> elapsed_seconds = end-start;
-	printf( "Mutex container reached %d in %f seconds\n", mc.get(), elapsed_seconds.count() );
-	threads.clear();
+	printf( "%s reached %d in %f seconds\n", name, c.get().value, elapsed_seconds.count() );
+	assert( !torn );
+}
 
-	ConcurrentContainer<int> cc( 5 );
-	start = std::chrono::steady_clock::now();
-	auto foo2 = [&](){
-		std::default_random_engine generator;
-		std::uniform_int_distribution<int> distribution( 0, 9 );
-		int last = 0;
-		for( int i = 0; i < iterations; ++i )
+// Every thread fills its own key range while the map keeps growing, bumps a shared counter and erases even keys
+void check_map( int threads_count, int keys )
+{
+	ConcurrentHashMap<int, Pair> map;
+	std::vector<std::thread> threads;
+	std::atomic<bool> torn( false );
+	auto start = std::chrono::steady_clock::now();
+	auto foo = [&]( int index ){
+		std::default_random_engine generator( index );
+		std::uniform_int_distribution<int> distribution( 0, threads_count * keys - 1 );
+		int first = index * keys;
+		for( int k = first; k < first + keys; k++ )
 		{
-			int number = distribution( generator );
-			if ( number <= 2 ) // 10% - write
+			map.set( k, Pair{ k, -k } );
+			map.update( -1, []( Pair &p ) { p.value++; p.check--; } );
+			Pair p;
+			if ( map.get( distribution( generator ), p ) && p.check != -p.value )
 			{
-				cc.set( last );
-				last++;
-			} else {
-				last = cc.get();
+				torn = true;
 			}
 		}
+		for( int k = first; k < first + keys; k += 2 )
+		{
+			assert( map.erase( k ) );
+		}
 	};
-	threads.push_back( std::thread( foo2 ) );
-	threads.push_back( std::thread( foo2 ) );
+	for( int i = 0; i < threads_count; i++ )
+	{
+		threads.push_back( std::thread( foo, i ) );
+	}
 	for( auto &th : threads )
 	{
 		th.join();
 	}
-	end = std::chrono::steady_clock::now();
-	elapsed_seconds = end-start;
-	printf( "Concurrent container reached %d in %f seconds\n", cc.get(), elapsed_seconds.count() );
-	threads.clear();
+	auto end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed_seconds = end-start;
+	printf( "Hash map grew to %zu buckets in %f seconds\n", map.buckets(), elapsed_seconds.count() );
+	assert( !torn );
+
+	Pair counter;
+	assert( map.get( -1, counter ) && counter.value == threads_count * keys && counter.check == -counter.value );
+	assert( map.size() == static_cast<size_t>( threads_count * keys / 2 + 1 ) );
+	size_t seen = 0;
+	map.for_each( [&]( int k, const Pair &p ) {
+		assert( k == -1 || ( k % 2 == 1 && p.value == k ) );
+		seen++;
+	} );
+	assert( seen == map.size() );
+	for( int k = 0; k < threads_count * keys; k++ )
+	{
+		assert( map.contains( k ) == ( k % 2 == 1 ) );
+	}
+}
+
+int main()
+{
+	// Quick check for torn reads, see bench.cpp for measurements
+	int threads = 4;
+	int iterations = 100000;
+	compare<MutexContainer<Pair> >( "Mutex container", threads, iterations );
+	compare<ConcurrentContainer<Pair, SpinRWLock> >( "Concurrent container (spin)", threads, iterations );
+	compare<ConcurrentContainer<Pair, FutexRWLock> >( "Concurrent container (futex)", threads, iterations );
+	compare<ConcurrentContainer<Pair, StripedRWLock<> > >( "Concurrent container (striped)", threads, iterations );
+	compare<SeqlockContainer<Pair> >( "Seqlock container", threads, iterations );
+	compare<RcuContainer<Pair> >( "RCU container", threads, iterations );
+	check_map( threads, 20000 );
+	// Nearly all retired copies are freed already
+	assert( EpochDomain::instance().pending() < static_cast<size_t>( threads * iterations / 100 ) );
 }
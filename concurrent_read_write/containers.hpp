@@ -0,0 +1,94 @@
+#pragma once
+#include <mutex>
+#include <utility>
+#include "rw_lock.hpp"
+
+
+/*
+ * Containers guarding a single value.
+ *
+ * All of them, including SeqlockContainer and RcuContainer, share one interface:
+ * get()/set() copy the value out and in, read( fn ) calls fn( const T& ) and
+ * update( fn ) calls fn( T& ) on the value under the container's protection.
+ */
+
+/**
+ * Value guarded by a reader-writer lock, see rw_lock.hpp for the lock family
+ */
+template<typename T, typename Lock = StripedRWLock<> >
+class ConcurrentContainer
+{
+public:
+	ConcurrentContainer( const T &value ) :
+		data_( value )
+	{}
+
+	T get()
+	{
+		ReadGuard<Lock> guard( lock_ );
+		return data_;
+	}
+
+	void set( const T &value )
+	{
+		WriteGuard<Lock> guard( lock_ );
+		data_ = value;
+	}
+
+	template<typename Fn>
+	auto read( Fn &&fn ) -> decltype( fn( std::declval<const T&>() ) )
+	{
+		ReadGuard<Lock> guard( lock_ );
+		return fn( static_cast<const T&>( data_ ) );
+	}
+
+	template<typename Fn>
+	void update( Fn &&fn )
+	{
+		WriteGuard<Lock> guard( lock_ );
+		fn( data_ );
+	}
+
+private:
+	T data_;
+	Lock lock_;
+};
+
+template<typename T>
+class MutexContainer
+{
+public:
+	MutexContainer( const T &value ) :
+		data_( value )
+	{}
+
+	T get()
+	{
+		std::lock_guard<std::mutex> lck( mtx_ );
+		return data_;
+	}
+
+	void set( const T &value )
+	{
+		std::lock_guard<std::mutex> lck( mtx_ );
+		data_ = value;
+	}
+
+	template<typename Fn>
+	auto read( Fn &&fn ) -> decltype( fn( std::declval<const T&>() ) )
+	{
+		std::lock_guard<std::mutex> lck( mtx_ );
+		return fn( static_cast<const T&>( data_ ) );
+	}
+
+	template<typename Fn>
+	void update( Fn &&fn )
+	{
+		std::lock_guard<std::mutex> lck( mtx_ );
+		fn( data_ );
+	}
+
+private:
+	T data_;
+	std::mutex mtx_;
+};
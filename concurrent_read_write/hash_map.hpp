@@ -0,0 +1,464 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "rcu.hpp"
+
+
+/**
+ * Hash map with lock-free readers and striped writers.
+ *
+ * Buckets are singly linked lists of immutable nodes. Readers pin an epoch
+ * (see EpochDomain) and walk the lists without taking any lock. Writers lock
+ * one of Stripes mutexes chosen by the key hash, and replace or unlink whole
+ * nodes, which are freed once no reader may hold them.
+ *
+ * The table doubles in place of stopping the world: a writer which finds it
+ * too full links a twice larger table behind it, then every writer moves a
+ * chunk of buckets before doing its own work. A moved bucket is marked, so
+ * readers and writers reaching it go on to the next table. Buckets count is
+ * a multiple of Stripes, so a bucket and both of its halves in the next table
+ * are guarded by the same stripe.
+ */
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K> >
+class ConcurrentHashMap
+{
+	struct Node;
+	struct Table;
+
+public:
+	static const size_t Stripes = 64;
+
+	explicit ConcurrentHashMap( size_t capacity = 0 ) :
+		table_( new Table( buckets_for( capacity ) ) )
+	{
+		for( auto &s : stripes_ )
+		{
+			s.count.store( 0, std::memory_order_relaxed );
+		}
+	}
+
+	~ConcurrentHashMap()
+	{
+		// No readers or writers are left, a table being migrated still owns its unmoved buckets
+		Table *t = table_.load( std::memory_order_relaxed );
+		while( t )
+		{
+			for( size_t i = 0; i <= t->mask; i++ )
+			{
+				Node *head = t->buckets[i].load( std::memory_order_relaxed );
+				if ( head != moved() )
+				{
+					free_chain( head );
+				}
+			}
+			Table *next = t->next.load( std::memory_order_relaxed );
+			delete t;
+			t = next;
+		}
+	}
+
+	ConcurrentHashMap( const ConcurrentHashMap& ) = delete;
+	ConcurrentHashMap& operator=( const ConcurrentHashMap& ) = delete;
+
+	/**
+	 * Copy the value of key out
+	 * @return false if there is no such key
+	 */
+	bool get( const K &key, V &value ) const
+	{
+		return read( key, [&value]( const V &v ) { value = v; } );
+	}
+
+	bool contains( const K &key ) const
+	{
+		return read( key, []( const V& ) {} );
+	}
+
+	/**
+	 * Call fn( const V& ) on the value of key in place, never blocks
+	 * @return false if there is no such key
+	 */
+	template<typename Fn>
+	bool read( const K &key, Fn &&fn ) const
+	{
+		EpochDomain::Guard guard;
+		uint64_t h = hash( key );
+		const Table *t = table_.load( std::memory_order_acquire );
+		while( true )
+		{
+			Node *n = t->bucket( h ).load( std::memory_order_acquire );
+			if ( n == moved() )
+			{
+				t = t->next.load( std::memory_order_acquire );
+				continue;
+			}
+			for( ; n; n = n->next.load( std::memory_order_acquire ) )
+			{
+				if ( n->hash == h && equal_( n->key, key ) )
+				{
+					fn( static_cast<const V&>( n->value ) );
+					return true;
+				}
+			}
+			return false;
+		}
+	}
+
+	/**
+	 * Insert or replace
+	 * @return true if key was inserted
+	 */
+	bool set( const K &key, const V &value )
+	{
+		return modify( key, [&value]( V &v ) { v = value; }, value );
+	}
+
+	/**
+	 * Call fn( V& ) on a copy of the value and publish it, a missing key
+	 * starts from V(). Updates of the same key are serialized.
+	 * @return true if key was inserted
+	 */
+	template<typename Fn>
+	bool update( const K &key, Fn &&fn )
+	{
+		return modify( key, fn, V() );
+	}
+
+	/**
+	 * @return false if there was no such key
+	 */
+	bool erase( const K &key )
+	{
+		EpochDomain::Guard guard;
+		uint64_t h = hash( key );
+		Stripe &s = stripe( h );
+		Node *old = nullptr;
+		{
+			std::lock_guard<std::mutex> lck( s.mtx );
+			for( std::atomic<Node*> *link = &locked_bucket( h ); Node *n = link->load( std::memory_order_relaxed ); link = &n->next )
+			{
+				if ( n->hash == h && equal_( n->key, key ) )
+				{
+					link->store( n->next.load( std::memory_order_relaxed ), std::memory_order_release );
+					s.count.store( s.count.load( std::memory_order_relaxed ) - 1, std::memory_order_relaxed );
+					old = n;
+					break;
+				}
+			}
+		}
+		if ( !old )
+		{
+			return false;
+		}
+		EpochDomain::instance().retire( old );
+		return true;
+	}
+
+	/**
+	 * Call fn( const K&, const V& ) on every entry. Weakly consistent: entries
+	 * changed meanwhile may or may not be seen, but none is seen twice.
+	 */
+	template<typename Fn>
+	void for_each( Fn &&fn ) const
+	{
+		EpochDomain::Guard guard;
+		const Table *t = table_.load( std::memory_order_acquire );
+		for( size_t i = 0; i <= t->mask; i++ )
+		{
+			visit( t, i, fn );
+		}
+	}
+
+	/**
+	 * Number of entries, exact only while there are no writers
+	 */
+	size_t size() const
+	{
+		size_t total = 0;
+		for( auto &s : stripes_ )
+		{
+			total += s.count.load( std::memory_order_relaxed );
+		}
+		return total;
+	}
+
+	/**
+	 * Buckets of the current table
+	 */
+	size_t buckets() const
+	{
+		EpochDomain::Guard guard;
+		return table_.load( std::memory_order_acquire )->mask + 1;
+	}
+
+private:
+	static const size_t Chunk = 16;       // buckets moved by a writer at once
+	static const size_t MaxChain = 2;     // average chain length which triggers growth
+
+	struct Node
+	{
+		const uint64_t hash;
+		const K key;
+		const V value;
+		std::atomic<Node*> next;
+
+		Node( uint64_t h, const K &k, const V &v, Node *n ) :
+			hash( h ),
+			key( k ),
+			value( v ),
+			next( n )
+		{}
+	};
+
+	struct Table
+	{
+		const size_t mask;
+		std::unique_ptr<std::atomic<Node*>[]> buckets;
+		std::atomic<Table*> next;         // table being migrated to
+		std::atomic<size_t> claimed;      // buckets handed out to movers
+		std::atomic<size_t> done;         // buckets moved
+
+		explicit Table( size_t size ) :
+			mask( size - 1 ),
+			buckets( new std::atomic<Node*>[size] ),
+			next( nullptr ),
+			claimed( 0 ),
+			done( 0 )
+		{
+			for( size_t i = 0; i < size; i++ )
+			{
+				buckets[i].store( nullptr, std::memory_order_relaxed );
+			}
+		}
+
+		std::atomic<Node*>& bucket( uint64_t h ) const
+		{
+			return buckets[h & mask];
+		}
+	};
+
+	// Copied parts of moved buckets, freed together
+	struct Chains
+	{
+		std::vector<std::pair<Node*, Node*> > ranges;   // [first, last)
+		~Chains()
+		{
+			for( auto &r : ranges )
+			{
+				free_chain( r.first, r.second );
+			}
+		}
+	};
+
+	struct alignas( 64 ) Stripe
+	{
+		std::mutex mtx;
+		std::atomic<size_t> count;        // entries, written under mtx
+	};
+
+	std::atomic<Table*> table_;
+	Stripe stripes_[Stripes];
+	Hash hash_;
+	KeyEqual equal_;
+
+	// Marks a moved bucket, never dereferenced
+	static Node* moved()
+	{
+		static char tag;
+		return reinterpret_cast<Node*>( &tag );
+	}
+
+	static size_t buckets_for( size_t capacity )
+	{
+		size_t size = Stripes;
+		while( size * MaxChain < capacity )
+		{
+			size *= 2;
+		}
+		return size;
+	}
+
+	static void free_chain( Node *n, Node *last = nullptr )
+	{
+		while( n != last )
+		{
+			Node *next = n->next.load( std::memory_order_relaxed );
+			delete n;
+			n = next;
+		}
+	}
+
+	uint64_t hash( const K &key ) const
+	{
+		// Fold high bits into the low ones used for buckets and stripes. No full mix:
+		// std::hash of integers is identity, and neighbour keys then stay in neighbour buckets.
+		uint64_t h = hash_( key );
+		h ^= h >> 32;
+		h ^= h >> 16;
+		return h;
+	}
+
+	Stripe& stripe( uint64_t h )
+	{
+		return stripes_[h & ( Stripes - 1 )];
+	}
+
+	// Caller holds the stripe of h, follows moved buckets to the table which owns h
+	std::atomic<Node*>& locked_bucket( uint64_t h )
+	{
+		Table *t = table_.load( std::memory_order_acquire );
+		while( t->bucket( h ).load( std::memory_order_relaxed ) == moved() )
+		{
+			t = t->next.load( std::memory_order_acquire );
+		}
+		return t->bucket( h );
+	}
+
+	// Insert starts from a copy of initial
+	template<typename Fn>
+	bool modify( const K &key, Fn &&fn, const V &initial )
+	{
+		EpochDomain::Guard guard;
+		Table *t = table_.load( std::memory_order_acquire );
+		if ( t->next.load( std::memory_order_acquire ) )
+		{
+			migrate( t );
+		}
+		uint64_t h = hash( key );
+		Stripe &s = stripe( h );
+		Node *old = nullptr;
+		size_t count = 0;
+		{
+			std::lock_guard<std::mutex> lck( s.mtx );
+			std::atomic<Node*> &bucket = locked_bucket( h );
+			for( std::atomic<Node*> *link = &bucket; Node *n = link->load( std::memory_order_relaxed ); link = &n->next )
+			{
+				if ( n->hash == h && equal_( n->key, key ) )
+				{
+					V value( n->value );
+					fn( value );
+					link->store( new Node( h, key, value, n->next.load( std::memory_order_relaxed ) ), std::memory_order_release );
+					old = n;
+					break;
+				}
+			}
+			if ( !old )
+			{
+				V value( initial );
+				fn( value );
+				bucket.store( new Node( h, key, value, bucket.load( std::memory_order_relaxed ) ), std::memory_order_release );
+				count = s.count.load( std::memory_order_relaxed ) + 1;
+				s.count.store( count, std::memory_order_relaxed );
+			}
+		}
+		if ( old )
+		{
+			EpochDomain::instance().retire( old );
+			return false;
+		}
+		// Each stripe sees its share of the entries, so its own count is enough to estimate the load
+		if ( count * Stripes > ( t->mask + 1 ) * MaxChain )
+		{
+			grow( count );
+		}
+		return true;
+	}
+
+	// count is the entries of the stripe which has just grown
+	void grow( size_t count )
+	{
+		Table *t = table_.load( std::memory_order_acquire );
+		size_t limit = ( t->mask + 1 ) * MaxChain;
+		if ( count * Stripes <= limit || t->next.load( std::memory_order_acquire ) || size() <= limit / 2 )
+		{
+			// Table has grown meanwhile, is growing, or a single stripe is skewed
+			return;
+		}
+		Table *next = new Table( ( t->mask + 1 ) * 2 );
+		Table *expected = nullptr;
+		if ( !t->next.compare_exchange_strong( expected, next, std::memory_order_acq_rel ) )
+		{
+			delete next;
+		}
+	}
+
+	// Move a chunk of buckets of t to the next table
+	void migrate( Table *t )
+	{
+		Table *next = t->next.load( std::memory_order_acquire );
+		size_t size = t->mask + 1;
+		size_t start = t->claimed.fetch_add( Chunk, std::memory_order_relaxed );
+		if ( start >= size )
+		{
+			return;
+		}
+		size_t end = std::min( start + Chunk, size );
+		Chains *old = new Chains;
+		for( size_t i = start; i < end; i++ )
+		{
+			std::lock_guard<std::mutex> lck( stripes_[i & ( Stripes - 1 )].mtx );
+			Node *head = t->buckets[i].load( std::memory_order_relaxed );
+			// Readers may be walking the old chain, so it is not relinked. The tail
+			// which goes to one half as a whole is shared, the nodes before it are copied.
+			Node *tail = head;
+			for( Node *n = head; n; n = n->next.load( std::memory_order_relaxed ) )
+			{
+				if ( ( n->hash ^ tail->hash ) & next->mask )
+				{
+					tail = n;
+				}
+			}
+			if ( tail )
+			{
+				next->bucket( tail->hash ).store( tail, std::memory_order_release );
+			}
+			for( Node *n = head; n != tail; n = n->next.load( std::memory_order_relaxed ) )
+			{
+				std::atomic<Node*> &bucket = next->bucket( n->hash );
+				bucket.store( new Node( n->hash, n->key, n->value, bucket.load( std::memory_order_relaxed ) ), std::memory_order_release );
+			}
+			t->buckets[i].store( moved(), std::memory_order_release );
+			if ( head != tail )
+			{
+				old->ranges.push_back( std::make_pair( head, tail ) );
+			}
+		}
+		EpochDomain &domain = EpochDomain::instance();
+		if ( old->ranges.empty() )
+		{
+			delete old;
+		}
+		else
+		{
+			domain.retire( old );
+		}
+		if ( t->done.fetch_add( end - start, std::memory_order_acq_rel ) + ( end - start ) == size )
+		{
+			table_.store( next, std::memory_order_release );
+			domain.retire( t );
+		}
+	}
+
+	template<typename Fn>
+	static void visit( const Table *t, size_t i, Fn &fn )
+	{
+		Node *n = t->buckets[i].load( std::memory_order_acquire );
+		if ( n == moved() )
+		{
+			// Bucket i was split into i and i + size of the next table
+			const Table *next = t->next.load( std::memory_order_acquire );
+			visit( next, i, fn );
+			visit( next, i + t->mask + 1, fn );
+			return;
+		}
+		for( ; n; n = n->next.load( std::memory_order_acquire ) )
+		{
+			fn( n->key, static_cast<const V&>( n->value ) );
+		}
+	}
+};
@@ -0,0 +1,280 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "hash_map.hpp"
+#include "rw_lock.hpp"
+
+
+/*
+ * ConcurrentHashMap against std::unordered_map behind a lock.
+ *
+ * mixed - keys are inserted up front, then every thread reads and
+ *         replaces random keys for a fixed time
+ * grow  - map starts empty and small, every thread inserts its own keys,
+ *         so the table keeps growing under load
+ *
+ * Every 16th operation is timed. Results are printed as CSV, one row per
+ * run: throughput is the sum over all threads, latencies are in ns.
+ *
+ * Usage: map_bench [max threads] [milliseconds per run]
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t KeyCounts[] = { 1000, 1000000 };
+static const int WritePercents[] = { 0, 10, 50 };
+static const unsigned SampleMask = 15;
+
+template<typename Lock>
+class LockedMap
+{
+public:
+	explicit LockedMap( size_t capacity = 0 )
+	{
+		map_.reserve( capacity );
+	}
+
+	bool get( uint64_t key, uint64_t &value )
+	{
+		ReadGuard<Lock> guard( lock_ );
+		auto it = map_.find( key );
+		if ( it == map_.end() )
+		{
+			return false;
+		}
+		value = it->second;
+		return true;
+	}
+
+	bool set( uint64_t key, uint64_t value )
+	{
+		WriteGuard<Lock> guard( lock_ );
+		auto res = map_.insert( std::make_pair( key, value ) );
+		if ( !res.second )
+		{
+			res.first->second = value;
+		}
+		return res.second;
+	}
+
+private:
+	std::unordered_map<uint64_t, uint64_t> map_;
+	Lock lock_;
+};
+
+// std::mutex has no shared side
+struct MutexLock
+{
+	std::mutex mtx;
+	int lock_shared()
+	{
+		mtx.lock();
+		return 0;
+	}
+	void unlock_shared( int )
+	{
+		mtx.unlock();
+	}
+	void lock()
+	{
+		mtx.lock();
+	}
+	void unlock()
+	{
+		mtx.unlock();
+	}
+};
+
+struct Sample
+{
+	std::vector<uint32_t> latency;   // ns per sampled operation
+	uint64_t ops = 0;
+};
+
+static inline uint32_t since( Clock::time_point t )
+{
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - t ).count();
+	return ns > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>( ns );
+}
+
+static uint32_t percentile( const std::vector<uint32_t> &sorted, double p )
+{
+	if ( sorted.empty() )
+	{
+		return 0;
+	}
+	return sorted[std::min( sorted.size() - 1, static_cast<size_t>( p * sorted.size() ) )];
+}
+
+/**
+ * Run body( index, ops, rng ) in threads until the time is up or every body returns false
+ */
+template<typename Body>
+void run( const char *map, const char *scenario, int threads, size_t keys, int write_pct, int milliseconds, Body body )
+{
+	std::vector<Sample> samples( threads );
+	std::atomic<int> ready( 0 );
+	std::atomic<bool> go( false );
+	std::atomic<bool> stop( false );
+	std::atomic<int> finished( 0 );
+
+	auto worker = [&]( int index ) {
+		Sample &sample = samples[index];
+		uint64_t rng = 0x9e3779b97f4a7c15ULL * ( index + 1 );
+		ready.fetch_add( 1 );
+		while( !go.load( std::memory_order_acquire ) )
+		{
+			detail::cpu_relax();
+		}
+		uint64_t ops = 0;
+		while( !stop.load( std::memory_order_relaxed ) )
+		{
+			rng ^= rng << 13;
+			rng ^= rng >> 7;
+			rng ^= rng << 17;
+			bool sampled = ( ops & SampleMask ) == 0;
+			Clock::time_point start;
+			if ( sampled )
+			{
+				start = Clock::now();
+			}
+			if ( !body( index, ops, rng ) )
+			{
+				break;
+			}
+			if ( sampled )
+			{
+				sample.latency.push_back( since( start ) );
+			}
+			ops++;
+		}
+		sample.ops = ops;
+		finished.fetch_add( 1 );
+	};
+
+	std::vector<std::thread> workers;
+	for( int i = 0; i < threads; i++ )
+	{
+		workers.push_back( std::thread( worker, i ) );
+	}
+	while( ready.load() < threads )
+	{
+		std::this_thread::yield();
+	}
+	auto start = Clock::now();
+	go.store( true, std::memory_order_release );
+	auto deadline = start + std::chrono::milliseconds( milliseconds );
+	while( Clock::now() < deadline && finished.load() < threads )
+	{
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+	stop.store( true, std::memory_order_relaxed );
+	for( auto &w : workers )
+	{
+		w.join();
+	}
+	double seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+
+	std::vector<uint32_t> all;
+	uint64_t ops = 0;
+	for( auto &s : samples )
+	{
+		all.insert( all.end(), s.latency.begin(), s.latency.end() );
+		ops += s.ops;
+	}
+	std::sort( all.begin(), all.end() );
+	printf( "%s,%s,%d,%zu,%d,%llu,%.6f,%.0f,%u,%u,%u,%u\n", map, scenario, threads, keys, write_pct,
+		static_cast<unsigned long long>( ops ), seconds, ops / seconds,
+		percentile( all, 0.5 ), percentile( all, 0.99 ), percentile( all, 0.999 ), all.empty() ? 0 : all.back() );
+	fflush( stdout );
+}
+
+template<typename Map>
+void mixed( const char *name, int threads, size_t keys, int write_pct, int milliseconds )
+{
+	Map map( keys );
+	for( size_t k = 0; k < keys; k++ )
+	{
+		map.set( k, k );
+	}
+	run( name, "mixed", threads, keys, write_pct, milliseconds, [&]( int, uint64_t, uint64_t rng ) {
+		uint64_t key = ( rng >> 8 ) % keys;
+		if ( static_cast<int>( rng % 100 ) < write_pct )
+		{
+			map.set( key, rng );
+		} else {
+			uint64_t value;
+			if ( !map.get( key, value ) )
+			{
+				abort();
+			}
+		}
+		return true;
+	} );
+}
+
+template<typename Map>
+void grow( const char *name, int threads, size_t keys, int milliseconds )
+{
+	Map map;
+	// Threads insert disjoint keys, each stops after its share
+	size_t share = keys / threads;
+	run( name, "grow", threads, keys, 100, milliseconds, [&]( int index, uint64_t ops, uint64_t ) {
+		if ( ops >= share )
+		{
+			return false;
+		}
+		map.set( index * share + ops, ops );
+		return true;
+	} );
+}
+
+int main( int argc, char **argv )
+{
+	int max_threads = argc > 1 ? atoi( argv[1] ) : static_cast<int>( std::thread::hardware_concurrency() );
+	int milliseconds = argc > 2 ? atoi( argv[2] ) : 100;
+	if ( max_threads < 1 )
+	{
+		max_threads = 1;
+	}
+	if ( milliseconds < 1 )
+	{
+		milliseconds = 1;
+	}
+
+	std::vector<int> thread_counts;
+	for( int threads = 1; threads < max_threads; threads *= 2 )
+	{
+		thread_counts.push_back( threads );
+	}
+	thread_counts.push_back( max_threads );
+
+	typedef ConcurrentHashMap<uint64_t, uint64_t> Concurrent;
+	typedef LockedMap<MutexLock> Mutex;
+	typedef LockedMap<FutexRWLock> RWLock;
+
+	printf( "map,scenario,threads,keys,write_pct,ops,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n" );
+	for( int threads : thread_counts )
+	{
+		for( size_t keys : KeyCounts )
+		{
+			for( int write_pct : WritePercents )
+			{
+				mixed<Concurrent>( "concurrent", threads, keys, write_pct, milliseconds );
+				mixed<Mutex>( "unordered+mutex", threads, keys, write_pct, milliseconds );
+				mixed<RWLock>( "unordered+rwlock", threads, keys, write_pct, milliseconds );
+			}
+			grow<Concurrent>( "concurrent", threads, keys, milliseconds );
+			grow<Mutex>( "unordered+mutex", threads, keys, milliseconds );
+			grow<RWLock>( "unordered+rwlock", threads, keys, milliseconds );
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,301 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+
+/**
+ * Epoch-based reclamation.
+ *
+ * A reader pins the global epoch in its own per-thread record for the
+ * duration of a read section. Writers retire unlinked objects tagged with
+ * the current epoch, and the epoch advances only once every pinned reader
+ * has observed it. Object retired at epoch e can not be reached by anybody
+ * once the epoch is e + 2, then it is freed.
+ *
+ * Retired objects wait in a list of the retiring thread, which is collected
+ * every Batch retires, so writers do not share anything but the epoch.
+ */
+class EpochDomain
+{
+	struct Record;
+
+public:
+	static EpochDomain& instance()
+	{
+		static EpochDomain domain;
+		return domain;
+	}
+
+	static const size_t Batch = 64;
+
+	~EpochDomain()
+	{
+		// No readers are left at exit
+		Record *r = records_.load( std::memory_order_relaxed );
+		while( r )
+		{
+			for( auto &item : r->retired )
+			{
+				item.deleter( item.ptr );
+			}
+			Record *next = r->next;
+			delete r;
+			r = next;
+		}
+	}
+
+	EpochDomain( const EpochDomain& ) = delete;
+	EpochDomain& operator=( const EpochDomain& ) = delete;
+
+	/**
+	 * Read section, may be nested
+	 */
+	class Guard
+	{
+	public:
+		explicit Guard( EpochDomain &domain = EpochDomain::instance() ) :
+			record_( domain.record() )
+		{
+			if ( record_->depth++ == 0 )
+			{
+				record_->epoch.store( domain.epoch_.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+				// Publish the pin before reading any protected pointer
+				std::atomic_thread_fence( std::memory_order_seq_cst );
+			}
+		}
+		~Guard()
+		{
+			if ( --record_->depth == 0 )
+			{
+				record_->epoch.store( Idle, std::memory_order_release );
+			}
+		}
+
+		Guard( const Guard& ) = delete;
+		Guard& operator=( const Guard& ) = delete;
+
+	private:
+		Record *record_;
+	};
+
+	/**
+	 * Free object once no reader may hold it
+	 */
+	template<typename T>
+	void retire( T *ptr )
+	{
+		Record *r = record();
+		r->retired.push_back( Retired{ ptr, []( void *p ) { delete static_cast<T*>( p ); },
+									   epoch_.load( std::memory_order_seq_cst ) } );
+		if ( r->retired.size() >= Batch )
+		{
+			collect( r );
+		}
+		else
+		{
+			r->pending.store( r->retired.size(), std::memory_order_relaxed );
+		}
+	}
+
+	/**
+	 * Objects retired but not freed yet, by all threads
+	 */
+	size_t pending() const
+	{
+		size_t total = 0;
+		for( Record *r = records_.load( std::memory_order_acquire ); r; r = r->next )
+		{
+			total += r->pending.load( std::memory_order_relaxed );
+		}
+		return total;
+	}
+
+private:
+	static const uint64_t Idle = 0;
+
+	struct Retired
+	{
+		void *ptr;
+		void ( *deleter )( void* );
+		uint64_t epoch;
+	};
+
+	struct alignas( 64 ) Record
+	{
+		std::atomic<uint64_t> epoch;   // pinned epoch, Idle outside of read sections
+		std::atomic<bool> used;        // owned by a live thread
+		std::atomic<size_t> pending;   // retired.size() for pending()
+		unsigned depth;                // nesting, owner thread only
+		std::deque<Retired> retired;   // owner thread only, in order of epoch
+		Record *next;
+	};
+
+	// Gives the record back when its thread exits, a later thread inherits what is still retired
+	struct Owner
+	{
+		Record *record = nullptr;
+		~Owner()
+		{
+			if ( record )
+			{
+				EpochDomain::instance().collect( record );
+				record->used.store( false, std::memory_order_release );
+			}
+		}
+	};
+
+	std::atomic<uint64_t> epoch_;
+	std::atomic<Record*> records_;   // never shrinks, records are reused
+
+	EpochDomain() :
+		epoch_( 1 ),
+		records_( nullptr )
+	{}
+
+	Record* record()
+	{
+		static thread_local Owner owner;
+		if ( owner.record )
+		{
+			return owner.record;
+		}
+		for( Record *r = records_.load( std::memory_order_acquire ); r; r = r->next )
+		{
+			bool expected = false;
+			if ( !r->used.load( std::memory_order_relaxed ) &&
+				 r->used.compare_exchange_strong( expected, true, std::memory_order_acquire ) )
+			{
+				owner.record = r;
+				return r;
+			}
+		}
+		Record *r = new Record;
+		r->epoch.store( Idle, std::memory_order_relaxed );
+		r->used.store( true, std::memory_order_relaxed );
+		r->pending.store( 0, std::memory_order_relaxed );
+		r->depth = 0;
+		r->next = records_.load( std::memory_order_relaxed );
+		while( !records_.compare_exchange_weak( r->next, r, std::memory_order_release, std::memory_order_relaxed ) )
+		{}
+		owner.record = r;
+		return r;
+	}
+
+	// Called by the owner of own
+	void collect( Record *own )
+	{
+		// Pairs with the fence in Guard: either the reader sees the new pointer or we see its pin
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		uint64_t e = epoch_.load( std::memory_order_seq_cst );
+		bool advance = true;
+		for( Record *r = records_.load( std::memory_order_acquire ); r; r = r->next )
+		{
+			uint64_t pinned = r->epoch.load( std::memory_order_seq_cst );
+			if ( pinned != Idle && pinned != e )
+			{
+				advance = false;
+				break;
+			}
+		}
+		// Another thread may have advanced it meanwhile, which is as good
+		if ( advance && epoch_.compare_exchange_strong( e, e + 1, std::memory_order_seq_cst ) )
+		{
+			e++;
+		}
+		free_due( own, e );
+		// Lists left behind by exited threads are freed by whoever collects next
+		for( Record *r = records_.load( std::memory_order_acquire ); r; r = r->next )
+		{
+			bool expected = false;
+			if ( r != own && r->pending.load( std::memory_order_relaxed ) > 0 && !r->used.load( std::memory_order_relaxed ) &&
+				 r->used.compare_exchange_strong( expected, true, std::memory_order_acquire ) )
+			{
+				free_due( r, e );
+				r->used.store( false, std::memory_order_release );
+			}
+		}
+	}
+
+	// Caller owns r
+	static void free_due( Record *r, uint64_t e )
+	{
+		// Only the oldest ones can be due, a collect costs what it frees
+		while( !r->retired.empty() && r->retired.front().epoch + 2 <= e )
+		{
+			r->retired.front().deleter( r->retired.front().ptr );
+			r->retired.pop_front();
+		}
+		r->pending.store( r->retired.size(), std::memory_order_relaxed );
+	}
+};
+
+/**
+ * Value published through an atomic pointer.
+ *
+ * Readers pin an epoch and use the current copy in place, writers build a
+ * new copy, swap the pointer and retire the old one. Meant for large values
+ * which are read much more often than replaced.
+ */
+template<typename T>
+class RcuContainer
+{
+public:
+	RcuContainer( const T &value ) :
+		ptr_( new T( value ) )
+	{}
+
+	~RcuContainer()
+	{
+		delete ptr_.load( std::memory_order_relaxed );
+	}
+
+	RcuContainer( const RcuContainer& ) = delete;
+	RcuContainer& operator=( const RcuContainer& ) = delete;
+
+	T get() const
+	{
+		EpochDomain::Guard guard;
+		return *ptr_.load( std::memory_order_acquire );
+	}
+
+	/**
+	 * Call fn( const T& ) on the current value without copying it
+	 */
+	template<typename Fn>
+	auto read( Fn &&fn ) const -> decltype( fn( std::declval<const T&>() ) )
+	{
+		EpochDomain::Guard guard;
+		return fn( *ptr_.load( std::memory_order_acquire ) );
+	}
+
+	void set( const T &value )
+	{
+		std::lock_guard<std::mutex> lck( mtx_ );
+		replace( new T( value ) );
+	}
+
+	/**
+	 * Modify a copy with fn( T& ) and publish it, writers are serialized
+	 */
+	template<typename Fn>
+	void update( Fn &&fn )
+	{
+		std::lock_guard<std::mutex> lck( mtx_ );
+		T *copy = new T( *ptr_.load( std::memory_order_relaxed ) );
+		fn( *copy );
+		replace( copy );
+	}
+
+private:
+	std::atomic<T*> ptr_;
+	std::mutex mtx_;    // serializes writers
+
+	void replace( T *value )
+	{
+		T *old = ptr_.exchange( value, std::memory_order_acq_rel );
+		EpochDomain::instance().retire( old );
+	}
+};
@@ -0,0 +1,317 @@
+#pragma once
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+
+/*
+ * Reader-writer locks.
+ *
+ * All of them share one interface: lock_shared() returns a token which
+ * must be passed back to unlock_shared(), lock()/unlock() are exclusive.
+ * Use ReadGuard/WriteGuard to hold them.
+ *
+ * SpinRWLock     - writer-preferring, waiters spin and yield
+ * FutexRWLock    - writer-preferring, waiters sleep on a futex after a short spin
+ * StripedRWLock  - reader-biased (BRAVO): readers only touch their own stripe
+ *                  while no writer shows up, otherwise fall back to an underlying lock
+ */
+
+namespace detail
+{
+	inline void cpu_relax()
+	{
+#if defined( __x86_64__ ) || defined( __i386__ )
+		__builtin_ia32_pause();
+#elif defined( __aarch64__ )
+		asm volatile( "yield" );
+#endif
+	}
+
+	struct YieldWait
+	{
+		static void wait( std::atomic<uint32_t>&, uint32_t )
+		{
+			std::this_thread::yield();
+		}
+		static void wake( std::atomic<uint32_t>& )
+		{}
+	};
+
+	struct FutexWait
+	{
+		static void wait( std::atomic<uint32_t> &word, uint32_t expected )
+		{
+			// Returns right away if word is not expected any more
+			syscall( SYS_futex, reinterpret_cast<uint32_t*>( &word ), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0 );
+		}
+		static void wake( std::atomic<uint32_t> &word )
+		{
+			syscall( SYS_futex, reinterpret_cast<uint32_t*>( &word ), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0 );
+		}
+	};
+}
+
+/**
+ * Single state word: active readers, waiting writers and the writer bit.
+ * New readers stay out while any writer waits, so writers never starve.
+ */
+template <class Wait>
+class BasicRWLock
+{
+public:
+	BasicRWLock() :
+		state_( 0 ),
+		sleepers_( 0 )
+	{}
+
+	BasicRWLock( const BasicRWLock& ) = delete;
+	BasicRWLock& operator=( const BasicRWLock& ) = delete;
+
+	int lock_shared()
+	{
+		for( int spins = 0; ; spins++ )
+		{
+			uint32_t s = state_.load( std::memory_order_relaxed );
+			if ( ( s & ( Writer | WaitingMask ) ) == 0 )
+			{
+				if ( state_.compare_exchange_weak( s, s + 1, std::memory_order_acquire, std::memory_order_relaxed ) )
+				{
+					return 0;
+				}
+				continue;
+			}
+			pause( s, spins );
+		}
+	}
+
+	void unlock_shared( int )
+	{
+		uint32_t s = state_.fetch_sub( 1, std::memory_order_release ) - 1;
+		if ( ( s & ReadersMask ) == 0 && ( s & WaitingMask ) != 0 )
+		{
+			wake();
+		}
+	}
+
+	void lock()
+	{
+		state_.fetch_add( Waiting, std::memory_order_relaxed );
+		for( int spins = 0; ; spins++ )
+		{
+			uint32_t s = state_.load( std::memory_order_relaxed );
+			if ( ( s & ( Writer | ReadersMask ) ) == 0 )
+			{
+				if ( state_.compare_exchange_weak( s, ( s - Waiting ) | Writer, std::memory_order_acquire, std::memory_order_relaxed ) )
+				{
+					return;
+				}
+				continue;
+			}
+			pause( s, spins );
+		}
+	}
+
+	void unlock()
+	{
+		state_.fetch_and( ~Writer, std::memory_order_release );
+		wake();
+	}
+
+private:
+	static const uint32_t ReadersMask = 0xffff;
+	static const uint32_t Waiting = 0x10000;
+	static const uint32_t WaitingMask = 0x7fff0000;
+	static const uint32_t Writer = 0x80000000;
+	static const int SpinLimit = 64;
+
+	std::atomic<uint32_t> state_;
+	std::atomic<int> sleepers_;
+
+	void pause( uint32_t seen, int spins )
+	{
+		if ( spins < SpinLimit )
+		{
+			detail::cpu_relax();
+			return;
+		}
+		// Sleepers count is raised before checking the word, and wakers change
+		// the word before reading the count, so one of them always notices
+		sleepers_.fetch_add( 1, std::memory_order_seq_cst );
+		Wait::wait( state_, seen );
+		sleepers_.fetch_sub( 1, std::memory_order_relaxed );
+	}
+
+	void wake()
+	{
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		if ( sleepers_.load( std::memory_order_relaxed ) > 0 )
+		{
+			Wait::wake( state_ );
+		}
+	}
+};
+
+typedef BasicRWLock<detail::YieldWait> SpinRWLock;
+typedef BasicRWLock<detail::FutexWait> FutexRWLock;
+
+/**
+ * BRAVO reader bias on top of another RW lock.
+ *
+ * While the lock is biased a reader increments the counter of its own
+ * stripe (a cache line per thread group) and rechecks the bias, so readers
+ * do not share any written memory. A writer takes the underlying lock,
+ * revokes the bias and waits for the stripes to drain. The bias is restored
+ * by a slow path reader once a multiple of that revocation time has passed,
+ * which bounds the writer cost on write-heavy loads.
+ */
+template <class Lock = FutexRWLock>
+class StripedRWLock
+{
+public:
+	static const int Stripes = 64;
+
+	StripedRWLock() :
+		bias_( true ),
+		inhibit_until_( 0 )
+	{
+		for( auto &s : stripes_ )
+		{
+			s.readers.store( 0, std::memory_order_relaxed );
+		}
+	}
+
+	StripedRWLock( const StripedRWLock& ) = delete;
+	StripedRWLock& operator=( const StripedRWLock& ) = delete;
+
+	int lock_shared()
+	{
+		if ( bias_.load( std::memory_order_acquire ) )
+		{
+			int i = stripe();
+			stripes_[i].readers.fetch_add( 1, std::memory_order_seq_cst );
+			if ( bias_.load( std::memory_order_seq_cst ) )
+			{
+				return i;
+			}
+			// Writer is revoking the bias, let it proceed
+			stripes_[i].readers.fetch_sub( 1, std::memory_order_release );
+		}
+		lock_.lock_shared();
+		if ( !bias_.load( std::memory_order_relaxed ) && now() >= inhibit_until_.load( std::memory_order_relaxed ) )
+		{
+			bias_.store( true, std::memory_order_release );
+		}
+		return -1;
+	}
+
+	void unlock_shared( int token )
+	{
+		if ( token >= 0 )
+		{
+			stripes_[token].readers.fetch_sub( 1, std::memory_order_release );
+		}
+		else
+		{
+			lock_.unlock_shared( 0 );
+		}
+	}
+
+	void lock()
+	{
+		lock_.lock();
+		if ( bias_.load( std::memory_order_relaxed ) )
+		{
+			bias_.store( false, std::memory_order_seq_cst );
+			int64_t start = now();
+			for( auto &s : stripes_ )
+			{
+				while( s.readers.load( std::memory_order_seq_cst ) > 0 )
+				{
+					detail::cpu_relax();
+				}
+			}
+			int64_t end = now();
+			inhibit_until_.store( end + ( end - start ) * InhibitFactor, std::memory_order_relaxed );
+		}
+	}
+
+	void unlock()
+	{
+		lock_.unlock();
+	}
+
+private:
+	static const int InhibitFactor = 9;
+
+	struct alignas( 64 ) Stripe
+	{
+		std::atomic<int> readers;
+	};
+
+	Stripe stripes_[Stripes];
+	std::atomic<bool> bias_;
+	std::atomic<int64_t> inhibit_until_;
+	Lock lock_;
+
+	static int stripe()
+	{
+		// Threads are spread over stripes in order of their first read
+		static std::atomic<unsigned> next( 0 );
+		static thread_local int index = next.fetch_add( 1, std::memory_order_relaxed ) % Stripes;
+		return index;
+	}
+
+	static int64_t now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch() ).count();
+	}
+};
+
+template <class Lock>
+class ReadGuard
+{
+public:
+	explicit ReadGuard( Lock &lock ) :
+		lock_( lock ),
+		token_( lock.lock_shared() )
+	{}
+	~ReadGuard()
+	{
+		lock_.unlock_shared( token_ );
+	}
+
+	ReadGuard( const ReadGuard& ) = delete;
+	ReadGuard& operator=( const ReadGuard& ) = delete;
+
+private:
+	Lock &lock_;
+	int token_;
+};
+
+template <class Lock>
+class WriteGuard
+{
+public:
+	explicit WriteGuard( Lock &lock ) :
+		lock_( lock )
+	{
+		lock_.lock();
+	}
+	~WriteGuard()
+	{
+		lock_.unlock();
+	}
+
+	WriteGuard( const WriteGuard& ) = delete;
+	WriteGuard& operator=( const WriteGuard& ) = delete;
+
+private:
+	Lock &lock_;
+};
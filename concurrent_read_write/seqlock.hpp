@@ -0,0 +1,113 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include "rw_lock.hpp"
+
+
+/**
+ * Value read under a sequence lock.
+ *
+ * Readers copy the value and retry if a writer was active meanwhile, so
+ * they never write shared memory. Meant for small trivially copyable values:
+ * the value is kept as relaxed atomic words, which keeps racing copies
+ * well-defined, and a busy writer makes readers spin.
+ */
+template<typename T>
+class SeqlockContainer
+{
+	static_assert( std::is_trivially_copyable<T>::value, "SeqlockContainer needs a trivially copyable type" );
+
+public:
+	SeqlockContainer( const T &value ) :
+		seq_( 0 )
+	{
+		store( value );
+	}
+
+	T get() const
+	{
+		uint64_t words[Words];
+		while( true )
+		{
+			uint32_t before = seq_.load( std::memory_order_acquire );
+			if ( before & 1 )
+			{
+				// Writer is in the middle of an update
+				detail::cpu_relax();
+				continue;
+			}
+			for( size_t i = 0; i < Words; i++ )
+			{
+				words[i] = data_[i].load( std::memory_order_relaxed );
+			}
+			std::atomic_thread_fence( std::memory_order_acquire );
+			if ( seq_.load( std::memory_order_relaxed ) == before )
+			{
+				break;
+			}
+		}
+		// T need not be default constructible
+		alignas( T ) unsigned char raw[sizeof( T )];
+		memcpy( raw, words, sizeof( T ) );
+		return *reinterpret_cast<const T*>( raw );
+	}
+
+	void set( const T &value )
+	{
+		std::lock_guard<std::mutex> lck( mtx_ );
+		publish( value );
+	}
+
+	/**
+	 * Call fn( const T& ) on a consistent copy
+	 */
+	template<typename Fn>
+	auto read( Fn &&fn ) const -> decltype( fn( std::declval<const T&>() ) )
+	{
+		const T value = get();
+		return fn( value );
+	}
+
+	/**
+	 * Modify a copy with fn( T& ) and publish it, writers are serialized
+	 */
+	template<typename Fn>
+	void update( Fn &&fn )
+	{
+		std::lock_guard<std::mutex> lck( mtx_ );
+		T value = get();
+		fn( value );
+		publish( value );
+	}
+
+private:
+	static const size_t Words = ( sizeof( T ) + sizeof( uint64_t ) - 1 ) / sizeof( uint64_t );
+
+	std::atomic<uint32_t> seq_;     // odd while a write is in progress
+	std::atomic<uint64_t> data_[Words];
+	std::mutex mtx_;                // serializes writers
+
+	// Caller holds mtx_
+	void publish( const T &value )
+	{
+		uint32_t s = seq_.load( std::memory_order_relaxed );
+		seq_.store( s + 1, std::memory_order_relaxed );
+		std::atomic_thread_fence( std::memory_order_release );
+		store( value );
+		seq_.store( s + 2, std::memory_order_release );
+	}
+
+	void store( const T &value )
+	{
+		uint64_t words[Words] = {};
+		memcpy( words, &value, sizeof( T ) );
+		for( size_t i = 0; i < Words; i++ )
+		{
+			data_[i].store( words[i], std::memory_order_relaxed );
+		}
+	}
+};
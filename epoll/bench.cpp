@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "epoll.hpp"
+#include "co_epoll.hpp"
+
+/*
+ * Event loop microbenchmarks.
+ *
+ * Every scenario runs one independent loop per thread, for 1..N threads.
+ * Results are printed as CSV, one row per scenario and thread count:
+ * latencies are in nanoseconds, throughput is the sum over all threads.
+ *
+ * Usage: epoll_bench [max threads] [events per thread]
+ */
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+static constexpr int IdlePipes = 256;
+
+struct Pipe
+{
+	int r;
+	int w;
+	Pipe()
+	{
+		int fd[2];
+		if (pipe2(fd, O_NONBLOCK) != 0)
+		{
+			perror("pipe2");
+			exit(1);
+		}
+		r = fd[0];
+		w = fd[1];
+	}
+	Pipe(const Pipe&) = delete;
+	Pipe& operator=(const Pipe&) = delete;
+	~Pipe()
+	{
+		close(r);
+		close(w);
+	}
+};
+
+struct Sample
+{
+	std::vector<uint32_t> latency; // ns per event
+	uint64_t events = 0;
+};
+
+static inline uint32_t Since(Clock::time_point t)
+{
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t).count();
+	return ns > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(ns);
+}
+
+static void Ping(int fd)
+{
+	char c = 'A';
+	if (write(fd, &c, 1) != 1)
+	{
+		abort();
+	}
+}
+
+static void Drain(int fd)
+{
+	char buf[64];
+	while (read(fd, buf, sizeof(buf)) > 0)
+	{}
+}
+
+// Two pipes bounce a byte between two callbacks of the same loop
+static void PipePingPong(Sample& s, int count, int idle)
+{
+	Pipe a, b;
+	std::vector<Pipe> idle_pipes(idle);
+	Epoll poll;
+	Clock::time_point sent;
+	int left = count;
+	for(auto& p : idle_pipes)
+	{
+		poll.Add(p.r, {Epoll::Event::In});
+	}
+	poll.Add(a.r, {Epoll::Event::In}, [&](int fd, Epoll::Event) {
+		s.latency.push_back(Since(sent));
+		Drain(fd);
+		sent = Clock::now();
+		Ping(b.w);
+	});
+	poll.Add(b.r, {Epoll::Event::In}, [&](int fd, Epoll::Event) {
+		s.latency.push_back(Since(sent));
+		Drain(fd);
+		if (--left > 0)
+		{
+			sent = Clock::now();
+			Ping(a.w);
+		}
+	});
+	sent = Clock::now();
+	Ping(a.w);
+	while (left > 0)
+	{
+		poll.Wait(1s);
+	}
+	s.events += count * 2;
+}
+
+static CoEpoll::Task<> CoBounce(CoEpoll& loop, int in, int out, int count, Clock::time_point& sent, Sample& s, bool last)
+{
+	for(int i = 0; i < count; i++)
+	{
+		co_await loop.Readable(in);
+		s.latency.push_back(Since(sent));
+		Drain(in);
+		if (!last || i + 1 < count)
+		{
+			sent = Clock::now();
+			Ping(out);
+		}
+	}
+}
+
+// Same as pipe ping-pong, with coroutines resumed by CoEpoll
+static void CoPingPong(Sample& s, int count, int idle)
+{
+	Pipe a, b;
+	std::vector<Pipe> idle_pipes(idle);
+	CoEpoll loop;
+	Clock::time_point sent;
+	for(auto& p : idle_pipes)
+	{
+		// Keep idle descriptors registered for the whole run
+		loop.Spawn([](CoEpoll& loop, int fd) -> CoEpoll::Task<> {
+			co_await loop.Readable(fd);
+		}(loop, p.r));
+	}
+	loop.Spawn(CoBounce(loop, a.r, b.w, count, sent, s, false));
+	loop.Spawn(CoBounce(loop, b.r, a.w, count, sent, s, true));
+	sent = Clock::now();
+	Ping(a.w);
+	while (loop.Tasks() > static_cast<size_t>(idle))
+	{
+		loop.Wait(1s);
+	}
+	s.events += count * 2;
+}
+
+// Another thread signals eventfd, loop measures wakeup latency
+static void EventfdWakeup(Sample& s, int count)
+{
+	int efd = eventfd(0, EFD_NONBLOCK);
+	std::atomic<int64_t> sent(0);
+	std::atomic<int> acked(0);
+	int received = 0;
+	Epoll poll;
+	poll.Add(efd, {Epoll::Event::In}, [&](int fd, Epoll::Event) {
+		eventfd_t v;
+		eventfd_read(fd, &v);
+		s.latency.push_back(Since(Clock::time_point(Clock::duration(sent.load(std::memory_order_acquire)))));
+		received++;
+		acked.store(received, std::memory_order_release);
+	});
+	std::thread producer([&]() {
+		for(int i = 1; i <= count; i++)
+		{
+			sent.store(Clock::now().time_since_epoch().count(), std::memory_order_release);
+			eventfd_write(efd, 1);
+			// One event in flight at a time, so every wakeup is measured
+			while (acked.load(std::memory_order_acquire) < i)
+			{
+				std::this_thread::yield();
+			}
+		}
+	});
+	while (received < count)
+	{
+		poll.Wait(1s);
+	}
+	producer.join();
+	close(efd);
+	s.events += count;
+}
+
+// Cost of registering and unregistering a descriptor
+static void AddRemoveChurn(Sample& s, int count)
+{
+	Pipe p;
+	Epoll poll;
+	for(int i = 0; i < count; i++)
+	{
+		auto start = Clock::now();
+		poll.Add(p.r, {Epoll::Event::In}, [](int, Epoll::Event) {});
+		poll.Remove(p.r);
+		s.latency.push_back(Since(start));
+	}
+	s.events += count;
+}
+
+static void Run(const char* name, int threads, int count, const std::function<void(Sample&, int)>& fn)
+{
+	std::vector<Sample> samples(threads);
+	std::vector<std::thread> workers;
+	for(auto& s : samples)
+	{
+		s.latency.reserve(count * 2);
+	}
+	auto start = Clock::now();
+	for(int t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&, t]() {
+			fn(samples[t], count);
+		});
+	}
+	for(auto& w : workers)
+	{
+		w.join();
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::vector<uint32_t> all;
+	uint64_t events = 0;
+	for(auto& s : samples)
+	{
+		all.insert(all.end(), s.latency.begin(), s.latency.end());
+		events += s.events;
+	}
+	std::sort(all.begin(), all.end());
+	auto pct = [&](double p) -> uint32_t {
+		if (all.empty())
+		{
+			return 0;
+		}
+		return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))];
+	};
+	printf("%s,%d,%llu,%.6f,%.0f,%u,%u,%u,%u,%u\n", name, threads,
+		static_cast<unsigned long long>(events), seconds, events / seconds,
+		pct(0.5), pct(0.9), pct(0.99), pct(0.999), all.empty() ? 0 : all.back());
+	fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+	int max_threads = argc > 1 ? atoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+	int count = argc > 2 ? atoi(argv[2]) : 100000;
+	if (max_threads < 1)
+	{
+		max_threads = 1;
+	}
+
+	// Idle descriptors of all threads must fit
+	struct rlimit lim;
+	if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+	{
+		lim.rlim_cur = lim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &lim);
+	}
+
+	printf("scenario,threads,events,seconds,events_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+	std::vector<int> thread_counts;
+	for(int threads = 1; threads < max_threads; threads *= 2)
+	{
+		thread_counts.push_back(threads);
+	}
+	thread_counts.push_back(max_threads);
+	for(int threads : thread_counts)
+	{
+		Run("pipe_pingpong", threads, count, [](Sample& s, int n) { PipePingPong(s, n, 0); });
+		Run("co_pipe_pingpong", threads, count, [](Sample& s, int n) { CoPingPong(s, n, 0); });
+		Run("idle_fds_pingpong", threads, count, [](Sample& s, int n) { PipePingPong(s, n, IdlePipes); });
+		Run("co_idle_fds_pingpong", threads, count, [](Sample& s, int n) { CoPingPong(s, n, IdlePipes); });
+		Run("eventfd_wakeup", threads, count, EventfdWakeup);
+		Run("add_remove_churn", threads, count, AddRemoveChurn);
+	}
+	return 0;
+}
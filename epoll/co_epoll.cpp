@@ -0,0 +1,400 @@
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <new>
+#include "co_epoll.hpp"
+
+#define COUNTOF(X) (sizeof(X) / sizeof(X[0]))
+
+static constexpr uint32_t ReadHangup = EPOLLRDHUP | EPOLLERR | EPOLLHUP;
+static constexpr uint32_t WriteHangup = EPOLLERR | EPOLLHUP;
+
+// Frame header keeps the size class, so frames can be released without the loop at hand
+struct CoEpoll::FramePool::Header
+{
+	FramePool* pool;
+	size_t cls;
+};
+
+CoEpoll::FramePool::FramePool() :
+	m_free()
+{}
+
+CoEpoll::FramePool::~FramePool()
+{
+	for(auto& head : m_free)
+	{
+		while (head)
+		{
+			FreeNode* next = head->next;
+			::operator delete(reinterpret_cast<Header*>(head) - 1);
+			head = next;
+		}
+	}
+}
+
+void* CoEpoll::FramePool::Allocate(size_t size)
+{
+	size_t cls = (size + Granularity - 1) / Granularity;
+	if (cls < Classes && m_free[cls])
+	{
+		FreeNode* node = m_free[cls];
+		m_free[cls] = node->next;
+		return node;
+	}
+	// Oversized frames are not pooled
+	Header* h = static_cast<Header*>(::operator new(sizeof(Header) + (cls < Classes ? cls * Granularity : size)));
+	h->pool = cls < Classes ? this : nullptr;
+	h->cls = cls;
+	return h + 1;
+}
+
+void CoEpoll::FramePool::Deallocate(void* ptr)
+{
+	Header* h = static_cast<Header*>(ptr) - 1;
+	if (!h->pool)
+	{
+		::operator delete(h);
+		return;
+	}
+	FreeNode* node = static_cast<FreeNode*>(ptr);
+	node->next = h->pool->m_free[h->cls];
+	h->pool->m_free[h->cls] = node;
+}
+
+bool CoEpoll::IoAwaiter::await_suspend(std::coroutine_handle<> h)
+{
+	m_handle = h;
+	// Resume immediately (with Hangup) if descriptor can not be watched
+	return m_loop.Watch(*this);
+}
+
+void CoEpoll::SleepAwaiter::await_suspend(std::coroutine_handle<> h)
+{
+	m_loop.m_timers.push(Timer{m_deadline, m_loop.m_timer_seq++, h});
+}
+
+CoEpoll::CoEpoll() :
+	m_fd(epoll_create1(EPOLL_CLOEXEC)),
+	m_wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+	m_stop(false),
+	m_timer_seq(0),
+	m_slots(),
+	m_dirty(),
+	m_timers(),
+	m_tasks(nullptr),
+	m_task_count(0),
+	m_pool()
+{
+	struct epoll_event evt{0};
+	evt.data.fd = -1;
+	evt.events = EPOLLIN;
+	if (m_wake_fd >= 0 && epoll_ctl(m_fd, EPOLL_CTL_ADD, m_wake_fd, &evt) < 0)
+	{
+		close(m_wake_fd);
+		m_wake_fd = -1;
+	}
+}
+
+CoEpoll::~CoEpoll()
+{
+	// Tear down suspended tasks while the frame pool is still alive
+	while (m_tasks)
+	{
+		PromiseBase* p = m_tasks;
+		Unlink(*p);
+		std::coroutine_handle<PromiseBase>::from_promise(*p).destroy();
+	}
+	if (m_wake_fd >= 0)
+	{
+		close(m_wake_fd);
+	}
+	if (m_fd >= 0)
+	{
+		close(m_fd);
+	}
+}
+
+CoEpoll::operator bool() const
+{
+	return m_fd >= 0;
+}
+
+CoEpoll::IoAwaiter CoEpoll::Readable(int fd)
+{
+	return IoAwaiter(*this, fd, EPOLLIN);
+}
+
+CoEpoll::IoAwaiter CoEpoll::Writable(int fd)
+{
+	return IoAwaiter(*this, fd, EPOLLOUT);
+}
+
+bool CoEpoll::Watch(IoAwaiter& awaiter)
+{
+	int fd = awaiter.m_fd;
+	if (!operator bool() || fd < 0)
+	{
+		return false;
+	}
+	if (static_cast<size_t>(fd) >= m_slots.size())
+	{
+		m_slots.resize(fd + 1, Slot{nullptr, nullptr, 0, false});
+	}
+	Slot& slot = m_slots[fd];
+	IoAwaiter*& waiter = awaiter.m_events == EPOLLIN ? slot.reader : slot.writer;
+	if (waiter)
+	{
+		// Only one reader and one writer per descriptor
+		return false;
+	}
+	waiter = &awaiter;
+	// Registration is synced lazily before next wait, so a task re-awaiting
+	// the same descriptor from its resumption costs no syscall
+	if (!slot.dirty)
+	{
+		slot.dirty = true;
+		m_dirty.push_back(fd);
+	}
+	return true;
+}
+
+bool CoEpoll::Remove(int fd)
+{
+	if (fd < 0 || static_cast<size_t>(fd) >= m_slots.size())
+	{
+		return false;
+	}
+	Slot& slot = m_slots[fd];
+	bool ret = slot.armed != 0;
+	if (ret)
+	{
+		epoll_ctl(m_fd, EPOLL_CTL_DEL, fd, nullptr);
+		slot.armed = 0;
+	}
+	// Pending waiters are resumed with Hangup
+	IoAwaiter* r = std::exchange(slot.reader, nullptr);
+	IoAwaiter* w = std::exchange(slot.writer, nullptr);
+	if (r)
+	{
+		r->m_result = Epoll::Event::Hangup;
+		r->m_handle.resume();
+	}
+	if (w)
+	{
+		w->m_result = Epoll::Event::Hangup;
+		w->m_handle.resume();
+	}
+	return ret;
+}
+
+void CoEpoll::Update()
+{
+	for(size_t i = 0; i < m_dirty.size(); i++)
+	{
+		int fd = m_dirty[i];
+		Slot& slot = m_slots[fd];
+		slot.dirty = false;
+		uint32_t wanted = (slot.reader ? EPOLLIN | EPOLLRDHUP : 0) | (slot.writer ? static_cast<uint32_t>(EPOLLOUT) : 0);
+		if (wanted == slot.armed)
+		{
+			continue;
+		}
+		struct epoll_event event{0};
+		event.events = wanted;
+		event.data.fd = fd;
+		int ret = 0;
+		if (wanted == 0)
+		{
+			ret = epoll_ctl(m_fd, EPOLL_CTL_DEL, fd, nullptr);
+		}
+		else if (slot.armed == 0)
+		{
+			ret = epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &event);
+		}
+		else
+		{
+			ret = epoll_ctl(m_fd, EPOLL_CTL_MOD, fd, &event);
+			if (ret < 0 && errno == ENOENT)
+			{
+				// Descriptor was closed and reused behind our back
+				ret = epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &event);
+			}
+		}
+		slot.armed = ret == 0 ? wanted : 0;
+		if (ret < 0 && wanted != 0)
+		{
+			// Can not watch, resume waiters with Hangup
+			IoAwaiter* r = std::exchange(slot.reader, nullptr);
+			IoAwaiter* w = std::exchange(slot.writer, nullptr);
+			if (r)
+			{
+				r->m_result = Epoll::Event::Hangup;
+				r->m_handle.resume();
+			}
+			if (w)
+			{
+				w->m_result = Epoll::Event::Hangup;
+				w->m_handle.resume();
+			}
+		}
+	}
+	m_dirty.clear();
+}
+
+void CoEpoll::Expire()
+{
+	auto now = std::chrono::steady_clock::now();
+	while (!m_timers.empty() && m_timers.top().deadline <= now)
+	{
+		auto h = m_timers.top().handle;
+		m_timers.pop();
+		h.resume();
+	}
+}
+
+bool CoEpoll::Wait(const timespec* timeout)
+{
+	if (!operator bool())
+	{
+		return false;
+	}
+	Update();
+	timespec next;
+	if (!m_timers.empty())
+	{
+		auto left = m_timers.top().deadline - std::chrono::steady_clock::now();
+		if (left < left.zero())
+		{
+			left = left.zero();
+		}
+		auto sec = std::chrono::duration_cast<std::chrono::seconds>(left);
+		next = timespec{sec.count(), std::chrono::duration_cast<std::chrono::nanoseconds>(left - sec).count()};
+		if (!timeout || next.tv_sec < timeout->tv_sec ||
+			(next.tv_sec == timeout->tv_sec && next.tv_nsec < timeout->tv_nsec))
+		{
+			timeout = &next;
+		}
+	}
+	struct epoll_event events[64];
+	int n = epoll_pwait2(m_fd, events, COUNTOF(events), timeout, nullptr);
+	if (n < 0 && errno != EINTR)
+	{
+		return false;
+	}
+	for(int i = 0; i < n; i++)
+	{
+		int fd = events[i].data.fd;
+		if (fd < 0)
+		{
+			// Wakeup requested
+			eventfd_t val;
+			eventfd_read(m_wake_fd, &val);
+			m_stop = true;
+			continue;
+		}
+		// Waiters are cleared before resuming, tasks may await again right away
+		uint32_t e = events[i].events;
+		if (e & (EPOLLIN | ReadHangup))
+		{
+			IoAwaiter* r = std::exchange(m_slots[fd].reader, nullptr);
+			if (r)
+			{
+				r->m_result = (e & ReadHangup) ? Epoll::Event::Hangup : Epoll::Event::In;
+				r->m_handle.resume();
+			}
+		}
+		if (e & (EPOLLOUT | WriteHangup))
+		{
+			IoAwaiter* w = std::exchange(m_slots[fd].writer, nullptr);
+			if (w)
+			{
+				w->m_result = (e & WriteHangup) ? Epoll::Event::Hangup : Epoll::Event::Out;
+				w->m_handle.resume();
+			}
+		}
+		Slot& slot = m_slots[fd];
+		if (!slot.dirty)
+		{
+			slot.dirty = true;
+			m_dirty.push_back(fd);
+		}
+	}
+	Expire();
+	return true;
+}
+
+bool CoEpoll::Wait()
+{
+	return Wait(nullptr);
+}
+
+bool CoEpoll::Run()
+{
+	m_stop = false;
+	while (m_task_count > 0 && !m_stop)
+	{
+		if (!Wait(nullptr))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void CoEpoll::StopWait() const
+{
+	if (!operator bool())
+	{
+		return;
+	}
+	eventfd_write(m_wake_fd, 1);
+}
+
+void CoEpoll::Spawn(Task<void>&& task)
+{
+	auto h = std::exchange(task.m_handle, nullptr);
+	if (!h)
+	{
+		return;
+	}
+	PromiseBase& p = h.promise();
+	p.m_detached = true;
+	Link(p);
+	h.resume();
+}
+
+size_t CoEpoll::Tasks() const
+{
+	return m_task_count;
+}
+
+void CoEpoll::Link(PromiseBase& p)
+{
+	p.m_prev = nullptr;
+	p.m_next = m_tasks;
+	if (m_tasks)
+	{
+		m_tasks->m_prev = &p;
+	}
+	m_tasks = &p;
+	m_task_count++;
+}
+
+void CoEpoll::Unlink(PromiseBase& p)
+{
+	if (p.m_prev)
+	{
+		p.m_prev->m_next = p.m_next;
+	}
+	else
+	{
+		m_tasks = p.m_next;
+	}
+	if (p.m_next)
+	{
+		p.m_next->m_prev = p.m_prev;
+	}
+	m_task_count--;
+}
@@ -0,0 +1,398 @@
+#pragma once
+#include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <queue>
+#include <utility>
+#include <vector>
+#include "epoll.hpp"
+
+
+/**
+ * Coroutine flavour of the Epoll event loop.
+ *
+ * Instead of registering callbacks, tasks suspend on `co_await loop.Readable(fd)`,
+ * `co_await loop.Writable(fd)` or `co_await loop.Sleep(duration)` and are resumed
+ * directly from the dispatch loop. Waiters are looked up by fd in a flat table and
+ * resumed through their coroutine handle, so no map lookup or std::function call
+ * is involved.
+ *
+ * Every coroutine returning CoEpoll::Task<> must take `CoEpoll&` as its first
+ * parameter: its frame is allocated from that loop's frame pool. Tasks must not
+ * outlive the loop. The loop is single-threaded, only StopWait() may be called
+ * from another thread.
+ */
+struct CoEpoll
+{
+	template<typename T = void>
+	struct Task;
+
+	CoEpoll();
+	CoEpoll(const CoEpoll&) = delete;
+	CoEpoll(CoEpoll&&) = delete;
+	CoEpoll& operator=(const CoEpoll&) = delete;
+	CoEpoll& operator=(CoEpoll&&) = delete;
+	~CoEpoll();
+	operator bool() const;
+
+	struct IoAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+		bool await_suspend(std::coroutine_handle<> h);
+		Epoll::Event await_resume() const noexcept { return m_result; }
+
+	private:
+		friend struct CoEpoll;
+		IoAwaiter(CoEpoll& loop, int fd, uint32_t e) :
+			m_loop(loop), m_fd(fd), m_events(e), m_result(Epoll::Event::Hangup), m_handle()
+		{}
+		CoEpoll& m_loop;
+		int m_fd;
+		uint32_t m_events;
+		Epoll::Event m_result;
+		std::coroutine_handle<> m_handle;
+	};
+
+	struct SleepAwaiter
+	{
+		bool await_ready() const noexcept { return m_deadline <= std::chrono::steady_clock::now(); }
+		void await_suspend(std::coroutine_handle<> h);
+		void await_resume() const noexcept {}
+
+	private:
+		friend struct CoEpoll;
+		SleepAwaiter(CoEpoll& loop, std::chrono::steady_clock::time_point deadline) :
+			m_loop(loop), m_deadline(deadline)
+		{}
+		CoEpoll& m_loop;
+		std::chrono::steady_clock::time_point m_deadline;
+	};
+
+	/**
+	 * @brief Suspend until descriptor becomes readable
+	 * @param[in] fd - file descriptor
+	 * @return awaitable yielding Event::In or Event::Hangup
+	 */
+	IoAwaiter Readable(int fd);
+
+	/**
+	 * @brief Suspend until descriptor becomes writable
+	 * @param[in] fd - file descriptor
+	 * @return awaitable yielding Event::Out or Event::Hangup
+	 */
+	IoAwaiter Writable(int fd);
+
+	/**
+	 * @brief Suspend for given duration
+	 * @param[in] duration - sleep time
+	 */
+	template<class Rep, class Period>
+	SleepAwaiter Sleep(const std::chrono::duration<Rep, Period>& duration)
+	{
+		return SleepAwaiter(*this, std::chrono::steady_clock::now() +
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration));
+	}
+
+	/**
+	 * @brief Remove descriptor from the watch list (call before closing it)
+	 * @param[in] fd - file descriptor
+	 * @return true if descriptor was watched
+	 */
+	bool Remove(int fd);
+
+	/**
+	 * @brief Start task detached, its frame is released once it completes
+	 * @param[in] task - task to run (must be returned by a coroutine taking this loop)
+	 */
+	void Spawn(Task<void>&& task);
+
+	/**
+	 * @brief Number of spawned tasks which have not completed yet
+	 */
+	size_t Tasks() const;
+
+	/**
+	 * @brief Wait for pending events and resume waiting tasks
+	 * @param[in] duration - maximum wait time
+	 * @return true if events were dispatched or timeout occured
+	 * @return false on error
+	 */
+	template<class Rep, class Period>
+	bool Wait(const std::chrono::duration<Rep, Period>& duration)
+	{
+		auto sec = std::chrono::duration_cast<std::chrono::seconds>(duration);
+		auto timeout = timespec{sec.count(), std::chrono::duration_cast<std::chrono::nanoseconds>(duration - sec).count()};
+		return Wait(&timeout);
+	}
+	bool Wait();
+
+	/**
+	 * @brief Dispatch events until all spawned tasks complete or StopWait() is called
+	 * @return false on error
+	 */
+	bool Run();
+
+	/**
+	 * @brief Leave waiting state (thread-safe)
+	 */
+	void StopWait() const;
+
+private:
+	struct PromiseBase;
+
+	// Size-class free lists for coroutine frames, owned by the loop
+	struct FramePool
+	{
+		static constexpr size_t Granularity = 64;
+		static constexpr size_t Classes = 64;
+
+		FramePool();
+		FramePool(const FramePool&) = delete;
+		FramePool& operator=(const FramePool&) = delete;
+		~FramePool();
+		void* Allocate(size_t size);
+		static void Deallocate(void* ptr);
+
+	private:
+		struct Header;
+		struct FreeNode
+		{
+			FreeNode* next;
+		};
+		FreeNode* m_free[Classes];
+	};
+
+	struct Slot
+	{
+		IoAwaiter* reader;
+		IoAwaiter* writer;
+		uint32_t armed;
+		bool dirty;
+	};
+
+	struct Timer
+	{
+		std::chrono::steady_clock::time_point deadline;
+		uint64_t seq;
+		std::coroutine_handle<> handle;
+		bool operator>(const Timer& rhs) const
+		{
+			return deadline != rhs.deadline ? deadline > rhs.deadline : seq > rhs.seq;
+		}
+	};
+
+	int m_fd;
+	int m_wake_fd;
+	bool m_stop;
+	uint64_t m_timer_seq;
+	std::vector<Slot> m_slots;
+	std::vector<int> m_dirty;
+	std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> m_timers;
+	PromiseBase* m_tasks;
+	size_t m_task_count;
+	FramePool m_pool;
+
+	bool Wait(const timespec* timeout);
+	bool Watch(IoAwaiter& awaiter);
+	void Update();
+	void Expire();
+	void Link(PromiseBase& p);
+	void Unlink(PromiseBase& p);
+};
+
+struct CoEpoll::PromiseBase
+{
+	PromiseBase(CoEpoll& loop) :
+		m_loop(loop), m_continuation(), m_exception(), m_detached(false), m_prev(nullptr), m_next(nullptr)
+	{}
+
+	// Frames of every coroutine running on the loop come from its pool.
+	// Inlined so that GCC does not pair the template with the non-template
+	// delete below and report -Wmismatched-new-delete at every coroutine.
+	template<typename... Args>
+	[[gnu::always_inline]] static void* operator new(size_t size, CoEpoll& loop, Args&...)
+	{
+		return loop.m_pool.Allocate(size);
+	}
+	// Member function coroutines: skip the implicit object argument
+	template<typename Class, typename... Args>
+	[[gnu::always_inline]] static void* operator new(size_t size, Class&, CoEpoll& loop, Args&...)
+	{
+		return loop.m_pool.Allocate(size);
+	}
+	static void operator delete(void* ptr)
+	{
+		FramePool::Deallocate(ptr);
+	}
+	// Sized form, preferred for coroutine frames
+	static void operator delete(void* ptr, size_t)
+	{
+		FramePool::Deallocate(ptr);
+	}
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+		{
+			PromiseBase& p = h.promise();
+			if (p.m_detached)
+			{
+				if (p.m_exception)
+				{
+					std::terminate();
+				}
+				p.m_loop.Unlink(p);
+				h.destroy();
+				return std::noop_coroutine();
+			}
+			if (p.m_continuation)
+			{
+				return p.m_continuation;
+			}
+			return std::noop_coroutine();
+		}
+		void await_resume() const noexcept {}
+	};
+	FinalAwaiter final_suspend() noexcept { return {}; }
+
+	void unhandled_exception()
+	{
+		m_exception = std::current_exception();
+	}
+
+	CoEpoll& m_loop;
+	std::coroutine_handle<> m_continuation;
+	std::exception_ptr m_exception;
+	bool m_detached;
+	PromiseBase* m_prev;
+	PromiseBase* m_next;
+};
+
+/**
+ * Lazily started coroutine. Either co_await it from another task
+ * or hand it over to CoEpoll::Spawn().
+ */
+template<typename T>
+struct CoEpoll::Task
+{
+	struct promise_type : PromiseBase
+	{
+		template<typename... Args>
+		promise_type(CoEpoll& loop, Args&...) : PromiseBase(loop) {}
+		template<typename Class, typename... Args>
+		promise_type(Class&, CoEpoll& loop, Args&...) : PromiseBase(loop) {}
+
+		Task get_return_object()
+		{
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		template<typename V>
+		void return_value(V&& value)
+		{
+			m_value.emplace(std::forward<V>(value));
+		}
+
+	private:
+		friend struct Task;
+		std::optional<T> m_value;
+	};
+
+	Task(Task&& rhs) : m_handle(std::exchange(rhs.m_handle, nullptr)) {}
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+	Task& operator=(Task&& rhs)
+	{
+		std::swap(m_handle, rhs.m_handle);
+		return *this;
+	}
+	~Task()
+	{
+		if (m_handle)
+		{
+			m_handle.destroy();
+		}
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		m_handle.promise().m_continuation = h;
+		return m_handle;
+	}
+	T await_resume()
+	{
+		auto& p = m_handle.promise();
+		if (p.m_exception)
+		{
+			std::rethrow_exception(p.m_exception);
+		}
+		return std::move(*p.m_value);
+	}
+
+private:
+	friend struct CoEpoll;
+	std::coroutine_handle<promise_type> m_handle;
+	explicit Task(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+};
+
+template<>
+struct CoEpoll::Task<void>
+{
+	struct promise_type : PromiseBase
+	{
+		template<typename... Args>
+		promise_type(CoEpoll& loop, Args&...) : PromiseBase(loop) {}
+		template<typename Class, typename... Args>
+		promise_type(Class&, CoEpoll& loop, Args&...) : PromiseBase(loop) {}
+
+		Task get_return_object()
+		{
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		void return_void() {}
+	};
+
+	Task(Task&& rhs) : m_handle(std::exchange(rhs.m_handle, nullptr)) {}
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+	Task& operator=(Task&& rhs)
+	{
+		std::swap(m_handle, rhs.m_handle);
+		return *this;
+	}
+	~Task()
+	{
+		if (m_handle)
+		{
+			m_handle.destroy();
+		}
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		m_handle.promise().m_continuation = h;
+		return m_handle;
+	}
+	void await_resume()
+	{
+		auto& p = m_handle.promise();
+		if (p.m_exception)
+		{
+			std::rethrow_exception(p.m_exception);
+		}
+	}
+
+private:
+	friend struct CoEpoll;
+	std::coroutine_handle<promise_type> m_handle;
+	explicit Task(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+};
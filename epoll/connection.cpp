@@ -0,0 +1,375 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "connection.hpp"
+
+#define READ_CHUNK 16384
+#define READ_LIMIT (4 * READ_CHUNK) // per event, lets other descriptors be served
+#define IOV_COUNT 64
+
+Connection::Connection(Epoll& poll, int fd) :
+	m_poll(poll),
+	m_fd(fd),
+	m_socket(true),
+	m_out_armed(false),
+	m_above_high(false),
+	m_read(),
+	m_read_pos(0),
+	m_read_end(0),
+	m_queue(),
+	m_queue_pos(0),
+	m_pending(0),
+	m_low(0),
+	m_high(1 << 20),
+	m_on_read(),
+	m_on_close(),
+	m_on_high(),
+	m_on_low()
+{
+	if (m_fd < 0)
+	{
+		return;
+	}
+	int flags = fcntl(m_fd, F_GETFL);
+	if (flags < 0 || fcntl(m_fd, F_SETFL, flags | O_NONBLOCK) < 0 ||
+		!m_poll.Add(m_fd, {Epoll::Event::In, Epoll::Event::Hangup},
+			[this](int, Epoll::Event e) { Handle(e); }))
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+}
+
+Connection::~Connection()
+{
+	if (m_fd >= 0)
+	{
+		m_poll.Remove(m_fd);
+		close(m_fd);
+	}
+}
+
+Connection::operator bool() const
+{
+	return m_fd >= 0;
+}
+
+int Connection::Fd() const
+{
+	return m_fd;
+}
+
+void Connection::OnRead(Handler cb)
+{
+	m_on_read = cb;
+}
+
+void Connection::OnClose(Handler cb)
+{
+	m_on_close = cb;
+}
+
+void Connection::SetWatermarks(size_t low, size_t high)
+{
+	m_low = low;
+	m_high = high;
+}
+
+void Connection::OnHighWatermark(Handler cb)
+{
+	m_on_high = cb;
+}
+
+void Connection::OnLowWatermark(Handler cb)
+{
+	m_on_low = cb;
+}
+
+const char* Connection::Data() const
+{
+	return m_read.data() + m_read_pos;
+}
+
+size_t Connection::Size() const
+{
+	return m_read_end - m_read_pos;
+}
+
+void Connection::Consume(size_t n)
+{
+	m_read_pos += n < Size() ? n : Size();
+	if (m_read_pos == m_read_end)
+	{
+		m_read_pos = m_read_end = 0;
+	}
+}
+
+bool Connection::Write(const void* data, size_t size)
+{
+	if (m_fd < 0)
+	{
+		return false;
+	}
+	if (size == 0)
+	{
+		return true;
+	}
+	const char* p = static_cast<const char*>(data);
+	if (m_queue.empty())
+	{
+		struct iovec iov{const_cast<char*>(p), size};
+		ssize_t n = Send(&iov, 1);
+		if (n < 0)
+		{
+			return false;
+		}
+		p += n;
+		size -= n;
+		if (size == 0)
+		{
+			return true;
+		}
+	}
+	m_queue.emplace_back(p, size);
+	m_pending += size;
+	Enqueued();
+	return true;
+}
+
+bool Connection::Write(std::string&& data)
+{
+	if (m_fd < 0)
+	{
+		return false;
+	}
+	if (data.empty())
+	{
+		return true;
+	}
+	size_t offset = 0;
+	if (m_queue.empty())
+	{
+		struct iovec iov{&data[0], data.size()};
+		ssize_t n = Send(&iov, 1);
+		if (n < 0)
+		{
+			return false;
+		}
+		if (static_cast<size_t>(n) == data.size())
+		{
+			return true;
+		}
+		offset = n;
+	}
+	m_pending += data.size() - offset;
+	m_queue.push_back(std::move(data));
+	if (m_queue.size() == 1)
+	{
+		m_queue_pos = offset;
+	}
+	Enqueued();
+	return true;
+}
+
+size_t Connection::Pending() const
+{
+	return m_pending;
+}
+
+void Connection::Close()
+{
+	if (m_fd < 0)
+	{
+		return;
+	}
+	m_poll.Remove(m_fd);
+	close(m_fd);
+	m_fd = -1;
+	m_queue.clear();
+	m_queue_pos = 0;
+	m_pending = 0;
+	m_out_armed = false;
+	if (m_on_close)
+	{
+		m_on_close(*this);
+	}
+}
+
+void Connection::Handle(Epoll::Event e)
+{
+	// Epoll reports one event per wakeup, so flush on any of them
+	if (!m_queue.empty() && !Flush())
+	{
+		return;
+	}
+	if (e == Epoll::Event::In || e == Epoll::Event::Hangup)
+	{
+		// Receive what is left even if peer has gone
+		bool open = Receive();
+		if (Size() > 0 && m_on_read)
+		{
+			m_on_read(*this);
+		}
+		if (!open || e == Epoll::Event::Hangup)
+		{
+			Close();
+		}
+	}
+}
+
+bool Connection::Receive()
+{
+	size_t total = 0;
+	while (m_fd >= 0 && total < READ_LIMIT)
+	{
+		if (m_read_pos > 0 && m_read.size() - m_read_end < READ_CHUNK)
+		{
+			// Compact before growing
+			memmove(m_read.data(), m_read.data() + m_read_pos, Size());
+			m_read_end -= m_read_pos;
+			m_read_pos = 0;
+		}
+		if (m_read.size() - m_read_end < READ_CHUNK)
+		{
+			m_read.resize(m_read_end + READ_CHUNK);
+		}
+		ssize_t n = read(m_fd, m_read.data() + m_read_end, m_read.size() - m_read_end);
+		if (n > 0)
+		{
+			m_read_end += n;
+			total += n;
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			return true;
+		}
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		return false;
+	}
+	return m_fd >= 0;
+}
+
+ssize_t Connection::Send(const struct iovec* iov, int count)
+{
+	while (true)
+	{
+		ssize_t n;
+		if (m_socket)
+		{
+			// Same as writev, but a closed peer must not raise SIGPIPE
+			struct msghdr msg{};
+			msg.msg_iov = const_cast<struct iovec*>(iov);
+			msg.msg_iovlen = count;
+			n = sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+			if (n < 0 && errno == ENOTSOCK)
+			{
+				m_socket = false;
+				continue;
+			}
+		}
+		else
+		{
+			n = writev(m_fd, iov, count);
+		}
+		if (n >= 0)
+		{
+			return n;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			return 0;
+		}
+		if (errno != EINTR)
+		{
+			Close();
+			return -1;
+		}
+	}
+}
+
+bool Connection::Flush()
+{
+	while (!m_queue.empty())
+	{
+		struct iovec iov[IOV_COUNT];
+		int count = 0;
+		size_t offset = m_queue_pos;
+		for(auto it = m_queue.begin(); it != m_queue.end() && count < IOV_COUNT; ++it)
+		{
+			iov[count].iov_base = &(*it)[offset];
+			iov[count].iov_len = it->size() - offset;
+			offset = 0;
+			count++;
+		}
+		ssize_t n = Send(iov, count);
+		if (n < 0)
+		{
+			return false;
+		}
+		if (n == 0)
+		{
+			break;
+		}
+		m_pending -= n;
+		size_t left = n;
+		while (left > 0)
+		{
+			size_t chunk = m_queue.front().size() - m_queue_pos;
+			if (left < chunk)
+			{
+				m_queue_pos += left;
+				break;
+			}
+			left -= chunk;
+			m_queue.pop_front();
+			m_queue_pos = 0;
+		}
+	}
+	ArmOut(!m_queue.empty());
+	if (m_above_high && m_pending <= m_low)
+	{
+		m_above_high = false;
+		if (m_on_low)
+		{
+			m_on_low(*this);
+		}
+	}
+	return m_fd >= 0;
+}
+
+void Connection::Enqueued()
+{
+	ArmOut(true);
+	if (!m_above_high && m_pending >= m_high)
+	{
+		m_above_high = true;
+		if (m_on_high)
+		{
+			m_on_high(*this);
+		}
+	}
+}
+
+void Connection::ArmOut(bool arm)
+{
+	if (m_fd < 0 || arm == m_out_armed)
+	{
+		return;
+	}
+	if (arm)
+	{
+		m_poll.Modify(m_fd, {Epoll::Event::In, Epoll::Event::Out, Epoll::Event::Hangup});
+	}
+	else
+	{
+		m_poll.Modify(m_fd, {Epoll::Event::In, Epoll::Event::Hangup});
+	}
+	m_out_armed = arm;
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <stddef.h>
+#include <sys/types.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include "epoll.hpp"
+
+
+/**
+ * Buffered non-blocking connection driven by Epoll.
+ *
+ * Owns a descriptor, a read buffer and a chained write queue. Writes go
+ * straight to the descriptor while the queue is empty, the rest is queued
+ * and flushed with writev once the descriptor becomes writable. EPOLLOUT
+ * is armed only while the queue is not empty. Crossing the high watermark
+ * and draining back to the low one is reported for backpressure.
+ *
+ * Connection must not be destroyed from its own handlers, use Close() there.
+ */
+struct Connection
+{
+	typedef std::function<void(Connection&)> Handler;
+
+	/**
+	 * @brief Take ownership of descriptor and start watching it
+	 * @param[in] poll - event loop
+	 * @param[in] fd   - connected descriptor (switched to non-blocking mode)
+	 */
+	Connection(Epoll& poll, int fd);
+	Connection(const Connection&) = delete;
+	Connection(Connection&&) = delete;
+	Connection& operator=(const Connection&) = delete;
+	Connection& operator=(Connection&&) = delete;
+	~Connection();
+	operator bool() const;
+	int Fd() const;
+
+	/**
+	 * @brief Called when new data is appended to the read buffer
+	 */
+	void OnRead(Handler cb);
+
+	/**
+	 * @brief Called once when connection is closed (by peer, on error or by Close())
+	 */
+	void OnClose(Handler cb);
+
+	/**
+	 * @brief Set write queue watermarks
+	 * @param[in] low  - OnLowWatermark fires when queue drains to this size
+	 * @param[in] high - OnHighWatermark fires when queue grows to this size
+	 */
+	void SetWatermarks(size_t low, size_t high);
+	void OnHighWatermark(Handler cb);
+	void OnLowWatermark(Handler cb);
+
+	/**
+	 * @brief Received data, not consumed yet
+	 */
+	const char* Data() const;
+	size_t Size() const;
+
+	/**
+	 * @brief Drop bytes from the front of the read buffer
+	 * @param[in] n - number of bytes
+	 */
+	void Consume(size_t n);
+
+	/**
+	 * @brief Send data, whatever can not be written right away is copied into the queue
+	 * @param[in] data - buffer
+	 * @param[in] size - buffer size
+	 * @return false if connection is closed
+	 */
+	bool Write(const void* data, size_t size);
+
+	/**
+	 * @brief Send data, whatever can not be written right away is queued without copying
+	 * @param[in] data - buffer
+	 * @return false if connection is closed
+	 */
+	bool Write(std::string&& data);
+
+	/**
+	 * @brief Bytes waiting in the write queue
+	 */
+	size_t Pending() const;
+
+	/**
+	 * @brief Stop watching and close descriptor, pending writes are dropped
+	 */
+	void Close();
+
+private:
+	Epoll& m_poll;
+	int m_fd;
+	bool m_socket;
+	bool m_out_armed;
+	bool m_above_high;
+	std::vector<char> m_read;
+	size_t m_read_pos;
+	size_t m_read_end;
+	std::deque<std::string> m_queue;
+	size_t m_queue_pos;     // written part of the front chunk
+	size_t m_pending;
+	size_t m_low;
+	size_t m_high;
+	Handler m_on_read;
+	Handler m_on_close;
+	Handler m_on_high;
+	Handler m_on_low;
+
+	void Handle(Epoll::Event e);
+	bool Receive();
+	bool Flush();
+	ssize_t Send(const struct iovec* iov, int count);
+	void Enqueued();
+	void ArmOut(bool arm);
+};
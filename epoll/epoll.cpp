@@ -4,7 +4,9 @@
 #include <sys/eventfd.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <algorithm>
 #include <map>
+#include <vector>
 #include "epoll.hpp"
 
 #define COUNTOF(X) (sizeof(X) / sizeof(X[0]))
@@ -15,7 +17,10 @@ struct Epoll::Impl
 		m_fd(epoll_create(1)),
 		m_wake_fd(eventfd(0, EFD_NONBLOCK)),
 		m_cb(common_cb),
-		m_handlers()
+		m_handlers(),
+		m_dispatching(false),
+		m_removed(),
+		m_removed_fds()
 	{
 		struct epoll_event evt{0};
 		evt.data.fd = m_wake_fd;
@@ -72,7 +77,19 @@ struct Epoll::Impl
 		auto it = m_handlers.find(fd);
 		if (it != m_handlers.end())
 		{
-			m_handlers.erase(it);
+			if (m_dispatching)
+			{
+				// Handler may be the one running right now, keep it alive until dispatch is over
+				m_removed.push_back(m_handlers.extract(it));
+			}
+			else
+			{
+				m_handlers.erase(it);
+			}
+		}
+		if (m_dispatching)
+		{
+			m_removed_fds.push_back(fd);
 		}
 		return epoll_ctl(m_fd, EPOLL_CTL_DEL, fd, nullptr) == 0;
 	}
@@ -97,6 +114,7 @@ struct Epoll::Impl
 		}
 		struct epoll_event events[64];
 		int n = epoll_pwait2(m_fd, events, COUNTOF(events), timeout, nullptr);
+		m_dispatching = true;
 		for(int i = 0; i < n; i++)
 		{
 			if (events[i].data.fd == m_wake_fd)
@@ -106,6 +124,12 @@ struct Epoll::Impl
 				eventfd_read(m_wake_fd, &val);
 				break;
 			}
+			if (!m_removed_fds.empty() &&
+				std::find(m_removed_fds.begin(), m_removed_fds.end(), events[i].data.fd) != m_removed_fds.end())
+			{
+				// Removed by one of previous handlers
+				continue;
+			}
 			if (events[i].events & (EPOLLRDHUP | EPOLLPRI | EPOLLERR | EPOLLHUP))
 			{
 				auto& cb = GetCallback(events[i].data.fd);
@@ -131,6 +155,9 @@ struct Epoll::Impl
 				}
 			}
 		}
+		m_dispatching = false;
+		m_removed.clear();
+		m_removed_fds.clear();
 		return n >= 0;
 	}
 
@@ -148,6 +175,9 @@ private:
 	int m_wake_fd;
 	mutable Callback m_cb;
 	mutable std::map<int, Callback> m_handlers;
+	mutable bool m_dispatching;
+	mutable std::vector<std::map<int, Callback>::node_type> m_removed;
+	mutable std::vector<int> m_removed_fds;
 
 	Callback& GetCallback(int fd) const
 	{
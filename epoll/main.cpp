@@ -1,11 +1,16 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/socket.h>
 #include <atomic>
 #include <chrono>
+#include <string>
 #include <thread>
 #include "epoll.hpp"
+#include "co_epoll.hpp"
+#include "connection.hpp"
 
 using namespace std::chrono_literals;
 
@@ -208,6 +213,208 @@ void edge_trigger()
 	assert(ctr.load() == 2);
 }
 
+CoEpoll::Task<> co_writer(CoEpoll& loop, int fd, int count)
+{
+	for(int i = 0; i < count; i++)
+	{
+		assert(co_await loop.Writable(fd) == Epoll::Event::Out);
+		char buf[] = {'A'};
+		assert(write(fd, buf, 1) == 1);
+		// Let reader drain the pipe
+		co_await loop.Sleep(1ms);
+	}
+}
+
+CoEpoll::Task<> co_reader(CoEpoll& loop, int fd, int count, int& ctr)
+{
+	while (ctr < count)
+	{
+		assert(co_await loop.Readable(fd) == Epoll::Event::In);
+		char buf[5];
+		assert(read(fd, buf, sizeof(buf)) == 1);
+		assert(buf[0] == 'A');
+		ctr++;
+	}
+}
+
+void co_read_write()
+{
+	Pipe p;
+	CoEpoll loop;
+	assert(loop);
+	int ctr = 0;
+	loop.Spawn(co_reader(loop, p.pipe_r_fd, 10, ctr));
+	loop.Spawn(co_writer(loop, p.pipe_w_fd, 10));
+	assert(loop.Tasks() == 2);
+	assert(loop.Run());
+	assert(loop.Tasks() == 0);
+	assert(ctr == 10);
+}
+
+CoEpoll::Task<> co_sleeper(CoEpoll& loop, std::chrono::milliseconds d, int& order, int& slot)
+{
+	co_await loop.Sleep(d);
+	slot = ++order;
+}
+
+void co_sleep()
+{
+	CoEpoll loop;
+	int order = 0;
+	int first = 0;
+	int second = 0;
+	auto start = std::chrono::steady_clock::now();
+	loop.Spawn(co_sleeper(loop, 60ms, order, second));
+	loop.Spawn(co_sleeper(loop, 30ms, order, first));
+	assert(loop.Run());
+	assert(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() >= 60);
+	assert(first == 1);
+	assert(second == 2);
+}
+
+CoEpoll::Task<int> co_read_byte(CoEpoll& loop, int fd)
+{
+	char c;
+	// Suspend only when there is nothing to read yet
+	ssize_t n;
+	while ((n = read(fd, &c, 1)) != 1)
+	{
+		if (n == 0 || errno != EAGAIN || co_await loop.Readable(fd) != Epoll::Event::In)
+		{
+			co_return -1;
+		}
+	}
+	co_return c;
+}
+
+CoEpoll::Task<> co_frame(CoEpoll& loop, int fd, std::string& out)
+{
+	// Sequential frame reader: length byte followed by payload
+	int len = co_await co_read_byte(loop, fd);
+	for(int i = 0; i < len; i++)
+	{
+		int c = co_await co_read_byte(loop, fd);
+		if (c < 0)
+		{
+			break;
+		}
+		out.push_back(static_cast<char>(c));
+	}
+	// Writer is gone
+	assert(co_await co_read_byte(loop, fd) == -1);
+}
+
+void co_nested()
+{
+	Pipe p;
+	CoEpoll loop;
+	std::string out;
+	loop.Spawn(co_frame(loop, p.pipe_r_fd, out));
+	char buf[] = {3, 'a', 'b', 'c'};
+	assert(write(p.pipe_w_fd, buf, sizeof(buf)) == sizeof(buf));
+	assert(loop.Wait(50ms));
+	assert(out == "abc");
+	assert(loop.Tasks() == 1);
+	close(p.pipe_w_fd);
+	p.pipe_w_fd = open("/dev/null", O_WRONLY);
+	assert(loop.Wait(50ms));
+	assert(loop.Tasks() == 0);
+}
+
+void co_stop_wait()
+{
+	Pipe p;
+	CoEpoll loop;
+	int ctr = 0;
+	loop.Spawn(co_reader(loop, p.pipe_r_fd, 1, ctr));
+	std::thread t([&](){
+		std::this_thread::sleep_for(10ms);
+		loop.StopWait();
+	});
+	assert(loop.Run());
+	assert(ctr == 0);
+	assert(loop.Tasks() == 1);
+	t.join();
+	// Suspended task is destroyed along with the loop
+}
+
+void connection_echo()
+{
+	int sv[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	Epoll poll;
+	Connection server(poll, sv[0]);
+	Connection client(poll, sv[1]);
+	assert(server && client);
+	std::string received;
+	server.OnRead([](Connection& c) {
+		assert(c.Write(c.Data(), c.Size()));
+		c.Consume(c.Size());
+	});
+	client.OnRead([&](Connection& c) {
+		received.append(c.Data(), c.Size());
+		c.Consume(c.Size());
+	});
+	assert(client.Write(std::string("ping")));
+	for(int i = 0; i < 10 && received.size() < 4; i++)
+	{
+		assert(poll.Wait(50ms));
+	}
+	assert(received == "ping");
+}
+
+void connection_backpressure()
+{
+	int sv[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	int sndbuf = 4096;
+	setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	Epoll poll;
+	Connection writer(poll, sv[0]);
+	Connection reader(poll, sv[1]);
+	int high = 0;
+	int low = 0;
+	bool closed = false;
+	writer.SetWatermarks(1024, 64 * 1024);
+	writer.OnHighWatermark([&](Connection&) { high++; });
+	writer.OnLowWatermark([&](Connection&) { low++; });
+	std::string received;
+	reader.OnRead([&](Connection& c) {
+		received.append(c.Data(), c.Size());
+		c.Consume(c.Size());
+	});
+	reader.OnClose([&](Connection&) { closed = true; });
+
+	// Far more than socket buffers hold, so most of it is queued
+	std::string sent;
+	for(int i = 0; i < 1024; i++)
+	{
+		std::string chunk(1000, static_cast<char>('a' + i % 26));
+		sent += chunk;
+		assert(writer.Write(std::move(chunk)));
+	}
+	assert(writer.Pending() > 0);
+	assert(high == 1);
+	assert(low == 0);
+	for(int i = 0; i < 10000 && received.size() < sent.size(); i++)
+	{
+		assert(poll.Wait(50ms));
+	}
+	assert(received == sent);
+	assert(writer.Pending() == 0);
+	assert(low == 1);
+
+	writer.Close();
+	assert(!writer);
+	assert(!writer.Write("x", 1));
+	for(int i = 0; i < 10 && !closed; i++)
+	{
+		assert(poll.Wait(50ms));
+	}
+	assert(closed);
+	assert(!reader);
+}
+
 int main()
 {
 	wait_timeout();
@@ -217,5 +424,11 @@ int main()
 	stop_wait();
 	one_shot();
 	edge_trigger();
+	co_read_write();
+	co_sleep();
+	co_nested();
+	co_stop_wait();
+	connection_echo();
+	connection_backpressure();
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,335 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+class ThreadPool;
+
+template <class R>
+class Future;
+
+template <class R>
+class Promise;
+
+template <class R>
+Future<std::vector<Future<R> > > when_all( std::vector<Future<R> > futures );
+
+template <class R>
+Future<size_t> when_any( const std::vector<Future<R> > &futures );
+
+namespace detail
+{
+	template <class R>
+	struct Result
+	{
+		typedef const R& type;
+	};
+
+	template <>
+	struct Result<void>
+	{
+		typedef void type;
+	};
+
+	// Shared state of a promise/future pair
+	struct StateBase
+	{
+		StateBase( ThreadPool *pool ) :
+			pool_( pool ),
+			ready_( false )
+		{}
+
+		bool ready() const
+		{
+			return ready_.load( std::memory_order_acquire );
+		}
+
+		void wait()
+		{
+			if ( ready() )
+			{
+				return;
+			}
+			std::unique_lock<std::mutex> lck( mtx_ );
+			while( !ready() )
+			{
+				cv_.wait( lck );
+			}
+		}
+
+		/**
+		 * Run callback once the state is ready (right away if it already is)
+		 */
+		void on_ready( std::function<void()> &&cb )
+		{
+			{
+				std::lock_guard<std::mutex> lck( mtx_ );
+				if ( !ready() )
+				{
+					callbacks_.push_back( std::move( cb ) );
+					return;
+				}
+			}
+			cb();
+		}
+
+		void set_exception( std::exception_ptr e )
+		{
+			error_ = e;
+			complete();
+		}
+
+		void rethrow() const
+		{
+			if ( error_ )
+			{
+				std::rethrow_exception( error_ );
+			}
+		}
+
+		ThreadPool *pool_;
+		std::exception_ptr error_;
+
+	protected:
+		void complete()
+		{
+			std::vector<std::function<void()> > callbacks;
+			{
+				std::lock_guard<std::mutex> lck( mtx_ );
+				ready_.store( true, std::memory_order_release );
+				callbacks.swap( callbacks_ );
+				cv_.notify_all();
+			}
+			// Continuations run on the completing thread
+			for( auto &cb : callbacks )
+			{
+				cb();
+			}
+		}
+
+	private:
+		std::atomic<bool> ready_;
+		std::mutex mtx_;
+		std::condition_variable cv_;
+		std::vector<std::function<void()> > callbacks_;
+	};
+
+	template <class R>
+	struct State : StateBase
+	{
+		using StateBase::StateBase;
+
+		template <class V>
+		void set_value( V &&v )
+		{
+			value_.emplace( std::forward<V>( v ) );
+			complete();
+		}
+
+		const R& value() const
+		{
+			rethrow();
+			return *value_;
+		}
+
+	private:
+		std::optional<R> value_;
+	};
+
+	template <>
+	struct State<void> : StateBase
+	{
+		using StateBase::StateBase;
+
+		void set_value()
+		{
+			complete();
+		}
+
+		void value() const
+		{
+			rethrow();
+		}
+	};
+
+	// Run fn and store its result (or exception) into state
+	template <class R, class Fn>
+	void fulfill( State<R> &state, Fn &&fn )
+	{
+		try
+		{
+			if constexpr ( std::is_void<R>::value )
+			{
+				fn();
+				state.set_value();
+			}
+			else
+			{
+				state.set_value( fn() );
+			}
+		}
+		catch( ... )
+		{
+			state.set_exception( std::current_exception() );
+		}
+	}
+}
+
+/**
+ * Result of a pool work item. Copies share the same state.
+ * Prefer then() over get() inside work items, get() blocks the worker.
+ */
+template <class R>
+class Future
+{
+public:
+	Future() {}
+
+	bool valid() const
+	{
+		return state_ != nullptr;
+	}
+
+	bool ready() const
+	{
+		return state_ && state_->ready();
+	}
+
+	void wait() const
+	{
+		state_->wait();
+	}
+
+	/**
+	 * Wait for result. Rethrows exception thrown by work item.
+	 */
+	typename detail::Result<R>::type get() const
+	{
+		state_->wait();
+		return state_->value();
+	}
+
+	/**
+	 * Schedule fn( *this ) on the pool once this future is ready
+	 * @return future of fn result
+	 */
+	template <class Fn>
+	Future<std::invoke_result_t<Fn, Future<R> > > then( Fn &&fn ) const;
+
+private:
+	template <class T> friend class Future;
+	template <class T> friend class Promise;
+	template <class T> friend Future<std::vector<Future<T> > > when_all( std::vector<Future<T> > );
+	template <class T> friend Future<size_t> when_any( const std::vector<Future<T> >& );
+	friend class ThreadPool;
+	typedef detail::State<R> StateType;
+	std::shared_ptr<StateType> state_;
+
+	explicit Future( std::shared_ptr<StateType> s ) :
+		state_( std::move( s ) )
+	{}
+};
+
+/**
+ * Producer side of a future, for results which do not come from a work item
+ */
+template <class R>
+class Promise
+{
+public:
+	Promise( ThreadPool *pool = nullptr ) :
+		state_( std::make_shared<detail::State<R> >( pool ) )
+	{}
+
+	Future<R> get_future() const
+	{
+		return Future<R>( state_ );
+	}
+
+	template <class... V>
+	void set_value( V &&... v )
+	{
+		state_->set_value( std::forward<V>( v )... );
+	}
+
+	void set_exception( std::exception_ptr e )
+	{
+		state_->set_exception( e );
+	}
+
+private:
+	std::shared_ptr<detail::State<R> > state_;
+};
+
+/**
+ * Future which becomes ready when all inputs are ready
+ */
+template <class R>
+Future<std::vector<Future<R> > > when_all( std::vector<Future<R> > futures )
+{
+	typedef std::vector<Future<R> > Result;
+	struct Shared
+	{
+		Promise<Result> promise;
+		Result futures;
+		std::atomic<size_t> left;
+	};
+	auto shared = std::make_shared<Shared>();
+	shared->futures = std::move( futures );
+	shared->left.store( shared->futures.size() + 1 );
+	auto done = [shared]() {
+		if ( shared->left.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+		{
+			shared->promise.set_value( std::move( shared->futures ) );
+		}
+	};
+	for( auto &f : shared->futures )
+	{
+		f.state_->on_ready( done );
+	}
+	// Extra count keeps the result from completing while callbacks are being attached
+	auto result = shared->promise.get_future();
+	done();
+	return result;
+}
+
+/**
+ * Future which becomes ready when any of inputs is ready
+ * @return future of the first ready input index, holds std::invalid_argument if there are no inputs
+ */
+template <class R>
+Future<size_t> when_any( const std::vector<Future<R> > &futures )
+{
+	struct Shared
+	{
+		Promise<size_t> promise;
+		std::atomic<bool> done;
+	};
+	auto shared = std::make_shared<Shared>();
+	shared->done.store( false );
+	if ( futures.empty() )
+	{
+		// Nothing would ever complete it
+		shared->promise.set_exception( std::make_exception_ptr( std::invalid_argument( "when_any of no futures" ) ) );
+	}
+	for( size_t i = 0; i < futures.size(); i++ )
+	{
+		futures[i].state_->on_ready( [shared, i]() {
+			if ( !shared->done.exchange( true, std::memory_order_acq_rel ) )
+			{
+				shared->promise.set_value( i );
+			}
+		} );
+	}
+	return shared->promise.get_future();
+}
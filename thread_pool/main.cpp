@@ -1,8 +1,20 @@
 
+#include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <list>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
 #include "thread_pool.hpp"
+#include "task_graph.hpp"
+#include "parallel.hpp"
 
 
 void foo( int i, std::string &&s )
@@ -60,5 +72,292 @@ int main()
 	printf( "joining...\n" );
 	pool.join();
 
+	// Items spawned from inside an item
+	{
+		ThreadPool p( 4 );
+		std::atomic<int> ctr( 0 );
+		std::function<void( int )> spawn = [&]( int depth ) {
+			ctr++;
+			if ( depth > 0 )
+			{
+				p.submit( spawn, depth - 1 );
+				p.submit( spawn, depth - 1 );
+			}
+		};
+		p.submit( spawn, 12 );
+		p.join();
+		printf( "nested: %d items\n", ctr.load() );
+		assert( ctr.load() == ( 1 << 13 ) - 1 );
+	}
+
+	// Futures and continuations
+	{
+		ThreadPool p( 4 );
+		auto f = p.submit( []( int a, int b ) { return a + b; }, 2, 3 );
+		auto g = f.then( []( Future<int> r ) { return std::to_string( r.get() * 2 ); } );
+		assert( g.get() == "10" );
+
+		auto e = p.submit( []() -> int { throw std::runtime_error( "failed" ); } );
+		auto h = e.then( []( Future<int> r ) {
+			try
+			{
+				r.get();
+			}
+			catch( const std::runtime_error& )
+			{
+				return -1;
+			}
+			return 0;
+		} );
+		assert( h.get() == -1 );
+
+		std::vector<Future<int> > parts;
+		for( int i = 0; i < 10; i++ )
+		{
+			parts.push_back( p.submit( []( int v ) { return v * v; }, i ) );
+		}
+		auto all = when_all( parts ).then( []( Future<std::vector<Future<int> > > r ) {
+			int sum = 0;
+			for( auto &f : r.get() )
+			{
+				sum += f.get();
+			}
+			return sum;
+		} );
+		assert( all.get() == 285 );
+
+		Promise<void> never;
+		std::vector<Future<void> > any = { never.get_future(), p.submit( []() {} ) };
+		assert( when_any( any ).get() == 1 );
+		never.set_value();
+		bool empty = false;
+		try
+		{
+			when_any( std::vector<Future<void> >() ).get();
+		}
+		catch( const std::invalid_argument& )
+		{
+			empty = true;
+		}
+		assert( empty );
+		printf( "futures: ok\n" );
+	}
+
+	// Task graph: a -> (b, c) -> d
+	{
+		ThreadPool p( 4 );
+		TaskGraph graph;
+		std::atomic<int> step( 0 );
+		int a = 0, b = 0, c = 0, d = 0;
+		auto na = graph.add( [&]() { a = ++step; } );
+		auto nb = graph.add( [&]() { b = ++step; }, { na } );
+		auto nc = graph.add( [&]() { c = ++step; }, { na } );
+		graph.add( [&]() { d = ++step; }, { nb, nc } );
+		graph.run( p ).get();
+		assert( a == 1 && d == 4 && b > 1 && c > 1 && b != c );
+
+		// Failure skips dependents
+		TaskGraph failing;
+		bool ran = false;
+		auto nf = failing.add( []() { throw std::runtime_error( "failed" ); } );
+		failing.add( [&]() { ran = true; }, { nf } );
+		bool thrown = false;
+		try
+		{
+			failing.run( p ).get();
+		}
+		catch( const std::runtime_error& )
+		{
+			thrown = true;
+		}
+		assert( thrown && !ran );
+
+		// Cycles fail the run, nothing is started
+		TaskGraph cyclic;
+		auto n1 = cyclic.add( [&]() { ran = true; } );
+		auto n2 = cyclic.add( [&]() { ran = true; }, { n1 } );
+		cyclic.add( [&]() { ran = true; }, { n2 } );
+		cyclic.depend( n1, n2 );
+		thrown = false;
+		try
+		{
+			cyclic.run( p ).get();
+		}
+		catch( const TaskGraph::Cycle& )
+		{
+			thrown = true;
+		}
+		assert( thrown && !ran );
+		printf( "task graph: ok\n" );
+	}
+
+	// Parallel algorithms
+	{
+		ThreadPool p( 4 );
+		const size_t n = 1000000;
+		std::vector<int> v( n );
+		parallel_for( p, 0, n, [&]( size_t i ) { v[i] = static_cast<int>( i % 1000 ); } );
+		long long sum = parallel_reduce( p, v.begin(), v.end(), 0LL, []( long long a, long long b ) { return a + b; } );
+		assert( sum == std::accumulate( v.begin(), v.end(), 0LL ) );
+
+		std::vector<double> halves( n );
+		parallel_transform( p, v.begin(), v.end(), halves.begin(), []( int x ) { return x / 2.0; } );
+		assert( halves[999] == 499.5 );
+
+		std::mt19937 rng( 42 );
+		for( auto &x : v )
+		{
+			x = static_cast<int>( rng() );
+		}
+		auto expected = v;
+		std::sort( expected.begin(), expected.end() );
+		auto start = std::chrono::steady_clock::now();
+		parallel_sort( p, v.begin(), v.end() );
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		assert( v == expected );
+
+		// Small input runs inline
+		std::vector<int> small = { 3, 1, 2 };
+		parallel_sort( p, small.begin(), small.end(), std::greater<int>() );
+		assert( ( small == std::vector<int>{ 3, 2, 1 } ) );
+		printf( "parallel: ok, sort %zu items in %f seconds\n", n, elapsed.count() );
+	}
+
+	// Priorities and deadlines
+	{
+		typedef ThreadPool::Schedule Schedule;
+		ThreadPool p( 1 );
+		std::mutex mtx;
+		std::vector<int> order;
+		auto record = [&]( int v ) {
+			std::lock_guard<std::mutex> lck( mtx );
+			order.push_back( v );
+		};
+		// Keep the only worker busy while the queues fill up
+		std::atomic<bool> started( false ), go( false );
+		auto blocker = [&started, &go]() {
+			started.store( true );
+			while( !go.load() )
+			{
+				std::this_thread::yield();
+			}
+		};
+		p.post( blocker );
+		while( !started.load() )
+		{
+			std::this_thread::yield();
+		}
+		Schedule low, normal, high;
+		low.priority = ThreadPool::Priority::Low;
+		high.priority = ThreadPool::Priority::High;
+		p.post_scheduled( low, record, 3 );
+		p.post_scheduled( normal, record, 2 );
+		p.post_scheduled( high, record, 1 );
+
+		Schedule late;
+		late.priority = ThreadPool::Priority::Low;
+		late.deadline = ThreadPool::Clock::now();
+		late.late = ThreadPool::Late::Cancel;
+		auto cancelled = p.submit_scheduled( late, []() { return 1; } );
+
+		Schedule urgent;
+		urgent.priority = ThreadPool::Priority::Low;
+		urgent.deadline = ThreadPool::Clock::now();
+		p.post_scheduled( urgent, record, 0 );
+
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+		go.store( true );
+		bool thrown = false;
+		try
+		{
+			cancelled.get();
+		}
+		catch( const ThreadPool::DeadlineExceeded& )
+		{
+			thrown = true;
+		}
+		p.join();
+		assert( thrown );
+		// Escalated item first, then by priority
+		assert( ( order == std::vector<int>{ 0, 1, 2, 3 } ) );
+
+		// Aged low priority item overtakes newer high priority ones
+		ThreadPool q( 1 );
+		q.set_aging( std::chrono::milliseconds( 1 ) );
+		order.clear();
+		started.store( false );
+		go.store( false );
+		q.post( blocker );
+		while( !started.load() )
+		{
+			std::this_thread::yield();
+		}
+		q.post_scheduled( low, record, 1 );
+		std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+		q.post_scheduled( high, record, 2 );
+		go.store( true );
+		q.join();
+		assert( ( order == std::vector<int>{ 1, 2 } ) );
+		printf( "priorities: ok\n" );
+	}
+
+	// NUMA placement
+	{
+		ThreadPool::Config cfg;
+		cfg.placement = ThreadPool::Placement::Core;
+		ThreadPool p( cfg );
+		assert( p.size() >= 1 && p.nodes() >= 1 );
+		assert( ThreadPool::current_node() == -1 );
+		std::vector<Future<bool> > checks;
+		for( int i = 0; i < 100; i++ )
+		{
+			checks.push_back( p.submit( [&p]() {
+				int node = ThreadPool::current_node();
+				const size_t size = 1 << 20;
+				char *buf = static_cast<char*>( numa::alloc( size, node ) );
+				if ( !buf )
+				{
+					return false;
+				}
+				memset( buf, 1, size );
+				numa::free( buf, size );
+				std::vector<int, numa::Allocator<int> > local( 1000, node );
+				std::list<int, numa::Allocator<int> > nodes( 1000, node, numa::Allocator<int>( node ) );
+				return node >= 0 && node < p.nodes() && local[999] == node && nodes.back() == node;
+			} ) );
+		}
+		for( auto &c : checks )
+		{
+			assert( c.get() );
+		}
+		printf( "numa: ok, %d workers on %d nodes\n", p.size(), p.nodes() );
+	}
+
+	// Short items throughput
+	{
+		const int count = 1000000;
+		ThreadPool p( std::thread::hardware_concurrency() );
+		std::atomic<int> ctr( 0 );
+		auto start = std::chrono::steady_clock::now();
+		for( int i = 0; i < count; i++ )
+		{
+			p.post( [&ctr]() { ctr.fetch_add( 1, std::memory_order_relaxed ); } );
+		}
+		p.join();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		assert( ctr.load() == count );
+		printf( "throughput: %.0f items/s\n", count / elapsed.count() );
+
+		ThreadPool::Stats st = p.stats();
+		assert( st.total.executed == static_cast<uint64_t>( count ) );
+		assert( st.total.local + st.total.injected + st.total.stolen == st.total.executed );
+		assert( st.total.wait.count() == st.total.executed && st.queued == 0 );
+		printf( "stats: wait p50 %llu ns, p99 %llu ns, run p50 %llu ns, steals %llu\n",
+				static_cast<unsigned long long>( st.total.wait.percentile( 0.5 ) ),
+				static_cast<unsigned long long>( st.total.wait.percentile( 0.99 ) ),
+				static_cast<unsigned long long>( st.total.run.percentile( 0.5 ) ),
+				static_cast<unsigned long long>( st.total.stolen ) );
+	}
+
 	return 0;
 }
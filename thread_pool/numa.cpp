@@ -0,0 +1,326 @@
+#include <sched.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include "numa.hpp"
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+
+static std::vector<int> allowed_cpus()
+{
+	std::vector<int> cpus;
+	cpu_set_t set;
+	CPU_ZERO( &set );
+	if ( sched_getaffinity( 0, sizeof( set ), &set ) != 0 )
+	{
+		return cpus;
+	}
+	for( int cpu = 0; cpu < CPU_SETSIZE; cpu++ )
+	{
+		if ( CPU_ISSET( cpu, &set ) )
+		{
+			cpus.push_back( cpu );
+		}
+	}
+	return cpus;
+}
+
+#ifndef HAVE_LIBNUMA
+// Parse sysfs cpu list, e.g. "0-3,8-11"
+static std::vector<int> parse_cpulist( const char *path )
+{
+	std::vector<int> cpus;
+	FILE *f = fopen( path, "r" );
+	if ( !f )
+	{
+		return cpus;
+	}
+	int from, to;
+	while( fscanf( f, "%d", &from ) == 1 )
+	{
+		to = from;
+		int c = fgetc( f );
+		if ( c == '-' )
+		{
+			if ( fscanf( f, "%d", &to ) != 1 )
+			{
+				break;
+			}
+			c = fgetc( f );
+		}
+		for( int cpu = from; cpu <= to; cpu++ )
+		{
+			cpus.push_back( cpu );
+		}
+		if ( c != ',' )
+		{
+			break;
+		}
+	}
+	fclose( f );
+	return cpus;
+}
+#endif
+
+// Topology does not change while running, node lookups use a cached copy
+static const std::vector<std::vector<int> >& topology()
+{
+	static const std::vector<std::vector<int> > nodes = numa::nodes();
+	return nodes;
+}
+
+std::vector<std::vector<int> > numa::nodes()
+{
+	std::vector<int> allowed = allowed_cpus();
+	std::vector<std::vector<int> > result;
+#ifdef HAVE_LIBNUMA
+	if ( numa_available() >= 0 )
+	{
+		struct bitmask *mask = numa_allocate_cpumask();
+		for( int node = 0; node <= numa_max_node(); node++ )
+		{
+			if ( numa_node_to_cpus( node, mask ) != 0 )
+			{
+				continue;
+			}
+			std::vector<int> cpus;
+			for( int cpu : allowed )
+			{
+				if ( numa_bitmask_isbitset( mask, cpu ) )
+				{
+					cpus.push_back( cpu );
+				}
+			}
+			if ( !cpus.empty() )
+			{
+				result.push_back( cpus );
+			}
+		}
+		numa_free_cpumask( mask );
+	}
+#else
+	for( int node = 0; ; node++ )
+	{
+		char path[64];
+		snprintf( path, sizeof( path ), "/sys/devices/system/node/node%d/cpulist", node );
+		if ( access( path, R_OK ) != 0 )
+		{
+			break;
+		}
+		std::vector<int> cpus;
+		for( int cpu : parse_cpulist( path ) )
+		{
+			if ( std::binary_search( allowed.begin(), allowed.end(), cpu ) )
+			{
+				cpus.push_back( cpu );
+			}
+		}
+		if ( !cpus.empty() )
+		{
+			result.push_back( cpus );
+		}
+	}
+#endif
+	if ( result.empty() )
+	{
+		result.push_back( allowed );
+	}
+	return result;
+}
+
+int numa::current_node()
+{
+	int cpu = sched_getcpu();
+	const auto &nodes = topology();
+	for( size_t node = 0; node < nodes.size(); node++ )
+	{
+		if ( std::find( nodes[node].begin(), nodes[node].end(), cpu ) != nodes[node].end() )
+		{
+			return node;
+		}
+	}
+	return 0;
+}
+
+bool numa::pin( const std::vector<int> &cpus )
+{
+	cpu_set_t set;
+	CPU_ZERO( &set );
+	for( int cpu : cpus )
+	{
+		CPU_SET( cpu, &set );
+	}
+	return sched_setaffinity( 0, sizeof( set ), &set ) == 0;
+}
+
+/*
+ * Node numbers below are indexes in nodes(), which skips nodes without
+ * allowed CPUs. Memory policy wants kernel node ids, so map them back.
+ */
+static int kernel_node( int node )
+{
+	const auto &nodes = topology();
+	if ( node < 0 || node >= static_cast<int>( nodes.size() ) || nodes.size() == 1 )
+	{
+		return -1;
+	}
+#ifdef HAVE_LIBNUMA
+	return numa_available() >= 0 ? numa_node_of_cpu( nodes[node].front() ) : -1;
+#else
+	for( int id = 0; ; id++ )
+	{
+		char path[64];
+		snprintf( path, sizeof( path ), "/sys/devices/system/node/node%d/cpulist", id );
+		if ( access( path, R_OK ) != 0 )
+		{
+			return -1;
+		}
+		std::vector<int> cpus = parse_cpulist( path );
+		if ( std::find( cpus.begin(), cpus.end(), nodes[node].front() ) != cpus.end() )
+		{
+			return id;
+		}
+	}
+#endif
+}
+
+void* numa::alloc( size_t size, int node )
+{
+	int id = kernel_node( node < 0 ? current_node() : node );
+#ifdef HAVE_LIBNUMA
+	if ( id >= 0 )
+	{
+		return numa_alloc_onnode( size, id );
+	}
+#endif
+	void *p = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if ( p == MAP_FAILED )
+	{
+		return nullptr;
+	}
+#ifndef HAVE_LIBNUMA
+	if ( id >= 0 && id < 64 )
+	{
+		// MPOL_PREFERRED: place pages on the node while it has free memory
+		unsigned long mask = 1UL << id;
+		syscall( SYS_mbind, p, size, 1, &mask, 64, 0 );
+	}
+#endif
+	return p;
+}
+
+void numa::free( void *p, size_t size )
+{
+	if ( !p )
+	{
+		return;
+	}
+#ifdef HAVE_LIBNUMA
+	numa_free( p, size );
+#else
+	munmap( p, size );
+#endif
+}
+
+/*
+ * Power of two size classes from 16 bytes to PoolMax. Each node owns its
+ * free lists and the chunk blocks are currently carved from; a block goes
+ * back to the node it came from, whichever thread frees it.
+ */
+namespace
+{
+	const size_t PoolMin = 16;
+	const size_t PoolClasses = 9;       // 16 .. 4096
+	const size_t PoolChunk = 256 << 10;
+
+	struct FreeBlock
+	{
+		FreeBlock *next;
+	};
+
+	struct NodePool
+	{
+		std::mutex lock;
+		FreeBlock *free[PoolClasses] = {};
+		char *chunk = nullptr;
+		size_t left = 0;
+	};
+
+	size_t pool_class( size_t size )
+	{
+		size_t c = 0;
+		for( size_t block = PoolMin; block < size; block <<= 1 )
+		{
+			c++;
+		}
+		return c;
+	}
+
+	NodePool& node_pool( int node )
+	{
+		static const size_t count = topology().size();
+		static std::unique_ptr<NodePool[]> pools( new NodePool[count] );
+		return pools[node >= 0 && static_cast<size_t>( node ) < count ? node : 0];
+	}
+}
+
+void* numa::pool_alloc( size_t size, int node )
+{
+	if ( node < 0 )
+	{
+		node = current_node();
+	}
+	if ( size > PoolMax )
+	{
+		return alloc( size, node );
+	}
+	size_t c = pool_class( size );
+	size_t block = PoolMin << c;
+	NodePool &pool = node_pool( node );
+	std::lock_guard<std::mutex> lck( pool.lock );
+	if ( FreeBlock *b = pool.free[c] )
+	{
+		pool.free[c] = b->next;
+		return b;
+	}
+	if ( pool.left < block )
+	{
+		// The tail of the old chunk is too small for this class, it stays unused
+		char *chunk = static_cast<char*>( alloc( PoolChunk, node ) );
+		if ( !chunk )
+		{
+			return nullptr;
+		}
+		pool.chunk = chunk;
+		pool.left = PoolChunk;
+	}
+	void *p = pool.chunk;
+	pool.chunk += block;
+	pool.left -= block;
+	return p;
+}
+
+void numa::pool_free( void *p, size_t size, int node )
+{
+	if ( !p )
+	{
+		return;
+	}
+	if ( size > PoolMax )
+	{
+		free( p, size );
+		return;
+	}
+	NodePool &pool = node_pool( node );
+	FreeBlock *b = static_cast<FreeBlock*>( p );
+	size_t c = pool_class( size );
+	std::lock_guard<std::mutex> lck( pool.lock );
+	b->next = pool.free[c];
+	pool.free[c] = b;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <vector>
+
+
+/*
+ * NUMA topology, thread placement and node-local memory.
+ *
+ * Built with libnuma when it is available (HAVE_LIBNUMA, see Makefile),
+ * otherwise topology is read from sysfs, threads are placed with
+ * sched_setaffinity and memory relies on the kernel first-touch policy:
+ * pages land on the node of the thread which writes them first.
+ */
+namespace numa
+{
+	/**
+	 * CPUs of every node which has any CPU the process may run on.
+	 * A machine without NUMA is reported as a single node.
+	 */
+	std::vector<std::vector<int> > nodes();
+
+	/**
+	 * Node the calling thread is running on right now
+	 */
+	int current_node();
+
+	/**
+	 * Restrict the calling thread to given CPUs
+	 * @return false if the kernel refused
+	 */
+	bool pin( const std::vector<int> &cpus );
+
+	/**
+	 * Allocate memory on a node (-1 for the calling thread's node).
+	 * Without libnuma memory is placed on first touch.
+	 * @return nullptr on failure
+	 */
+	void* alloc( size_t size, int node = -1 );
+
+	/**
+	 * Release memory returned by alloc()
+	 */
+	void free( void *p, size_t size );
+
+	/**
+	 * Largest block pool_alloc() serves from its free lists
+	 */
+	const size_t PoolMax = 4096;
+
+	/**
+	 * Allocate a small block on a node (-1 for the calling thread's node).
+	 * Blocks are carved from node-local chunks and recycled through per-node
+	 * size-class free lists, so there is no system call per block. Chunks
+	 * are kept for the life of the process. Larger sizes go to alloc().
+	 * @return nullptr on failure
+	 */
+	void* pool_alloc( size_t size, int node = -1 );
+
+	/**
+	 * Release a block returned by pool_alloc() for the same node
+	 */
+	void pool_free( void *p, size_t size, int node );
+
+	/**
+	 * STL allocator placing elements on a node, by default the one the thread
+	 * creating the allocator runs on. Small allocations come from pool_alloc().
+	 */
+	template <class T>
+	struct Allocator
+	{
+		typedef T value_type;
+		int node;
+
+		explicit Allocator( int n = -1 ) : node( n < 0 ? current_node() : n ) {}
+		template <class U> Allocator( const Allocator<U> &rhs ) : node( rhs.node ) {}
+
+		T* allocate( size_t n )
+		{
+			size_t size = n * sizeof( T );
+			void *p = alignof( T ) <= alignof( std::max_align_t ) ? pool_alloc( size, node ) : alloc( size, node );
+			if ( !p )
+			{
+				throw std::bad_alloc();
+			}
+			return static_cast<T*>( p );
+		}
+
+		void deallocate( T *p, size_t n )
+		{
+			if ( alignof( T ) <= alignof( std::max_align_t ) )
+			{
+				pool_free( p, n * sizeof( T ), node );
+			}
+			else
+			{
+				free( p, n * sizeof( T ) );
+			}
+		}
+
+		template <class U> bool operator==( const Allocator<U> &rhs ) const { return node == rhs.node; }
+		template <class U> bool operator!=( const Allocator<U> &rhs ) const { return node != rhs.node; }
+	};
+}
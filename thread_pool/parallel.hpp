@@ -0,0 +1,244 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <vector>
+#include "thread_pool.hpp"
+
+
+/*
+ * Data-parallel algorithms on top of ThreadPool.
+ *
+ * Ranges are split recursively in halves: one half is posted into the pool
+ * (where idle workers steal it), the other is processed by the calling thread,
+ * which then helps running pending items until the posted half is done.
+ * Splitting stops at the grain size, which is derived from the range length
+ * and the pool size unless given explicitly. Inputs below one grain run inline.
+ */
+
+namespace detail
+{
+	// Splitting below this many elements costs more than it gains
+	static const size_t min_grain = 1024;
+
+	inline size_t grain( const ThreadPool &pool, size_t n, size_t requested )
+	{
+		if ( requested > 0 )
+		{
+			return requested;
+		}
+		// Several chunks per worker keep them busy when chunk costs differ
+		size_t g = n / ( static_cast<size_t>( pool.size() ) * 8 );
+		return g < min_grain ? min_grain : g;
+	}
+
+	/**
+	 * Run both functions, possibly in parallel, and return when both are done
+	 */
+	template <class F1, class F2>
+	void fork_join( ThreadPool &pool, F1 &&f1, F2 &&f2 )
+	{
+		// Lives on our stack, posted half does not touch it after setting done
+		struct Shared
+		{
+			std::atomic<bool> done;
+			std::exception_ptr error;
+		} shared;
+		shared.done.store( false, std::memory_order_relaxed );
+		pool.post( [&shared, &f2]() {
+			try
+			{
+				f2();
+			}
+			catch( ... )
+			{
+				shared.error = std::current_exception();
+			}
+			shared.done.store( true, std::memory_order_release );
+		} );
+		std::exception_ptr error;
+		try
+		{
+			f1();
+		}
+		catch( ... )
+		{
+			error = std::current_exception();
+		}
+		// f2 references our stack, wait for it even if f1 has failed
+		pool.help_until( [&shared]() { return shared.done.load( std::memory_order_acquire ); } );
+		if ( error )
+		{
+			std::rethrow_exception( error );
+		}
+		if ( shared.error )
+		{
+			std::rethrow_exception( shared.error );
+		}
+	}
+
+	template <class Fn>
+	void split( ThreadPool &pool, size_t begin, size_t end, size_t grain, const Fn &fn )
+	{
+		if ( end - begin <= grain )
+		{
+			fn( begin, end );
+			return;
+		}
+		size_t mid = begin + ( end - begin ) / 2;
+		fork_join( pool,
+			[&]() { split( pool, begin, mid, grain, fn ); },
+			[&]() { split( pool, mid, end, grain, fn ); } );
+	}
+
+	template <class It, class Out, class Comp>
+	void merge( ThreadPool &pool, It first1, It last1, It first2, It last2, Out out, Comp comp, size_t grain )
+	{
+		size_t n1 = std::distance( first1, last1 );
+		size_t n2 = std::distance( first2, last2 );
+		if ( n1 + n2 <= grain )
+		{
+			std::merge( std::make_move_iterator( first1 ), std::make_move_iterator( last1 ),
+						std::make_move_iterator( first2 ), std::make_move_iterator( last2 ), out, comp );
+			return;
+		}
+		if ( n1 < n2 )
+		{
+			// Split the longer run
+			std::swap( first1, first2 );
+			std::swap( last1, last2 );
+			std::swap( n1, n2 );
+		}
+		It mid1 = first1 + n1 / 2;
+		It mid2 = std::lower_bound( first2, last2, *mid1, comp );
+		Out mid_out = out + ( mid1 - first1 ) + ( mid2 - first2 );
+		fork_join( pool,
+			[&]() { merge( pool, first1, mid1, first2, mid2, out, comp, grain ); },
+			[&]() { merge( pool, mid1, last1, mid2, last2, mid_out, comp, grain ); } );
+	}
+
+	// Sorts [first, last) using buffer of the same length, result ends up in [first, last)
+	template <class It, class Buf, class Comp>
+	void merge_sort( ThreadPool &pool, It first, It last, Buf buf, Comp comp, size_t grain )
+	{
+		size_t n = std::distance( first, last );
+		if ( n <= grain )
+		{
+			std::sort( first, last, comp );
+			return;
+		}
+		It mid = first + n / 2;
+		Buf buf_mid = buf + n / 2;
+		fork_join( pool,
+			[&]() { merge_sort( pool, first, mid, buf, comp, grain ); },
+			[&]() { merge_sort( pool, mid, last, buf_mid, comp, grain ); } );
+		std::move( first, last, buf );
+		merge( pool, buf, buf_mid, buf_mid, buf + n, first, comp, grain );
+	}
+}
+
+/**
+ * Call fn( i ) for every i in [begin, end)
+ * @param grain elements per chunk (0 - choose automatically)
+ */
+template <class Fn>
+void parallel_for( ThreadPool &pool, size_t begin, size_t end, Fn &&fn, size_t grain = 0 )
+{
+	if ( begin >= end )
+	{
+		return;
+	}
+	detail::split( pool, begin, end, detail::grain( pool, end - begin, grain ),
+		[&fn]( size_t b, size_t e ) {
+			for( size_t i = b; i < e; i++ )
+			{
+				fn( i );
+			}
+		} );
+}
+
+/**
+ * Call fn( begin, end ) for chunks covering [begin, end)
+ */
+template <class Fn>
+void parallel_for_range( ThreadPool &pool, size_t begin, size_t end, Fn &&fn, size_t grain = 0 )
+{
+	if ( begin >= end )
+	{
+		return;
+	}
+	detail::split( pool, begin, end, detail::grain( pool, end - begin, grain ), fn );
+}
+
+/**
+ * Reduce [first, last) with associative operation op
+ * @param init identity value of op (e.g. 0 for addition)
+ */
+template <class It, class T, class Op>
+T parallel_reduce( ThreadPool &pool, It first, It last, T init, Op op, size_t grain = 0 )
+{
+	size_t n = std::distance( first, last );
+	size_t g = detail::grain( pool, n, grain );
+	if ( n <= g )
+	{
+		return std::accumulate( first, last, init, op );
+	}
+	// One partial result per chunk, combined in order so op need not be commutative
+	size_t chunks = ( n + g - 1 ) / g;
+	std::vector<T> partial( chunks, init );
+	detail::split( pool, 0, chunks, 1, [&]( size_t b, size_t e ) {
+		for( size_t c = b; c < e; c++ )
+		{
+			It from = first + c * g;
+			It to = first + std::min( n, ( c + 1 ) * g );
+			partial[c] = std::accumulate( from, to, init, op );
+		}
+	} );
+	T result = init;
+	for( auto &p : partial )
+	{
+		result = op( result, p );
+	}
+	return result;
+}
+
+/**
+ * out[i] = fn( first[i] ) for every element of [first, last)
+ * @return end of output range
+ */
+template <class It, class Out, class Fn>
+Out parallel_transform( ThreadPool &pool, It first, It last, Out out, Fn &&fn, size_t grain = 0 )
+{
+	size_t n = std::distance( first, last );
+	parallel_for_range( pool, 0, n, [&]( size_t b, size_t e ) {
+		std::transform( first + b, first + e, out + b, fn );
+	}, grain );
+	return out + n;
+}
+
+/**
+ * Parallel merge sort of [first, last), not stable
+ */
+template <class It, class Comp>
+void parallel_sort( ThreadPool &pool, It first, It last, Comp comp, size_t grain = 0 )
+{
+	size_t n = std::distance( first, last );
+	size_t g = detail::grain( pool, n, grain );
+	if ( n <= g )
+	{
+		std::sort( first, last, comp );
+		return;
+	}
+	std::vector<typename std::iterator_traits<It>::value_type> buf( n );
+	detail::merge_sort( pool, first, last, buf.begin(), comp, g );
+}
+
+template <class It>
+void parallel_sort( ThreadPool &pool, It first, It last, size_t grain = 0 )
+{
+	parallel_sort( pool, first, last, std::less<typename std::iterator_traits<It>::value_type>(), grain );
+}
@@ -0,0 +1,156 @@
+#include "task_graph.hpp"
+
+
+TaskGraph::TaskGraph()
+{}
+
+TaskGraph::Node TaskGraph::add( std::function<void()> fn, std::initializer_list<Node> deps )
+{
+	return add( std::move( fn ), std::vector<Node>( deps ) );
+}
+
+TaskGraph::Node TaskGraph::add( std::function<void()> fn, const std::vector<Node> &deps )
+{
+	Node node = items_.size();
+	items_.emplace_back( new Item );
+	Item &item = *items_.back();
+	item.fn = std::move( fn );
+	item.deps = 0;
+	for( auto dep : deps )
+	{
+		depend( node, dep );
+	}
+	return node;
+}
+
+void TaskGraph::depend( Node node, Node dep )
+{
+	if ( node >= items_.size() || dep >= items_.size() || node == dep )
+	{
+		return;
+	}
+	items_[dep]->next.push_back( node );
+	items_[node]->deps++;
+}
+
+size_t TaskGraph::size() const
+{
+	return items_.size();
+}
+
+Future<void> TaskGraph::run( ThreadPool &pool )
+{
+	auto run = std::make_shared<Run>( pool, items_.size() );
+	auto result = run->promise.get_future();
+	if ( items_.empty() )
+	{
+		run->promise.set_value();
+		return result;
+	}
+	if ( !acyclic() )
+	{
+		run->promise.set_exception( std::make_exception_ptr( Cycle() ) );
+		return result;
+	}
+	for( auto &item : items_ )
+	{
+		item->left.store( item->deps, std::memory_order_relaxed );
+		item->skip.store( false, std::memory_order_relaxed );
+	}
+	// Collect roots first, they may finish and release dependents while we iterate
+	std::vector<Node> roots;
+	for( Node i = 0; i < items_.size(); i++ )
+	{
+		if ( items_[i]->deps == 0 )
+		{
+			roots.push_back( i );
+		}
+	}
+	for( auto node : roots )
+	{
+		schedule( run, node );
+	}
+	return result;
+}
+
+bool TaskGraph::acyclic() const
+{
+	// Kahn's algorithm: every node is reached only if there is no cycle
+	std::vector<int> left( items_.size() );
+	std::vector<Node> ready;
+	for( Node i = 0; i < items_.size(); i++ )
+	{
+		left[i] = items_[i]->deps;
+		if ( left[i] == 0 )
+		{
+			ready.push_back( i );
+		}
+	}
+	size_t reached = 0;
+	while( !ready.empty() )
+	{
+		Node node = ready.back();
+		ready.pop_back();
+		reached++;
+		for( auto next : items_[node]->next )
+		{
+			if ( --left[next] == 0 )
+			{
+				ready.push_back( next );
+			}
+		}
+	}
+	return reached == items_.size();
+}
+
+void TaskGraph::schedule( const std::shared_ptr<Run> &run, Node node )
+{
+	run->pool.post( [this, run, node]() {
+		execute( run, node );
+	} );
+}
+
+void TaskGraph::execute( const std::shared_ptr<Run> &run, Node node )
+{
+	Item &item = *items_[node];
+	bool failed = item.skip.load( std::memory_order_acquire );
+	if ( !failed && item.fn )
+	{
+		try
+		{
+			item.fn();
+		}
+		catch( ... )
+		{
+			failed = true;
+			std::lock_guard<std::mutex> lck( run->mtx );
+			if ( !run->error )
+			{
+				run->error = std::current_exception();
+			}
+		}
+	}
+	for( auto next : item.next )
+	{
+		Item &n = *items_[next];
+		if ( failed )
+		{
+			n.skip.store( true, std::memory_order_release );
+		}
+		if ( n.left.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+		{
+			schedule( run, next );
+		}
+	}
+	if ( run->left.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+	{
+		if ( run->error )
+		{
+			run->promise.set_exception( run->error );
+		}
+		else
+		{
+			run->promise.set_value();
+		}
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "thread_pool.hpp"
+
+
+/**
+ * Dependency graph of work items.
+ * A node is posted into the pool as soon as all of its dependencies finish,
+ * no thread is blocked waiting for them.
+ */
+class TaskGraph
+{
+public:
+	typedef size_t Node;
+
+	struct Cycle : std::logic_error
+	{
+		Cycle() : std::logic_error( "task graph has a cycle" ) {}
+	};
+
+	TaskGraph();
+
+	TaskGraph( const TaskGraph& ) = delete;
+	TaskGraph& operator=( const TaskGraph& ) = delete;
+
+	/**
+	 * Add a work item
+	 * @param fn work item
+	 * @param deps nodes which must finish before this one starts
+	 * @return node handle
+	 */
+	Node add( std::function<void()> fn, std::initializer_list<Node> deps = {} );
+	Node add( std::function<void()> fn, const std::vector<Node> &deps );
+
+	/**
+	 * Add dependency between two existing nodes
+	 */
+	void depend( Node node, Node dep );
+
+	size_t size() const;
+
+	/**
+	 * Run the whole graph. Graph must not be modified or re-run until the future is ready.
+	 * If a node throws, its dependents are skipped and the future holds the first exception.
+	 * If dependencies form a cycle, no node runs and the future holds Cycle.
+	 * @return future which is ready when all nodes are done
+	 */
+	Future<void> run( ThreadPool &pool );
+
+private:
+	struct Item
+	{
+		std::function<void()> fn;
+		std::vector<Node> next;
+		int deps;
+		std::atomic<int> left;
+		std::atomic<bool> skip;
+	};
+
+	struct Run
+	{
+		ThreadPool &pool;
+		Promise<void> promise;
+		std::atomic<size_t> left;
+		std::mutex mtx;
+		std::exception_ptr error;
+		Run( ThreadPool &p, size_t n ) : pool( p ), promise( &p ), left( n ) {}
+	};
+
+	std::vector<std::unique_ptr<Item> > items_;
+
+	bool acyclic() const;
+	void schedule( const std::shared_ptr<Run> &run, Node node );
+	void execute( const std::shared_ptr<Run> &run, Node node );
+};
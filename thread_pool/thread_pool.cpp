@@ -1,89 +1,648 @@
-
+#include <pthread.h>
+#include <stdio.h>
+#include <algorithm>
 #include "thread_pool.hpp"
 
 
-ThreadPool::Worker::Worker() :
-	started_( false ),
-	done_( false )
+// Worker running on current thread, if any
+static thread_local ThreadPool::Worker *current_ = nullptr;
+
+// Counters have a single writer, so a plain load and store is enough
+template <class T, class V>
+static inline void bump( std::atomic<T> &c, V v )
+{
+	c.store( c.load( std::memory_order_relaxed ) + v, std::memory_order_relaxed );
+}
+
+static inline uint64_t nanoseconds( ThreadPool::Clock::duration d )
+{
+	int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>( d ).count();
+	return ns > 0 ? ns : 0;
+}
+
+
+int ThreadPool::Histogram::bucket( uint64_t v )
+{
+	int b = v ? 64 - __builtin_clzll( v ) : 0;
+	return b < Buckets ? b : Buckets - 1;
+}
+
+uint64_t ThreadPool::Histogram::count() const
+{
+	uint64_t n = 0;
+	for( auto c : counts )
+	{
+		n += c;
+	}
+	return n;
+}
+
+uint64_t ThreadPool::Histogram::percentile( double p ) const
+{
+	uint64_t n = count();
+	if ( n == 0 )
+	{
+		return 0;
+	}
+	uint64_t rank = static_cast<uint64_t>( p * n );
+	uint64_t seen = 0;
+	for( int i = 0; i < Buckets; i++ )
+	{
+		seen += counts[i];
+		if ( seen > rank )
+		{
+			return i ? ( uint64_t( 1 ) << i ) - 1 : 0;
+		}
+	}
+	return ( uint64_t( 1 ) << ( Buckets - 1 ) ) - 1;
+}
+
+void ThreadPool::Histogram::merge( const Histogram &rhs )
+{
+	for( int i = 0; i < Buckets; i++ )
+	{
+		counts[i] += rhs.counts[i];
+	}
+}
+
+
+ThreadPool::Deque::Ring::Ring( int64_t s ) :
+	size( s ),
+	mask( s - 1 ),
+	items( new std::atomic<Job*>[s] )
 {}
 
-ThreadPool::Worker::~Worker()
+ThreadPool::Deque::Ring::~Ring()
 {
-	join();
+	delete[] items;
 }
 
-ThreadPool::Worker::operator bool()
+ThreadPool::Deque::Deque() :
+	top_( 0 ),
+	bottom_( 0 ),
+	ring_( new Ring( 256 ) )
+{}
+
+ThreadPool::Deque::~Deque()
 {
-	mtx_.lock();
-	bool ret = !started_ || ( started_ && done_ );
-	mtx_.unlock();
-	return ret;
+	delete ring_.load();
 }
 
-void ThreadPool::Worker::swap( Worker &rhs )
+void ThreadPool::Deque::push( Job *job )
 {
-	thread_.swap( rhs.thread_ );
-	std::swap( started_, rhs.started_ );
-	std::swap( done_, rhs.done_ );
+	int64_t b = bottom_.load( std::memory_order_relaxed );
+	int64_t t = top_.load( std::memory_order_acquire );
+	Ring *r = ring_.load( std::memory_order_relaxed );
+	if ( b - t > r->size - 1 )
+	{
+		// Grow, old ring is kept alive for thieves still reading it
+		Ring *bigger = new Ring( r->size * 2 );
+		for( int64_t i = t; i < b; i++ )
+		{
+			bigger->put( i, r->get( i ) );
+		}
+		retired_.emplace_back( r );
+		r = bigger;
+		ring_.store( r, std::memory_order_release );
+	}
+	r->put( b, job );
+	bottom_.store( b + 1, std::memory_order_release );
 }
 
-void ThreadPool::Worker::join()
+ThreadPool::Job* ThreadPool::Deque::take()
 {
+	int64_t b = bottom_.load( std::memory_order_relaxed ) - 1;
+	Ring *r = ring_.load( std::memory_order_relaxed );
+	bottom_.store( b, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	int64_t t = top_.load( std::memory_order_relaxed );
+	if ( t > b )
+	{
+		// Empty
+		bottom_.store( b + 1, std::memory_order_relaxed );
+		return nullptr;
+	}
+	Job *job = r->get( b );
+	if ( t == b )
+	{
+		// Last item, race against thieves
+		if ( !top_.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+		{
+			job = nullptr;
+		}
+		bottom_.store( b + 1, std::memory_order_relaxed );
+	}
+	return job;
+}
+
+ThreadPool::Job* ThreadPool::Deque::steal()
+{
+	int64_t t = top_.load( std::memory_order_acquire );
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	int64_t b = bottom_.load( std::memory_order_acquire );
+	if ( t >= b )
+	{
+		return nullptr;
+	}
+	Ring *r = ring_.load( std::memory_order_acquire );
+	Job *job = r->get( t );
+	if ( !top_.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+	{
+		// Lost the race, caller moves on to another victim
+		return nullptr;
+	}
+	return job;
+}
+
+bool ThreadPool::Deque::empty() const
+{
+	return top_.load( std::memory_order_acquire ) >= bottom_.load( std::memory_order_acquire );
+}
+
+size_t ThreadPool::Deque::size() const
+{
+	int64_t n = bottom_.load( std::memory_order_relaxed ) - top_.load( std::memory_order_relaxed );
+	return n > 0 ? n : 0;
+}
+
+ThreadPool::Worker::Worker( ThreadPool &pool, int index ) :
+	pool_( pool ),
+	index_( index ),
+	node_( 0 ),
+	ticks_( 0 )
+{}
+
+ThreadPool::Worker::~Worker()
+{
+	if ( thread_.joinable() )
+	{
+		thread_.join();
+	}
+}
+
+void ThreadPool::Worker::loop()
+{
+	current_ = this;
+	char name[16];
+	snprintf( name, sizeof( name ), "%s-%d", pool_.name_.c_str(), index_ );
+	pthread_setname_np( pthread_self(), name );
+	if ( !cpus_.empty() )
+	{
+		// Before the first item, so its memory is touched on the right node
+		numa::pin( cpus_ );
+	}
 	while( true )
 	{
-		mtx_.lock();
-		if ( !started_ )
+		Job *job = pool_.find( *this );
+		if ( job )
 		{
-			mtx_.unlock();
-			break;
+			pool_.execute( this, job );
+			continue;
 		}
-		if ( done_ )
+
+		// Nothing to do, park
+		Clock::time_point parked = Clock::now();
+		std::unique_lock<std::mutex> lck( pool_.mtx_ );
+		pool_.sleeping_.fetch_add( 1, std::memory_order_seq_cst );
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		while( !pool_.has_work() && !pool_.stopping_.load() )
+		{
+			pool_.wake_.wait( lck );
+		}
+		pool_.sleeping_.fetch_sub( 1, std::memory_order_relaxed );
+		bump( counters_.idle, ( Clock::now() - parked ).count() );
+		if ( pool_.stopping_.load() && !pool_.has_work() )
 		{
-			thread_.join();
-			started_ = false;
-			done_ = false;
-			mtx_.unlock();
 			break;
 		}
-		mtx_.unlock();
-		std::this_thread::sleep_for( std::chrono::milliseconds( 200 ) );
 	}
+	current_ = nullptr;
 }
 
-ThreadPool::ThreadPool( int size ) :
-	workers_( size ),
-	joining_( false )
+ThreadPool::ThreadPool( int size, const std::string &name ) :
+	ThreadPool( Config{ size < 1 ? 1 : size, name, Placement::None } )
+{}
+
+ThreadPool::ThreadPool( const Config &cfg ) :
+	injected_size_( 0 ),
+	urgent_( 0 ),
+	aging_( Clock::duration( std::chrono::milliseconds( 100 ) ).count() ),
+	sleeping_( 0 ),
+	pending_( 0 ),
+	next_( 0 ),
+	stopping_( false ),
+	joined_( false ),
+	name_( cfg.name )
 {
+	std::vector<std::vector<int> > topology;
+	if ( cfg.placement == Placement::None )
+	{
+		topology.emplace_back();
+	}
+	else
+	{
+		topology = numa::nodes();
+	}
+	size_t cpus = 0;
+	for( auto &cpu_list : topology )
+	{
+		nodes_.emplace_back( new Node );
+		nodes_.back()->cpus = cpu_list;
+		cpus += cpu_list.size();
+	}
+	int size = cfg.size;
+	if ( size < 1 )
+	{
+		size = cfg.placement == Placement::None ? std::thread::hardware_concurrency() : cpus;
+		size = size < 1 ? 1 : size;
+	}
+
+	for( int i = 0; i < size; i++ )
+	{
+		workers_.emplace_back( new Worker( *this, i ) );
+		Worker &w = *workers_.back();
+		// Spread over nodes, then over CPUs of a node
+		w.node_ = i % nodes_.size();
+		const std::vector<int> &node_cpus = nodes_[w.node_]->cpus;
+		if ( cfg.placement == Placement::Node )
+		{
+			w.cpus_ = node_cpus;
+		}
+		else if ( cfg.placement == Placement::Core )
+		{
+			w.cpus_.push_back( node_cpus[( i / nodes_.size() ) % node_cpus.size()] );
+		}
+	}
+	for( auto &w : workers_ )
+	{
+		// Victims of the same node first, each starting next to the thief
+		size_t n = workers_.size();
+		for( int same = 1; same >= 0; same-- )
+		{
+			for( size_t i = 1; i < n; i++ )
+			{
+				Worker *v = workers_[( w->index_ + i ) % n].get();
+				if ( ( v->node_ == w->node_ ) == static_cast<bool>( same ) )
+				{
+					w->victims_.push_back( v );
+				}
+			}
+		}
+	}
+	// Start threads only when all deques exist
+	for( auto &w : workers_ )
+	{
+		w->thread_ = std::thread( &Worker::loop, w.get() );
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	join();
 }
 
 ThreadPool::Worker& ThreadPool::get()
 {
-	std::lock_guard<std::mutex> lck( mtx_ );
-	while( true )
+	return *workers_[next_.fetch_add( 1, std::memory_order_relaxed ) % workers_.size()];
+}
+
+int ThreadPool::size() const
+{
+	return static_cast<int>( workers_.size() );
+}
+
+int ThreadPool::nodes() const
+{
+	return static_cast<int>( nodes_.size() );
+}
+
+int ThreadPool::current_node()
+{
+	return current_ ? current_->node_ : -1;
+}
+
+void ThreadPool::set_aging( Clock::duration step )
+{
+	aging_.store( step > Clock::duration::zero() ? step.count() : 1, std::memory_order_relaxed );
+}
+
+void ThreadPool::push( Job *job )
+{
+	if ( current_ && &current_->pool_ == this )
 	{
-		for( auto &w : workers_ )
+		// Spawned from a task: keep it local, others will steal if idle
+		pending_.fetch_add( 1, std::memory_order_relaxed );
+		job->queued = Clock::now();
+		current_->deque_.push( job );
+		wake();
+		return;
+	}
+	inject( job );
+}
+
+void ThreadPool::inject( Job *job )
+{
+	inject( job, Schedule() );
+}
+
+void ThreadPool::inject( Job *job, const Schedule &sched )
+{
+	pending_.fetch_add( 1, std::memory_order_relaxed );
+	job->priority = sched.priority;
+	job->deadline = sched.deadline;
+	job->queued = Clock::now();
+	int n = 0;
+	if ( nodes_.size() > 1 )
+	{
+		// Queue on the node the caller runs on, its workers share the caches
+		n = ( current_ && &current_->pool_ == this ) ? current_->node_ : numa::current_node();
+		n = n < static_cast<int>( nodes_.size() ) ? n : 0;
+	}
+	Node &node = *nodes_[n];
+	{
+		std::lock_guard<std::mutex> lck( node.mtx );
+		if ( sched.late == Late::Escalate && sched.deadline != Clock::time_point::max() )
 		{
-			if ( w )
-			{
-				Worker tmp;
-				w.swap( tmp );
-				return w;
-			}
+			node.deadlines.push_back( job );
+			std::push_heap( node.deadlines.begin(), node.deadlines.end(), LaterDeadline() );
+		}
+		else
+		{
+			node.injected[static_cast<int>( job->priority )].push_back( job );
+		}
+		node.size.fetch_add( 1, std::memory_order_relaxed );
+		injected_size_.fetch_add( 1, std::memory_order_relaxed );
+		if ( job->priority == Priority::High )
+		{
+			urgent_.fetch_add( 1, std::memory_order_relaxed );
+		}
+	}
+	wake();
+}
+
+void ThreadPool::wake()
+{
+	// Pairs with sleeping_ increment before re-checking queues in Worker::loop()
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	if ( sleeping_.load( std::memory_order_relaxed ) > 0 )
+	{
+		std::lock_guard<std::mutex> lck( mtx_ );
+		wake_.notify_one();
+	}
+}
+
+ThreadPool::Job* ThreadPool::pop_injected( Node &node )
+{
+	// Caller holds node.mtx. Only queue heads compete: levels are FIFO and
+	// deadline items are ordered earliest first.
+	Clock::time_point now = Clock::now();
+	Clock::duration aging( aging_.load( std::memory_order_relaxed ) );
+	auto rank = [&]( const Job *job ) -> int64_t {
+		// One level up per aging step of waiting, but never above late deadline items
+		int64_t r = static_cast<int64_t>( job->priority ) - ( now - job->queued ) / aging;
+		return r < -Levels ? -Levels : r;
+	};
+	int best = -1;
+	int64_t best_rank = 0;
+	for( int level = 0; level < Levels; level++ )
+	{
+		if ( node.injected[level].empty() )
+		{
+			continue;
+		}
+		int64_t r = rank( node.injected[level].front() );
+		if ( best < 0 || r < best_rank )
+		{
+			best = level;
+			best_rank = r;
 		}
-		std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	}
+	Job *job;
+	if ( !node.deadlines.empty() &&
+		 ( best < 0 || node.deadlines.front()->deadline <= now || rank( node.deadlines.front() ) < best_rank ) )
+	{
+		job = node.deadlines.front();
+		std::pop_heap( node.deadlines.begin(), node.deadlines.end(), LaterDeadline() );
+		node.deadlines.pop_back();
+	}
+	else if ( best >= 0 )
+	{
+		job = node.injected[best].front();
+		node.injected[best].pop_front();
+	}
+	else
+	{
+		return nullptr;
+	}
+	node.size.fetch_sub( 1, std::memory_order_relaxed );
+	injected_size_.fetch_sub( 1, std::memory_order_relaxed );
+	if ( job->priority == Priority::High )
+	{
+		urgent_.fetch_sub( 1, std::memory_order_relaxed );
+	}
+	return job;
+}
+
+ThreadPool::Job* ThreadPool::pop_injected( int first )
+{
+	// Own node first, then the others
+	size_t n = nodes_.size();
+	for( size_t i = 0; i < n; i++ )
+	{
+		Node &node = *nodes_[( first + i ) % n];
+		if ( node.size.load( std::memory_order_relaxed ) == 0 )
+		{
+			continue;
+		}
+		std::lock_guard<std::mutex> lck( node.mtx );
+		Job *job = pop_injected( node );
+		if ( job )
+		{
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+ThreadPool::Job* ThreadPool::find( Worker &self )
+{
+	Job *job = nullptr;
+	// High priority items go ahead of local work, the rest is looked at periodically
+	// so that aged and escalated items are not stuck behind a busy worker's deque
+	if ( injected_size_.load( std::memory_order_relaxed ) > 0 &&
+		 ( urgent_.load( std::memory_order_relaxed ) > 0 || ++self.ticks_ % 32 == 0 ) )
+	{
+		job = pop_injected( self.node_ );
+		if ( job )
+		{
+			bump( self.counters_.injected, 1 );
+			return job;
+		}
+	}
+	job = self.deque_.take();
+	if ( job )
+	{
+		bump( self.counters_.local, 1 );
+		return job;
+	}
+	if ( injected_size_.load( std::memory_order_relaxed ) > 0 )
+	{
+		job = pop_injected( self.node_ );
+		if ( job )
+		{
+			bump( self.counters_.injected, 1 );
+			return job;
+		}
+	}
+	for( Worker *victim : self.victims_ )
+	{
+		job = victim->deque_.steal();
+		if ( job )
+		{
+			bump( self.counters_.stolen, 1 );
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+ThreadPool::Job* ThreadPool::find()
+{
+	// Thread outside of the pool has no deque, it may only steal
+	for( auto &w : workers_ )
+	{
+		Job *job = w->deque_.steal();
+		if ( job )
+		{
+			return job;
+		}
+	}
+	if ( injected_size_.load( std::memory_order_relaxed ) == 0 )
+	{
+		return nullptr;
+	}
+	return pop_injected( nodes_.size() > 1 ? numa::current_node() : 0 );
+}
+
+bool ThreadPool::run_pending()
+{
+	Worker *self = ( current_ && &current_->pool_ == this ) ? current_ : nullptr;
+	Job *job = self ? find( *self ) : find();
+	if ( !job )
+	{
+		return false;
+	}
+	execute( self, job );
+	return true;
+}
+
+void ThreadPool::execute( Worker *self, Job *job )
+{
+	if ( !self )
+	{
+		// Helping thread outside of the pool is not accounted
+		( *job )();
+		delete job;
+		finished();
+		return;
+	}
+	Worker::Counters &c = self->counters_;
+	bump( c.depth[Histogram::bucket( self->deque_.size() + injected_size_.load( std::memory_order_relaxed ) )], 1 );
+	Clock::time_point start = Clock::now();
+	bump( c.wait[Histogram::bucket( nanoseconds( start - job->queued ) )], 1 );
+	( *job )();
+	delete job;
+	Clock::duration spent = Clock::now() - start;
+	bump( c.run[Histogram::bucket( nanoseconds( spent ) )], 1 );
+	bump( c.busy, spent.count() );
+	bump( c.executed, 1 );
+	finished();
+}
+
+ThreadPool::Stats ThreadPool::stats() const
+{
+	Stats st;
+	auto load = []( const std::atomic<uint64_t> *from, Histogram &to ) {
+		for( int i = 0; i < Histogram::Buckets; i++ )
+		{
+			to.counts[i] = from[i].load( std::memory_order_relaxed );
+		}
+	};
+	st.queued = injected_size_.load( std::memory_order_relaxed );
+	st.sleeping = sleeping_.load( std::memory_order_relaxed );
+	for( auto &w : workers_ )
+	{
+		const Worker::Counters &c = w->counters_;
+		WorkerStats ws;
+		ws.executed = c.executed.load( std::memory_order_relaxed );
+		ws.local = c.local.load( std::memory_order_relaxed );
+		ws.injected = c.injected.load( std::memory_order_relaxed );
+		ws.stolen = c.stolen.load( std::memory_order_relaxed );
+		ws.busy = Clock::duration( c.busy.load( std::memory_order_relaxed ) );
+		ws.idle = Clock::duration( c.idle.load( std::memory_order_relaxed ) );
+		load( c.wait, ws.wait );
+		load( c.run, ws.run );
+		load( c.depth, ws.depth );
+		st.queued += w->deque_.size();
+
+		st.total.executed += ws.executed;
+		st.total.local += ws.local;
+		st.total.injected += ws.injected;
+		st.total.stolen += ws.stolen;
+		st.total.busy += ws.busy;
+		st.total.idle += ws.idle;
+		st.total.wait.merge( ws.wait );
+		st.total.run.merge( ws.run );
+		st.total.depth.merge( ws.depth );
+		st.workers.push_back( ws );
+	}
+	return st;
+}
+
+bool ThreadPool::has_work() const
+{
+	if ( injected_size_.load() > 0 )
+	{
+		return true;
+	}
+	for( auto &w : workers_ )
+	{
+		if ( !w->deque_.empty() )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::finished()
+{
+	if ( pending_.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+	{
+		std::lock_guard<std::mutex> lck( mtx_ );
+		done_.notify_all();
 	}
 }
 
 void ThreadPool::join()
 {
-	mtx_.lock();
-	if ( !joining_ )
+	std::lock_guard<std::mutex> join_lck( join_mtx_ );
+	if ( joined_ )
 	{
-		joining_ = true;
-		for( auto &w : workers_ )
+		return;
+	}
+	joined_ = true;
+	{
+		std::unique_lock<std::mutex> lck( mtx_ );
+		while( pending_.load() > 0 )
 		{
-			w.join();
+			done_.wait( lck );
 		}
+		stopping_.store( true );
+		wake_.notify_all();
+	}
+	for( auto &w : workers_ )
+	{
+		w->thread_.join();
 	}
-	mtx_.unlock();
 }
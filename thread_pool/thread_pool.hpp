@@ -1,15 +1,184 @@
-
-#include <thread>
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <vector>
+#include "future.hpp"
+#include "numa.hpp"
 
 
 class ThreadPool
 {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	enum class Priority
+	{
+		High,
+		Normal,
+		Low
+	};
+
+	// What happens to an item still queued when its deadline passes
+	enum class Late
+	{
+		Escalate,   // run it ahead of everything else
+		Cancel      // drop it (its future gets DeadlineExceeded)
+	};
+
+	struct Schedule
+	{
+		Priority priority = Priority::Normal;
+		Clock::time_point deadline = Clock::time_point::max();
+		Late late = Late::Escalate;
+	};
+
+	struct DeadlineExceeded : std::runtime_error
+	{
+		DeadlineExceeded() : std::runtime_error( "deadline exceeded" ) {}
+	};
+
+	/**
+	 * Power of two histogram: bucket i counts values in [2^(i-1), 2^i), bucket 0 counts zeros
+	 */
+	struct Histogram
+	{
+		static const int Buckets = 40;
+		uint64_t counts[Buckets] = {};
+
+		static int bucket( uint64_t v );
+		uint64_t count() const;
+		/**
+		 * @return upper bound of the bucket holding p-th fraction of values (p in 0..1)
+		 */
+		uint64_t percentile( double p ) const;
+		void merge( const Histogram &rhs );
+	};
+
+	struct WorkerStats
+	{
+		uint64_t executed = 0;
+		uint64_t local = 0;       // taken from own deque
+		uint64_t injected = 0;    // taken from injection queues
+		uint64_t stolen = 0;      // taken from other workers
+		Clock::duration busy{};   // running items
+		Clock::duration idle{};   // parked
+		Histogram wait;           // ns from posting to start
+		Histogram run;            // ns of running
+		Histogram depth;          // items queued for the worker at pick-up
+	};
+
+	enum class Placement
+	{
+		None,   // workers run on any allowed CPU, one injection queue set
+		Node,   // workers are spread over NUMA nodes and run on any CPU of their node
+		Core    // as Node, and every worker is pinned to a single CPU
+	};
+
+	struct Config
+	{
+		int size = 0;             // 0: one worker per allowed CPU
+		std::string name = "pool";
+		Placement placement = Placement::None;
+	};
+
+	struct Stats
+	{
+		std::vector<WorkerStats> workers;
+		WorkerStats total;
+		size_t queued = 0;        // items waiting in injection queues and deques
+		int sleeping = 0;         // parked workers
+	};
+
+private:
+	static const int Levels = 3;
+
+	// Type-erased work item, one allocation per task
+	struct Job
+	{
+		virtual ~Job() {}
+		virtual void operator()() = 0;
+
+		// Used by injection queues only
+		Priority priority = Priority::Normal;
+		Clock::time_point queued;
+		Clock::time_point deadline;
+	};
+
+	struct LaterDeadline
+	{
+		bool operator()( const Job *a, const Job *b ) const { return a->deadline > b->deadline; }
+	};
+
+	// Injection queues of a NUMA node (of the whole pool without NUMA placement)
+	struct Node
+	{
+		std::mutex mtx;
+		std::deque<Job*> injected[Levels];   // per priority level
+		std::vector<Job*> deadlines;          // heap of items to escalate once late, earliest first
+		std::atomic<size_t> size{ 0 };
+		std::vector<int> cpus;
+	};
+
+	template <class Fn>
+	struct JobImpl : Job
+	{
+		Fn fn_;
+		JobImpl( Fn &&fn ) : fn_( std::move( fn ) ) {}
+		void operator()() override { fn_(); }
+	};
+
+	/**
+	 * Chase-Lev work-stealing deque.
+	 * Owner pushes and takes at the bottom, thieves steal from the top.
+	 */
+	class Deque
+	{
+	public:
+		Deque();
+		~Deque();
+
+		Deque( const Deque& ) = delete;
+		Deque& operator=( const Deque& ) = delete;
+
+		void push( Job *job );
+		Job* take();
+		Job* steal();
+		bool empty() const;
+		size_t size() const;
+
+	private:
+		struct Ring
+		{
+			int64_t size;
+			int64_t mask;
+			std::atomic<Job*> *items;
+			Ring( int64_t s );
+			~Ring();
+			Job* get( int64_t i ) const { return items[i & mask].load( std::memory_order_relaxed ); }
+			void put( int64_t i, Job *j ) { items[i & mask].store( j, std::memory_order_relaxed ); }
+		};
+
+		alignas( 64 ) std::atomic<int64_t> top_;
+		alignas( 64 ) std::atomic<int64_t> bottom_;
+		std::atomic<Ring*> ring_;
+		std::vector<std::unique_ptr<Ring> > retired_; // thieves may still read old rings
+	};
+
 public:
 	struct Worker
 	{
-		Worker();
+		Worker( ThreadPool &pool, int index );
 		~Worker();
 
 		Worker( const Worker& ) = delete;
@@ -17,44 +186,245 @@ public:
 		Worker& operator=( const Worker& ) = delete;
 		Worker& operator=( const Worker&& ) = delete;
 
+		/**
+		 * Post work item into the pool
+		 */
 		template <class Fn, class... Args>
 		void run( Fn &&fn, Args &&... args )
 		{
-			mtx_.lock();
-			started_ = true;
-			thread_ = std::thread( &Worker::wrapper<Fn, Args...>, this,
-					std::forward<Fn>( fn ), std::forward<Args>( args )... );
-			mtx_.unlock();
+			pool_.post( std::forward<Fn>( fn ), std::forward<Args>( args )... );
 		}
 
 	private:
 		friend class ThreadPool;
-		std::thread thread_;
-		std::mutex mtx_;
-		bool started_;
-		bool done_;
 
-		template <class Fn, class... Args>
-		void wrapper( Fn &&fn, Args &&... args )
+		/**
+		 * Written by the owner thread only (plain load and store, no read-modify-write),
+		 * read by stats() from any thread.
+		 */
+		struct alignas( 64 ) Counters
 		{
-			fn( std::forward<Args>( args )... );
-			mtx_.lock();
-			done_ = true;
-			mtx_.unlock();
-		}
+			std::atomic<uint64_t> executed{ 0 };
+			std::atomic<uint64_t> local{ 0 };
+			std::atomic<uint64_t> injected{ 0 };
+			std::atomic<uint64_t> stolen{ 0 };
+			std::atomic<int64_t> busy{ 0 };
+			std::atomic<int64_t> idle{ 0 };
+			std::atomic<uint64_t> wait[Histogram::Buckets] = {};
+			std::atomic<uint64_t> run[Histogram::Buckets] = {};
+			std::atomic<uint64_t> depth[Histogram::Buckets] = {};
+		};
 
-		operator bool();
-		void swap( Worker &rhs );
-		void join();
+		ThreadPool &pool_;
+		int index_;
+		int node_;
+		std::vector<int> cpus_;            // CPUs to run on, empty if not placed
+		std::vector<Worker*> victims_;     // same node workers first
+		unsigned ticks_;
+		Deque deque_;
+		Counters counters_;
+		std::thread thread_;
+
+		void loop();
 	};
 
-	ThreadPool( int size );
+	/**
+	 * @param size - number of worker threads
+	 * @param name - worker thread name prefix, as seen by profilers and debuggers
+	 */
+	ThreadPool( int size, const std::string &name = "pool" );
+
+	/**
+	 * With Node or Core placement workers are assigned to NUMA nodes round-robin.
+	 * Every node has its own injection queues: items posted from outside of the
+	 * pool go to the queues of the node the caller runs on. Idle workers look at
+	 * their own node first, both for injected items and for stealing.
+	 */
+	ThreadPool( const Config &cfg );
+	~ThreadPool();
 
+	ThreadPool( const ThreadPool& ) = delete;
+	ThreadPool& operator=( const ThreadPool& ) = delete;
+
+	/**
+	 * Returns a worker to post work item with (kept for compatibility, any worker may pick it up)
+	 */
 	Worker& get();
+
+	/**
+	 * Post work item into the pool. Items posted from inside a work item
+	 * go to the current worker's own deque, others to the injection queue.
+	 * @return future of the item result
+	 */
+	template <class Fn, class... Args>
+	Future<std::invoke_result_t<std::decay_t<Fn>, std::decay_t<Args>...> > submit( Fn &&fn, Args &&... args )
+	{
+		typedef std::invoke_result_t<std::decay_t<Fn>, std::decay_t<Args>...> R;
+		auto state = std::make_shared<detail::State<R> >( this );
+		post( [state, f = std::decay_t<Fn>( std::forward<Fn>( fn ) ),
+			   a = std::make_tuple( std::forward<Args>( args )... )]() mutable {
+			detail::fulfill( *state, [&]() -> R { return std::apply( std::move( f ), std::move( a ) ); } );
+		} );
+		return Future<R>( std::move( state ) );
+	}
+
+	/**
+	 * Post work item without tracking its result
+	 */
+	template <class Fn, class... Args>
+	void post( Fn &&fn, Args &&... args )
+	{
+		auto call = [f = std::decay_t<Fn>( std::forward<Fn>( fn ) ),
+					 a = std::make_tuple( std::forward<Args>( args )... )]() mutable {
+			std::apply( std::move( f ), std::move( a ) );
+		};
+		push( new JobImpl<decltype( call )>( std::move( call ) ) );
+	}
+
+	/**
+	 * Post work item with priority and optional deadline. Such items always
+	 * go through the injection queue of their priority level.
+	 * @return future of the item result
+	 */
+	template <class Fn, class... Args>
+	Future<std::invoke_result_t<std::decay_t<Fn>, std::decay_t<Args>...> > submit_scheduled( const Schedule &sched, Fn &&fn, Args &&... args )
+	{
+		typedef std::invoke_result_t<std::decay_t<Fn>, std::decay_t<Args>...> R;
+		auto state = std::make_shared<detail::State<R> >( this );
+		auto call = [state, sched, f = std::decay_t<Fn>( std::forward<Fn>( fn ) ),
+					 a = std::make_tuple( std::forward<Args>( args )... )]() mutable {
+			if ( sched.late == Late::Cancel && Clock::now() > sched.deadline )
+			{
+				state->set_exception( std::make_exception_ptr( DeadlineExceeded() ) );
+				return;
+			}
+			detail::fulfill( *state, [&]() -> R { return std::apply( std::move( f ), std::move( a ) ); } );
+		};
+		inject( new JobImpl<decltype( call )>( std::move( call ) ), sched );
+		return Future<R>( std::move( state ) );
+	}
+
+	/**
+	 * Post work item with priority and optional deadline, without tracking its result
+	 */
+	template <class Fn, class... Args>
+	void post_scheduled( const Schedule &sched, Fn &&fn, Args &&... args )
+	{
+		auto call = [sched, f = std::decay_t<Fn>( std::forward<Fn>( fn ) ),
+					 a = std::make_tuple( std::forward<Args>( args )... )]() mutable {
+			if ( sched.late == Late::Cancel && Clock::now() > sched.deadline )
+			{
+				return;
+			}
+			std::apply( std::move( f ), std::move( a ) );
+		};
+		inject( new JobImpl<decltype( call )>( std::move( call ) ), sched );
+	}
+
+	/**
+	 * Queued items gain one priority level per step of waiting, so low
+	 * priority items are not starved by a steady flow of higher ones.
+	 */
+	void set_aging( Clock::duration step );
+
+	/**
+	 * Wait until all posted items are complete and stop worker threads.
+	 * New items should not be added once join is called.
+	 */
 	void join();
 
+	/**
+	 * Run one pending item on the calling thread
+	 * @return false if there was nothing to run
+	 */
+	bool run_pending();
+
+	/**
+	 * Run pending items on the calling thread until done() returns true.
+	 * Lets a work item wait for items it has spawned without idling a worker.
+	 */
+	template <class Pred>
+	void help_until( Pred done )
+	{
+		while( !done() )
+		{
+			if ( !run_pending() )
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	int size() const;
+
+	/**
+	 * Number of NUMA nodes workers are spread over (1 without placement)
+	 */
+	int nodes() const;
+
+	/**
+	 * Node of the worker running the calling thread, -1 outside of a pool.
+	 * Use numa::pool_alloc( size, ThreadPool::current_node() ) for node-local item memory,
+	 * numa::alloc() for large buffers.
+	 */
+	static int current_node();
+
+	/**
+	 * Collect per-worker counters and histograms. Values are read without
+	 * stopping workers, so totals of a busy pool are only approximate.
+	 */
+	Stats stats() const;
+
 private:
-	std::vector<Worker> workers_;
-	std::mutex mtx_;
-	bool joining_;
+	std::vector<std::unique_ptr<Worker> > workers_;
+	std::vector<std::unique_ptr<Node> > nodes_;
+	std::mutex mtx_;                     // guards parking
+	std::atomic<size_t> injected_size_;  // over all nodes
+	std::atomic<size_t> urgent_;         // High level items
+	std::atomic<Clock::rep> aging_;
+	std::condition_variable wake_;
+	std::condition_variable done_;
+	std::atomic<int> sleeping_;
+	std::atomic<int64_t> pending_;       // posted but not finished items
+	std::atomic<unsigned> next_;
+	std::atomic<bool> stopping_;
+	std::mutex join_mtx_;
+	bool joined_;
+	std::string name_;
+
+	void push( Job *job );
+	void inject( Job *job );
+	void inject( Job *job, const Schedule &sched );
+	void wake();
+	Job* pop_injected( Node &node );
+	Job* pop_injected( int first );
+	Job* find( Worker &self );
+	Job* find();
+	void execute( Worker *self, Job *job );
+	bool has_work() const;
+	void finished();
 };
+
+template <class R>
+template <class Fn>
+Future<std::invoke_result_t<Fn, Future<R> > > Future<R>::then( Fn &&fn ) const
+{
+	typedef std::invoke_result_t<Fn, Future<R> > T;
+	ThreadPool *pool = state_->pool_;
+	auto next = std::make_shared<detail::State<T> >( pool );
+	Future<R> self( *this );
+	state_->on_ready( [pool, next, self, f = std::decay_t<Fn>( std::forward<Fn>( fn ) )]() mutable {
+		auto run = [next, self, f = std::move( f )]() mutable {
+			detail::fulfill( *next, [&]() -> T { return f( self ); } );
+		};
+		if ( pool )
+		{
+			pool->post( std::move( run ) );
+		}
+		else
+		{
+			run();
+		}
+	} );
+	return Future<T>( next );
+}